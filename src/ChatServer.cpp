@@ -1,41 +1,47 @@
+#include <algorithm>
 #include <cerrno>
 #include <cctype>
 #include <cstdlib>
-#include <vector>	// for PacketUtil::Split
-#include <cstring>	// for memset
+#include <cstring>
+#include <vector>
 
 #include <unistd.h>
-#include <sys/time.h>	// for timestamping
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "ChatServer.h"
+#include "Handoff.h"
+#include "Shard.h"
 #include "logger/Logger.h"
 #include "model/Room.h"
 #include "model/User.h"
 #include "network/DatabaseConnector.h"
 #include "packet/ChatPacket.h"
-#include "packet/PacketUtil.h"
 #include "packet/PacketHandler.h"
+#include "util/Clock.h"
 #include "util/Config.h"
+#include "util/FileUtil.h"
 #include "util/StringUtil.h"
 #include "verinfo.h"	// for BUILD_DATE, BUILD_VERSION
 
 using namespace std;
 
-ChatServer::ChatServer() : m_pListener(NULL)
+ChatServer::ChatServer() : m_bRunning(false), m_pConnector(NULL),
+	m_pConfig(NULL), m_pRooms(NULL)
 {
-	m_pListener = new SocketListener;
+	m_bReloadRequested = m_bQuitRequested = m_bUpgradeRequested = false;
+	m_bStatsRequested = false;
+	m_bHandedOff = false;
+	m_bReusePort = false;
+	m_iNextShard = 0;
+	m_iSleepTime = m_iLagSpikeTime = m_iOutputLatency = 0;
+	m_iLastListUpdate = 0;
 }
 
 ChatServer::~ChatServer()
 {
 	Stop();
 
-	if( m_pListener )
-	{
-		delete m_pListener;
-		m_pListener = NULL;
-	}
-
 	if( m_pConnector )
 	{
 		delete m_pConnector;
@@ -43,7 +49,7 @@ ChatServer::~ChatServer()
 	}
 }
 
-void ChatServer::Start()
+void ChatServer::Start( const HandoffState *pHandoff )
 {
 	if( m_pConfig == NULL )
 	{
@@ -51,12 +57,6 @@ void ChatServer::Start()
 		return;
 	}
 
-	if( m_pListener->IsConnected() )
-		m_pListener->Disconnect();
-
-	// connect to the port specified in the configuration
-	m_pListener->Connect( m_pConfig->GetInt("ServerPort") );
-
 	// Remove the connector, if it exists, and re-create it
 	if( m_pConnector )
 		delete m_pConnector;
@@ -70,23 +70,115 @@ void ChatServer::Start()
 	m_pRooms = new RoomList( m_pConfig );
 
 	// check for, and initialize, additional rooms
-	const char* EXTRA_ROOMS	= m_pConfig->Get( "AdditionalRooms", true );
+	vector<string> vsRooms;
+	GetExtraRooms( m_pConfig, vsRooms );
 
-	if( EXTRA_ROOMS )
+	for( unsigned i = 0; i < vsRooms.size(); ++i )
+		m_pRooms->AddRoom( vsRooms[i] );
+
+	ApplyConfig();
+
+	// one reactor thread per CPU, unless we're told otherwise
+	int iThreads = m_pConfig->GetInt( "ReactorThreads", true, 1 );
+
+	if( iThreads <= 0 )
+		iThreads = sysconf( _SC_NPROCESSORS_ONLN );
+	if( iThreads <= 0 )
+		iThreads = 1;
+
+	// "uring" does socket I/O through io_uring, where the kernel has it
+	const char *szBackend = m_pConfig->Get( "IOBackend", true, "epoll" );
+	const bool bUseRing = !strcmp( szBackend, "uring" );
+
+	for( int i = 0; i < iThreads; ++i )
+		m_Shards.push_back( new Shard(this, i, bUseRing) );
+
+	Shard::SetShards( &m_Shards );
+
+	// the first Shard runs on this thread
+	m_Shards[0]->MakeCurrent();
+
+	// connect to the port specified in the configuration. After a restart,
+	// everyone reconnects at once, so make room for them in the backlog.
+	const int iPort = m_pConfig->GetInt( "ServerPort" );
+	const int iBacklog = m_pConfig->GetInt( "ListenBacklog", true, 1024 );
+	const int iDeferSecs = m_pConfig->GetInt( "DeferAccept", true, 0 );
+	m_bReusePort = m_pConfig->GetBool( "ReusePort", true, false );
+
+	// without ReusePort, the first Shard takes all connections
+	const unsigned iListeners = m_bReusePort ? m_Shards.size() : 1;
+
+	for( unsigned i = 0; i < iListeners; ++i )
 	{
-		vector<string> vsRooms;
-		StringUtil::Split( EXTRA_ROOMS, vsRooms, ',' );
+		SocketListener *pListener = new SocketListener;
+		pListener->SetConnectionTable( &m_Connections );
+		m_Listeners.push_back( pListener );
+
+		// carry on with the old server's sockets, so nobody gets refused
+		// while we start up, unless the port's been changed since.
+		bool bListening = false;
+
+		if( pHandoff && i < pHandoff->vListeners.size() )
+		{
+			bListening = (pListener->Adopt(pHandoff->vListeners[i]) == iPort);
+
+			if( !bListening )
+				pListener->Disconnect();
+		}
+
+		if( !bListening )
+			bListening = pListener->Connect( iPort, iBacklog, m_bReusePort, iDeferSecs );
 
-		for( unsigned i = 0; i < vsRooms.size(); ++i )
-			m_pRooms->AddRoom( vsRooms[i] );
+		if( bListening )
+			m_Shards[i]->SetListener( pListener );
 	}
 
+	// the old server had more listeners than we need
+	if( pHandoff )
+		for( unsigned i = iListeners; i < pHandoff->vListeners.size(); ++i )
+			close( pHandoff->vListeners[i] );
+
+	m_iNextShard = 0;
+
+	if( pHandoff )
+		Restore( *pHandoff );
+
+	StartThreads();
+
+	LOG->System( "Server started with %u reactor thread(s).", (unsigned)m_Shards.size() );
+}
+
+void ChatServer::GetExtraRooms( const Config *cfg, vector<string> &vsRooms )
+{
+	const char* EXTRA_ROOMS	= cfg->Get( "AdditionalRooms", true );
+
+	if( EXTRA_ROOMS )
+		StringUtil::Split( EXTRA_ROOMS, vsRooms, ',' );
+}
+
+void ChatServer::ApplyConfig()
+{
 	// set up user idle limits
 	const int iTimeToIdle = m_pConfig->GetInt( "UserIdleTime", 5 );
 	const int iTimeToKick = m_pConfig->GetInt( "UserKickTime", 90 );
 
 	User::SetIdleLimits( iTimeToIdle, iTimeToKick );
 
+	// set up limits for clients that can't keep up with their output
+	const int iOutputSoftLimit = m_pConfig->GetInt( "OutputSoftLimit", true, 64*1024 );
+	const int iOutputHardLimit = m_pConfig->GetInt( "OutputHardLimit", true, 256*1024 );
+
+	User::SetOutputLimits( iOutputSoftLimit, iOutputHardLimit );
+
+	// how hard to compress output for clients that ask for it
+	User::SetCompressionLevel( m_pConfig->GetInt("CompressionLevel", true, 6) );
+
+	// anything longer than this isn't a packet we want to handle
+	User::SetInputLimit( m_pConfig->GetInt("MaxPacketSize", true, 8*1024) );
+
+	// how quickly each user can send each kind of packet
+	m_FloodControl.Load( m_pConfig );
+
 	// set up server-side user level stuff.
 	// TODO: synchronization mechanism between database and server?
 	const char* sModLevels = m_pConfig->Get( "ModLevels" );
@@ -95,31 +187,409 @@ void ChatServer::Start()
 	m_sModLevels.assign( sModLevels );
 	m_cBanLevel = sBanLevel[0];
 
+	// SleepTime is the most usecs we'll wait for network activity before
+	// checking on idle users, LagSpikeTime is the amount of usecs required
+	// to pass within an update to be considered a spike (which results in
+	// a message to stdout).
+	m_iSleepTime = m_pConfig->GetInt( "SleepTime", true, 1000*150 );	// 150 ms
+	m_iLagSpikeTime = m_pConfig->GetInt( "LagSpikeTime", true, 250 );	// 250 us
+
+	// output's gathered up and sent once per update, but never held
+	// longer than OutputLatency usecs while an update runs long.
+	m_iOutputLatency = m_pConfig->GetInt( "OutputLatency", true, 2000 );	// 2 ms
+
+	// limit how many connections one address can have, and how quickly
+	// it can make them. Connections over a limit are dropped at accept().
+	const int iMaxPerIP = m_pConfig->GetInt( "MaxConnectionsPerIP", true, 0 );
+	const int iRatePerIP = m_pConfig->GetInt( "ConnectRatePerIP", true, 0 );
+	const int iBurstPerIP = m_pConfig->GetInt( "ConnectBurstPerIP", true, 1 );
+
+	m_Connections.SetLimits( max(iMaxPerIP, 0), max(iRatePerIP, 0), max(iBurstPerIP, 0) );
+}
+
+void ChatServer::Restore( const HandoffState &state )
+{
+	for( unsigned i = 0; i < state.vRooms.size(); ++i )
+		if( !m_pRooms->RoomExists(state.vRooms[i]) )
+			m_pRooms->AddRoom( state.vRooms[i] );
+
+	for( unsigned i = 0; i < state.vBans.size(); ++i )
+		m_BanList.Add( state.vBans[i] );
+
+	for( unsigned i = 0; i < state.vMutes.size(); ++i )
+		m_MuteList.Add( state.vMutes[i] );
+
+	for( unsigned i = 0; i < state.vUsers.size(); ++i )
+	{
+		const UserHandoff &u = state.vUsers[i];
+
+		Shard *pShard = m_Shards[m_iNextShard];
+		m_iNextShard = (m_iNextShard + 1) % m_Shards.size();
+
+		User *user = pShard->RestoreUser( u );
+
+		// we never accepted this one, but it counts all the same
+		m_Connections.Readmit( user->GetAddress() );
+
+		if( !user->IsLoggedIn() )
+			continue;
+
+		// a room that's gone (e.g. removed from the config) sends its
+		// users back to the default room
+		Room *pRoom = m_pRooms->GetRoom( u.sRoom );
+
+		if( pRoom == NULL )
+			pRoom = m_pRooms->GetDefaultRoom();
+
+		m_StateLock.LockWrite();
+		EnterRoom( user, pRoom );
+		m_UsersByName.Add( user );
+		m_StateLock.Unlock();
+	}
+
+	// now that everyone's where they were, handle what they'd sent
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+		m_Shards[i]->HandleRestoredInput();
+
+	LOG->System( "Took over %u user(s) from the old server.", (unsigned)state.vUsers.size() );
+}
+
+bool ChatServer::TakeOver( int iSocket )
+{
+	HandoffState state;
+
+	if( !Handoff::Receive(iSocket, state) )
+	{
+		LOG->System( "Couldn't receive the old server's state; not taking over." );
+		close( iSocket );
+		return false;
+	}
+
+	Start( &state );
+
+	// if the old server's given up on us already, it's closed every
+	// socket we have, and there's not much to be done about it now.
+	if( !Handoff::SendReady(iSocket) )
+		LOG->System( "Couldn't tell the old server we've taken over (%s).", strerror(errno) );
+
+	close( iSocket );
+	return true;
+}
+
+bool ChatServer::Upgrade()
+{
+	const char *szBinary = m_pConfig->Get( "UpgradeBinary", true, m_sBinaryPath.c_str() );
+
+	LOG->System( "Handing over to a new process running %s...", szBinary );
+	LOG->Flush();
+
+	StopThreads();
+
+	// the second pass gets whatever the later Shards sent the earlier
+	// ones while they were quiescing
+	for( int iPass = 0; iPass < 2; ++iPass )
+		for( unsigned i = 0; i < m_Shards.size(); ++i )
+			m_Shards[i]->Quiesce();
+
+	HandoffState state;
+
+	for( unsigned i = 0; i < m_Listeners.size(); ++i )
+		if( m_Listeners[i]->IsConnected() )
+			state.vListeners.push_back( m_Listeners[i]->GetFD() );
+
+	const map<string,Room*> *pRooms = m_pRooms->GetRooms();
+
+	for( map<string,Room*>::const_iterator it = pRooms->begin(); it != pRooms->end(); ++it )
+		state.vRooms.push_back( it->first );
+
+	m_BanList.GetEntries( state.vBans );
+	m_MuteList.GetEntries( state.vMutes );
+
+	for( list<User*>::const_iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+	{
+		const User *user = *it;
+
+		// a login that's still out can't be sent anywhere; they'll
+		// have to log in again.
+		if( user->IsDead() || user->GetLoginState() == LOGIN_CHECKING )
+			continue;
+
+		state.vUsers.push_back( UserHandoff() );
+		UserHandoff &u = state.vUsers.back();
+
+		user->SaveHandoff( u );
+
+		if( user->IsLoggedIn() )
+			u.sRoom = user->GetRoomName();
+	}
+
+	int iChildPID = -1;
+	const int iSocket = Handoff::Spawn( szBinary, iChildPID );
+
+	// give it a while: it has to start up and take everyone in first
+	if( iSocket >= 0 && Handoff::Send(iSocket, state) && Handoff::WaitForReady(iSocket, 30*1000) )
+	{
+		LOG->System( "Handed %u user(s) over to process %d.", (unsigned)state.vUsers.size(), iChildPID );
+		close( iSocket );
+
+		m_bHandedOff = true;
+		return true;
+	}
+
+	LOG->System( "Upgrade failed; carrying on as we were." );
+
+	if( iChildPID > 0 )
+	{
+		kill( iChildPID, SIGKILL );
+		waitpid( iChildPID, NULL, 0 );
+	}
+
+	if( iSocket >= 0 )
+		close( iSocket );
+
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+	{
+		SocketListener *pListener = NULL;
+
+		if( i < m_Listeners.size() && m_Listeners[i]->IsConnected() )
+			pListener = m_Listeners[i];
+
+		m_Shards[i]->Resume( pListener );
+	}
+
+	StartThreads();
+	return false;
+}
+
+void ChatServer::StopThreads()
+{
+	// the threads run until the server isn't running
+	m_bRunning = false;
+
+	for( unsigned i = 1; i < m_Shards.size(); ++i )
+		m_Shards[i]->StopThread();
+
+	Shard::SetThreaded( false );
+}
+
+void ChatServer::StartThreads()
+{
 	m_bRunning = true;
+
+	Shard::SetThreaded( m_Shards.size() > 1 );
+
+	for( unsigned i = 1; i < m_Shards.size(); ++i )
+		m_Shards[i]->StartThread();
+}
+
+/* these need new Shards or listeners to take effect */
+static const char* const RESTART_KEYS[] =
+{
+	"ReactorThreads", "IOBackend", "ReusePort", "ListenBacklog",
+	"DeferAccept", "DefaultRoom", "Daemonize", NULL
+};
+
+/* these are the DatabaseWorker's, and the Logger's */
+static const char* const DATABASE_KEYS[] =
+{
+	"DatabaseHost", "LoginPage", "ConfigPage", "BanPage", "DefaultConfig",
+	"DatabaseReadTimeout", "DatabaseWriteTimeout", NULL
+};
+
+static const char* const LOG_KEYS[] = { "LogPath", "DebugMode", "ChatOutput", NULL };
+
+static bool HasKey( const vector<string> &vKeys, const char *szKey )
+{
+	return find( vKeys.begin(), vKeys.end(), szKey ) != vKeys.end();
+}
+
+static bool HasAnyKey( const vector<string> &vKeys, const char* const *pList )
+{
+	for( ; *pList; ++pList )
+		if( HasKey(vKeys, *pList) )
+			return true;
+
+	return false;
+}
+
+void ChatServer::Reload()
+{
+	Config cfg;
+
+	if( !cfg.Load(FileUtil::GetConfigFilePath()) )
+	{
+		LOG->System( "Couldn't load the config; keeping the one we have." );
+		return;
+	}
+
+	vector<string> vChanged;
+	m_pConfig->Diff( cfg, vChanged );
+
+	if( vChanged.empty() )
+	{
+		LOG->System( "Nothing's changed in the config." );
+		return;
+	}
+
+	LOG->System( "Changed in the config: %s", StringUtil::Join(vChanged, ", ").c_str() );
+
+	for( unsigned i = 0; RESTART_KEYS[i]; ++i )
+		if( HasKey(vChanged, RESTART_KEYS[i]) )
+			LOG->System( "%s takes effect at the next upgrade (SIGUSR2) or restart.", RESTART_KEYS[i] );
+
+	// keep these from before the new config replaces them
+	vector<string> vsOldRooms, vsNewRooms;
+	GetExtraRooms( m_pConfig, vsOldRooms );
+	GetExtraRooms( &cfg, vsNewRooms );
+
+	const int iOldPort = m_pConfig->GetInt( "ServerPort" );
+	const string sOldModLevels = m_sModLevels;
+
+	// the old entries go when cfg does
+	m_pConfig->Swap( cfg );
+
+	// nothing's running but us while everything's changed over
+	StopThreads();
+
+	m_StateLock.LockWrite();
+
+	ApplyConfig();
+
+	// rooms that were taken out are emptied into the default room; rooms
+	// users made themselves aren't ours to remove.
+	for( unsigned i = 0; i < vsOldRooms.size(); ++i )
+		if( find(vsNewRooms.begin(), vsNewRooms.end(), vsOldRooms[i]) == vsNewRooms.end() )
+			m_pRooms->RemoveRoom( vsOldRooms[i] );
+
+	for( unsigned i = 0; i < vsNewRooms.size(); ++i )
+		m_pRooms->AddRoom( vsNewRooms[i] );
+
+	// whoever's a mod now is going by their level, as at login
+	if( m_sModLevels != sOldModLevels )
+	{
+		for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+			if( (*it)->IsLoggedIn() )
+				(*it)->SetMod( m_sModLevels.find((*it)->GetLevel()) != string::npos );
+	}
+
+	m_StateLock.Unlock();
+
+	if( HasAnyKey(vChanged, DATABASE_KEYS) )
+		m_pConnector->SetConfig( m_pConfig );
+
+	if( HasAnyKey(vChanged, LOG_KEYS) )
+		LOG->Reload( m_pConfig );
+
+	const int iPort = m_pConfig->GetInt( "ServerPort" );
+
+	if( iPort != iOldPort )
+		Rebind( iPort );
+
+	StartThreads();
+
+	LOG->System( "Config reloaded." );
+}
+
+void ChatServer::Rebind( int iPort )
+{
+	const int iBacklog = m_pConfig->GetInt( "ListenBacklog", true, 1024 );
+	const int iDeferSecs = m_pConfig->GetInt( "DeferAccept", true, 0 );
+
+	// open every new listener before closing any old one
+	vector<SocketListener*> vNew;
+
+	for( unsigned i = 0; i < m_Listeners.size(); ++i )
+	{
+		SocketListener *pListener = new SocketListener;
+		pListener->SetConnectionTable( &m_Connections );
+		vNew.push_back( pListener );
+
+		if( !pListener->Connect(iPort, iBacklog, m_bReusePort, iDeferSecs) )
+		{
+			LOG->System( "Couldn't listen on port %d; staying where we are.", iPort );
+
+			for( unsigned j = 0; j < vNew.size(); ++j )
+				delete vNew[j];
+
+			return;
+		}
+	}
+
+	for( unsigned i = 0; i < m_Listeners.size(); ++i )
+	{
+		// whoever's connected already gets in, rather than being reset
+		int iSocket;
+		NetAddress addr;
+
+		while( (iSocket = m_Listeners[i]->GetConnection(addr)) >= 0 )
+			AddConnection( iSocket, addr, m_Shards[i] );
+
+		m_Shards[i]->SetListener( vNew[i] );
+		delete m_Listeners[i];
+		m_Listeners[i] = vNew[i];
+	}
+
+	LOG->System( "Now listening on port %d.", iPort );
 }
 
 void ChatServer::Stop()
 {
 	m_bRunning = false;
 
-	// remove all users
-	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
-		RemoveUser( *it );
+	// wait for the other reactor threads to notice. after that, this is
+	// the only thread left, so it can touch every Shard's users itself.
+	for( unsigned i = 1; i < m_Shards.size(); ++i )
+		m_Shards[i]->StopThread();
 
-	m_Users.clear();
+	Shard::SetThreaded( false );
+
+	// remove all users. each Shard takes a user out of its list before
+	// removing it, so the USER_PART broadcasts don't go to deleted users.
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+		m_Shards[i]->RemoveAllUsers();
+
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+		m_Shards[i]->DropMessages();
+
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+		delete m_Shards[i];
+
+	m_Shards.clear();
+	Shard::SetShards( NULL );
 
 	// wipe all the rooms except the default room
-	m_pRooms->ClearRooms();
+	if( m_pRooms )
+		m_pRooms->ClearRooms();
+
+	for( unsigned i = 0; i < m_Listeners.size(); ++i )
+		delete m_Listeners[i];
 
-	m_pListener->Disconnect();
+	m_Listeners.clear();
 }
 
-void ChatServer::AddUser( unsigned iSocket )
+void ChatServer::AddConnection( int iSocket, const NetAddress &addr, Shard *pAcceptor )
+{
+	if( m_bReusePort )
+	{
+		pAcceptor->AddUser( iSocket, addr );
+		return;
+	}
+
+	// round-robin is about as fair as we can get without knowing
+	// anything about the client yet
+	Shard *pShard = m_Shards[m_iNextShard];
+	m_iNextShard = (m_iNextShard + 1) % m_Shards.size();
+
+	pShard->AddUser( iSocket, addr );
+}
+
+void ChatServer::AddUser( User *pUser )
 {
-	User *pUser = new User( iSocket );
 	m_Users.push_back( pUser );
+	m_Connections.AddUser( pUser );
 
-	LOG->Debug( "Added new client on socket %d, from IP %s", iSocket, pUser->GetIP() );
+	LOG->Debug( "Added new client on socket %d, from IP %s (shard %u)",
+		pUser->GetFD(), pUser->GetIP(), pUser->GetShard()->GetIndex() );
 }
 
 void ChatServer::RemoveUser( User *user )
@@ -130,6 +600,12 @@ void ChatServer::RemoveUser( User *user )
 	if( user->IsLoggedIn() )
 	{
 		user->SetLoggedIn( false );
+		m_UsersByName.Remove( user );
+
+		m_ListLock.Lock();
+		m_Presence.Remove( user->GetID() );
+		m_ListLock.Unlock();
+
 		Broadcast( ChatPacket(USER_PART, user->GetName(), BLANK) );
 
 		if( !user->GetName().empty() )
@@ -141,173 +617,201 @@ void ChatServer::RemoveUser( User *user )
 
 	user->Kill();
 
-	// take this user out of the RoomList
-	m_pRooms->RemoveUser( user );
+	m_Users.remove( user );
+	m_Connections.RemoveUser( user );
 
-	delete user;
+	// take this user out of their room
+	EnterRoom( user, NULL );
 }
 
-void ChatServer::MainLoop()
+bool ChatServer::CheckFlood( User *user, int iCode, string_view buf )
 {
-	// no listener means no connection; no connection means no server.
-	if( m_pListener == NULL )
-		return;
-
-	// set some optional configuration: SleepTime is the amount of usecs to wait
-	// between updates, LagSpikeTime is the amount of usecs required to pass within
-	// an update to be considered a spike (which results in a message to stdout).
-
-	const unsigned iSleepTime = m_pConfig->GetInt( "SleepTime", true, 1000*150 );	// 150 ms
-	const unsigned iLagSpikeTime = m_pConfig->GetInt( "LagSpikeTime", true, 250 );	// 250 us
+	// users who aren't logged in can't do much to anyone else (and
+	// making their connections is limited already)
+	if( !user->IsLoggedIn() )
+		return true;
 
-	struct timeval tv_start, tv_end;
+	const uint64_t iNow = Clock::GetMilliseconds();
+	FloodState &state = user->GetFloodState();
 
-	while( true )
+	switch( m_FloodControl.Check(state, iCode, iNow) )
 	{
-		// If we're not running, then keep looping (lazily) until we are.
-		// We don't actually want to stop this function; it's only called once.
-		if( !m_bRunning )
+	case FLOOD_PASS:
+		return true;
+	case FLOOD_DROP:
+		break;
+	case FLOOD_DELAY:
+		state.vDelayed.emplace_back( buf );
+		user->GetShard()->AddDelayedUser( user );
+		break;
+	case FLOOD_WARN:
+		if( m_FloodControl.ShouldWarn(state, iNow) )
 		{
-			sleep( 1 );
-			continue;
+			ChatPacket warning( WALL_MESSAGE, BLANK, "You're sending messages too quickly. Please slow down." );
+			user->Write( warning );
 		}
+		break;
+	}
 
-		gettimeofday( &tv_start, NULL );
+	// somebody who won't slow down is muted for a while. Mods can be
+	// limited, but not muted; a muted user needs no more muting.
+	if( m_FloodControl.IsStruckOut(state, iNow) && !user->IsMod() && !user->IsMuted() )
+	{
+		LOG->System( "Muting %s@%s for flooding.", user->GetName().c_str(), user->GetIP() );
 
-		// see if the SocketListener has any new connections and add them.
-		{
-			int iSocket = m_pListener->GetConnection();
+		const time_t iExpires = Clock::GetWallTime() + m_FloodControl.GetMuteSeconds();
 
-			if( iSocket > 0 )
-				AddUser( iSocket );
-		}
+		m_StateLock.LockWrite();
+		m_MuteList.Add( ListEntry(user->GetName(), iExpires) );
+		m_StateLock.Unlock();
 
-		// loop over all the clients and update them as needed
-		for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
-		{
-			User *user = (*it);
+		SetMuted( user, true );
+		Broadcast( ChatPacket(USER_MUTE, user->GetName(), BLANK) );
+	}
 
-			// if the user isn't logged in, check login status
-			if( !user->IsLoggedIn() )
-			{
-				const LoginState state = user->GetLoginState();
+	return false;
+}
 
-				// we're not expecting any data just yet.
-				if( state == LOGIN_CHECKING )
-					continue;
+void ChatServer::HandleDelayedPackets( User *user )
+{
+	const uint64_t iNow = Clock::GetMilliseconds();
+	FloodState &state = user->GetFloodState();
 
-				// if the user's login completed, check it.
-				if( state != LOGIN_NONE )
-					HandleLoginState( user );
-			}
+	// these were all valid packets, so they start with their codes
+	while( !state.vDelayed.empty() && !user->IsDead() )
+	{
+		const uint16_t iCode = ChatPacket::GetCode( state.vDelayed.front(), user->GetEncoding() );
 
-			// update this user (which means checking for and
-			// handling packets) regardless of login status.
-			UpdateUser( user );
+		if( !m_FloodControl.Retry(state, iCode, iNow) )
+			break;
 
-			// users can't be idle unless they're logged in...
-			if( user->IsLoggedIn() )
-				CheckIdleStatus( user );
+		const string buf = state.vDelayed.front();
+		state.vDelayed.pop_front();
 
-			// if this user is dead, erase/reposition the iterator
-			// and properly remove the user from rooms, etc.
-			if( user->IsDead() )
-			{
-				it = m_Users.erase( it );
-				RemoveUser( user );
-			}
+		HandleUserPacket( user, buf, true );
+	}
+}
 
+void ChatServer::MainLoop()
+{
+	while( !m_bQuitRequested )
+	{
+		// SIGHUP: reload the config and restart. We do this here, rather
+		// than in the handler, so no Shard's in the middle of anything.
+		if( m_bReloadRequested )
+		{
+			m_bReloadRequested = false;
+			LOG->System( "Caught SIGHUP! Reloading config..." );
+
+			if( m_bRunning )
+				Reload();
 		}
 
-		// flush all the logs to disk on update
-		LOG->Flush();
+		// SIGUSR2: hand everything to a new process, and leave it be
+		if( m_bUpgradeRequested )
+		{
+			m_bUpgradeRequested = false;
+			LOG->System( "Caught SIGUSR2! Upgrading..." );
 
-		// run some basic lag-detection logic
+			if( m_bRunning && Upgrade() )
+			{
+				// the new process starts counting from zero
+				DumpPacketStats();
+				return;
+			}
+		}
+
+		// SIGUSR1: how much each kind of packet's cost, so far
+		if( m_bStatsRequested )
 		{
-			gettimeofday( &tv_end, NULL );
-			unsigned iDiff = 1000000 * (tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec);
+			m_bStatsRequested = false;
+			DumpPacketStats();
+		}
 
-			if( iDiff >= iLagSpikeTime )
-				LOG->Debug( "[MainLoop took %u usecs to execute.]\n", iDiff );
+		// If we're not running, then keep looping (lazily) until we are.
+		if( !m_bRunning || m_Shards.empty() )
+		{
+			sleep( 1 );
+			continue;
 		}
 
-		// give a bunch of time to other processes
-		usleep( iSleepTime );
+		m_Shards[0]->Update( m_iSleepTime/1000 );
+
+		UpdateTimedLists();
+
+		// flush all the logs to disk on update
+		LOG->Flush();
 	}
 
-	LOG->System( "The impossible happened! :(" );
+	LOG->System( "Caught signal, shutting down..." );
+	DumpPacketStats();
 }
 
-void ChatServer::UpdateUser( User *user )
+void ChatServer::DumpPacketStats() const
 {
-	unsigned iPos = 0;
-
-	memset( m_sReadBuffer, '\0', BUFFER_SIZE );
+	PacketStats total;
 
-	// no new data to operate on, or an error occurred
-	if( (iPos = user->Read(m_sReadBuffer, BUFFER_SIZE)) <= 0 )
-		return;
-
-	// the vast majority of cases won't need split, so we
-	// can optimize the branching logic around that case.
-	std::string sBuffer( m_sReadBuffer );
+	for( unsigned i = 0; i < m_Shards.size(); ++i )
+		total.Add( *m_Shards[i]->GetStats() );
 
-	if( !PacketUtil::NeedsSplit(sBuffer) )
-	{
-		// only one packet: handle and be on our way.
-		HandleUserPacket( user, sBuffer );
-	}
-	else
-	{
-		// we have multiple packets. split them and handle each.
-		vector<std::string> vPackets;
-		PacketUtil::Split( sBuffer, vPackets );
-
-		for( unsigned i = 0; i < vPackets.size(); ++i )
-			HandleUserPacket( user, vPackets[i] );
-	}
+	total.Dump();
 }
 
-void ChatServer::HandleUserPacket( User *user, const std::string &buf )
+/* cuts a field off at its first newline, so a packet's one line in the log */
+static string_view FirstLine( string_view sField )
 {
-	// create user-specific log prefix, e.g. "Fire_Adept@127.0.0.1"
-	const string sUserPrefix = StringUtil::Format( "%s@%s", user->GetName().c_str(), user->GetIP() );
+	return sField.substr( 0, sField.find('\n') );
+}
 
-	// try to make a packet out of the data we've gotten
-	ChatPacket packet( buf );
+void ChatServer::HandleUserPacket( User *user, string_view buf, bool bDelayed,
+	const TextScan *pScan )
+{
+	// parse the packet where it lies. Nothing's copied out of buf unless
+	// flood control holds it back or a handler needs to keep something.
+	PacketView packet;
 
 	// if the packet can't be parsed, drop the client.
-	if( !packet.IsValid() )
+	if( !packet.Parse(buf, user->GetEncoding(), pScan) )
 	{
-		LOG->Debug( "invalid packet from %s! %s", sUserPrefix.c_str(), buf.c_str() );
-		LOG->Debug( "packet data: %s", buf.c_str() );
+		LOG->Debug( "invalid packet from %s@%s!", user->GetName().c_str(), user->GetIP() );
+		LOG->Debug( "packet data: %.*s", int(buf.size()), buf.data() );
 		user->Kill();
 		return;
 	}
 
+	// a packet over the flood limits is treated as if it never came in
+	if( !bDelayed && !CheckFlood(user, packet.iCode, buf) )
+		return;
+
 	// broadcast a returned message if the user was idle or away before.
-	if( user->IsLoggedIn() && (user->IsIdle() || user->IsAway()) )
+	const bool bBack = user->IsLoggedIn() && (user->IsIdle() || user->IsAway());
+
+	if( bBack )
 		Broadcast( ChatPacket(CLIENT_BACK, user->GetName(), BLANK) );
 
 	// update idle/away and last message timestamp
 	user->PacketSent();
 
+	if( bBack )
+		UpdatePresence( user );
+
 	// don't log packets that weren't actually handled
-	if( !PacketHandler::Handle(this, user, &packet) )
+	if( !PacketHandler::Handle(this, user, &packet, buf.size()) )
 		return;
 
+	const string_view sUsername = FirstLine( packet.sUsername );
+
 	// If we have a login packet, wipe the password from the log.
-	if( packet.iCode == USER_JOIN )
-		packet.sMessage = "[censored]";
+	const string_view sMessage = (packet.iCode == USER_JOIN) ?
+		string_view( "[censored]" ) : FirstLine( packet.sMessage );
 
 	/* write this packet to the log, including the user prefix, e.g.
 	 * Fire_Adept@192.168.1.1	3`_`hey sup d00dz`3`13`37
 	 */
-	string sLogLine = StringUtil::Format( "%s\t%s",
-		sUserPrefix.c_str(), packet.ToString().c_str() );
-
-	LOG->Chat( sLogLine.c_str() );
-}	
+	LOG->Chat( "%s@%s\t%u`%.*s`%.*s`%u`%u`%u", user->GetName().c_str(), user->GetIP(),
+		packet.iCode, int(sUsername.size()), sUsername.data(),
+		int(sMessage.size()), sMessage.data(), packet.r, packet.g, packet.b );
+}
 
 void ChatServer::CheckIdleStatus( User *user )
 {
@@ -318,7 +822,7 @@ void ChatServer::CheckIdleStatus( User *user )
 	// user has been away for too long, so kick 'em
 	if( user->IsInert() )
 	{
-		user->Write( ChatPacket(IDLE_KICK).ToString() );
+		user->Write( ChatPacket(IDLE_KICK) );
 		user->Kill();
 		return;
 	}
@@ -335,6 +839,42 @@ void ChatServer::CheckIdleStatus( User *user )
 
 	// update the user's last idle broadcast timestamp
 	user->UpdateLastIdle();
+	UpdatePresence( user );
+}
+
+void ChatServer::UpdateTimedLists()
+{
+	// nothing expires more precisely than a second
+	const time_t now = Clock::GetWallTime();
+
+	if( now == m_iLastListUpdate )
+		return;
+
+	m_iLastListUpdate = now;
+
+	// this has its own lock
+	m_Connections.Prune();
+
+	vector<string> vUnmuted;
+
+	m_StateLock.LockWrite();
+
+	m_BanList.Update( now );
+	m_MuteList.Update( now, &vUnmuted );
+
+	// a mute that's run out lets its user talk again right away
+	for( unsigned i = 0; i < vUnmuted.size(); ++i )
+	{
+		User *user = GetUserByName( vUnmuted[i] );
+
+		if( user == NULL || !user->IsLoggedIn() || !user->IsMuted() )
+			continue;
+
+		SetMuted( user, false );
+		Broadcast( ChatPacket(USER_UNMUTE, user->GetName(), BLANK) );
+	}
+
+	m_StateLock.Unlock();
 }
 
 void ChatServer::HandleLoginState( User *user )
@@ -344,20 +884,20 @@ void ChatServer::HandleLoginState( User *user )
 	switch( user->GetLoginState() )
 	{
 	case LOGIN_ERROR:
-		user->Write( ChatPacket(ACCESS_DENIED).ToString() );
+		user->Write( ChatPacket(ACCESS_DENIED) );
 		break;
 	case LOGIN_ERROR_ATTEMPTS:
-		user->Write( ChatPacket(LIMIT_REACHED).ToString() );
+		user->Write( ChatPacket(LIMIT_REACHED) );
 		break;
 	case LOGIN_SERVER_DOWN:
-		user->Write( ChatPacket(SERVER_DOWN).ToString() );
+		user->Write( ChatPacket(SERVER_DOWN) );
 		break;
 	case LOGIN_SUCCESS:
 	{
 		// if this user is banned, send them a message and cut the connection
 		if( user->GetLevel() == m_cBanLevel || m_BanList.HasName(user->GetName()) )
 		{
-			user->Write( ChatPacket(USER_BAN, BLANK, BLANK).ToString() );
+			user->Write( ChatPacket(USER_BAN, BLANK, BLANK) );
 			user->Kill();
 			return;
 		}
@@ -370,21 +910,41 @@ void ChatServer::HandleLoginState( User *user )
 		if( m_sModLevels.find(user->GetLevel()) != string::npos )
 			user->SetMod( true );
 
-		// write 'accepted' response
-		user->Write( ChatPacket(ACCESS_GRANTED).ToString() );
+		// write 'accepted' response, echoing the protocol options we'll
+		// give them (see ChatPacket.h). It goes in plain text; they start
+		// with everything after it.
+		uint8_t iProtocol = 0;
+
+		if( user->GetRequestedEncoding() == ENCODING_BINARY )
+			iProtocol |= BINARY_PROTOCOL;
+		if( user->GetRequestedCompression() && User::GetCompressionLevel() > 0 )
+			iProtocol |= DEFLATE_PROTOCOL;
+
+		user->Write( ChatPacket(ACCESS_GRANTED, BLANK, BLANK, iProtocol, 0, 0) );
+
+		if( iProtocol & BINARY_PROTOCOL )
+			user->SetEncoding( ENCODING_BINARY );
+
+		if( (iProtocol & DEFLATE_PROTOCOL) && !user->StartCompression() )
+		{
+			user->Kill();
+			return;
+		}
 
 		// write user config (which was set by the login request)
 		ChatPacket prefs(CLIENT_CONFIG, BLANK, user->GetPrefs() );
-		user->Write( prefs.ToString() );
+		user->Write( prefs );
 
-		m_pRooms->GetDefaultRoom()->AddUser( user );
+		EnterRoom( user, m_pRooms->GetDefaultRoom() );
 		user->SetLoggedIn( true );
+		m_UsersByName.Add( user );
+		UpdatePresence( user );
 
 		// send the new guy a nice little version message
 		std::string ver = StringUtil::Format( "Server build %u, "
 			"compiled %s", BUILD_VERSION, BUILD_DATE );
 
-		user->Write( ChatPacket(WALL_MESSAGE, BLANK, ver).ToString() );
+		user->Write( ChatPacket(WALL_MESSAGE, BLANK, ver) );
 
 		// tell everyone that this user joined
 		ChatPacket msg( USER_JOIN, user->GetName(), GetUserState(user) );
@@ -404,21 +964,134 @@ void ChatServer::HandleLoginState( User *user )
 		user->Kill();
 }
 
-User* ChatServer::GetUserByName( const std::string &sName ) const
+void ChatServer::UpdatePresence( const User *user )
 {
-	// XXX: always a linear search. Can we improve on that?
-	// (probably not, we don't have a high enough user load to justify it)
-	for( list<User*>::const_iterator it = m_Users.begin(); it != m_Users.end(); ++it )
-		if( !StringUtil::CompareNoCase((*it)->GetName(), sName) )
-			return (*it);
+	if( !user->IsLoggedIn() )
+		return;
+
+	// (worked out before locking: only our thread changes it)
+	const string sState = GetUserState( user );
+
+	m_ListLock.Lock();
+	m_Presence.Update( user->GetID(), user->GetName(), sState );
+	m_ListLock.Unlock();
+}
+
+void ChatServer::EnterRoom( User *user, const Room *room )
+{
+	user->SetRoom( room );
+	user->GetShard()->UpdateRoom( user );
+	UpdatePresence( user );
+}
+
+void ChatServer::MoveUser( User *user, const Room *room )
+{
+	if( !user->GetShard()->IsLocal() )
+	{
+		user->GetShard()->MoveUser( user->GetID(), room->GetID(), room->GetName() );
+		return;
+	}
+
+	EnterRoom( user, room );
+	Broadcast( ChatPacket(JOIN_ROOM, user->GetName(), room->GetName()) );
+}
+
+void ChatServer::SetMuted( User *user, bool bMuted )
+{
+	if( !user->GetShard()->IsLocal() )
+	{
+		user->GetShard()->MuteUser( user->GetID(), bMuted );
+		return;
+	}
+
+	user->SetMuted( bMuted );
+	UpdatePresence( user );
+}
 
-	// no match found
-	return NULL;
+void ChatServer::Lock( HandlerLock lock )
+{
+	switch( lock )
+	{
+	case LOCK_NONE:		break;
+	case LOCK_READ:		m_StateLock.LockRead(); break;
+	case LOCK_WRITE:	m_StateLock.LockWrite(); break;
+	case LOCK_LISTS:	m_ListLock.Lock(); break;
+	}
+}
+
+void ChatServer::Unlock( HandlerLock lock )
+{
+	switch( lock )
+	{
+	case LOCK_NONE:		break;
+	case LOCK_READ:
+	case LOCK_WRITE:	m_StateLock.Unlock(); break;
+	case LOCK_LISTS:	m_ListLock.Unlock(); break;
+	}
+}
+
+const std::string& ChatServer::GetUserListResponse( PacketEncoding encoding, bool bVersioned )
+{
+	CachedResponse &cache = bVersioned ? m_VersionedUserList : m_UserList;
+	const uint64_t iVersion = m_Presence.GetVersion();
+
+	const string *pCached = cache.Get( encoding, iVersion );
+
+	if( pCached )
+		return *pCached;
+
+	vector<const PresenceTable::Entry*> vEntries;
+	m_Presence.GetAll( vEntries );
+
+	string sData;
+
+	for( unsigned i = 0; i < vEntries.size(); ++i )
+		PacketView( USER_LIST, vEntries[i]->sName, vEntries[i]->sState ).AppendTo( sData, encoding );
+
+	string sDone = "done";
+
+	if( bVersioned )
+		sDone = StringUtil::Format( "full|%llu", (unsigned long long)iVersion );
+
+	PacketView( USER_LIST, BLANK, sDone ).AppendTo( sData, encoding );
+
+	return cache.Set( encoding, iVersion, sData );
+}
+
+const std::string& ChatServer::GetRoomListResponse( PacketEncoding encoding )
+{
+	// the version can't change while the state lock's held, so what's
+	// cached for it stays put until our caller's done with it. Two
+	// readers may build it at once, though; the first one keeps it.
+	const uint64_t iVersion = m_pRooms->GetVersion();
+
+	m_ListLock.Lock();
+	const string *pCached = m_RoomList.Get( encoding, iVersion );
+	m_ListLock.Unlock();
+
+	if( pCached )
+		return *pCached;
+
+	const map<string,Room*> *rooms = m_pRooms->GetRooms();
+	string sData;
+
+	for( map<string,Room*>::const_iterator it = rooms->begin(); it != rooms->end(); ++it )
+		PacketView( ROOM_LIST, BLANK, it->first ).AppendTo( sData, encoding );
+
+	m_ListLock.Lock();
+
+	// somebody else got there first
+	if( (pCached = m_RoomList.Get(encoding, iVersion)) == NULL )
+		pCached = &m_RoomList.Set( encoding, iVersion, sData );
+
+	m_ListLock.Unlock();
+
+	return *pCached;
 }
 
 std::string ChatServer::GetUserState( const User *user ) const
 {
-	const string sRoom = m_pRooms->GetName( user->GetRoom() );
+	const string &sRoom = user->GetRoomName();
 	const char cLevel = user->GetLevel();
 	const char cMuted = user->IsMuted() ? 'M' : '_';
 	string sIdle( BLANK ), sAway( BLANK );
@@ -435,33 +1108,23 @@ std::string ChatServer::GetUserState( const User *user ) const
 void ChatServer::Broadcast( const ChatPacket &packet )
 {
 	// optimization: instead of using Send(), cache the packet string and
-	// Write(). we only need ToString (which is expensive) once this way.
-	const std::string sPacketData = packet.ToString();
-
-	// send to every single user on the server
-	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
-	{
-		User *user = (*it);
+	// Write(). we only need to encode it (which is expensive) once this way.
+	Shard::Broadcast( SHARD_SEND_ALL, PacketView(packet) );
+}
 
-		// don't bother broadcasting to users who won't see it
-		if( !user->IsLoggedIn() )
-			continue;
+void ChatServer::BroadcastRoom( uint64_t iRoomID, const ChatPacket &packet )
+{
+	BroadcastRoom( iRoomID, PacketView(packet) );
+}
 
-		user->Write( sPacketData );
-	}
+void ChatServer::BroadcastRoom( uint64_t iRoomID, const PacketView &packet )
+{
+	Shard::Broadcast( SHARD_SEND_ROOM, packet, iRoomID );
 }
 
 void ChatServer::WallMessage( const std::string &sMessage )
 {
-	const std::string sPacket = ChatPacket(WALL_MESSAGE, BLANK, sMessage).ToString();
-
-	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
-	{
-		User *user = (*it);
-
-		if( user->IsMod() )
-			user->Write( sPacket );
-	}
+	Shard::Broadcast( SHARD_SEND_MODS, PacketView(WALL_MESSAGE, BLANK, sMessage) );
 }
 
 /* 
@@ -1,23 +1,45 @@
 /* ChatServer: the main server file. Handles all users, message broadcasting,
- * that sort of thing. */
+ * that sort of thing. Connections are spread over one or more Shards, each
+ * with its own thread; see Shard.h for who may touch what, and when. */
 
 #ifndef CHAT_SERVER_H
 #define CHAT_SERVER_H
 
+#include <atomic>
+#include <csignal>
 #include <list>
 #include <vector>
 #include <string>
+#include <string_view>
+#include "network/ConnectionTable.h"
 #include "network/SocketListener.h"
+#include "packet/CachedResponse.h"
+#include "packet/FloodControl.h"
+#include "model/PresenceTable.h"
 #include "model/RoomList.h"
 #include "model/TimedList.h"
+#include "model/UserIndex.h"
+#include "util/Thread.h"
 
 class ChatPacket;
 class Config;
 class DatabaseConnector;
+struct HandoffState;
+class NetAddress;
+struct PacketView;
+class Room;
+class Shard;
+struct TextScan;
 class User;
 
-// 1024 = 1 KB, so 4 KB
-const unsigned BUFFER_SIZE = 1024*4;
+/* what a packet handler needs locked while it runs; see Shard.h */
+enum HandlerLock
+{
+	LOCK_NONE,	/* it only touches the sender, and broadcasts */
+	LOCK_READ,	/* it looks up other users or rooms */
+	LOCK_WRITE,	/* it changes who's on, the rooms, or the ban/mute lists */
+	LOCK_LISTS	/* it reads the presence table */
+};
 
 class ChatServer
 {
@@ -28,54 +50,149 @@ public:
 	/* sets configuration */
 	void SetConfig( Config *cfg )	{ m_pConfig = cfg; }
 
-	/* loads preferences and starts up the network server */
-	void Start();
+	/* loads preferences and starts up the network server. With pHandoff,
+	 * it carries on with the users and listeners of the server that
+	 * handed them over (see Handoff.h) instead of starting fresh. */
+	void Start( const HandoffState *pHandoff = NULL );
+
+	/* receives a running server's state from iSocket, starts with it, and
+	 * tells the old server we've taken over. Returns false if nothing
+	 * (usable) was received; the old server carries on in that case. */
+	bool TakeOver( int iSocket );
 
 	/* tells the main server loop to stop running */
 	void Stop();
 
-	// returns a reference to the user with the given name
-	User* GetUserByName( const std::string &sName ) const;
+	/* safe to call from a signal handler: the main loop reloads the
+	 * config (restarting the server) or returns at its next pass. */
+	void RequestReload()	{ m_bReloadRequested = true; }
+	void RequestQuit()	{ m_bQuitRequested = true; }
+
+	/* also safe from a signal handler: the main loop hands everything to
+	 * a new process running the binary at sPath (or UpgradeBinary, if it's
+	 * set in the config), then returns if that worked. */
+	void RequestUpgrade()	{ m_bUpgradeRequested = true; }
+
+	/* and this one: the main loop writes out the packet stats */
+	void RequestStats()	{ m_bStatsRequested = true; }
+	void SetBinaryPath( const std::string &sPath )	{ m_sBinaryPath = sPath; }
+
+	/* true once another process has taken over. Our users' sockets are
+	 * that process's now, so we must leave without touching them. */
+	bool IsHandedOff() const	{ return m_bHandedOff; }
+
+	bool IsRunning() const	{ return m_bRunning; }
+
+	/* takes what a handler with this HandlerLock needs, and lets it go */
+	void Lock( HandlerLock lock );
+	void Unlock( HandlerLock lock );
+
+	/* the logged in user with this name (ignoring case), or NULL. Needs
+	 * the state lock held; the user's good until it's let go. */
+	User* GetUserByName( std::string_view sName ) const	{ return m_UsersByName.Find( sName ); }
 
-	/* returns a std::string expressing the user's current state */
+	/* returns a std::string expressing the user's current state. Only
+	 * on the user's Shard's thread. */
 	std::string GetUserState( const User *user ) const;
 
+	/* every logged in user's state, by version; only read it with the
+	 * list lock held. Whatever changes a user's state (see GetUserState)
+	 * has to call UpdatePresence() afterwards, which takes the lock. */
+	const PresenceTable* GetPresence() const	{ return &m_Presence; }
+	void UpdatePresence( const User *user );
+
+	/* the whole user list (a USER_LIST per user, then "done", or with
+	 * bVersioned, "full|<version>") and the whole room list, serialized
+	 * in this encoding. They're built once and kept until the presence
+	 * table or the room list changes. The user list needs the list lock
+	 * held for as long as it's used; the room list needs the state lock
+	 * (for reading, at least), and takes the list lock itself. */
+	const std::string& GetUserListResponse( PacketEncoding encoding, bool bVersioned );
+	const std::string& GetRoomListResponse( PacketEncoding encoding );
+
+	/* puts user in room (or, if it's NULL, none) and updates their
+	 * presence. Only on the user's Shard's thread, with the state lock
+	 * held, so the room can't go away in the meantime. */
+	void EnterRoom( User *user, const Room *room );
+
+	/* EnterRoom()s user and tells everyone (JOIN_ROOM). From another
+	 * Shard's thread, this asks the user's Shard to do it; if the room's
+	 * gone by then, they stay where they are. Needs the state lock held. */
+	void MoveUser( User *user, const Room *room );
+
+	/* mutes or unmutes user and updates their presence. From another
+	 * Shard's thread, this asks the user's Shard to do it. */
+	void SetMuted( User *user, bool bMuted );
+
 	/* sends a system message to all mods on the server */
 	void WallMessage( const std::string &sMessage );
 
-	/* sends a packet to all users on the server */
+	/* sends a packet to all users on the server, or to everyone in the
+	 * room with this ID */
 	void Broadcast( const ChatPacket &packet );
+	void BroadcastRoom( uint64_t iRoomID, const ChatPacket &packet );
+	void BroadcastRoom( uint64_t iRoomID, const PacketView &packet );
 
-	/* main processing loop */
+	/* main processing loop. Runs the first Shard until RequestQuit(),
+	 * or until an upgrade's handed everything to a new process. */
 	void MainLoop();
 
+	/* writes every Shard's PacketStats, added up, to the system log.
+	 * Safe while the Shards are running. */
+	void DumpPacketStats() const;
+
 	/* returns true if we're listening for clients */
-	bool IsListening() const { return m_pListener != NULL && m_pListener->IsConnected(); }
+	bool IsListening() const { return !m_Listeners.empty() && m_Listeners[0]->IsConnected(); }
 
-	// no non-const version because no functions should need it
+	// no non-const version because no functions should need it.
+	// this is shared state: only read it with the state lock held.
 	const std::list<User*>* GetUserList() const	{ return &m_Users; }
 
+	/* the rooms, and the ban and mute lists, are shared too: reading
+	 * them needs the state lock, and changing them needs it for writing */
 	RoomList* GetRoomList()	{ return m_pRooms; }
 	const RoomList* GetRoomList() const { return m_pRooms; }
 
 	/* retrieves a pointer to the database connector for login/prefs */
 	DatabaseConnector* GetConnection() { return m_pConnector; }
 
+	/* every connection we've accepted, by address. Safe from any thread. */
+	ConnectionTable* GetConnectionTable() { return &m_Connections; }
+
 	TimedList* GetBanList() { return &m_BanList; }
 	TimedList* GetMuteList() { return &m_MuteList; }
 
+	/* in microseconds, as set in the config */
+	unsigned GetSleepTime() const		{ return m_iSleepTime; }
+	unsigned GetLagSpikeTime() const	{ return m_iLagSpikeTime; }
+	unsigned GetOutputLatency() const	{ return m_iOutputLatency; }
+
 protected:
-	/* assigns a user to the given socket */
-	void AddUser( unsigned iSocket );
+	// Shards call everything below. Adding and removing users, and
+	// login results, need the state lock held for writing; the rest
+	// needs no lock, and takes what it needs.
+	friend class Shard;
+
+	/* hands a socket accepted by pAcceptor (from addr) to the Shard that
+	 * should serve it: pAcceptor with ReusePort (the kernel did the
+	 * balancing for us), otherwise the next Shard in line. */
+	void AddConnection( int iSocket, const NetAddress &addr, Shard *pAcceptor );
 
-	/* disconnects the given user from the server */
+	/* adds a user to the server's list */
+	void AddUser( User *user );
+
+	/* disconnects the given user from the server. The user's Shard
+	 * deletes it, once nothing else refers to it. */
 	void RemoveUser( User *user );
 
-	/* performs an update cycle on the given user */
-	void UpdateUser( User *user );
+	/* handles a packet received from user. bDelayed means flood control
+	 * held it back earlier, and has let it through now. pScan, if given,
+	 * is where a text packet's delimiters are (see User::GetFrame). */
+	void HandleUserPacket( User *user, std::string_view in, bool bDelayed = false,
+		const TextScan *pScan = NULL );
 
-	/* handles a packet received from user */
-	void HandleUserPacket( User *user, const std::string &in );
+	/* handles as many of user's delayed packets as flood control allows */
+	void HandleDelayedPackets( User *user );
 
 	/* handles the login status of a user */
 	void HandleLoginState( User *user );
@@ -84,17 +201,82 @@ protected:
 	void CheckIdleStatus( User *user );
 
 private:
+	/* returns true if a packet with iCode from user is within the flood
+	 * limits. If not, deals with it (and maybe the user) and returns
+	 * false: the packet's not to be handled now. */
+	bool CheckFlood( User *user, int iCode, std::string_view in );
+
+	/* drops bans and mutes that have run out, and connection table
+	 * entries that aren't needed anymore. Takes the state lock. */
+	void UpdateTimedLists();
+
+	/* reads the settings that can change while we're running out of
+	 * m_pConfig. Start() and Reload() both use this. */
+	void ApplyConfig();
+
+	/* the AdditionalRooms in cfg */
+	static void GetExtraRooms( const Config *cfg, std::vector<std::string> &vsRooms );
+
+	/* loads the config again, and applies whatever's changed without
+	 * disconnecting anyone. Only a new ServerPort touches the listeners;
+	 * settings that need new Shards wait for the next start or upgrade. */
+	void Reload();
+
+	/* moves the listeners to iPort. If that fails, they stay put. */
+	void Rebind( int iPort );
+
+	/* stops the reactor threads (leaving this thread to do everything,
+	 * as in Stop()), and starts them again */
+	void StopThreads();
+	void StartThreads();
+
+	/* hands our users and listeners to a new process. Returns true if it
+	 * took them; otherwise, we carry on as we were. */
+	bool Upgrade();
+
+	/* brings back the rooms, lists, and users another process handed
+	 * over. Called from Start(), before the reactor threads start. */
+	void Restore( const HandoffState &state );
+
 	/* true as long as the server is running */
-	bool m_bRunning;
+	std::atomic<bool> m_bRunning;
+
+	/* set by signal handlers, checked by MainLoop */
+	volatile sig_atomic_t m_bReloadRequested, m_bQuitRequested, m_bUpgradeRequested;
+	volatile sig_atomic_t m_bStatsRequested;
+
+	/* set once Upgrade() has handed everything over */
+	bool m_bHandedOff;
+
+	/* the binary we're running, for Upgrade() */
+	std::string m_sBinaryPath;
 
-	/* instance buffer for reading packet data from a user */
-	char m_sReadBuffer[BUFFER_SIZE];
+	/* the state lock guards the user list and index, the RoomList, and
+	 * the ban and mute lists; the list lock, the presence table and the
+	 * cached lists. See Shard.h. */
+	RWLock m_StateLock;
+	Mutex m_ListLock;
+
+	/* one per reactor thread; the first runs in MainLoop */
+	std::vector<Shard*> m_Shards;
+
+	/* which Shard gets the next connection */
+	unsigned m_iNextShard;
+
+	/* see config.txt */
+	unsigned m_iSleepTime, m_iLagSpikeTime, m_iOutputLatency;
 
 	/* handles verifying accounts and config save/load */
 	DatabaseConnector *m_pConnector;
 
-	/* listens for connections on the given port */
-	SocketListener *m_pListener;
+	/* listens for connections on the given port: one socket, or with
+	 * ReusePort, one per Shard sharing the port */
+	std::vector<SocketListener*> m_Listeners;
+	bool m_bReusePort;
+
+	/* open connections by address, and the limits on them. This outlives
+	 * a restart, along with the users it's counting. */
+	ConnectionTable m_Connections;
 
 	/* handles configuration for server logic */
 	Config *m_pConfig;
@@ -108,9 +290,24 @@ private:
 	/* handles users muted server-side */
 	TimedList m_MuteList;
 
-	/* set of all users being updated */
+	/* limits how fast users can send packets */
+	FloodControl m_FloodControl;
+
+	/* the last second UpdateTimedLists() ran in */
+	time_t m_iLastListUpdate;
+
+	/* set of all users on the server, whichever Shard they're on */
 	std::list<User*> m_Users;
 
+	/* the logged in ones, by name, for GetUserByName() */
+	UserIndex m_UsersByName;
+
+	/* the logged in users' states, for USER_LIST */
+	PresenceTable m_Presence;
+
+	/* the lists, as GetUserListResponse() and GetRoomListResponse() */
+	CachedResponse m_UserList, m_VersionedUserList, m_RoomList;
+
 	/* set of muted users that should stay muted between logins. */
 	std::vector<std::string> m_MutedUsers;
 
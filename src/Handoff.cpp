@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "Handoff.h"
+#include "logger/Logger.h"
+#include "packet/ChatPacket.h"
+
+using namespace std;
+
+/* "RVHO", and the layout version: bump it whenever the layout changes, so
+ * a binary never tries to read a state it doesn't understand */
+const uint32_t HANDOFF_MAGIC = 0x5256484f;
+const uint32_t HANDOFF_VERSION = 3;
+
+/* descriptors per message; the kernel takes up to 253 (SCM_MAX_FD) */
+const unsigned FDS_PER_MESSAGE = 200;
+
+/* how long Send() waits on a new process that's stopped reading */
+const int SEND_TIMEOUT_SECS = 30;
+
+/* what the new process sends once it's running */
+const char READY_BYTE = 'R';
+
+namespace
+{
+	/* builds up the state in a flat buffer */
+	class Writer
+	{
+	public:
+		void PutU8( uint8_t i )		{ m_sData.push_back( char(i) ); }
+		void PutU32( uint32_t i )	{ Put( &i, sizeof(i) ); }
+		void PutU64( uint64_t i )	{ Put( &i, sizeof(i) ); }
+
+		void PutString( const string &s )
+		{
+			PutU32( s.length() );
+			m_sData.append( s );
+		}
+
+		const string& GetData() const	{ return m_sData; }
+
+	private:
+		void Put( const void *p, unsigned iLen )	{ m_sData.append( (const char*)p, iLen ); }
+
+		string m_sData;
+	};
+
+	/* reads it back. Once anything runs past the end, every read after
+	 * that returns nothing, and IsValid() says so. */
+	class Reader
+	{
+	public:
+		Reader( const string &sData ) : m_sData(sData), m_iPos(0), m_bValid(true) { }
+
+		uint8_t GetU8()		{ uint8_t i = 0; Get( &i, sizeof(i) ); return i; }
+		uint32_t GetU32()	{ uint32_t i = 0; Get( &i, sizeof(i) ); return i; }
+		uint64_t GetU64()	{ uint64_t i = 0; Get( &i, sizeof(i) ); return i; }
+
+		string GetString()
+		{
+			const uint32_t iLen = GetU32();
+
+			if( !m_bValid || iLen > m_sData.length() - m_iPos )
+			{
+				m_bValid = false;
+				return string();
+			}
+
+			m_iPos += iLen;
+			return m_sData.substr( m_iPos - iLen, iLen );
+		}
+
+		bool IsValid() const	{ return m_bValid; }
+
+	private:
+		void Get( void *p, unsigned iLen )
+		{
+			if( !m_bValid || iLen > m_sData.length() - m_iPos )
+			{
+				m_bValid = false;
+				return;
+			}
+
+			memcpy( p, m_sData.data() + m_iPos, iLen );
+			m_iPos += iLen;
+		}
+
+		const string &m_sData;
+		size_t m_iPos;
+		bool m_bValid;
+	};
+
+	bool WriteAll( int iSocket, const char *p, size_t iLen )
+	{
+		while( iLen > 0 )
+		{
+			ssize_t iSent = write( iSocket, p, iLen );
+
+			if( iSent < 0 && errno == EINTR )
+				continue;
+			if( iSent <= 0 )
+				return false;
+
+			p += iSent;
+			iLen -= iSent;
+		}
+
+		return true;
+	}
+
+	bool ReadAll( int iSocket, char *p, size_t iLen )
+	{
+		while( iLen > 0 )
+		{
+			ssize_t iRead = read( iSocket, p, iLen );
+
+			if( iRead < 0 && errno == EINTR )
+				continue;
+			if( iRead <= 0 )
+				return false;
+
+			p += iRead;
+			iLen -= iRead;
+		}
+
+		return true;
+	}
+
+	void PutList( Writer &w, const vector<ListEntry> &vEntries )
+	{
+		w.PutU32( vEntries.size() );
+
+		for( unsigned i = 0; i < vEntries.size(); ++i )
+		{
+			w.PutString( vEntries[i].name );
+			w.PutU64( (uint64_t)vEntries[i].time );
+		}
+	}
+
+	void GetList( Reader &r, vector<ListEntry> &vEntries )
+	{
+		const uint32_t iCount = r.GetU32();
+
+		for( uint32_t i = 0; i < iCount && r.IsValid(); ++i )
+		{
+			const string sName = r.GetString();
+			const time_t iTime = (time_t)r.GetU64();
+			vEntries.push_back( ListEntry(sName, iTime) );
+		}
+	}
+
+	enum
+	{
+		FLAG_LOGGED_IN	= 1 << 0,
+		FLAG_MUTED	= 1 << 1,
+		FLAG_AWAY	= 1 << 2,
+		FLAG_MOD	= 1 << 3,
+		FLAG_COMPRESSED	= 1 << 4
+	};
+}
+
+bool Handoff::Send( int iSocket, const HandoffState &state )
+{
+	Writer w;
+
+	w.PutU32( HANDOFF_MAGIC );
+	w.PutU32( HANDOFF_VERSION );
+
+	w.PutU32( state.vListeners.size() );
+
+	w.PutU32( state.vRooms.size() );
+
+	for( unsigned i = 0; i < state.vRooms.size(); ++i )
+		w.PutString( state.vRooms[i] );
+
+	PutList( w, state.vBans );
+	PutList( w, state.vMutes );
+
+	w.PutU32( state.vUsers.size() );
+
+	for( unsigned i = 0; i < state.vUsers.size(); ++i )
+	{
+		const UserHandoff &user = state.vUsers[i];
+
+		w.PutString( user.sAddress );
+		w.PutString( user.sName );
+		w.PutString( user.sPrefs );
+		w.PutString( user.sMessage );
+		w.PutString( user.sRoom );
+		w.PutU8( user.cLevel );
+
+		uint8_t iFlags = 0;
+		if( user.bLoggedIn )	iFlags |= FLAG_LOGGED_IN;
+		if( user.bMuted )	iFlags |= FLAG_MUTED;
+		if( user.bAway )	iFlags |= FLAG_AWAY;
+		if( user.bMod )		iFlags |= FLAG_MOD;
+		if( user.bCompressed )	iFlags |= FLAG_COMPRESSED;
+		w.PutU8( iFlags );
+		w.PutU8( user.iEncoding );
+		w.PutString( user.sDeflateHistory );
+
+		w.PutU64( user.iLastActive );
+		w.PutU32( user.iLastIdleMinute );
+		w.PutString( user.sInput );
+		w.PutString( user.sOutput );
+	}
+
+	// the state, with its length in front...
+	const string &sData = w.GetData();
+	const uint32_t iLen = sData.length();
+
+	if( !WriteAll(iSocket, (const char*)&iLen, sizeof(iLen)) || !WriteAll(iSocket, sData.data(), iLen) )
+	{
+		LOG->System( "Handoff: sending state failed (%s)", strerror(errno) );
+		return false;
+	}
+
+	// ...then the descriptors, in order: listeners, then users
+	vector<int> vFDs( state.vListeners );
+
+	for( unsigned i = 0; i < state.vUsers.size(); ++i )
+		vFDs.push_back( state.vUsers[i].iSocket );
+
+	for( unsigned iStart = 0; iStart < vFDs.size(); iStart += FDS_PER_MESSAGE )
+	{
+		const unsigned iCount = min( FDS_PER_MESSAGE, unsigned(vFDs.size() - iStart) );
+
+		// the descriptors ride along with a single byte of data
+		char cByte = 'F';
+		struct iovec iov = { &cByte, 1 };
+
+		vector<char> vControl( CMSG_SPACE(iCount * sizeof(int)) );
+
+		struct msghdr msg;
+		memset( &msg, 0, sizeof(msg) );
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &vControl[0];
+		msg.msg_controllen = vControl.size();
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN( iCount * sizeof(int) );
+		memcpy( CMSG_DATA(cmsg), &vFDs[iStart], iCount * sizeof(int) );
+
+		ssize_t iSent;
+
+		do
+			iSent = sendmsg( iSocket, &msg, 0 );
+		while( iSent < 0 && errno == EINTR );
+
+		if( iSent != 1 )
+		{
+			LOG->System( "Handoff: sending descriptors failed (%s)", strerror(errno) );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Handoff::Receive( int iSocket, HandoffState &state )
+{
+	uint32_t iLen;
+	string sData;
+
+	if( !ReadAll(iSocket, (char*)&iLen, sizeof(iLen)) )
+	{
+		LOG->System( "Handoff: no state received" );
+		return false;
+	}
+
+	sData.resize( iLen );
+
+	if( iLen > 0 && !ReadAll(iSocket, &sData[0], iLen) )
+	{
+		LOG->System( "Handoff: state cut short" );
+		return false;
+	}
+
+	Reader r( sData );
+
+	const uint32_t iMagic = r.GetU32();
+	const uint32_t iVersion = r.GetU32();
+
+	if( iMagic != HANDOFF_MAGIC || iVersion != HANDOFF_VERSION )
+	{
+		LOG->System( "Handoff: unknown state (version %u; we read %u)", iVersion, HANDOFF_VERSION );
+		return false;
+	}
+
+	const uint32_t iListeners = r.GetU32();
+
+	const uint32_t iRooms = r.GetU32();
+
+	for( uint32_t i = 0; i < iRooms && r.IsValid(); ++i )
+		state.vRooms.push_back( r.GetString() );
+
+	GetList( r, state.vBans );
+	GetList( r, state.vMutes );
+
+	const uint32_t iUsers = r.GetU32();
+
+	for( uint32_t i = 0; i < iUsers && r.IsValid(); ++i )
+	{
+		UserHandoff user;
+
+		user.iSocket = -1;
+		user.sAddress = r.GetString();
+		user.sName = r.GetString();
+		user.sPrefs = r.GetString();
+		user.sMessage = r.GetString();
+		user.sRoom = r.GetString();
+		user.cLevel = r.GetU8();
+
+		const uint8_t iFlags = r.GetU8();
+		user.bLoggedIn = (iFlags & FLAG_LOGGED_IN) != 0;
+		user.bMuted = (iFlags & FLAG_MUTED) != 0;
+		user.bAway = (iFlags & FLAG_AWAY) != 0;
+		user.bMod = (iFlags & FLAG_MOD) != 0;
+		user.bCompressed = (iFlags & FLAG_COMPRESSED) != 0;
+
+		user.iEncoding = r.GetU8();
+		user.sDeflateHistory = r.GetString();
+
+		if( user.iEncoding >= NUM_ENCODINGS )
+		{
+			LOG->System( "Handoff: unknown encoding %u", user.iEncoding );
+			return false;
+		}
+
+		user.iLastActive = r.GetU64();
+		user.iLastIdleMinute = r.GetU32();
+		user.sInput = r.GetString();
+		user.sOutput = r.GetString();
+
+		state.vUsers.push_back( user );
+	}
+
+	if( !r.IsValid() )
+	{
+		LOG->System( "Handoff: state is damaged" );
+		return false;
+	}
+
+	// now the descriptors, however the kernel splits them up
+	vector<int> vFDs;
+	const unsigned iExpected = iListeners + iUsers;
+
+	while( vFDs.size() < iExpected )
+	{
+		char cByte;
+		struct iovec iov = { &cByte, 1 };
+
+		vector<char> vControl( CMSG_SPACE(FDS_PER_MESSAGE * sizeof(int)) );
+
+		struct msghdr msg;
+		memset( &msg, 0, sizeof(msg) );
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &vControl[0];
+		msg.msg_controllen = vControl.size();
+
+		ssize_t iRead;
+
+		do
+			iRead = recvmsg( iSocket, &msg, MSG_CMSG_CLOEXEC );
+		while( iRead < 0 && errno == EINTR );
+
+		if( iRead != 1 )
+			break;
+
+		for( struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+		{
+			if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+				continue;
+
+			const unsigned iCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *pFDs = (const int*)CMSG_DATA( cmsg );
+			vFDs.insert( vFDs.end(), pFDs, pFDs + iCount );
+		}
+	}
+
+	if( vFDs.size() != iExpected )
+	{
+		LOG->System( "Handoff: expected %u descriptors, got %u", iExpected, (unsigned)vFDs.size() );
+
+		for( unsigned i = 0; i < vFDs.size(); ++i )
+			close( vFDs[i] );
+
+		return false;
+	}
+
+	state.vListeners.assign( vFDs.begin(), vFDs.begin() + iListeners );
+
+	for( unsigned i = 0; i < iUsers; ++i )
+		state.vUsers[i].iSocket = vFDs[iListeners + i];
+
+	return true;
+}
+
+int Handoff::Spawn( const string &sBinary, int &iChildPID )
+{
+	int sv[2];
+
+	if( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0 )
+	{
+		LOG->System( "Handoff: socketpair failed (%s)", strerror(errno) );
+		return -1;
+	}
+
+	// build everything the child needs now; after fork(), it can't
+	// safely do much more than exec
+	char szFD[16];
+	snprintf( szFD, sizeof(szFD), "%d", sv[1] );
+
+	char *argv[] = { const_cast<char*>(sBinary.c_str()), const_cast<char*>("--upgrade"), szFD, NULL };
+
+	pid_t pid = fork();
+
+	if( pid == 0 )
+	{
+		// the new process keeps its end across the exec
+		fcntl( sv[1], F_SETFD, 0 );
+		execv( argv[0], argv );
+		_exit( 127 );
+	}
+
+	close( sv[1] );
+
+	if( pid < 0 )
+	{
+		LOG->System( "Handoff: fork failed (%s)", strerror(errno) );
+		close( sv[0] );
+		return -1;
+	}
+
+	// a new process that hangs before it reads shouldn't hang us, too
+	struct timeval tv = { SEND_TIMEOUT_SECS, 0 };
+	setsockopt( sv[0], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) );
+
+	iChildPID = pid;
+	return sv[0];
+}
+
+bool Handoff::SendReady( int iSocket )
+{
+	return WriteAll( iSocket, &READY_BYTE, 1 );
+}
+
+bool Handoff::WaitForReady( int iSocket, int iTimeoutMS )
+{
+	struct pollfd pfd = { iSocket, POLLIN, 0 };
+
+	int iReady;
+
+	do
+		iReady = poll( &pfd, 1, iTimeoutMS );
+	while( iReady < 0 && errno == EINTR );
+
+	char cByte = 0;
+
+	return iReady > 0 && ReadAll( iSocket, &cByte, 1 ) && cByte == READY_BYTE;
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
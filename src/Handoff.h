@@ -0,0 +1,95 @@
+/* Handoff: moves a running server into a new process without dropping
+ * anyone, for upgrading the binary. The old process stops its Shards and
+ * writes down everything the new one needs: its users, rooms, and ban and
+ * mute lists. It sends that, the listening sockets, and every client's
+ * socket over a Unix socket (the descriptors go as SCM_RIGHTS), then waits
+ * for the new process to say it's taken over before it exits. Clients see
+ * a short pause, not a disconnect.
+ *
+ * A HandoffState's file descriptors are only good in the process that
+ * made it, or, after Receive(), the one that received it. */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "model/TimedList.h"
+
+/* everything about a user that outlives their connection's process */
+struct UserHandoff
+{
+	int iSocket;
+	std::string sAddress;
+
+	std::string sName, sPrefs, sMessage, sRoom;
+	char cLevel;
+	bool bLoggedIn, bMuted, bAway, bMod;
+
+	/* the PacketEncoding they're talking in, and if their output's
+	 * compressed, the deflate stream's history (see Deflater.h) */
+	uint8_t iEncoding;
+	bool bCompressed;
+	std::string sDeflateHistory;
+
+	/* when they last sent something, in Clock::GetSeconds(). That's the
+	 * system's monotonic clock, so it means the same thing to us both. */
+	uint64_t iLastActive;
+	unsigned iLastIdleMinute;
+
+	/* what they've sent that we haven't handled, and what we've queued
+	 * for them that the socket hasn't taken yet */
+	std::string sInput, sOutput;
+};
+
+struct HandoffState
+{
+	std::vector<int> vListeners;
+	std::vector<std::string> vRooms;
+	std::vector<ListEntry> vBans, vMutes;
+	std::vector<UserHandoff> vUsers;
+};
+
+namespace Handoff
+{
+	/* sends state over iSocket, descriptors and all. Blocks until it's
+	 * all sent; returns false if it couldn't be. */
+	bool Send( int iSocket, const HandoffState &state );
+
+	/* receives what Send() sent into state. The descriptors are ours
+	 * now. Returns false if the state's damaged, incomplete, or from an
+	 * incompatible version. */
+	bool Receive( int iSocket, HandoffState &state );
+
+	/* starts sBinary (with "--upgrade <fd>") as a new process that can
+	 * Receive() from the socket this returns. Returns -1 on failure. */
+	int Spawn( const std::string &sBinary, int &iChildPID );
+
+	/* tells the old process we've taken over, or waits (up to iTimeoutMS)
+	 * for the new process to tell us. Waiting returns false if it died
+	 * or gave up instead. */
+	bool SendReady( int iSocket );
+	bool WaitForReady( int iSocket, int iTimeoutMS );
+}
+
+#endif // HANDOFF_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -11,6 +11,7 @@ extern "C" {
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>	// for umask()
 }
 
 using namespace std;
@@ -21,11 +22,15 @@ Config *g_pConfig = NULL;
 
 int g_HandlerSemaphore = 0;
 
+// how many times we've been asked to quit
+int g_QuitRequests = 0;
+
 int g_LockFile = -1;
 
 const char* const LOCK_FILE_PATH = "/tmp/rvserver-lock";
 
-/* On caught signal, add a message and flush logs before exiting. */
+/* On a fatal signal (or once the main loop's done), add a message and
+ * flush logs before exiting. */
 static void clean_exit( int signum )
 {
 	g_HandlerSemaphore++;
@@ -72,23 +77,36 @@ static void HandleSignal( int signum )
 {
 	switch( signum )
 	{
+	/* The reactor threads may be in the middle of anything, so these
+	 * just leave a note for the main loop, which acts on its next pass. */
 	case SIGHUP:	/* reload config and restart */
-		{
-			if( !g_pServer )
-				return;
+		if( g_pServer )
+			g_pServer->RequestReload();
+		break;
 
-			if( LOG )
-				LOG->System( "Caught SIGHUP! Reloading config..." );
+	case SIGUSR2:	/* hand everything to a new process and leave */
+		if( g_pServer )
+			g_pServer->RequestUpgrade();
+		break;
 
-			g_pServer->Stop();
-			g_pConfig->Load( FileUtil::GetConfigFilePath() );
-			g_pServer->Start();
+	case SIGUSR1:	/* write the packet stats to the system log */
+		if( g_pServer )
+			g_pServer->RequestStats();
+		break;
 
+	case SIGINT:
+	case SIGTERM:
+		// the first time, stop nicely. the second time, stop now.
+		if( g_pServer && ++g_QuitRequests == 1 )
+		{
+			g_pServer->RequestQuit();
 			break;
 		}
 
-	case SIGINT:
-	case SIGTERM:
+		LOG->Stdout( "Alright, you insisted, stopping now." );
+		exit( signum );
+		break;
+
 	case SIGSEGV:
 	case SIGABRT:
 		clean_exit( signum );
@@ -136,7 +154,7 @@ static void daemonize()
 	}
 
 	/* Create our lock file and fork the daemon process. */
-	g_LockFile = open( LOCK_FILE_PATH, O_CREAT | O_EXCL | O_SYNC, 0755 );
+	g_LockFile = open( LOCK_FILE_PATH, O_WRONLY | O_CREAT | O_EXCL | O_SYNC | O_CLOEXEC, 0755 );
 
 	if( g_LockFile < 0 )
 	{
@@ -156,13 +174,47 @@ static void daemonize()
 	fclose( stderr );
 }
 
+/* We're taking over from a daemon that's upgrading: it's already done the
+ * daemonizing, so all that's left is to put our PID in its lock file. */
+static void TakeOverLockFile()
+{
+	g_LockFile = open( LOCK_FILE_PATH, O_WRONLY | O_TRUNC | O_SYNC | O_CLOEXEC );
+
+	if( g_LockFile < 0 )
+	{
+		LOG->Stdout( "Could not open lock file at %s: %s", LOCK_FILE_PATH, strerror(errno) );
+		return;
+	}
+
+	char sPID[12];
+	sprintf( sPID, "%i\n", getpid() );
+	write( g_LockFile, sPID, sizeof(sPID) );
+}
+
+/* The path of the binary we're running, for upgrading: whatever's there
+ * when we're told to upgrade is what we upgrade to. */
+static string GetBinaryPath()
+{
+	char szPath[4096];
+	ssize_t iLen = readlink( "/proc/self/exe", szPath, sizeof(szPath) - 1 );
+
+	if( iLen <= 0 )
+		return string();
+
+	szPath[iLen] = '\0';
+	return string( szPath );
+}
+
 static void SetUpSignalHandlers()
 {
 	// prevent the server from stopping on unexpected disconnect
 	sigignore( SIGPIPE );
 
-	// we use SIGHUP as a sentinel to reload configuration.
+	// we use SIGHUP as a sentinel to reload configuration,
+	// SIGUSR2 to upgrade to a new binary, and SIGUSR1 for stats.
 	signal( SIGHUP, HandleSignal );
+	signal( SIGUSR2, HandleSignal );
+	signal( SIGUSR1, HandleSignal );
 
 	// we intercept these signals with our cleaner version
 	signal( SIGINT, HandleSignal );
@@ -183,8 +235,21 @@ int main( int argc, char **argv )
 		return 1;
 	}
 
+	// "--upgrade <fd>": we've been started by a running server, which
+	// is waiting to hand its users over on fd
+	int iUpgradeFD = -1;
+
+	if( argc >= 3 && !strcmp(argv[1], "--upgrade") )
+		iUpgradeFD = atoi( argv[2] );
+
+	// (the server that started us has daemonized already)
 	if( g_pConfig->GetBool("Daemonize") )
-		daemonize();
+	{
+		if( iUpgradeFD < 0 )
+			daemonize();
+		else
+			TakeOverLockFile();
+	}
 
 	SetUpSignalHandlers();
 
@@ -192,25 +257,44 @@ int main( int argc, char **argv )
 
 	const char* const LOG_PATH = g_pConfig->Get( "LogPath" );
 
+	// after an upgrade, carry on with the old server's logs
 	LOG = new Logger( g_pConfig );
-	LOG->Open( LOG_PATH );
+	LOG->Open( LOG_PATH, iUpgradeFD >= 0 );
 
 	g_pServer = new ChatServer;
 	g_pServer->SetConfig( g_pConfig );
+	g_pServer->SetBinaryPath( GetBinaryPath() );
 
-	g_pServer->Start();
+	if( iUpgradeFD < 0 )
+	{
+		g_pServer->Start();
+	}
+	else if( !g_pServer->TakeOver(iUpgradeFD) )
+	{
+		// the old server's still running; leave it be
+		delete LOG;
+		exit( EXIT_FAILURE );
+	}
 
-	// run the server until the end of time
+	// run the server until we're told to stop
 	g_pServer->MainLoop();
 
-	// we should never get here, but if we do, clean up.
-	LOG->Stdout( "I'a! Cthulhu fhtagn!" );
+	// everyone's been handed to a new process, along with their sockets,
+	// the listeners, and the lock file. Removing our users (or anything
+	// else clean_exit does) would disconnect them, so just go.
+	if( g_pServer->IsHandedOff() )
+	{
+		LOG->System( "Upgrade finished; exiting." );
+		delete LOG;
 
-	delete g_pServer;
-	g_pServer = NULL;
+		if( g_LockFile >= 0 )
+			close( g_LockFile );
+
+		_exit( EXIT_SUCCESS );
+	}
 
-	delete g_pConfig;
-	g_pConfig = NULL;
+	// remove everyone, save their prefs, close the logs, and leave.
+	clean_exit( EXIT_SUCCESS );
 
 	return 0;
 }
@@ -0,0 +1,1230 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "Shard.h"
+#include "ChatServer.h"
+#include "Handoff.h"
+#include "logger/Logger.h"
+#include "model/Room.h"
+#include "model/User.h"
+#include "network/Ring.h"
+#include "network/SocketListener.h"
+#include "packet/MessageCodes.h"
+#include "util/Arena.h"
+#include "util/Clock.h"
+
+using namespace std;
+
+// while logins are out, check on them this often (in milliseconds).
+// the DatabaseWorker doesn't wake us up, so we have to go ask.
+const int LOGIN_POLL_MS = 25;
+
+// io_uring sizes: requests in one batch, and receive buffers (these are
+// only held while a completion's being handled, so a few go a long way)
+const unsigned RING_ENTRIES = 4096;
+const unsigned RING_BUFFERS = 1024;
+const unsigned RING_BUFFER_SIZE = 4096;
+
+// a Ring tag with no user ID: the Poller has something for us
+const uint64_t RING_TAG_POLLER = 0;
+
+// ...or a receive we've asked the Ring to cancel has been
+const uint64_t RING_TAG_CANCEL = 3;
+
+// how long Quiesce() waits for logins, and then the Ring, to finish
+const unsigned QUIESCE_LOGIN_MS = 10*1000;
+const unsigned QUIESCE_RING_MS = 5*1000;
+
+__thread Shard *Shard::s_pCurrent = NULL;
+bool Shard::s_bThreaded = false;
+const vector<Shard*> *Shard::s_pShards = NULL;
+
+Shard::Shard( ChatServer *pServer, unsigned iIndex, bool bUseRing ) :
+	m_pServer(pServer), m_iIndex(iIndex), m_bSleeping(false), m_Timers(Clock::GetSeconds())
+{
+	m_pRing = NULL;
+	m_bPollArmed = false;
+	m_pListener = NULL;
+	m_bThreadStarted = false;
+	m_iSendQueuedAt = 0;
+
+	m_iWakeFD = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+	if( m_iWakeFD < 0 )
+		LOG->System( "Shard %u: eventfd failed (%s)", m_iIndex, strerror(errno) );
+	else
+		m_Poller.Add( m_iWakeFD, this );
+
+	if( bUseRing )
+	{
+		m_pRing = new Ring;
+
+		if( !m_pRing->Init(RING_ENTRIES, RING_BUFFERS, RING_BUFFER_SIZE) )
+		{
+			LOG->System( "Shard %u: io_uring isn't available; using epoll.", m_iIndex );
+			delete m_pRing;
+			m_pRing = NULL;
+		}
+		else
+		{
+			// the Ring wakes us for the listener and wakeup, too
+			m_bPollArmed = m_pRing->Poll( m_Poller.GetFD(), RING_TAG_POLLER );
+		}
+	}
+}
+
+Shard::~Shard()
+{
+	DropMessages();
+
+	if( m_iWakeFD >= 0 )
+		close( m_iWakeFD );
+
+	if( m_pRing )
+	{
+		// the Ring may still be sending from a zombie's output
+		ReapZombies( true );
+		delete m_pRing;
+	}
+}
+
+void Shard::DropMessages()
+{
+	// anything still queued is undeliverable now. sockets we were
+	// handed but never got to are still ours to close, though.
+	QueueNode *pNode;
+
+	while( (pNode = m_Queue.Pop()) != NULL )
+	{
+		ShardMessage *msg = static_cast<ShardMessage*>( pNode );
+
+		if( msg->type == SHARD_ADD_USER )
+		{
+			close( msg->iSocket );
+			m_pServer->GetConnectionTable()->Release( msg->Address );
+		}
+
+		FreeMessage( msg );
+	}
+}
+
+void Shard::FreeMessage( ShardMessage *msg )
+{
+	if( msg->pBlock == NULL )
+	{
+		delete msg;
+		return;
+	}
+
+	// the packet it points to is in the same allocation, and has
+	// nothing of its own to free
+	SharedArena::Block *pBlock = msg->pBlock;
+	msg->~ShardMessage();
+	SharedArena::Release( pBlock );
+}
+
+void *Shard::ThreadMain( void *p )
+{
+	Shard *pShard = (Shard*)p;
+
+	// signals are the main thread's business; don't let them land here
+	sigset_t mask;
+	sigfillset( &mask );
+	sigdelset( &mask, SIGSEGV );
+	sigdelset( &mask, SIGABRT );
+	pthread_sigmask( SIG_BLOCK, &mask, NULL );
+
+	pShard->MakeCurrent();
+
+	while( pShard->m_pServer->IsRunning() )
+		pShard->Update( pShard->m_pServer->GetSleepTime() / 1000 );
+
+	return NULL;
+}
+
+void Shard::StartThread()
+{
+	m_Thread.Start( &ThreadMain, this );
+	m_bThreadStarted = true;
+}
+
+void Shard::StopThread()
+{
+	if( !m_bThreadStarted )
+		return;
+
+	// make sure it notices that the server isn't running anymore
+	uint64_t iOne = 1;
+	write( m_iWakeFD, &iOne, sizeof(iOne) );
+
+	m_Thread.Stop();
+	m_bThreadStarted = false;
+}
+
+void Shard::SetListener( SocketListener *pListener )
+{
+	if( m_pListener )
+		m_Poller.Remove( m_pListener->GetFD() );
+
+	m_pListener = pListener;
+
+	if( m_pListener )
+		m_Poller.Add( m_pListener->GetFD(), m_pListener );
+}
+
+void Shard::Post( ShardMessage *msg )
+{
+	m_Queue.Push( msg );
+
+	// only poke the eventfd if we might be asleep; one poke is enough.
+	if( m_bSleeping.exchange(false) )
+	{
+		uint64_t iOne = 1;
+		write( m_iWakeFD, &iOne, sizeof(iOne) );
+	}
+}
+
+void Shard::AddUser( int iSocket, const NetAddress &addr )
+{
+	if( IsLocal() )
+	{
+		CreateUser( iSocket, addr );
+		return;
+	}
+
+	ShardMessage *msg = new ShardMessage( SHARD_ADD_USER );
+	msg->iSocket = iSocket;
+	msg->Address = addr;
+	Post( msg );
+}
+
+void Shard::QueueSend( User *user )
+{
+	// the latency budget runs from the oldest output that's waiting
+	if( m_SendQueue.empty() )
+		m_iSendQueuedAt = Clock::ReadMicroseconds();
+
+	m_SendQueue.push_back( user->GetID() );
+}
+
+void Shard::FlushOutput()
+{
+	for( unsigned i = 0; i < m_SendQueue.size(); ++i )
+	{
+		map<uint64_t,User*>::iterator it = m_UserIDs.find( m_SendQueue[i] );
+
+		// they might have been removed since they were queued
+		if( it == m_UserIDs.end() )
+			continue;
+
+		User *user = it->second;
+		user->SendQueued();
+
+		if( user->IsDead() )
+			m_DeadUsers.insert( user );
+	}
+
+	m_SendQueue.clear();
+}
+
+void Shard::CheckOutputLatency()
+{
+	if( m_SendQueue.empty() )
+		return;
+
+	if( Clock::ReadMicroseconds() - m_iSendQueuedAt < m_pServer->GetOutputLatency() )
+		return;
+
+	// this update's running long; don't keep everyone waiting on it
+	FlushOutput();
+
+	if( m_pRing )
+		m_pRing->Submit();
+}
+
+void Shard::SendToUser( uint64_t iUserID, std::string_view sData, bool bLossy )
+{
+	ShardMessage *msg = new ShardMessage( SHARD_SEND_USER );
+	msg->iUserID = iUserID;
+	msg->pData = make_shared<const string>( sData );
+	msg->bLossy = bLossy;
+	Post( msg );
+}
+
+void Shard::KillUser( uint64_t iUserID )
+{
+	ShardMessage *msg = new ShardMessage( SHARD_KILL_USER );
+	msg->iUserID = iUserID;
+	Post( msg );
+}
+
+void Shard::MuteUser( uint64_t iUserID, bool bMuted )
+{
+	ShardMessage *msg = new ShardMessage( bMuted ? SHARD_MUTE_USER : SHARD_UNMUTE_USER );
+	msg->iUserID = iUserID;
+	Post( msg );
+}
+
+void Shard::MoveUser( uint64_t iUserID, uint64_t iRoomID, const string &sRoom )
+{
+	ShardMessage *msg = new ShardMessage( SHARD_MOVE_USER );
+	msg->iUserID = iUserID;
+	msg->iRoomID = iRoomID;
+	msg->sRoom = sRoom;
+	Post( msg );
+}
+
+void Shard::Broadcast( ShardMessageType type, const PacketView &packet,
+	uint64_t iRoomID )
+{
+	if( s_pShards == NULL )
+		return;
+
+	// every encoding's serialized once, here, however many users get it.
+	// Without threads, they've all got it before we return, so it can go
+	// on this update's Arena.
+	if( !s_bThreaded )
+	{
+		const EncodedPacket encoded( packet, Arena::GetTick() );
+
+		// points at encoded without owning it (or allocating anything)
+		SendEncoded( type, shared_ptr<const EncodedPacket>(shared_ptr<void>(), &encoded), iRoomID );
+		return;
+	}
+
+	// with them, the other Shards share it until the last one's done.
+	// Off a Shard's thread, that's counted by a shared_ptr.
+	if( s_pCurrent == NULL )
+	{
+		SendEncoded( type, make_shared<const EncodedPacket>(packet), iRoomID );
+		return;
+	}
+
+	// on one, the packet goes in our SharedArena, along with the message
+	// to each other Shard: one allocation, which each of them releases
+	// once they've delivered it.
+	const unsigned iRemote = s_pShards->size() - 1;
+	const size_t iMessages = iRemote * sizeof(ShardMessage);
+
+	SharedArena::Block *pBlock;
+	char *p = (char*)s_pCurrent->m_Broadcasts.Alloc( iMessages + sizeof(EncodedPacket) +
+		EncodedPacket::GetSize(packet), iRemote, &pBlock );
+
+	const EncodedPacket *pEncoded = new( p + iMessages )
+		EncodedPacket( packet, p + iMessages + sizeof(EncodedPacket) );
+
+	SendEncoded( type, shared_ptr<const EncodedPacket>(shared_ptr<void>(), pEncoded), iRoomID,
+		p, pBlock );
+}
+
+void Shard::SendEncoded( ShardMessageType type, const shared_ptr<const EncodedPacket> &pPacket,
+	uint64_t iRoomID, char *pMessages, SharedArena::Block *pBlock )
+{
+	for( unsigned i = 0; i < s_pShards->size(); ++i )
+	{
+		Shard *pShard = (*s_pShards)[i];
+
+		// our own users can have it now
+		if( pShard->IsLocal() )
+		{
+			ShardMessage msg( type );
+			msg.iRoomID = iRoomID;
+			msg.bLossy = pPacket->bLossy;
+			msg.pPacket = pPacket;
+
+			pShard->Deliver( &msg );
+			continue;
+		}
+
+		ShardMessage *msg;
+
+		if( pBlock != NULL )
+		{
+			msg = new( pMessages ) ShardMessage( type );
+			msg->pBlock = pBlock;
+			pMessages += sizeof(ShardMessage);
+		}
+		else
+		{
+			msg = new ShardMessage( type );
+		}
+
+		msg->iRoomID = iRoomID;
+		msg->bLossy = pPacket->bLossy;
+		msg->pPacket = pPacket;
+		msg->iCode = PacketStats::GetCurrentCode();
+
+		pShard->Post( msg );
+	}
+}
+
+void Shard::CloseRoom( uint64_t iRoomID )
+{
+	if( s_pShards == NULL )
+		return;
+
+	for( unsigned i = 0; i < s_pShards->size(); ++i )
+	{
+		Shard *pShard = (*s_pShards)[i];
+
+		if( pShard->IsLocal() )
+		{
+			pShard->EmptyRoom( iRoomID );
+			continue;
+		}
+
+		ShardMessage *msg = new ShardMessage( SHARD_CLOSE_ROOM );
+		msg->iRoomID = iRoomID;
+		pShard->Post( msg );
+	}
+}
+
+void Shard::UpdateRoom( User *user )
+{
+	const uint64_t iRoomID = user->GetRoomID();
+	map<User*,uint64_t>::iterator it = m_UserRooms.find( user );
+
+	if( it != m_UserRooms.end() )
+	{
+		if( it->second == iRoomID )
+			return;
+
+		// drop empty rooms' entries, or removed rooms would pile up
+		set<User*> &members = m_RoomUsers[it->second];
+		members.erase( user );
+
+		if( members.empty() )
+			m_RoomUsers.erase( it->second );
+
+		m_UserRooms.erase( it );
+	}
+
+	if( iRoomID == 0 )
+		return;
+
+	m_RoomUsers[iRoomID].insert( user );
+	m_UserRooms[user] = iRoomID;
+}
+
+void Shard::EmptyRoom( uint64_t iRoomID )
+{
+	map<uint64_t, set<User*> >::iterator it = m_RoomUsers.find( iRoomID );
+
+	if( it == m_RoomUsers.end() )
+		return;
+
+	// moving them takes them out of the set, so go by a copy
+	const vector<User*> vUsers( it->second.begin(), it->second.end() );
+	const Room *pDefault = m_pServer->GetRoomList()->GetDefaultRoom();
+
+	for( unsigned i = 0; i < vUsers.size(); ++i )
+	{
+		User *user = vUsers[i];
+		m_pServer->EnterRoom( user, pDefault );
+
+		// the room they've landed in hears about it
+		ChatPacket msg( JOIN_ROOM, user->GetName(), pDefault->GetName() );
+		m_pServer->BroadcastRoom( pDefault->GetID(), msg );
+	}
+}
+
+void Shard::Deliver( const ShardMessage *msg )
+{
+	// messages for one user in particular
+	if( msg->type == SHARD_SEND_USER || msg->type == SHARD_KILL_USER ||
+		msg->type == SHARD_MUTE_USER || msg->type == SHARD_UNMUTE_USER ||
+		msg->type == SHARD_MOVE_USER )
+	{
+		map<uint64_t,User*>::iterator it = m_UserIDs.find( msg->iUserID );
+
+		// they left before this got here
+		if( it == m_UserIDs.end() )
+			return;
+
+		User *user = it->second;
+
+		switch( msg->type )
+		{
+		case SHARD_SEND_USER:
+			user->Write( *msg->pData, msg->bLossy );
+			break;
+		case SHARD_KILL_USER:
+			user->Kill();
+			break;
+		case SHARD_MUTE_USER:
+		case SHARD_UNMUTE_USER:
+			m_pServer->SetMuted( user, msg->type == SHARD_MUTE_USER );
+			break;
+		case SHARD_MOVE_USER:
+		{
+			// the room may have been removed since this was sent. If
+			// it has, its SHARD_CLOSE_ROOM may have beaten us here, so
+			// they'd be stuck in it: leave them where they are.
+			const Room *room = m_pServer->GetRoomList()->GetRoom( msg->sRoom );
+
+			if( room != NULL && room->GetID() == msg->iRoomID && user->IsLoggedIn() )
+				m_pServer->MoveUser( user, room );
+			break;
+		}
+		default:
+			break;
+		}
+
+		if( user->IsDead() )
+			m_DeadUsers.insert( user );
+
+		return;
+	}
+
+	if( msg->type == SHARD_CLOSE_ROOM )
+	{
+		EmptyRoom( msg->iRoomID );
+		return;
+	}
+
+	// only the room's members, not everyone we've got
+	if( msg->type == SHARD_SEND_ROOM )
+	{
+		map<uint64_t, set<User*> >::iterator it = m_RoomUsers.find( msg->iRoomID );
+
+		// none of ours are in it (or it's gone)
+		if( it == m_RoomUsers.end() )
+			return;
+
+		const set<User*> &members = it->second;
+
+		for( set<User*>::const_iterator mit = members.begin(); mit != members.end(); ++mit )
+		{
+			User *user = (*mit);
+
+			if( !user->IsLoggedIn() )
+				continue;
+
+			user->Write( msg->pPacket->Get(user->GetEncoding()), msg->bLossy );
+
+			if( user->IsDead() )
+				m_DeadUsers.insert( user );
+		}
+
+		return;
+	}
+
+	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+	{
+		User *user = (*it);
+
+		switch( msg->type )
+		{
+		case SHARD_SEND_ALL:
+			if( !user->IsLoggedIn() )
+				continue;
+			break;
+		case SHARD_SEND_MODS:
+			if( !user->IsMod() )
+				continue;
+			break;
+		default:
+			continue;
+		}
+
+		user->Write( msg->pPacket->Get(user->GetEncoding()), msg->bLossy );
+
+		if( user->IsDead() )
+			m_DeadUsers.insert( user );
+	}
+}
+
+void Shard::HandleMessages()
+{
+	QueueNode *pNode;
+
+	while( (pNode = m_Queue.Pop()) != NULL )
+	{
+		ShardMessage *msg = static_cast<ShardMessage*>( pNode );
+
+		// (this locks the state for itself)
+		if( msg->type == SHARD_ADD_USER )
+		{
+			CreateUser( msg->iSocket, msg->Address );
+			FreeMessage( msg );
+			continue;
+		}
+
+		// no lock for the rest (see Shard.h), except to look at the
+		// RoomList when moving someone.
+		const bool bRooms = (msg->type == SHARD_MOVE_USER || msg->type == SHARD_CLOSE_ROOM);
+		const uint64_t iWritten = User::GetBytesWritten();
+
+		if( bRooms )
+			m_pServer->m_StateLock.LockRead();
+
+		Deliver( msg );
+
+		if( bRooms )
+			m_pServer->m_StateLock.Unlock();
+
+		if( msg->iCode != PacketStats::NO_CODE )
+			m_Stats.AddBytesOut( msg->iCode, User::GetBytesWritten() - iWritten );
+
+		FreeMessage( msg );
+
+		CheckOutputLatency();
+	}
+}
+
+User* Shard::CreateUser( int iSocket, const NetAddress &addr )
+{
+	User *pUser = new User( iSocket, addr );
+	pUser->SetShard( this );
+
+	m_Users.push_back( pUser );
+	m_UserIDs[pUser->GetID()] = pUser;
+
+	// wake up whenever this user has something for us
+	if( m_pRing )
+		pUser->SetRing( m_pRing );
+	else
+		pUser->SetPoller( &m_Poller );
+
+	m_Timers.Schedule( pUser->GetIdleTimer(), pUser->GetNextIdleCheck() );
+
+	m_pServer->m_StateLock.LockWrite();
+	m_pServer->AddUser( pUser );
+	m_pServer->m_StateLock.Unlock();
+
+	// (the Ring may not have had room to start reading from them)
+	if( pUser->IsDead() )
+		m_DeadUsers.insert( pUser );
+
+	return pUser;
+}
+
+void Shard::DestroyUser( User *user )
+{
+	// take this user out of our lists first, so they don't get
+	// any of the broadcasts RemoveUser makes on their behalf.
+	m_Users.remove( user );
+	m_UserIDs.erase( user->GetID() );
+	m_PendingLogins.remove( user );
+	m_DelayedUsers.erase( user );
+	user->GetIdleTimer()->Cancel();
+
+	m_pServer->RemoveUser( user );
+
+	// the Ring's still using this user; delete it once it's done.
+	if( user->HasRingRequests() )
+		m_Zombies[user->GetID()] = user;
+	else
+		delete user;
+}
+
+void Shard::RemoveAllUsers()
+{
+	while( !m_Users.empty() )
+		DestroyUser( m_Users.front() );
+
+	m_PendingLogins.clear();
+	m_DeadUsers.clear();
+}
+
+void Shard::Quiesce()
+{
+	SetListener( NULL );
+
+	// take any sockets that are on their way to us, and let the logins
+	// being checked finish: there's no sending those over.
+	HandleMessages();
+
+	Clock::Tick();
+	const uint64_t iLoginDeadline = Clock::GetMilliseconds() + QUIESCE_LOGIN_MS;
+
+	// (Update() ticks the Clock)
+	while( !m_PendingLogins.empty() && Clock::GetMilliseconds() < iLoginDeadline )
+		Update( LOGIN_POLL_MS );
+
+	if( !m_PendingLogins.empty() )
+		LOG->System( "Shard %u: %u login(s) still unchecked; they'll be dropped.",
+			m_iIndex, (unsigned)m_PendingLogins.size() );
+
+	// stop reading. The Ring has to give back the receives it's got out,
+	// and whatever they'd already read is handled like anything else.
+	// (Nobody's reaped until the end, so these pointers stay good.)
+	vector<User*> vUncancelled;
+
+	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+	{
+		User *user = *it;
+
+		if( m_pRing == NULL )
+		{
+			user->SetPoller( NULL );
+			continue;
+		}
+
+		// (no Ring means sends go out right away, too)
+		user->SetRing( NULL );
+
+		if( user->HasRingRequests() && !m_pRing->Cancel(user->GetRecvTag(), RING_TAG_CANCEL) )
+			vUncancelled.push_back( user );
+	}
+
+	if( m_pRing )
+	{
+		for( unsigned i = 0; i < QUIESCE_RING_MS / 100; ++i )
+		{
+			// the Ring was too full for these; it's had a chance to empty
+			vector<User*> vRetry;
+			vRetry.swap( vUncancelled );
+
+			for( unsigned j = 0; j < vRetry.size(); ++j )
+				if( vRetry[j]->HasRingRequests() && !m_pRing->Cancel(vRetry[j]->GetRecvTag(), RING_TAG_CANCEL) )
+					vUncancelled.push_back( vRetry[j] );
+
+			bool bPending = false;
+
+			for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+				bPending |= (*it)->HasRingRequests();
+
+			if( !bPending && m_Zombies.empty() )
+				break;
+
+			m_pRing->Wait( 100 );
+			HandleRingEvents();
+			ReapZombies( false );
+		}
+	}
+
+	HandleMessages();
+	FlushOutput();
+
+	// compressed output for users whose sockets were full hasn't been
+	// through the Deflater yet; the stream's history has to include it
+	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+		(*it)->Flush();
+
+	ReapUsers();
+}
+
+void Shard::Resume( SocketListener *pListener )
+{
+	for( list<User*>::iterator it = m_Users.begin(); it != m_Users.end(); ++it )
+	{
+		// anyone with a login out is still waiting on it, not the socket
+		if( m_pRing )
+			(*it)->SetRing( m_pRing );
+		else if( (*it)->GetLoginState() != LOGIN_CHECKING )
+			(*it)->SetPoller( &m_Poller );
+
+		if( (*it)->IsDead() )
+			m_DeadUsers.insert( *it );
+	}
+
+	SetListener( pListener );
+}
+
+User* Shard::RestoreUser( const UserHandoff &state )
+{
+	NetAddress addr;
+	addr.SetString( state.sAddress.c_str() );
+
+	User *user = CreateUser( state.iSocket, addr );
+	user->LoadHandoff( state );
+
+	// they may have been idle for a while already
+	user->GetIdleTimer()->Cancel();
+	m_Timers.Schedule( user->GetIdleTimer(), user->GetNextIdleCheck() );
+
+	return user;
+}
+
+void Shard::HandleRestoredInput()
+{
+	// HandleFrames can kill anyone, so go by a copy of the list
+	const vector<User*> vUsers( m_Users.begin(), m_Users.end() );
+
+	for( unsigned i = 0; i < vUsers.size(); ++i )
+	{
+		User *user = vUsers[i];
+
+		if( !user->IsDead() )
+			HandleFrames( user );
+
+		if( user->IsDead() )
+		{
+			m_DeadUsers.insert( user );
+			continue;
+		}
+
+		// same as in HandleUserEvent: a login stops the reading
+		if( user->GetLoginState() == LOGIN_CHECKING )
+		{
+			if( m_pRing == NULL )
+				user->SetPoller( NULL );
+
+			m_PendingLogins.push_back( user );
+		}
+	}
+
+	ReapUsers();
+}
+
+void Shard::Update( int iTimeoutMS )
+{
+	// sleep until something happens on the network, a message comes in,
+	// or it's time to see how the logins we've sent off are doing.
+	// (delayed packets get the same treatment, or they'd wait too long.)
+	int iTimeout = m_PendingLogins.empty() && m_DelayedUsers.empty() ? iTimeoutMS : LOGIN_POLL_MS;
+
+	// anyone who posts after this will wake us up, and anything posted
+	// before it will be seen here, so we can't sleep through a message.
+	m_bSleeping.store( true );
+
+	// everything written last time goes out now: one writev per user
+	// (or, with a Ring, one batch submitted along with the wait below).
+	FlushOutput();
+
+	// if that killed anyone, get them reaped
+	if( !m_Queue.IsEmpty() || !m_DeadUsers.empty() )
+		iTimeout = 0;
+
+	// the Ring was too full to take the poll on our Poller last time.
+	// Until it does, we have to go and look at the Poller ourselves.
+	if( m_pRing && !m_bPollArmed )
+	{
+		m_bPollArmed = m_pRing->Poll( m_Poller.GetFD(), RING_TAG_POLLER );
+
+		if( !m_bPollArmed && (iTimeout < 0 || iTimeout > LOGIN_POLL_MS) )
+			iTimeout = LOGIN_POLL_MS;
+	}
+
+	int iEvents;
+
+	if( m_pRing )
+		iEvents = m_pRing->Wait( iTimeout );
+	else
+		iEvents = m_Poller.Wait( iTimeout );
+
+	m_bSleeping.store( false );
+
+	// everything in this update happens at the same time, as far as
+	// anyone reading the Clock's concerned
+	Clock::Tick();
+
+	const uint64_t iStart = Clock::ReadMicroseconds();
+
+	if( m_pRing )
+	{
+		HandleRingEvents();
+
+		if( !m_bPollArmed )
+			HandlePollerEvents( m_Poller.Wait(0) );
+	}
+	else
+	{
+		HandlePollerEvents( iEvents );
+	}
+
+	HandleMessages();
+
+	UpdatePendingLogins();
+
+	UpdateDelayedUsers();
+
+	UpdateTimers( Clock::GetSeconds() );
+
+	// remove everyone who died this time around
+	ReapUsers();
+
+	if( !m_Zombies.empty() )
+		ReapZombies( false );
+
+	// nothing from this update's Arena is needed any more
+	Arena::GetTick()->Reset();
+
+	// run some basic lag-detection logic
+	{
+		unsigned iDiff = unsigned( Clock::ReadMicroseconds() - iStart );
+
+		if( iDiff >= m_pServer->GetLagSpikeTime() )
+			LOG->Debug( "[Shard %u update took %u usecs to execute.]\n", m_iIndex, iDiff );
+	}
+}
+
+void Shard::HandlePollerEvents( int iEvents )
+{
+	for( int i = 0; i < iEvents; ++i )
+	{
+		void *pData = m_Poller.GetData( i );
+
+		// messages are handled below; just clear the wakeup.
+		if( pData == this )
+		{
+			uint64_t iCount;
+			read( m_iWakeFD, &iCount, sizeof(iCount) );
+			continue;
+		}
+
+		// see if the SocketListener has any new connections and add them.
+		// take all of them: after a restart, everyone's waiting at once.
+		if( pData == m_pListener )
+		{
+			int iSocket;
+			NetAddress addr;
+
+			while( (iSocket = m_pListener->GetConnection(addr)) >= 0 )
+				m_pServer->AddConnection( iSocket, addr, this );
+
+			continue;
+		}
+
+		HandleUserEvent( (User*)pData, m_Poller.GetEvents(i) );
+		CheckOutputLatency();
+	}
+}
+
+void Shard::HandleRingEvents()
+{
+	RingCompletion c;
+
+	while( m_pRing->GetCompletion(c) )
+	{
+		if( c.iTag == RING_TAG_POLLER )
+		{
+			// the listener or wakeup has something; the Poller knows what
+			HandlePollerEvents( m_Poller.Wait(0) );
+
+			if( !c.bMore )
+				m_bPollArmed = m_pRing->Poll( m_Poller.GetFD(), RING_TAG_POLLER );
+
+			continue;
+		}
+
+		// the receive it cancelled completes on its own
+		if( c.iTag == RING_TAG_CANCEL )
+			continue;
+
+		const uint64_t iUserID = c.iTag >> 2;
+
+		if( (c.iTag & 3) == User::RING_TAG_RECV )
+			HandleRecv( iUserID, c );
+		else
+			HandleSend( iUserID, c );
+
+		CheckOutputLatency();
+	}
+}
+
+void Shard::HandleRecv( uint64_t iUserID, const RingCompletion &c )
+{
+	map<uint64_t,User*>::iterator it = m_UserIDs.find( iUserID );
+	User *user = NULL;
+
+	if( it != m_UserIDs.end() )
+		user = it->second;
+	else if( (it = m_Zombies.find(iUserID)) != m_Zombies.end() )
+		user = it->second;
+
+	// a buffer's only lent to us: copy out what we need, then give it back
+	if( user && !m_Zombies.count(iUserID) && c.iResult > 0 && c.iBufferID >= 0 )
+		user->AppendInput( m_pRing->GetBuffer(c.iBufferID), c.iResult );
+
+	if( c.iBufferID >= 0 )
+		m_pRing->ReturnBuffer( c.iBufferID );
+
+	if( user == NULL )
+		return;
+
+	if( c.iResult == 0 )
+	{
+		// a clean hangup; don't make a fuss over it
+		user->Kill();
+	}
+	else if( c.iResult == -EINVAL && m_pRing->IsMultishot() )
+	{
+		LOG->System( "Shard %u: multishot receives aren't supported; using single-shot.", m_iIndex );
+		m_pRing->DisableMultishot();
+	}
+	else if( c.iResult < 0 && c.iResult != -ENOBUFS && c.iResult != -ECANCELED )
+	{
+		// (ENOBUFS means the buffers ran out for a moment; just try again.
+		// ECANCELED means we asked for it: see Quiesce.)
+		LOG->System( "Read failed for %s (%s): killing.", user->GetName().c_str(), strerror(-c.iResult) );
+		user->Kill();
+	}
+
+	user->RecvFinished( c.bMore );
+
+	// zombies only need to finish their requests
+	if( m_Zombies.count(iUserID) )
+		return;
+
+	if( c.iResult > 0 && user->GetLoginState() != LOGIN_CHECKING )
+	{
+		HandleFrames( user );
+
+		// that was a login; the rest waits until it's been checked
+		if( user->GetLoginState() == LOGIN_CHECKING )
+			m_PendingLogins.push_back( user );
+	}
+
+	if( user->IsDead() )
+		m_DeadUsers.insert( user );
+}
+
+void Shard::HandleSend( uint64_t iUserID, const RingCompletion &c )
+{
+	map<uint64_t,User*>::iterator it = m_UserIDs.find( iUserID );
+
+	if( it == m_UserIDs.end() )
+	{
+		if( (it = m_Zombies.find(iUserID)) != m_Zombies.end() )
+			it->second->SendFinished( c.iResult );
+
+		return;
+	}
+
+	User *user = it->second;
+	user->SendFinished( c.iResult );
+
+	if( user->IsDead() )
+		m_DeadUsers.insert( user );
+}
+
+void Shard::ReapZombies( bool bWait )
+{
+	// when shutting down, give the kernel a moment to finish up
+	for( int i = 0; bWait && i < 10 && !m_Zombies.empty(); ++i )
+	{
+		m_pRing->Wait( 100 );
+
+		RingCompletion c;
+
+		while( m_pRing->GetCompletion(c) )
+		{
+			if( c.iBufferID >= 0 )
+				m_pRing->ReturnBuffer( c.iBufferID );
+
+			map<uint64_t,User*>::iterator it = m_Zombies.find( c.iTag >> 2 );
+
+			if( c.iTag == RING_TAG_POLLER || it == m_Zombies.end() )
+				continue;
+
+			if( (c.iTag & 3) == User::RING_TAG_RECV )
+				it->second->RecvFinished( c.bMore );
+			else
+				it->second->SendFinished( c.iResult );
+		}
+
+		ReapZombies( false );
+	}
+
+	map<uint64_t,User*>::iterator it = m_Zombies.begin();
+
+	while( it != m_Zombies.end() )
+	{
+		if( it->second->HasRingRequests() )
+		{
+			++it;
+			continue;
+		}
+
+		delete it->second;
+		m_Zombies.erase( it++ );
+	}
+}
+
+void Shard::HandleUserEvent( User *user, uint32_t iEvents )
+{
+	// the socket has room again: send what's been waiting on it
+	if( iEvents & EPOLLOUT )
+		user->Flush();
+
+	// a hangup or error still needs a read; that's how we find out about it.
+	if( iEvents & (EPOLLIN|EPOLLHUP|EPOLLERR) )
+		UpdateUser( user );
+
+	if( user->IsDead() )
+	{
+		m_DeadUsers.insert( user );
+		return;
+	}
+
+	// the user just sent a login. we're not expecting any data from them
+	// until it's been checked, so stop listening until then.
+	if( user->GetLoginState() == LOGIN_CHECKING )
+	{
+		user->SetPoller( NULL );
+		m_PendingLogins.push_back( user );
+	}
+}
+
+void Shard::UpdateUser( User *user )
+{
+	// read until the socket runs dry, handling each packet as it completes.
+	// a packet split across reads just waits in the buffer for the rest.
+	while( user->ReadInput() > 0 )
+	{
+		HandleFrames( user );
+
+		// we're not expecting any more data while a login is checked.
+		if( user->IsDead() || user->GetLoginState() == LOGIN_CHECKING )
+			break;
+	}
+}
+
+void Shard::HandleFrames( User *user )
+{
+	const char *pFrame;
+	unsigned iLen;
+	const TextScan *pScan;
+
+	// (each packet's handler locks whatever it needs; see Shard.h)
+	while( user->GetLoginState() != LOGIN_CHECKING && user->GetFrame(pFrame, iLen, pScan) )
+		m_pServer->HandleUserPacket( user, std::string_view(pFrame, iLen), false, pScan );
+}
+
+void Shard::UpdatePendingLogins()
+{
+	list<User*>::iterator it = m_PendingLogins.begin();
+
+	while( it != m_PendingLogins.end() )
+	{
+		User *user = (*it);
+
+		// still waiting on the database
+		if( user->GetLoginState() == LOGIN_CHECKING )
+		{
+			++it;
+			continue;
+		}
+
+		it = m_PendingLogins.erase( it );
+
+		// if this user was killed while we were waiting, don't bother.
+		if( !user->IsDead() )
+		{
+			m_pServer->m_StateLock.LockWrite();
+			m_pServer->HandleLoginState( user );
+			m_pServer->m_StateLock.Unlock();
+		}
+
+		if( user->IsDead() )
+		{
+			m_DeadUsers.insert( user );
+			continue;
+		}
+
+		// the user's logged in: handle whatever they sent behind the
+		// login, and (with epoll) start listening to them again.
+		HandleFrames( user );
+
+		if( user->IsDead() )
+		{
+			m_DeadUsers.insert( user );
+			continue;
+		}
+
+		if( m_pRing == NULL )
+			user->SetPoller( &m_Poller );
+
+		CheckOutputLatency();
+	}
+}
+
+void Shard::UpdateDelayedUsers()
+{
+	if( m_DelayedUsers.empty() )
+		return;
+
+	set<User*>::iterator it = m_DelayedUsers.begin();
+
+	while( it != m_DelayedUsers.end() )
+	{
+		User *user = (*it);
+
+		if( !user->IsDead() )
+			m_pServer->HandleDelayedPackets( user );
+
+		if( user->IsDead() )
+			m_DeadUsers.insert( user );
+
+		// keep them around until everything they sent is handled
+		if( user->IsDead() || user->GetFloodState().vDelayed.empty() )
+			m_DelayedUsers.erase( it++ );
+		else
+			++it;
+	}
+
+	CheckOutputLatency();
+}
+
+void Shard::UpdateTimers( uint64_t iNow )
+{
+	m_DueTimers.clear();
+	m_Timers.Advance( iNow, m_DueTimers );
+
+	if( m_DueTimers.empty() )
+		return;
+
+	// (idle checks only touch our users, and broadcast; no lock)
+	for( unsigned i = 0; i < m_DueTimers.size(); ++i )
+	{
+		User *user = (User*)m_DueTimers[i]->pData;
+
+		// users can't be idle unless they're logged in...
+		if( user->IsLoggedIn() )
+			m_pServer->CheckIdleStatus( user );
+
+		if( user->IsDead() )
+		{
+			m_DeadUsers.insert( user );
+			continue;
+		}
+
+		m_Timers.Schedule( user->GetIdleTimer(), user->GetNextIdleCheck() );
+	}
+}
+
+void Shard::ReapUsers()
+{
+	if( m_DeadUsers.empty() )
+		return;
+
+	m_pServer->m_StateLock.LockWrite();
+
+	// RemoveUser's broadcasts can kill more of our users (e.g. slow
+	// ones), so keep going until there's nobody left to remove.
+	while( !m_DeadUsers.empty() )
+	{
+		User *user = *m_DeadUsers.begin();
+		m_DeadUsers.erase( m_DeadUsers.begin() );
+
+		DestroyUser( user );
+	}
+
+	m_pServer->m_StateLock.Unlock();
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
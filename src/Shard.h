@@ -0,0 +1,397 @@
+/* Shard: one event loop's worth of users. The server runs one Shard per
+ * reactor thread, and each connection belongs to exactly one Shard for its
+ * whole life. Only the owning thread reads from a user's socket, writes to
+ * it, or touches its input/output buffers, so none of that needs a lock.
+ *
+ * A user's chat state (room, away, idle, muted, prefs, ...) is theirs too:
+ * only their Shard's thread changes it. A handler on another Shard that
+ * wants to change it - a mod muting them, or forcing them into a room -
+ * posts the change to the owner's MessageQueue, and the owner makes it on
+ * its next pass (and tells everyone, as if it had happened here). Writing
+ * to or killing someone else's user works the same way. So does removing
+ * a room: every Shard gets a message to move its own users out of it.
+ *
+ * That leaves the server-wide directory - the user list and index by name,
+ * the RoomList, and the ban and mute lists - guarded by ChatServer's state
+ * lock, and the presence table and cached lists, guarded by its list lock
+ * (taken after the state lock, if both are wanted). Each packet handler
+ * takes only what it needs (see the table in PacketHandler.cpp):
+ *
+ *  - nothing, for what only touches the sender and broadcasts (chat,
+ *    actions, going away, mod chat). These are most packets, and Shards
+ *    handle them in parallel, as they do idle checks.
+ *  - the state lock for reading, to look up another user or a room (PMs,
+ *    typing, joining a room). Readers don't hold each other up either.
+ *  - the state lock for writing, to change the directory: logging in and
+ *    out, adding and removing users and rooms, and bans and mutes.
+ *  - the list lock, to read the presence table (USER_LIST).
+ *
+ * A user found by name stays valid as long as the state lock's held, since
+ * taking them out of the directory needs it for writing. Their name and
+ * encoding only change with it held for writing, too, so anyone holding it
+ * can read those; anything else about them is their Shard's business.
+ *
+ * Delivering a broadcast takes no lock at all. It only needs to know which
+ * of our users are in the room, logged in, or mods, and all three only
+ * change on our thread (or while the other threads are stopped, for a
+ * config reload). The packet's serialized once per encoding, our own users
+ * get it right away, and every other Shard gets one message pointing at
+ * the shared data. The data and the messages come from one allocation in
+ * the sender's SharedArena, and nothing's freed: each Shard releases its
+ * message when it's delivered it, and the block's reused after the last.
+ *
+ * Messages between any two Shards arrive in the order they were sent, but
+ * there's no global order: two users on different Shards may see broadcasts
+ * from two other Shards in different orders. Room and mod filters are
+ * applied when a Shard delivers the message, not when it was sent.
+ *
+ * For room broadcasts, each Shard keeps its own list of its users in each
+ * room, so sending to a room only visits that room's members. That's the
+ * only record of who's in a room; only the Shard's thread touches it.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "network/NetAddress.h"
+#include "packet/ChatPacket.h"
+#include "packet/PacketStats.h"
+#include "network/Poller.h"
+#include "util/MessageQueue.h"
+#include "util/SharedArena.h"
+#include "util/Thread.h"
+#include "util/TimerWheel.h"
+
+class ChatServer;
+class Ring;
+class SocketListener;
+class User;
+struct UserHandoff;
+
+enum ShardMessageType
+{
+	SHARD_ADD_USER,		/* take ownership of a newly accepted socket */
+	SHARD_SEND_ALL,		/* send to every logged in user */
+	SHARD_SEND_ROOM,	/* send to every logged in user in iRoomID */
+	SHARD_SEND_MODS,	/* send to every moderator */
+	SHARD_SEND_USER,	/* send to the user with the given ID */
+	SHARD_KILL_USER,	/* disconnect the user with the given ID */
+	SHARD_MUTE_USER,	/* mute the user with the given ID */
+	SHARD_UNMUTE_USER,	/* ...or unmute them */
+	SHARD_MOVE_USER,	/* move the user with the given ID to iRoomID */
+	SHARD_CLOSE_ROOM	/* iRoomID's gone: move its users to the default room */
+};
+
+struct ShardMessage : public QueueNode
+{
+	ShardMessage( ShardMessageType type_ ) : type(type_), iSocket(-1),
+		iUserID(0), iRoomID(0), bLossy(false), iCode(PacketStats::NO_CODE),
+		pBlock(NULL) { }
+
+	ShardMessageType type;
+
+	int iSocket;
+	NetAddress Address;
+	uint64_t iUserID;
+	uint64_t iRoomID;
+
+	/* iRoomID's name (SHARD_MOVE_USER), to check it's still there */
+	std::string sRoom;
+
+	/* serialized data for one user (SHARD_SEND_USER) */
+	std::shared_ptr<const std::string> pData;
+
+	/* a broadcast packet in every encoding a user might want, shared by
+	 * every Shard it was sent to */
+	std::shared_ptr<const EncodedPacket> pPacket;
+
+	bool bLossy;
+
+	/* for a broadcast, the code of the packet being handled when it was
+	 * sent (if any), so what it costs to deliver is counted towards it */
+	int iCode;
+
+	/* if set, this message (and its packet) are in the sending Shard's
+	 * SharedArena, and are released there rather than deleted */
+	SharedArena::Block *pBlock;
+};
+
+class Shard
+{
+public:
+	/* with bUseRing, socket I/O goes through an io_uring Ring instead of
+	 * epoll (falling back to epoll if the kernel can't do it). */
+	Shard( ChatServer *pServer, unsigned iIndex, bool bUseRing );
+	~Shard();
+
+	unsigned GetIndex() const	{ return m_iIndex; }
+
+	/* what the packets handled here have cost. Only our thread writes
+	 * to it, but anyone can read it. */
+	PacketStats* GetStats()		{ return &m_Stats; }
+	const PacketStats* GetStats() const	{ return &m_Stats; }
+
+	/* runs Update() in a new thread until the server stops */
+	void StartThread();
+
+	/* waits for the thread started by StartThread() to finish */
+	void StopThread();
+
+	/* marks the calling thread as the one that runs this Shard */
+	void MakeCurrent()		{ s_pCurrent = this; }
+
+	/* true if the calling thread may touch this Shard's users directly.
+	 * That's always true while the server isn't threaded. */
+	bool IsLocal() const		{ return !s_bThreaded || s_pCurrent == this; }
+
+	/* accepts connections from pListener whenever it has some */
+	void SetListener( SocketListener *pListener );
+
+	/* gives this Shard a new socket, connected from addr, to serve.
+	 * Safe from any thread. */
+	void AddUser( int iSocket, const NetAddress &addr );
+
+	/* adds user to the list of users with output to send. It all goes
+	 * out at the end of this update, or sooner if the update runs past
+	 * the server's output latency budget. Only for users owned by this
+	 * Shard, and only once until their output's been sent. */
+	void QueueSend( User *user );
+
+	/* remembers that user has packets delayed by flood control, so they
+	 * get handled once the user's allowed to send them. Only for users
+	 * owned by this Shard. */
+	void AddDelayedUser( User *user )	{ m_DelayedUsers.insert( user ); }
+
+	/* sends sData to (or kills, mutes or unmutes) the user with the
+	 * given ID. Safe from any thread; only for users owned by another
+	 * Shard. */
+	void SendToUser( uint64_t iUserID, std::string_view sData, bool bLossy );
+	void KillUser( uint64_t iUserID );
+	void MuteUser( uint64_t iUserID, bool bMuted );
+
+	/* moves the user with the given ID to the room with this ID and
+	 * name (see ChatServer::MoveUser), unless it's been removed by the
+	 * time we get to it. Safe from any thread; only for users owned by
+	 * another Shard. */
+	void MoveUser( uint64_t iUserID, uint64_t iRoomID, const std::string &sRoom );
+
+	/* puts user, one of ours, on our list of the members of whichever
+	 * room they're in now (see User::GetRoomID()), or takes them off if
+	 * they're in none. Only on our thread. */
+	void UpdateRoom( User *user );
+
+	/* waits up to iTimeoutMS for network activity or messages, then
+	 * handles everything that happened. Only called by the owning thread. */
+	void Update( int iTimeoutMS );
+
+	/* removes every user on this Shard. Only used once threads are down. */
+	void RemoveAllUsers();
+
+	/* throws away everything still in our queue, closing the sockets
+	 * we'd been handed. What's in it may be in another Shard's
+	 * SharedArena, so every Shard does this before any is deleted. */
+	void DropMessages();
+
+	/* for handing our users to a new process (see Handoff.h): stops
+	 * accepting and reading, finishes the logins being checked, and
+	 * sends what output the sockets will take. Users are left with no
+	 * I/O in flight, so their state can be written down as it is.
+	 * Resume() undoes this, if the handoff fails. Only used once
+	 * threads are down. */
+	void Quiesce();
+	void Resume( SocketListener *pListener );
+
+	/* creates a user from what another process wrote down about it.
+	 * Once they're all in their rooms, HandleRestoredInput() handles what
+	 * they'd sent that the other process hadn't. Not thread-safe. */
+	User* RestoreUser( const UserHandoff &state );
+	void HandleRestoredInput();
+
+	/* sends packet to every logged in user on every Shard that passes the
+	 * type's filter, each in their own encoding. Needs no lock. */
+	static void Broadcast( ShardMessageType type, const PacketView &packet,
+		uint64_t iRoomID = 0 );
+
+	/* has every Shard move its users in the room with this ID (which
+	 * has just been removed) to the default room. Our own users are
+	 * moved right away. Needs the state lock held for writing. */
+	static void CloseRoom( uint64_t iRoomID );
+
+	/* registers the set of Shards that Broadcast() sends to */
+	static void SetShards( const std::vector<Shard*> *pShards )	{ s_pShards = pShards; }
+
+	/* set while more than one thread is running Shards */
+	static void SetThreaded( bool b )	{ s_bThreaded = b; }
+
+private:
+	/* Broadcast()s a packet that's been encoded already. With pBlock,
+	 * the messages to other Shards are made in pMessages, which has room
+	 * for one each, and which pBlock holds a reference to for each. */
+	static void SendEncoded( ShardMessageType type,
+		const std::shared_ptr<const EncodedPacket> &pPacket, uint64_t iRoomID,
+		char *pMessages = NULL, SharedArena::Block *pBlock = NULL );
+
+	/* deletes msg, or gives it back to the SharedArena it came from */
+	static void FreeMessage( ShardMessage *msg );
+
+	/* pushes msg onto our queue and wakes us up if we're asleep */
+	void Post( ShardMessage *msg );
+
+	/* handles everything in our queue */
+	void HandleMessages();
+
+	/* sends the output of every user on m_SendQueue */
+	void FlushOutput();
+
+	/* FlushOutput()s early if the oldest output has waited too long */
+	void CheckOutputLatency();
+
+	/* runs a fan-out message against our own users */
+	void Deliver( const ShardMessage *msg );
+
+	/* moves every one of our users in iRoomID to the default room, and
+	 * tells its members. Needs the state lock held. */
+	void EmptyRoom( uint64_t iRoomID );
+
+	/* takes ownership of iSocket; locks the server state */
+	User* CreateUser( int iSocket, const NetAddress &addr );
+
+	/* forgets about user and removes it from the server */
+	void DestroyUser( User *user );
+
+	/* handles the events returned by the last m_Poller.Wait() */
+	void HandlePollerEvents( int iEvents );
+
+	/* handles everything the Ring's finished */
+	void HandleRingEvents();
+
+	/* handles a completed receive or send for the user with this ID */
+	void HandleRecv( uint64_t iUserID, const struct RingCompletion &c );
+	void HandleSend( uint64_t iUserID, const struct RingCompletion &c );
+
+	/* deletes zombies the Ring's finished with. With bWait, waits a
+	 * little for the rest (shutting down, every request should end). */
+	void ReapZombies( bool bWait );
+
+	/* handles epoll activity on a user's socket */
+	void HandleUserEvent( User *user, uint32_t iEvents );
+
+	/* reads and handles every complete packet the user's sent */
+	void UpdateUser( User *user );
+
+	/* handles every complete packet in the user's input buffer, stopping
+	 * at a login: nothing else from them is handled until it's checked. */
+	void HandleFrames( User *user );
+
+	/* checks users waiting on the database for completed logins */
+	void UpdatePendingLogins();
+
+	/* handles whatever flood control's now letting through */
+	void UpdateDelayedUsers();
+
+	/* runs CheckIdleStatus on every user whose idle timer is due */
+	void UpdateTimers( uint64_t iNow );
+
+	/* removes every user that died during this update */
+	void ReapUsers();
+
+	static void *ThreadMain( void *p );
+
+	ChatServer *m_pServer;
+	const unsigned m_iIndex;
+
+	/* tells us which of our sockets (and our wakeup) need attention.
+	 * With a Ring, that's only the listener and wakeup, and the Ring
+	 * tells us when the Poller has something. */
+	Poller m_Poller;
+
+	/* does our users' socket I/O, if we're using io_uring */
+	Ring *m_pRing;
+
+	/* false if the Ring couldn't take our poll on m_Poller */
+	bool m_bPollArmed;
+
+	/* IDs of users with output to send, and when the first was queued */
+	std::vector<uint64_t> m_SendQueue;
+	uint64_t m_iSendQueuedAt;
+
+	/* removed users the Ring still has requests out for, by ID */
+	std::map<uint64_t,User*> m_Zombies;
+
+	/* eventfd other threads poke to wake us up for new messages */
+	int m_iWakeFD;
+
+	/* true while we're (about to be) blocked in m_Poller.Wait() */
+	std::atomic<bool> m_bSleeping;
+
+	/* messages for us from other Shards */
+	MessageQueue m_Queue;
+
+	/* where our broadcasts to other Shards go (while threaded) */
+	SharedArena m_Broadcasts;
+
+	SocketListener *m_pListener;
+
+	Thread m_Thread;
+	bool m_bThreadStarted;
+
+	/* every user we own, and the same users by ID */
+	std::list<User*> m_Users;
+	std::map<uint64_t,User*> m_UserIDs;
+
+	/* our users in each room, by room ID, and the room each of them is
+	 * listed under there */
+	std::map<uint64_t, std::set<User*> > m_RoomUsers;
+	std::map<User*,uint64_t> m_UserRooms;
+
+	/* users whose logins are being checked. They're taken out of the
+	 * Poller until the DatabaseWorker is done with them. */
+	std::list<User*> m_PendingLogins;
+
+	/* users with packets held back by flood control */
+	std::set<User*> m_DelayedUsers;
+
+	/* users found dead during this update, removed at the end of it */
+	std::set<User*> m_DeadUsers;
+
+	/* each of our users' next idle check, in Clock::GetSeconds().
+	 * Idle times are in minutes, so a second's plenty of resolution. */
+	TimerWheel m_Timers;
+	std::vector<Timer*> m_DueTimers;
+
+	PacketStats m_Stats;
+
+	static __thread Shard *s_pCurrent;
+	static bool s_bThreaded;
+	static const std::vector<Shard*> *s_pShards;
+};
+
+#endif // SHARD_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -1,21 +1,17 @@
 #include "packet/PacketHandler.h"
 #include "model/Room.h"
 
-bool Action( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( ROOM_ACTION, Action );
-
-bool Action( ChatServer *server, User *user, const ChatPacket *packet )
+bool Action( ChatServer *server, User *user, const PacketView *packet )
 {
 	// handled, but ignored
 	if( !user->IsLoggedIn() ||  user->IsMuted() )
 		return false;
 
 	// create a packet for the broadcast using the sender's name
-	ChatPacket msg( ROOM_ACTION, user->GetName(), packet->sMessage );
+	ChatPacket msg( ROOM_ACTION, user->GetName(), std::string(packet->sMessage) );
 
 	// broadcast the packet to the user's room
-	user->GetRoom()->Broadcast( msg );
+	server->BroadcastRoom( user->GetRoomID(), msg );
 
 	return true;
 }
@@ -1,17 +1,13 @@
 #include "packet/PacketHandler.h"
 #include "model/Room.h"
 
-bool Away( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( CLIENT_AWAY, Away );
-
-bool Away( ChatServer *server, User *user, const ChatPacket *packet )
+bool Away( ChatServer *server, User *user, const PacketView *packet )
 {
 	// this can be abused by muted users, so don't let them use it
 	if( user->IsMuted() )
 		return false;
 
-	user->SetMessage( packet->sMessage );
+	user->SetMessage( std::string(packet->sMessage) );
 
 	// broadcast a status change packet
 	ChatPacket away( CLIENT_AWAY, user->GetName(), user->GetMessage() );
@@ -21,10 +17,11 @@ bool Away( ChatServer *server, User *user, const ChatPacket *packet )
 	if( !user->IsAway() )
 	{
 		ChatPacket msg( WALL_MESSAGE, BLANK, user->GetName() + " has gone away." );
-		user->GetRoom()->Broadcast( msg );
+		server->BroadcastRoom( user->GetRoomID(), msg );
 	}
 
 	user->SetAway( true );
+	server->UpdatePresence( user );
 
 	return true;
 }
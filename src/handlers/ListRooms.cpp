@@ -4,19 +4,10 @@
 
 using namespace std;
 
-static bool ListRooms( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( ROOM_LIST, ListRooms );
-
-bool ListRooms( ChatServer *server, User *user, const ChatPacket *packet )
+bool ListRooms( ChatServer *server, User *user, const PacketView *packet )
 {
-	const map<string,Room*> *rooms = server->GetRoomList()->GetRooms();
-
-	for( map<string,Room*>::const_iterator it = rooms->begin(); it != rooms->end(); ++it )
-	{
-		ChatPacket room( ROOM_LIST, BLANK, it->first );
-		user->Write( room.ToString() );
-	}
+	// the same for everyone until a room comes or goes
+	user->Write( server->GetRoomListResponse(user->GetEncoding()) );
 
 	return true;
 }
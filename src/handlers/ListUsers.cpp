@@ -1,29 +1,57 @@
 #include "packet/PacketHandler.h"
+#include "model/PresenceTable.h"
+#include "util/StringUtil.h"
 #include "logger/Logger.h"
+#include <charconv>
 
-bool ListUsers( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( USER_LIST, ListUsers );
-
-bool ListUsers( ChatServer *server, User *user, const ChatPacket *packet )
+bool ListUsers( ChatServer *server, User *user, const PacketView *packet )
 {
 	// we intentionally don't check for login status because we want
 	// external processes to see who's where and doing what.
 
-	const std::list<User*>* users = server->GetUserList();
+	const PresenceTable *presence = server->GetPresence();
+	std::vector<const PresenceTable::Entry*> vEntries;
+
+	/* A client that puts a version in the message wants to know what's
+	 * changed since that version: states for users who've joined or
+	 * changed, USER_PARTs for those who left, then "delta|<version>".
+	 * If we can't say, it gets everyone and "full|<version>" instead.
+	 * Without a version, it's everyone and "done", as it's always been. */
+	const std::string_view sVersion = packet->sMessage;
+	const bool bVersioned = !sVersion.empty() && sVersion.find_first_not_of( "0123456789" ) == std::string_view::npos;
+
+	// one too big to read is newer than any we've given out
+	uint64_t iVersion;
+
+	if( std::from_chars(sVersion.data(), sVersion.data() + sVersion.size(), iVersion).ec != std::errc() )
+		iVersion = UINT64_MAX;
+
+	const PacketEncoding encoding = user->GetEncoding();
 
-	for( std::list<User*>::const_iterator it = users->begin(); it != users->end(); ++it )
+	// the whole list is the same for everyone until someone changes
+	if( !bVersioned || !presence->GetChanges(iVersion, vEntries) )
 	{
-		if( !(*it)->IsLoggedIn() )
-			continue;
+		user->Write( server->GetUserListResponse(encoding, bVersioned) );
+		return true;
+	}
+
+	std::string sData;
 
-		ChatPacket packet( USER_LIST, (*it)->GetName(), server->GetUserState(*it) );
-		user->Write( packet.ToString() );
+	for( unsigned i = 0; i < vEntries.size(); ++i )
+	{
+		const PresenceTable::Entry *entry = vEntries[i];
+
+		if( entry->bDeparted )
+			PacketView( USER_PART, entry->sName, BLANK ).AppendTo( sData, encoding );
+		else
+			PacketView( USER_LIST, entry->sName, entry->sState ).AppendTo( sData, encoding );
 	}
 
 	// signify that the user update is done
-	ChatPacket finish( USER_LIST, BLANK, "done" );
-	user->Write( finish.ToString() );
+	const std::string sDone = StringUtil::Format( "delta|%llu", (unsigned long long)presence->GetVersion() );
+	PacketView( USER_LIST, BLANK, sDone ).AppendTo( sData, encoding );
+
+	user->Write( sData );
 
 	return true;
 }
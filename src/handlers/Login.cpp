@@ -6,34 +6,35 @@
 #include "logger/Logger.h"
 #include <cstdlib>
 
-bool Login( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( USER_JOIN, Login );
-
-bool Login( ChatServer *server, User* const user, const ChatPacket *packet )
+bool Login( ChatServer *server, User* const user, const PacketView *packet )
 {
 	// don't take this packet from a user that's already in
 	if( user->IsLoggedIn() )
 		return false;
 
-	// if this name is already logged in, don't let it log in again.
-	if( server->GetUserByName(packet->sUsername) != NULL )
-	{
-		// HACK: the server doesn't always boot dead users quickly enough.
-		// Work around it until we get a proper solution (keepalive?) in place.
-		User *other = server->GetUserByName(packet->sUsername);
+	const std::string sName( packet->sUsername );
 
-		if( other->GetIP() == user->GetIP() )
-			other->Kill();
-	}
+	// the server doesn't always notice a dead connection right away. If
+	// this name's already on from the same address, that's most likely a
+	// client reconnecting, so let the new session replace the old one.
+	User *other = server->GetConnectionTable()->FindUser( user->GetAddress(),
+		sName, user );
+
+	if( other != NULL )
+		other->Kill();
 
 	// set the user's name from the login packet
-	user->SetName( packet->sUsername );
+	user->SetName( sName );
+
+	// the client asks for protocol options with this; they start once
+	// they're in (see ChatPacket.h)
+	user->RequestEncoding( (packet->r & BINARY_PROTOCOL) ? ENCODING_BINARY : ENCODING_TEXT );
+	user->RequestCompression( (packet->r & DEFLATE_PROTOCOL) != 0 );
 
 	// Dispatch a message to the connector to check login. This will set
 	// the user's LoginState on completion, which is handled in ChatServer.
 	DatabaseConnector *conn = server->GetConnection();
-	conn->Login( user, packet->sMessage );
+	conn->Login( user, std::string(packet->sMessage) );
 
 	return true;
 }
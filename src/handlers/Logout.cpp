@@ -1,10 +1,6 @@
 #include "packet/PacketHandler.h"
 
-bool Logout( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( USER_PART, Logout );
-
-bool Logout( ChatServer *server, User *user, const ChatPacket *packet )
+bool Logout( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsLoggedIn() )
 		return false;
@@ -1,23 +1,18 @@
 #include "packet/PacketHandler.h"
 #include "model/Room.h"
 
-bool HandleMessage( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( ROOM_MESSAGE, HandleMessage );
-
-bool HandleMessage( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleMessage( ChatServer *server, User *user, const PacketView *packet )
 {
 	// handled, but ignored
 	if( !user->IsLoggedIn() || user->IsMuted() )
 		return false;
 
-	// create a packet for broadcast, copying message and RGB
-	ChatPacket msg( *packet );
-
-	// set the first param to the user's name
-	msg.sUsername.assign( user->GetName() );
+	// the message and RGB as they came in, under the user's name. It's
+	// encoded straight from the user's input; nothing's copied.
+	PacketView msg( *packet );
+	msg.sUsername = user->GetName();
 
-	user->GetRoom()->Broadcast( msg );
+	server->BroadcastRoom( user->GetRoomID(), msg );
 
 	return true;
 }
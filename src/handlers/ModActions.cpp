@@ -7,34 +7,14 @@
 #include "logger/Logger.h"
 #include "util/StringUtil.h"
 
-/* A moderation action that involves a moderator and a user */
-bool UserAction( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( USER_KICK, UserAction );
-REGISTER_HANDLER( USER_DISABLE, UserAction );
-REGISTER_HANDLER( USER_BAN, UserAction );
-REGISTER_HANDLER( USER_UNBAN, UserAction );
-REGISTER_HANDLER( USER_MUTE, UserAction );
-REGISTER_HANDLER( USER_UNMUTE, UserAction );
-REGISTER_HANDLER( IP_QUERY, UserAction );
-
-
-/* These are handled separately because they don't share code paths. */
-bool ForceClear( ChatServer *server, User *user, const ChatPacket *packet );
-bool ModChat( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( FORCE_CLEAR, ForceClear );
-REGISTER_HANDLER( MOD_CHAT, ModChat );
-
-
 using namespace std;
 
 /* Internally used functions */
 bool Remove( User *target, uint16_t iCode );
 bool Ban( ChatServer *server, const string &sName );
 bool Unban( ChatServer *server, const string &sName );
-bool Mute( ChatServer *server, User *user, User *target, const ChatPacket *packet );
-bool Unmute( ChatServer *server, User *user, User *target, const ChatPacket *packet );
+bool Mute( ChatServer *server, User *user, User *target, const string &sName );
+bool Unmute( ChatServer *server, User *user, User *target, const string &sName );
 bool Query( ChatServer *server, User *user, User *target );
 
 const string GetAction( uint16_t iCode )
@@ -52,19 +32,14 @@ const string GetAction( uint16_t iCode )
 	}
 }
 
-/* returns a valid target if sName references a user on the server. */
+/* returns a valid target if sName references a user on the server.
+ * Users who aren't logged in aren't found, so we don't mess with them. */
 inline User* GetTarget( ChatServer *server, const string &sName )
 {
-	User* target = server->GetUserByName( sName );
-
-	// if not logged in, we don't mess with them
-	if( target && !target->IsLoggedIn() )
-		return NULL;
-
-	return target;
+	return server->GetUserByName( sName );
 }
 
-bool UserAction( ChatServer *server, User *user, const ChatPacket *packet )
+bool UserAction( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsMod() )
 	{
@@ -72,13 +47,14 @@ bool UserAction( ChatServer *server, User *user, const ChatPacket *packet )
 		return false;
 	}
 
-	User *target = GetTarget( server, packet->sMessage );
+	const string sName( packet->sMessage );
+	User *target = GetTarget( server, sName );
 
 	/* if we're affecting a user, let the moderators know what's happening.
 	 * MUTE and UNMUTE handle themselves, so we don't print in those cases. */
 	if( packet->iCode != USER_MUTE && packet->iCode != USER_UNMUTE )
 	{
-		string sMessage = (target) ? target->GetName() : packet->sMessage;
+		string sMessage = (target) ? target->GetName() : sName;
 		sMessage += " was " + GetAction(packet->iCode) + " by " + user->GetName();
 		server->WallMessage( sMessage );
 	}
@@ -87,10 +63,10 @@ bool UserAction( ChatServer *server, User *user, const ChatPacket *packet )
 	{
 	case USER_KICK:
 	case USER_DISABLE:	return Remove( target, packet->iCode );
-	case USER_BAN:		Remove(target, USER_BAN); return Ban( server, packet->sMessage );
-	case USER_UNBAN:	return Unban( server, packet->sMessage );
-	case USER_MUTE:		return Mute( server, user, target, packet );
-	case USER_UNMUTE:	return Unmute( server, user, target, packet );
+	case USER_BAN:		Remove(target, USER_BAN); return Ban( server, sName );
+	case USER_UNBAN:	return Unban( server, sName );
+	case USER_MUTE:		return Mute( server, user, target, sName );
+	case USER_UNMUTE:	return Unmute( server, user, target, sName );
 	case IP_QUERY:		return Query( server, user, target );
 	default:
 		LOG->Debug( "Hit a ModAction I don't know how to handle! Action %d", packet->iCode );
@@ -105,7 +81,7 @@ bool Remove( User *target, uint16_t iCode )
 	{
 		/* Just pass on the code. The client will kick/disable/ban as needed. */
 		ChatPacket notify( iCode );
-		target->Write( notify.ToString() );
+		target->Write( notify );
 		target->Kill();
 	}
 
@@ -130,13 +106,14 @@ bool Unban( ChatServer *server, const string &sName )
 	return true;
 }
 
-bool Mute( ChatServer *server, User *user, User *target, const ChatPacket *packet )
+bool Mute( ChatServer *server, User *user, User *target, const string &sName )
 {
-	server->GetMuteList()->Add( packet->sMessage );
+	server->GetMuteList()->Add( sName );
 
 	if( target )
 	{
-		target->SetMuted( true );
+		// (if they're on another Shard, theirs does this)
+		server->SetMuted( target, true );
 
 		// pass on the mute, who it affected, and who did it
 		ChatPacket msg( USER_MUTE, target->GetName(), user->GetName() );
@@ -146,13 +123,13 @@ bool Mute( ChatServer *server, User *user, User *target, const ChatPacket *packe
 	return true;
 }
 
-bool Unmute( ChatServer *server, User *user, User *target, const ChatPacket *packet )
+bool Unmute( ChatServer *server, User *user, User *target, const string &sName )
 {
-	server->GetMuteList()->Remove( packet->sMessage );
+	server->GetMuteList()->Remove( sName );
 
 	if( target )
 	{
-		target->SetMuted( false );
+		server->SetMuted( target, false );
 
 		// pass on the unmute, who it affected, and who did it
 		ChatPacket msg( USER_UNMUTE, target->GetName(), user->GetName() );
@@ -168,34 +145,34 @@ bool Query( ChatServer *server, User *user, User *target )
 		return false;
 
 	// send a packet back to the caller giving the IP address
-	ChatPacket query( IP_QUERY, target->GetName(), user->GetIP() );
-	user->Write( query.ToString() );
+	ChatPacket query( IP_QUERY, target->GetName(), target->GetIP() );
+	user->Write( query );
 
 	return true;
 }
 
-bool ModChat( ChatServer *server, User *user, const ChatPacket *packet )
+bool ModChat( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsMod() )
 		return false;
 
 	// TODO: handle this in a more standard fashion, not as a hack.
-	const string sMessage = StringUtil::Format( "{%s} %s",
-		user->GetName().c_str(), packet->sMessage.c_str() );
+	const string sMessage = StringUtil::Format( "{%s} %.*s",
+		user->GetName().c_str(), int(packet->sMessage.size()), packet->sMessage.data() );
 
 	server->WallMessage( sMessage );
 
 	return true;
 }
 
-bool ForceClear( ChatServer *server, User *user, const ChatPacket *packet )
+bool ForceClear( ChatServer *server, User *user, const PacketView *packet )
 {
-	if( !user->IsMod() || !user->GetRoom() )
+	if( !user->IsMod() || user->GetRoomID() == 0 )
 		return false;
 
 	// broadcast a message to clients so they blank their screens
 	ChatPacket msg( FORCE_CLEAR, user->GetName(), BLANK );
-	user->GetRoom()->Broadcast( msg );
+	server->BroadcastRoom( user->GetRoomID(), msg );
 
 	return true;
 }
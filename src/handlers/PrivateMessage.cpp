@@ -1,10 +1,6 @@
 #include "packet/PacketHandler.h"
 
-bool HandlePM( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( USER_PM, HandlePM );
-
-bool HandlePM( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandlePM( ChatServer *server, User *user, const PacketView *packet )
 {
 	// handled, but ignored
 	if( !user->IsLoggedIn() || user->IsMuted() )
@@ -18,10 +14,10 @@ bool HandlePM( ChatServer *server, User *user, const ChatPacket *packet )
 		return false;
 
 	// copy the packet code and message
-	ChatPacket msg( USER_PM, user->GetName(), packet->sMessage );
+	ChatPacket msg( USER_PM, user->GetName(), std::string(packet->sMessage) );
 
 	// send this packet to the recipient
-	recipient->Write( msg.ToString() );
+	recipient->Write( msg );
 
 	return true;
 }
@@ -3,21 +3,11 @@
 #include "model/Room.h"
 #include "model/RoomList.h"
 
-bool HandleJoin( ChatServer *server, User *user, const ChatPacket *packet );
-bool HandleCreate( ChatServer *server, User *user, const ChatPacket *packet );
-bool HandleDestroy( ChatServer *server, User *user, const ChatPacket *packet );
-bool HandleForceJoin( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( JOIN_ROOM, HandleJoin );
-REGISTER_HANDLER( CREATE_ROOM, HandleCreate );
-REGISTER_HANDLER( DESTROY_ROOM, HandleDestroy );
-REGISTER_HANDLER( FORCE_JOIN, HandleForceJoin );
-
 using namespace std;
 
-bool HandleJoin( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleJoin( ChatServer *server, User *user, const PacketView *packet )
 {
-	const string &sRoom = packet->sMessage;
+	const string sRoom( packet->sMessage );
 
 	Room *room = server->GetRoomList()->GetRoom( sRoom );
 
@@ -26,21 +16,20 @@ bool HandleJoin( ChatServer *server, User *user, const ChatPacket *packet )
 		return false;
 
 	// already here
-	if( room->HasUser(user) )
+	if( user->GetRoomID() == room->GetID() )
 		return false;
 
-	room->AddUser( user );
-	server->Broadcast( ChatPacket(JOIN_ROOM, user->GetName(), sRoom) );
+	server->MoveUser( user, room );
 
 	return true;
 }
 
-bool HandleCreate( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleCreate( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsMod() )
 		return false;
 
-	const string &sRoom = packet->sMessage;
+	const string sRoom( packet->sMessage );
 
 	RoomList *list = server->GetRoomList();
 	Room *room = list->GetRoom( sRoom );
@@ -48,7 +37,7 @@ bool HandleCreate( ChatServer *server, User *user, const ChatPacket *packet )
 	if( room != NULL )
 	{
 		ChatPacket msg( WALL_MESSAGE, BLANK, "That room already exists!" );
-		user->Write( msg.ToString() );
+		user->Write( msg );
 		return false;
 	}
 
@@ -56,7 +45,7 @@ bool HandleCreate( ChatServer *server, User *user, const ChatPacket *packet )
 	if( sRoom.length() > 16 )
 	{
 		ChatPacket msg( WALL_MESSAGE, BLANK, "Room names are limited to 16 characters." );
-		user->Write( msg.ToString() );
+		user->Write( msg );
 		return false;
 	}
 
@@ -70,25 +59,23 @@ bool HandleCreate( ChatServer *server, User *user, const ChatPacket *packet )
 		return true;	// log it
 	}
 
-	room->AddUser( user );
-
 	// broadcast the new room creation and join
 	server->Broadcast( ChatPacket(CREATE_ROOM, BLANK, sRoom) );
-	server->Broadcast( ChatPacket(JOIN_ROOM, user->GetName(), sRoom) );
+	server->MoveUser( user, room );
 
 	return true;
 }
 
-bool HandleDestroy( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleDestroy( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsMod() )
 		return false;
 
 	RoomList *pList = server->GetRoomList();
-	const string &sRoom = packet->sMessage;
+	const string sRoom( packet->sMessage );
 
 	// check to make sure that no one's trying to destroy Main
-	const string &sDefaultRoom = pList->GetName( pList->GetDefaultRoom() );
+	const string &sDefaultRoom = pList->GetDefaultRoom()->GetName();
 
 	// consequences shall be dire!
 	if( sRoom.compare( sDefaultRoom ) == 0 )
@@ -99,19 +86,21 @@ bool HandleDestroy( ChatServer *server, User *user, const ChatPacket *packet )
 		return true;
 	}
 
-	// remove the room and broadcast its destruction
+	// remove the room and broadcast its destruction. Each Shard moves
+	// its own users in it back to the default room.
 	pList->RemoveRoom( sRoom );
+
 	server->Broadcast( ChatPacket(DESTROY_ROOM, BLANK, sRoom) );
 
 	return true;
 }
 
-bool HandleForceJoin( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleForceJoin( ChatServer *server, User *user, const PacketView *packet )
 {
 	if( !user->IsMod() )
 		return false;
 
-	const string& sRoom = packet->sMessage;
+	const string sRoom( packet->sMessage );
 	RoomList *list = server->GetRoomList();
 	Room *room = list->GetRoom( sRoom );
 
@@ -125,10 +114,8 @@ bool HandleForceJoin( ChatServer *server, User *user, const ChatPacket *packet )
 	if( target == NULL )
 		return false;
 
-	room->AddUser( target );
-
-	// broadcast the new room join
-	server->Broadcast( ChatPacket(JOIN_ROOM, target->GetName(), sRoom) );
+	// (and tell everyone; if they're on another Shard, theirs does both)
+	server->MoveUser( target, room );
 
 	const string sMessage = target->GetName() + " was forced to join "
 		+ sRoom + " by " + user->GetName();
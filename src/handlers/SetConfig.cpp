@@ -1,12 +1,8 @@
 #include "packet/PacketHandler.h"
 
-static bool HandleSetConfig( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( CLIENT_CONFIG, HandleSetConfig );
-
-bool HandleSetConfig( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleSetConfig( ChatServer *server, User *user, const PacketView *packet )
 {
-	user->SetPrefs( packet->sMessage );
+	user->SetPrefs( std::string(packet->sMessage) );
 	return true;
 }
 
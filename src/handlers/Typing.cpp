@@ -3,13 +3,7 @@
 
 #include "packet/PacketHandler.h"
 
-bool HandleTyping( ChatServer *server, User *user, const ChatPacket *packet );
-
-REGISTER_HANDLER( START_TYPING, HandleTyping );
-REGISTER_HANDLER( STOP_TYPING, HandleTyping );
-REGISTER_HANDLER( RESET_TYPING, HandleTyping );
-
-bool HandleTyping( ChatServer *server, User *user, const ChatPacket *packet )
+bool HandleTyping( ChatServer *server, User *user, const PacketView *packet )
 {
 	// never send any of these messages if the user shouldn't
 	if( user->IsMuted() )
@@ -23,7 +17,7 @@ bool HandleTyping( ChatServer *server, User *user, const ChatPacket *packet )
 
 	// create a packet with the sender's name and send the handled code
 	ChatPacket notification( packet->iCode, user->GetName(), BLANK );
-	recipient->Write( notification.ToString() );
+	recipient->Write( notification, true );
 
 	return true;
 }
@@ -1,5 +1,6 @@
 #include "Logger.h"
 #include "util/FileUtil.h"
+#include "util/Clock.h"
 #include "util/Config.h"
 #include "util/Thread.h"
 #include <cstdio>
@@ -18,21 +19,24 @@ Logger* LOG = NULL;
 
 Spinlock g_FileLock;
 
-/* writes a line into the given log file with timestamp and newline. */
-static void WriteLine( const char *str, FILE *pFile )
+/* writes a line into the given log file with timestamp and newline. The
+ * file's looked up with the lock held, since Reload() may swap it out. */
+static void WriteLine( const char *str, FILE * const *ppFile )
 {
-	if( pFile == NULL )
-		return;
-
 	/* write a timestamp (e.g. [11:22:33]) with trailing space */
-	char timestamp[12];
-	time_t now = time(NULL);
-	struct tm *timeval = localtime( &now );
-	strftime( timestamp, 12, "[%X] ", timeval );
+	const char *timestamp = Clock::GetTimestamp();
 
 	// make sure only one file is written to at a time */
 	g_FileLock.Lock();
 
+	FILE *pFile = *ppFile;
+
+	if( pFile == NULL )
+	{
+		g_FileLock.Unlock();
+		return;
+	}
+
 	/* put the timestamp, the original string, and a newline. */
 	fputs( timestamp, pFile );
 	fputs( str, pFile );
@@ -41,6 +45,28 @@ static void WriteLine( const char *str, FILE *pFile )
 	g_FileLock.Unlock();
 }
 
+/* the same, formatted as vfprintf would */
+static void WriteLineVA( const char *fmt, va_list args, FILE * const *ppFile )
+{
+	const char *timestamp = Clock::GetTimestamp();
+
+	g_FileLock.Lock();
+
+	FILE *pFile = *ppFile;
+
+	if( pFile == NULL )
+	{
+		g_FileLock.Unlock();
+		return;
+	}
+
+	fputs( timestamp, pFile );
+	vfprintf( pFile, fmt, args );
+	fputc( '\n', pFile );
+
+	g_FileLock.Unlock();
+}
+
 static void WriteTimeHeader( const char *str, FILE *pFile )
 {
 	if( pFile == NULL )
@@ -88,7 +114,7 @@ Logger::~Logger()
 	m_pChatLog = m_pSystemLog = m_pDebugLog = NULL;
 }
 
-bool Logger::Open( const char *szLogDir )
+bool Logger::Open( const char *szLogDir, bool bAppend )
 {
 	if( !PathExists(szLogDir) && !CreateDir(szLogDir) )
 	{
@@ -104,50 +130,85 @@ bool Logger::Open( const char *szLogDir )
 
 	bool bAllOpened = true;
 
+	// "e" keeps them from leaking into the processes we start
+	const char *szMode = bAppend ? "ae" : "we";
+
 	// "&=" will pull down to false if any open fails
-	bAllOpened &= OpenFile( sChatLog.c_str(),	"a",	&m_pChatLog );
-	bAllOpened &= OpenFile( sSystemLog.c_str(),	"w",	&m_pSystemLog );
+	bAllOpened &= OpenFile( sChatLog.c_str(),	"ae",	&m_pChatLog );
+	bAllOpened &= OpenFile( sSystemLog.c_str(),	szMode,	&m_pSystemLog );
 
 	if( m_bDebugLog )
-		bAllOpened &= OpenFile( sDebugLog.c_str(), "w", &m_pDebugLog );
+		bAllOpened &= OpenFile( sDebugLog.c_str(), szMode, &m_pDebugLog );
 
 	return bAllOpened;
 }
 
 bool Logger::OpenFile( const char *szFilePath, const char *szMode, FILE **pFile )
 {
-	*pFile = fopen( szFilePath, szMode );
+	FILE *pNew = fopen( szFilePath, szMode );
 
-	if( *pFile == NULL )
+	if( pNew == NULL )
 	{
 		Stdout( "Failed to open %s: %s", szFilePath, strerror(errno) );
 		return false;
 	}
 
 	Stdout( "Opened log file \"%s\"", szFilePath );
-	WriteTimeHeader( "Log started", *pFile );
+	WriteTimeHeader( "Log started", pNew );
+
+	// other threads may be logging already
+	g_FileLock.Lock();
+	*pFile = pNew;
+	g_FileLock.Unlock();
 
 	return true;
-}	
+}
 
-static char s_VABuffer[2048];
+bool Logger::Reload( const Config *cfg )
+{
+	// take the files away from everyone else first, then close them
+	g_FileLock.Lock();
+	FILE *pOld[] = { m_pChatLog, m_pSystemLog, m_pDebugLog };
+	m_pChatLog = m_pSystemLog = m_pDebugLog = NULL;
+	g_FileLock.Unlock();
+
+	for( unsigned i = 0; i < sizeof(pOld) / sizeof(pOld[0]); ++i )
+	{
+		WriteTimeHeader( "Log ended", pOld[i] );
+		DO_IF_OPEN( pOld[i], fclose );
+	}
 
+	m_bDebugLog = cfg->GetBool( "DebugMode", true, true );
+	m_bChatOutput = cfg->GetBool( "ChatOutput", true, false );
+
+	return Open( cfg->Get("LogPath"), true );
+}	
+
+// every reactor thread logs, so this can't be static
 string FormatVA( const char *fmt, va_list args )
 {
-	vsnprintf( s_VABuffer, 2048, fmt, args );
-	return string(s_VABuffer);
+	char buffer[2048];
+	vsnprintf( buffer, 2048, fmt, args );
+	return string(buffer);
 }
 
-void Logger::Chat( const char *str )
+void Logger::Chat( const char *fmt, ... )
 {
-	// HACK: strip any newlines added by ChatPacket::ToString.
-	const string sStr( str );
-	const string sLine( sStr, 0, sStr.find_first_of("\n") );
+	va_list args;
+
+	va_start( args, fmt );
+	WriteLineVA( fmt, args, &m_pChatLog );
+	va_end( args );
 
-	if( m_pChatLog )
-		WriteLine( sLine.c_str(), m_pChatLog );
 	if( m_bChatOutput )
-		Stdout( sLine.c_str() );
+	{
+		va_start( args, fmt );
+		vprintf( fmt, args );
+		va_end( args );
+
+		printf( "\n" );
+		fflush( stdout );
+	}
 }
 
 void Logger::System( const char *fmt, ... )
@@ -161,8 +222,7 @@ void Logger::System( const char *fmt, ... )
 	va_end( args );
 
 	/* write the string to the system file. */
-	if( m_pSystemLog )
-		WriteLine( buf, m_pSystemLog );
+	WriteLine( buf, &m_pSystemLog );
 
 	Stdout( buf );
 }
@@ -180,7 +240,7 @@ void Logger::Debug( const char *fmt, ... )
 	/* write the string to the debug file and stdout. */
 	if( m_pDebugLog )
 	{
-		WriteLine( buf, m_pDebugLog );
+		WriteLine( buf, &m_pDebugLog );
 		Stdout( buf );
 	}
 }
@@ -20,10 +20,18 @@ public:
 	~Logger();
 
 	/* opens files for logging from this directory */
-	bool Open( const char *szLogPath );
-
-	/* writes a string, as is, to the chat log */
-	void Chat( const char *str );
+	/* with bAppend, the system and debug logs are added to rather than
+	 * started over (the chat log always is), e.g. when taking over from
+	 * an older process that's been writing them. */
+	bool Open( const char *szLogPath, bool bAppend = false );
+
+	/* picks up new log settings from cfg, closing the logs and opening
+	 * them again (appending) where LogPath says. */
+	bool Reload( const Config *cfg );
+
+	/* writes a formatted string to the chat log. Unlike the others, it's
+	 * formatted straight into the file, so it costs no allocations. */
+	void Chat( const char *fmt, ... );
 
 	/* writes a formatted string to the system log */
 	void System( const char *fmt, ... );
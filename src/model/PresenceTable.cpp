@@ -0,0 +1,125 @@
+#include "model/PresenceTable.h"
+#include "util/Clock.h"
+
+using namespace std;
+
+/* how many departed users we remember. Past this, clients that haven't
+ * asked since the oldest of them left get the whole list. */
+const unsigned MAX_DEPARTED = 1024;
+
+PresenceTable::PresenceTable()
+{
+	// leaves room for 16 million changes a second
+	m_iVersion = m_iForgotten = uint64_t( Clock::GetWallTime() ) << 24;
+}
+
+void PresenceTable::Touch( list<Entry>::iterator it )
+{
+	it->iVersion = ++m_iVersion;
+	m_Entries.splice( m_Entries.end(), m_Entries, it );
+}
+
+void PresenceTable::Update( uint64_t iUserID, const string &sName, const string &sState )
+{
+	map<uint64_t, list<Entry>::iterator>::iterator it = m_IDs.find( iUserID );
+
+	if( it == m_IDs.end() )
+	{
+		Entry entry;
+		entry.iUserID = iUserID;
+		entry.iVersion = ++m_iVersion;
+		entry.sName = sName;
+		entry.sState = sState;
+		entry.bDeparted = false;
+
+		m_IDs[iUserID] = m_Entries.insert( m_Entries.end(), entry );
+		return;
+	}
+
+	Entry &entry = *it->second;
+
+	// IDs aren't reused, so a departed user can't come back
+	if( entry.bDeparted || (entry.sName == sName && entry.sState == sState) )
+		return;
+
+	entry.sName = sName;
+	entry.sState = sState;
+	Touch( it->second );
+}
+
+void PresenceTable::Remove( uint64_t iUserID )
+{
+	map<uint64_t, list<Entry>::iterator>::iterator it = m_IDs.find( iUserID );
+
+	if( it == m_IDs.end() || it->second->bDeparted )
+		return;
+
+	it->second->bDeparted = true;
+	Touch( it->second );
+
+	m_Departed.push_back( iUserID );
+
+	if( m_Departed.size() <= MAX_DEPARTED )
+		return;
+
+	// forget the oldest departure; nobody can be told about it now
+	it = m_IDs.find( m_Departed.front() );
+	m_Departed.pop_front();
+
+	m_iForgotten = it->second->iVersion;
+	m_Entries.erase( it->second );
+	m_IDs.erase( it );
+}
+
+bool PresenceTable::GetChanges( uint64_t iVersion, vector<const Entry*> &vEntries ) const
+{
+	// too old for us to know, or from some other process
+	if( iVersion < m_iForgotten || iVersion > m_iVersion )
+		return false;
+
+	// the changes are at the back; find where they start
+	list<Entry>::const_iterator it = m_Entries.end();
+
+	while( it != m_Entries.begin() )
+	{
+		list<Entry>::const_iterator prev = it;
+		--prev;
+
+		if( prev->iVersion <= iVersion )
+			break;
+
+		it = prev;
+	}
+
+	for( ; it != m_Entries.end(); ++it )
+		vEntries.push_back( &*it );
+
+	return true;
+}
+
+void PresenceTable::GetAll( vector<const Entry*> &vEntries ) const
+{
+	vEntries.reserve( vEntries.size() + m_IDs.size() - m_Departed.size() );
+
+	for( list<Entry>::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+		if( !it->bDeparted )
+			vEntries.push_back( &*it );
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,90 @@
+/* PresenceTable: every logged in user's name and state (as in USER_LIST),
+ * kept up to date as things change, so a list doesn't have to be worked
+ * out from scratch each time it's asked for.
+ *
+ * Every change gets the next version number. A user who leaves is kept
+ * around for a while as "departed", so a client that's seen version V can
+ * be told just what's changed since: joins and state changes, and parts.
+ * Once too many departures have been forgotten to tell a client that,
+ * it has to start over with the whole list.
+ *
+ * Versions start at the wall clock time (shifted up), not at zero, so a
+ * version from before an upgrade or restart is always older than anything
+ * this process knows about. */
+
+#ifndef PRESENCE_TABLE_H
+#define PRESENCE_TABLE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class PresenceTable
+{
+public:
+	struct Entry
+	{
+		uint64_t iUserID;
+		uint64_t iVersion;	/* the version this entry last changed in */
+		std::string sName, sState;
+		bool bDeparted;
+	};
+
+	PresenceTable();
+
+	/* adds the user with this ID, or changes their state. If it's the
+	 * same as before, nothing happens (and the version stays the same). */
+	void Update( uint64_t iUserID, const std::string &sName, const std::string &sState );
+
+	/* marks the user with this ID as departed */
+	void Remove( uint64_t iUserID );
+
+	/* the version of the latest change */
+	uint64_t GetVersion() const	{ return m_iVersion; }
+
+	/* adds every entry that's changed since iVersion (departed or not) to
+	 * vEntries, oldest first, and returns true. Returns false if we can't
+	 * say what's changed since then. */
+	bool GetChanges( uint64_t iVersion, std::vector<const Entry*> &vEntries ) const;
+
+	/* adds every user that's here to vEntries */
+	void GetAll( std::vector<const Entry*> &vEntries ) const;
+
+private:
+	/* moves it to the back of m_Entries, as of the next version */
+	void Touch( std::list<Entry>::iterator it );
+
+	/* every entry, oldest version first, and the same entries by ID */
+	std::list<Entry> m_Entries;
+	std::map<uint64_t, std::list<Entry>::iterator> m_IDs;
+
+	/* IDs of departed users, in the order they left */
+	std::list<uint64_t> m_Departed;
+
+	uint64_t m_iVersion;
+
+	/* the newest version whose changes we can't report anymore */
+	uint64_t m_iForgotten;
+};
+
+#endif // PRESENCE_TABLE_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
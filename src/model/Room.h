@@ -1,30 +1,31 @@
-/* Room: a collection of users that get messages from each other. */
+/* Room: a collection of users that get messages from each other.
+ *
+ * Who's in which room isn't kept here: each user knows their own room (by
+ * ID and name), and each Shard keeps its own lists of its users in each
+ * room (see Shard.h). That's so a user can only be moved by their own
+ * Shard's thread, and a Room can go away while messages for it are still
+ * on their way to other Shards. */
 
 #ifndef ROOM_H
 #define ROOM_H
 
-#include <set>
 #include <string>
-
-class ChatPacket;
-class User;
+#include <stdint.h>
 
 class Room
 {
 public:
-	// sends a packet to all members of this room
-	void Broadcast( const ChatPacket &packet );
-
-	void AddUser( User *user );
-	void RemoveUser( User *user );
+	Room( const std::string &sName );
 
-	// returns true if the given User is in this Room
-	bool HasUser( User *user ) const;
+	/* unique for the life of the process, so a message queued for a
+	 * room that's since been removed can't reach whatever replaced it */
+	uint64_t GetID() const	{ return m_iID; }
 
-	const std::set<User*>* GetUserSet() const { return &m_Users; }
+	const std::string& GetName() const	{ return m_sName; }
 
 private:
-	std::set<User*> m_Users;
+	uint64_t m_iID;
+	std::string m_sName;
 };
 
 #endif // ROOM_H
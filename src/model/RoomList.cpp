@@ -1,22 +1,26 @@
 #include <algorithm>
+#include <vector>
 #include "logger/Logger.h"
 #include "model/RoomList.h"
 #include "model/Room.h"
-#include "model/User.h"
-#include "packet/ChatPacket.h"
-#include "packet/MessageCodes.h"
 #include "util/Config.h"
 #include "util/StringUtil.h"
+#include "Shard.h"
 
 using namespace std;
 
+// the last version any RoomList had: a new list's versions carry on from
+// the old one's, so nothing built from the old list looks current
+static uint64_t s_iLastVersion = 0;
+
 RoomList::RoomList( Config *cfg )
 {
 	const char* DEFAULT_ROOM = cfg->Get( "DefaultRoom", true, "Main" );
 
 	// ensure that the default room always exists
-	m_pDefaultRoom = new Room;
+	m_pDefaultRoom = new Room( DEFAULT_ROOM );
 	m_Rooms[DEFAULT_ROOM] = m_pDefaultRoom;
+	m_iVersion = ++s_iLastVersion;
 }
 
 RoomList::~RoomList()
@@ -43,27 +47,6 @@ Room* RoomList::GetRoom( const std::string &sRoom ) const
 	return NULL;	// no match
 }
 
-std::string RoomList::GetName( const Room *room ) const
-{
-	map<string,Room*>::const_iterator it;
-
-	for( it = m_Rooms.begin(); it != m_Rooms.end(); ++it )
-		if( it->second == room )
-			return it->first;
-
-	return string();
-}
-
-void RoomList::RemoveUser( User *user )
-{
-	map<string,Room*>::iterator it;
-
-	// just remove from all rooms...we can afford it.
-	// that's easier than the logic needed to find/erase.
-	for( it = m_Rooms.begin(); it != m_Rooms.end(); ++it )
-		it->second->RemoveUser( user );
-}
-		
 bool RoomList::RoomExists( const std::string &sRoom ) const
 {
 	return GetRoom(sRoom) != NULL;
@@ -75,7 +58,8 @@ void RoomList::AddRoom( const std::string &sRoom )
 	if( RoomExists(sRoom) )
 		return;
 
-	m_Rooms[sRoom.c_str()] = new Room;
+	m_Rooms[sRoom.c_str()] = new Room( sRoom );
+	m_iVersion = ++s_iLastVersion;
 }
 
 void RoomList::RemoveRoom( const std::string &sRoom )
@@ -100,36 +84,31 @@ void RoomList::RemoveRoom( const std::string &sRoom )
 	}
 
 	m_Rooms.erase( it );
+	m_iVersion = ++s_iLastVersion;
 
-	// get the name so we can move people back here
-	const string& sDefault = GetName( m_pDefaultRoom );
-
-	// remove all users in this room and boot them back to the main room
-	const set<User*> *users = pRoom->GetUserSet();
-
-	for( set<User*>::const_iterator it = users->begin(); it != users->end(); ++it )
-	{
-		ChatPacket msg( JOIN_ROOM, (*it)->GetName(), sDefault );
-		m_pDefaultRoom->Broadcast( msg );
-	}
+	// boot everyone in this room back to the main room. Its users may be
+	// on any Shard, and only theirs can move them; the ID's all they need.
+	Shard::CloseRoom( pRoom->GetID() );
 
 	delete( pRoom );
 }
 
 void RoomList::ClearRooms()
 {
-	const string &sDefault = this->GetName( m_pDefaultRoom );
+	// RemoveRoom erases from m_Rooms, so go by a list of names
+	vector<string> vNames;
 
 	for( map<string,Room*>::iterator it = m_Rooms.begin(); it != m_Rooms.end(); ++it )
 	{
-		const string &sName = it->first;
-
 		// skip the main room (we're booting everyone else back here)
-		if( sName.compare(sDefault) )
+		if( it->second == m_pDefaultRoom )
 			continue;
 
-		RemoveRoom( sName );
+		vNames.push_back( it->first );
 	}
+
+	for( unsigned i = 0; i < vNames.size(); ++i )
+		RemoveRoom( vNames[i] );
 }
 
 /* 
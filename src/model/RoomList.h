@@ -5,9 +5,9 @@
 
 #include <map>
 #include <string>
+#include <stdint.h>
 
 class Room;
-class User;
 class Config;
 
 class RoomList
@@ -22,29 +22,28 @@ public:
 	/* gets a room by its name, or NULL if not there */
 	Room* GetRoom( const std::string &name ) const;
 
-	/* gets a room name by its pointer */
-	std::string GetName( const Room *room ) const;
-
 	/* does a room exist with the given name? */
 	bool RoomExists( const std::string &name ) const;
 
 	/* adds a room to the list */
 	void AddRoom( const std::string &name );
 
-	/* removes a room name from the list */
+	/* removes a room name from the list. Its users go back to the
+	 * default room: each Shard moves its own (see Shard::CloseRoom). */
 	void RemoveRoom( const std::string &name );
 
-	/* removes this user from all rooms on the server */
-	void RemoveUser( User *user );
-
 	/* clears the room list completely, except the main room */
 	void ClearRooms();
 
 	/* returns a const pointer to the internal room map */
 	const std::map<std::string,Room*>* GetRooms() const { return &m_Rooms; }
 
+	/* changes whenever a room's added or removed */
+	uint64_t GetVersion() const	{ return m_iVersion; }
+
 private:
 	std::map<std::string,Room*> m_Rooms;
+	uint64_t m_iVersion;
 	Room *m_pDefaultRoom;
 };
 
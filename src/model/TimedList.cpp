@@ -1,38 +1,22 @@
 #include <climits>
+#include <cstdio>
 #include "TimedList.h"
+#include "util/Clock.h"
 #include "util/StringUtil.h"
 #include "logger/Logger.h"
 
-namespace
-{
-	#include <cstdio>
-	#include <sys/time.h>
-	#include <stdint.h>
-
-	static int64_t getusecs()
-	{
-		struct timeval tv;
-		gettimeofday( &tv, NULL );
-
-		int64_t iRet = int64_t(tv.tv_sec) * 1000000 + int64_t(tv.tv_usec);
-		return iRet;
-	}
-}
-
 using namespace std;
 
-TimedList::TimedList()
+TimedList::TimedList() : m_Expiries( Clock::GetWallTime() )
 {
-	m_Entries.clear();
-	m_NameEntries.clear();
-	m_TimeEntries.clear();
 }
 
 TimedList::~TimedList()
 {
+	for( NameMap::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+		delete it->second;
+
 	m_Entries.clear();
-	m_NameEntries.clear();
-	m_TimeEntries.clear();
 }
 
 void TimedList::Add( const string &sName )
@@ -43,113 +27,109 @@ void TimedList::Add( const string &sName )
 
 void TimedList::Add( const ListEntry &entry_ )
 {
-	LOG->Debug( "TimedList::Add( %s, %d )", entry_.name.c_str(), entry_.time );
+	LOG->Debug( "TimedList::Add( %s, %ld )", entry_.name.c_str(), long(entry_.time) );
 
 	// lowercase the name so we can compare case insensitively
 	ListEntry entry( entry_ );
 	StringUtil::ToLower( entry.name );
 
-	// if we have the entry already, just update it and return
-	NameMap::iterator it = m_NameEntries.find( entry.name );
+	// if we have the entry already, just update its time
+	NameMap::iterator it = m_Entries.find( entry.name );
 
-	if( it != m_NameEntries.end() )
+	if( it != m_Entries.end() )
 	{
-		it->second->time = entry.time;
+		it->second->entry.time = entry.time;
+		Schedule( it->second );
 		return;
 	}
 
-	m_Entries.push_back( entry );
-	ListEntry *pEntry = &m_Entries.back();
+	Entry *pEntry = new Entry( entry );
+	m_Entries[entry.name] = pEntry;
+	Schedule( pEntry );
+}
 
-	m_NameEntries.insert( NameEntry(entry.name, pEntry) );
-	m_TimeEntries.insert( TimeEntry(entry.time, pEntry) );
+void TimedList::Schedule( Entry *pEntry )
+{
+	// LONG_MAX means forever, so there's nothing to wait for
+	if( pEntry->entry.time == LONG_MAX )
+		pEntry->timer.Cancel();
+	else
+		m_Expiries.Schedule( &pEntry->timer, pEntry->entry.time );
 }
 
 void TimedList::Remove( const string &name_ )
 {
 	LOG->Debug( "TimedList::Remove( %s )", name_.c_str() );
 
-	uint64_t start = getusecs();
-
 	string name = name_;
 	StringUtil::ToLower( name );
 
-	ListEntry *pEntry = NULL;
-
-	// check to see if this is in the name map
-	{
-		NameMap::iterator it = m_NameEntries.find(name);
-
-		// if we have an entry, point to it
-		if( it != m_NameEntries.end() )
-			pEntry = it->second;
-	}
-
-	if( pEntry == NULL )
-		return;
-
-	// find this entry in the main list and erase it
-	m_NameEntries.erase( name );
-	m_TimeEntries.erase( pEntry->time );
-
-	list<ListEntry>::iterator it = m_Entries.begin();
-
-	for( it = m_Entries.begin(); it != m_Entries.end(); ++it )
-		if( &*it == pEntry )
-			break;
+	NameMap::iterator it = m_Entries.find( name );
 
 	if( it == m_Entries.end() )
-	{
-		LOG->System( "What? Coherency problem between main entry list and lookup lists..." );
-		return;	// nothing we can do
-	}
+		return;
 
+	// the entry's Timer takes itself off the wheel
+	delete it->second;
 	m_Entries.erase( it );
-
-	uint64_t end = getusecs();
-
-	LOG->Debug( "Removing \"%s\" took %llu usecs.", name.c_str(), end - start );
 }
 
-bool TimedList::HasName( const string &name ) const
+bool TimedList::HasName( const string &name_ ) const
 {
-	bool ret = m_NameEntries.find(name) != m_NameEntries.end();
+	string name = name_;
+	StringUtil::ToLower( name );
+
+	bool ret = m_Entries.find(name) != m_Entries.end();
 
 	LOG->Debug( "TimedList::HasName( %s ) returning %d", name.c_str(), int(ret) );
 	return ret;
 }
 
-void TimedList::Update()
+void TimedList::GetEntries( vector<ListEntry> &vEntries ) const
 {
-	const time_t now = time(NULL);
+	for( NameMap::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+		vEntries.push_back( it->second->entry );
+}
 
-	for( TimeMap::iterator it = m_TimeEntries.begin(); it != m_TimeEntries.end(); ++it )
+void TimedList::Update( time_t now, vector<string> *pExpired )
+{
+	vector<Timer*> vDue;
+	m_Expiries.Advance( now, vDue );
+
+	for( unsigned i = 0; i < vDue.size(); ++i )
 	{
-		// entries are in order of timestamp, so we can break
-		// on the first timestamp that's later than now.
-		if( now < it->first )
-			break;
-
-		ListEntry *pEntry = it->second;
-		LOG->Debug( "Removing entry for \"%s\" (now = %u, then = %u)\n", pEntry->name.c_str(), now, pEntry->time );
-		Remove( pEntry->name );
+		Entry *pEntry = (Entry*)vDue[i]->pData;
+		const string sName = pEntry->entry.name;
+
+		LOG->Debug( "Removing entry for \"%s\" (now = %ld, then = %ld)", sName.c_str(), long(now), long(pEntry->entry.time) );
+
+		if( pExpired )
+			pExpired->push_back( sName );
+
+		Remove( sName );
 	}
 }
 
 void TimedList::DumpNames()
 {
-	NameMap::const_iterator it = m_NameEntries.begin();
+	NameMap::const_iterator it = m_Entries.begin();
 	int i = 0;
 
-	for( ; it != m_NameEntries.end(); ++it )
-		printf( "Name entry %u: %s (%li)\n", ++i, it->first.c_str(), it->second->time );
+	for( ; it != m_Entries.end(); ++it )
+		printf( "Name entry %u: %s (%li)\n", ++i, it->first.c_str(), long(it->second->entry.time) );
 }
 
 void TimedList::DumpTimes()
 {
-	TimeMap::const_iterator it = m_TimeEntries.begin();
+	// there's no time-sorted list anymore; sort a copy for the dump
+	multimap<time_t,string> times;
+
+	for( NameMap::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+		times.insert( make_pair(it->second->entry.time, it->first) );
+
+	multimap<time_t,string>::const_iterator it = times.begin();
 	int i = 0;
 
-	for( ; it != m_TimeEntries.end(); ++it )
-		printf( "Time entry %u: %s (%li)\n", ++i, it->second->name.c_str(), it->first );
+	for( ; it != times.end(); ++it )
+		printf( "Time entry %u: %s (%li)\n", ++i, it->second.c_str(), long(it->first) );
 }
@@ -1,6 +1,7 @@
-/* TimedList: a class that contains a central set of names and timestamps,
- * referenced in two other structures that sort by each. We're not using very
- * much memory overall, so we can afford more memory to make lookups faster.
+/* TimedList: a class that contains a central set of names, each with the
+ * time it expires at (if it ever does). Names are looked up in a map, and
+ * expiries are kept on a TimerWheel, so Update() only touches the entries
+ * that have actually expired.
  *
  * All names are stored as lowercase, for sanity's sake. Storing them as is
  * would mean much worse searches, and we can't find them case agnostically.
@@ -12,9 +13,11 @@
 #include <string>
 #include <ctime>
 #include <map>
-#include <list>
+#include <vector>
 
-/* Contains a list of names, a timestamp, and a deletion flag. */
+#include "util/TimerWheel.h"
+
+/* Contains a name and the time it expires at. */
 struct ListEntry
 {
 	std::string name;
@@ -24,20 +27,13 @@ struct ListEntry
 	ListEntry( const ListEntry &cpy ) : name(cpy.name), time(cpy.time) { }
 };
 
-// convenience aliases
-typedef std::map<std::string,ListEntry*> NameMap;
-typedef std::pair<std::string,ListEntry*> NameEntry;
-
-typedef std::multimap<time_t,ListEntry*> TimeMap;
-typedef std::pair<time_t,ListEntry*> TimeEntry;
-
 class TimedList
 {
 public:
 	TimedList();
 	~TimedList();
 
-	/* Defaults to highest possible time */
+	/* Defaults to highest possible time (never expires) */
 	void Add( const std::string &name );
 
 	/* Allows specification of a time */
@@ -46,20 +42,31 @@ public:
 
 	bool HasName( const std::string &name ) const;
 
-	// removes entries for which time has expired
-	void Update();
+	/* adds a copy of every entry to vEntries */
+	void GetEntries( std::vector<ListEntry> &vEntries ) const;
+
+	// removes entries for which time has expired, adding their names
+	// to pExpired if it's given
+	void Update( time_t now, std::vector<std::string> *pExpired = NULL );
 
 private:
-	/* Inserts the entry into the appropriate map. */
-	void InsertName( ListEntry *entry );
-	void InsertTime( ListEntry *entry );
+	/* an entry, plus its place on the wheel */
+	struct Entry
+	{
+		Entry( const ListEntry &entry_ ) : entry(entry_), timer(this) { }
+
+		ListEntry entry;
+		Timer timer;
+	};
+
+	/* puts pEntry's expiry on the wheel, if it has one */
+	void Schedule( Entry *pEntry );
 
-	/* Main entry list */
-	std::list<ListEntry> m_Entries;
+	typedef std::map<std::string,Entry*> NameMap;
+	NameMap m_Entries;
 
-	/* Sorted entry lists */
-	NameMap	m_NameEntries;
-	TimeMap	m_TimeEntries;
+	/* when each entry expires, in seconds */
+	TimerWheel m_Expiries;
 
 public:
 	void DumpNames();
@@ -1,37 +1,94 @@
 #include "User.h"
 #include "Room.h"
 #include "logger/Logger.h"
+#include "network/Poller.h"
+#include "network/Ring.h"
+#include "Shard.h"
+#include "Handoff.h"
+#include "util/Clock.h"
+#include "network/Deflater.h"
+#include "packet/PacketUtil.h"
+#include "packet/PacketView.h"
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 unsigned User::s_iIdleMinutes;
 unsigned User::s_iKickMinutes;
 
-User::User( unsigned iSocket ) : m_Socket(iSocket), m_sName("<no name>")
+unsigned User::s_iMaxPacketSize = 8*1024;
+unsigned User::s_iOutputSoftLimit = 64*1024;
+int User::s_iCompressionLevel = 6;
+unsigned User::s_iOutputHardLimit = 256*1024;
+
+std::atomic<uint64_t> User::s_iNextID( 1 );
+
+// the most queued strings we'll gather into one send
+const unsigned MAX_IOVECS = 64;
+
+// packets are written onto the end of the last queued string until it's
+// this big. New strings start with room for a few packets.
+const unsigned OUTPUT_CHUNK_SIZE = 64*1024;
+const unsigned OUTPUT_CHUNK_RESERVE = 2*1024;
+
+// a packet headed for a Deflater is encoded here first
+static thread_local std::string s_sDeflateScratch;
+
+__thread uint64_t User::s_iBytesWritten = 0;
+
+/* a Ring send's gathered output, which has to stay put until it's done */
+struct RingSend
+{
+	struct msghdr msg;
+	struct iovec iov[MAX_IOVECS];
+};
+
+User::User( unsigned iSocket, const NetAddress &addr ) :
+	m_Socket(iSocket), m_Address(addr), m_sName("<no name>"), m_IdleTimer(this)
 {
-	m_pRoom = NULL;
+	m_pPoller = NULL;
+	m_pRing = NULL;
+	m_pRingSend = NULL;
+	m_bSendPending = m_bRecvPending = m_bSendQueued = m_bBlocked = false;
+	m_iSendCount = 0;
+	m_pShard = NULL;
+	m_iID = s_iNextID++;
+	m_iInStart = m_iInEnd = 0;
+	m_Scan.Reset();
+	m_Encoding = m_RequestedEncoding = ENCODING_TEXT;
+	m_bRequestedCompression = false;
+	m_pDeflater = NULL;
+	m_iOutOffset = m_iQueuedBytes = 0;
+	m_iRoomID = 0;
 	m_cLevel = '_';
-	m_bLoggedIn = m_bMuted = m_bAway = false;
-	m_LastActive = time_t(NULL);
+	m_bLoggedIn = m_bMuted = m_bAway = m_bIsMod = m_bKilled = false;
+	m_LastActive = Clock::GetSeconds();
+	m_iLastIdleMinute = 0;
 	m_LoginState = LOGIN_NONE;
 }
 
 User::~User()
 {
 	m_Socket.Close();
+	delete m_pRingSend;
+	delete m_pDeflater;
 }
 
-/* returns time from then to now, in seconds */
-static unsigned GetElapsedSeconds( time_t then )
+unsigned User::GetIdleSeconds() const
 {
-	time_t now = time(NULL);
-	double diff = difftime( now, then );
-	return unsigned(diff);
+	return unsigned( Clock::GetSeconds() - m_LastActive );
 }
 
-unsigned User::GetIdleSeconds() const
+uint64_t User::GetNextIdleCheck() const
 {
-	return GetElapsedSeconds( m_LastActive );
+	// not idle yet: nothing to do until we are
+	if( !IsIdle() )
+		return m_LastActive + s_iIdleMinutes * 60;
+
+	// idle: broadcast (or kick) each time another minute's gone by
+	return m_LastActive + (GetIdleMinutes() + 1) * 60;
 }
 
 void User::PacketSent()
@@ -43,43 +100,656 @@ void User::PacketSent()
 	}
 
 	// update last packet time
-	m_LastActive = time(NULL);
+	m_LastActive = Clock::GetSeconds();
 }
 
-int User::Write( const std::string &str )
+void User::SetRoom( const Room *p )
 {
-	if( !m_Socket.IsOpen() )
-		return -1;
+	m_iRoomID = p ? p->GetID() : 0;
+	m_sRoom = p ? p->GetName() : std::string();
+}
 
-	int iSent = m_Socket.Write( str );
+void User::Kill()
+{
+	// our socket's not this thread's to touch
+	if( m_pShard && !m_pShard->IsLocal() )
+	{
+		m_pShard->KillUser( m_iID );
+		return;
+	}
 
-	if( iSent < 0 )
+	if( m_bKilled )
+		return;
+
+	// get out whatever we can (e.g. the reason for the kick) first.
+	// if a Ring send is still out, the rest can't jump ahead of it.
+	if( !m_bSendPending )
+		Flush();
+
+	m_bKilled = true;
+	DropOutput();
+
+	// this also ends any receive the Ring has going
+	m_Socket.Shutdown();
+}
+
+void User::DropOutput()
+{
+	// a Ring send may be reading from the front strings; leave them be
+	if( m_bSendPending && m_iSendCount < m_OutQueue.size() )
 	{
-		LOG->System( "Write failed for %s (%s): killing.", m_sName.c_str(), strerror(errno) );
-		m_Socket.Close();
-		return -1;
+		m_OutQueue.erase( m_OutQueue.begin() + m_iSendCount, m_OutQueue.end() );
+		m_iQueuedBytes = 0;
+
+		for( unsigned i = 0; i < m_OutQueue.size(); ++i )
+			m_iQueuedBytes += m_OutQueue[i].length();
+
+		m_iQueuedBytes -= m_iOutOffset;
+
+		return;
+	}
+
+	if( m_bSendPending )
+		return;
+
+	m_OutQueue.clear();
+	m_iQueuedBytes = m_iOutOffset = 0;
+}
+
+uint32_t User::GetPollEvents() const
+{
+	return m_bBlocked ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+}
+
+void User::SetBlocked( bool b )
+{
+	if( m_bBlocked == b )
+		return;
+
+	m_bBlocked = b;
+
+	if( m_pPoller )
+		m_pPoller->Modify( GetFD(), this, GetPollEvents() );
+}
+
+void User::SetPoller( Poller *p )
+{
+	if( m_pPoller )
+		m_pPoller->Remove( GetFD() );
+
+	m_pPoller = p;
+
+	if( m_pPoller )
+		m_pPoller->Add( GetFD(), this, GetPollEvents() );
+}
+
+void User::SetRing( Ring *p )
+{
+	m_pRing = p;
+
+	if( m_pRing == NULL )
+		return;
+
+	if( m_pRingSend == NULL )
+	{
+		m_pRingSend = new RingSend;
+		memset( &m_pRingSend->msg, 0, sizeof(m_pRingSend->msg) );
+		m_pRingSend->msg.msg_iov = m_pRingSend->iov;
+	}
+
+	StartRecv();
+}
+
+void User::StartRecv()
+{
+	// we'd never hear from them again: better to let them reconnect
+	if( !m_pRing->Recv(GetFD(), GetRecvTag()) )
+	{
+		LOG->System( "Can't read from %s: killing.", m_sName.c_str() );
+		Kill();
+		return;
+	}
+
+	m_bRecvPending = true;
+}
+
+void User::SendQueued()
+{
+	m_bSendQueued = false;
+
+	if( !FlushDeflater() )
+		return;
+
+	if( m_pRing == NULL )
+	{
+		Flush();
+		return;
+	}
+
+	if( m_bSendPending || m_bKilled || m_OutQueue.empty() )
+		return;
+
+	m_iSendCount = GatherOutput( m_pRingSend->iov, MAX_IOVECS );
+	m_pRingSend->msg.msg_iovlen = m_iSendCount;
+
+	// their output would pile up behind a send that never finishes
+	if( !m_pRing->SendMsg(GetFD(), &m_pRingSend->msg, GetSendTag()) )
+	{
+		LOG->System( "Can't write to %s: killing.", m_sName.c_str() );
+		m_iSendCount = 0;
+		DropOutput();
+		Kill();
+		return;
+	}
+
+	m_bSendPending = true;
+}
+
+unsigned User::GatherOutput( struct iovec *pIOV, unsigned iMax ) const
+{
+	unsigned i = 0;
+
+	for( ; i < iMax && i < m_OutQueue.size(); ++i )
+	{
+		const std::string &str = m_OutQueue[i];
+		const unsigned iSkip = (i == 0) ? m_iOutOffset : 0;
+
+		pIOV[i].iov_base = const_cast<char*>( str.data() + iSkip );
+		pIOV[i].iov_len = str.length() - iSkip;
+	}
+
+	return i;
+}
+
+void User::ConsumeOutput( unsigned iBytes )
+{
+	m_iQueuedBytes -= iBytes;
+
+	while( iBytes > 0 )
+	{
+		const unsigned iLeft = m_OutQueue.front().length() - m_iOutOffset;
+
+		if( iBytes < iLeft )
+		{
+			m_iOutOffset += iBytes;
+			return;
+		}
+
+		iBytes -= iLeft;
+		m_OutQueue.pop_front();
+		m_iOutOffset = 0;
+	}
+}
+
+void User::SendFinished( int iResult )
+{
+	m_bSendPending = false;
+	m_iSendCount = 0;
+
+	// nobody's listening anymore; the data can go now
+	if( m_bKilled )
+	{
+		DropOutput();
+		return;
+	}
+
+	if( iResult < 0 )
+	{
+		LOG->System( "Write failed for %s (%s): killing.", m_sName.c_str(), strerror(-iResult) );
+		DropOutput();
+		Kill();
+		return;
+	}
+
+	ConsumeOutput( iResult );
+
+	// the next send goes out with the rest of this batch
+	SendQueued();
+}
+
+void User::RecvFinished( bool bMore )
+{
+	if( bMore )
+		return;
+
+	m_bRecvPending = false;
+
+	// the receive ran out of buffers, or wasn't multishot: start another
+	if( m_pRing && !m_bKilled && m_Socket.IsOpen() )
+		StartRecv();
+}
+
+int User::Write( std::string_view str, bool bLossy )
+{
+	s_iBytesWritten += str.length();
+
+	if( m_pShard && !m_pShard->IsLocal() )
+	{
+		m_pShard->SendToUser( m_iID, str, bLossy );
+		return str.length();
+	}
+
+	int iResult;
+	char *pOut = ReserveOutput( str.length(), bLossy, iResult );
+
+	if( pOut == NULL )
+		return iResult;
+
+	memcpy( pOut, str.data(), str.length() );
+	return CommitOutput( str.length() );
+}
+
+int User::Write( const ChatPacket &packet, bool bLossy )
+{
+	if( m_pShard && !m_pShard->IsLocal() )
+		return Write( packet.Encode(m_Encoding), bLossy );
+
+	// the packet's encoded right into the queue
+	const PacketView view( packet );
+	const unsigned iLen = view.GetEncodedSize( m_Encoding );
+	s_iBytesWritten += iLen;
+
+	int iResult;
+	char *pOut = ReserveOutput( iLen, bLossy, iResult );
+
+	if( pOut == NULL )
+		return iResult;
+
+	view.EncodeTo( m_Encoding, pOut );
+	return CommitOutput( iLen );
+}
+
+char* User::ReserveOutput( unsigned iLen, bool bLossy, int &iResult )
+{
+	iResult = -1;
+
+	if( !m_Socket.IsOpen() || m_bKilled )
+		return NULL;
+
+	// what we'd queue if we flushed now: the deflater holds on to
+	// everything compressed since the last flush
+	unsigned iQueued = m_iQueuedBytes;
+
+	if( m_pDeflater )
+		iQueued += m_pDeflater->GetPendingSize();
+
+	// this client is falling behind. throw out what it won't miss.
+	if( bLossy && iQueued >= s_iOutputSoftLimit )
+	{
+		iResult = 0;
+		return NULL;
+	}
+
+	// ...and if it's too far behind, give up on it entirely.
+	if( iQueued + iLen > s_iOutputHardLimit )
+	{
+		LOG->System( "%s has %u bytes queued: disconnecting slow client.",
+			m_sName.c_str(), iQueued );
+
+		DropOutput();
+		Kill();
+		return NULL;
+	}
+
+	// it's queued once it's compressed, at the end of the update
+	if( m_pDeflater )
+	{
+		s_sDeflateScratch.resize( iLen );
+		return &s_sDeflateScratch[0];
+	}
+
+	// add to the last string, unless a Ring send is reading from it or
+	// it's big enough already
+	if( m_OutQueue.size() <= m_iSendCount || m_OutQueue.back().length() + iLen > OUTPUT_CHUNK_SIZE )
+	{
+		m_OutQueue.push_back( std::string() );
+		m_OutQueue.back().reserve( std::max(iLen, OUTPUT_CHUNK_RESERVE) );
+	}
+
+	std::string &sOut = m_OutQueue.back();
+	const unsigned iStart = sOut.length();
+
+	sOut.resize( iStart + iLen );
+	return &sOut[iStart];
+}
+
+int User::CommitOutput( unsigned iLen )
+{
+	if( m_pDeflater )
+	{
+		if( !m_pDeflater->Write(s_sDeflateScratch.data(), iLen) )
+		{
+			DropOutput();
+			Kill();
+			return -1;
+		}
+	}
+	else
+	{
+		m_iQueuedBytes += iLen;
+	}
+
+	// everything written to us this update goes out in one go when our
+	// Shard's done with it, unless it's already waiting on the socket.
+	if( m_bSendQueued || m_bSendPending || m_bBlocked )
+		return iLen;
+
+	if( m_pShard == NULL )
+	{
+		Flush();
+		return iLen;
+	}
+
+	m_bSendQueued = true;
+	m_pShard->QueueSend( this );
+
+	return iLen;
+}
+
+void User::SetEncoding( PacketEncoding e )
+{
+	m_Encoding = e;
+
+	// nothing past the login's been looked at yet, but a text scan may
+	// have run ahead of it
+	m_Scan.Reset();
+}
+
+bool User::StartCompression( const std::string &sHistory )
+{
+	Deflater *pDeflater = new Deflater;
+
+	if( !pDeflater->Init(s_iCompressionLevel, sHistory) )
+	{
+		delete pDeflater;
+		return false;
+	}
+
+	delete m_pDeflater;
+	m_pDeflater = pDeflater;
+	return true;
+}
+
+bool User::FlushDeflater()
+{
+	if( m_pDeflater == NULL || !m_pDeflater->HasPending() || m_bKilled )
+		return true;
+
+	std::string sData;
+
+	if( !m_pDeflater->Flush(sData) )
+	{
+		DropOutput();
+		Kill();
+		return false;
+	}
+
+	m_iQueuedBytes += sData.length();
+	m_OutQueue.push_back( std::string() );
+	m_OutQueue.back().swap( sData );
+
+	return true;
+}
+
+void User::Flush()
+{
+	if( !FlushDeflater() )
+		return;
+
+	if( m_OutQueue.empty() || m_bKilled )
+		return;
+
+	struct iovec iov[MAX_IOVECS];
+
+	while( !m_OutQueue.empty() )
+	{
+		const unsigned iCount = GatherOutput( iov, MAX_IOVECS );
+		unsigned iLeft = 0;
+
+		for( unsigned i = 0; i < iCount; ++i )
+			iLeft += iov[i].iov_len;
+
+		int iSent = m_Socket.Write( iov, iCount );
+
+		if( iSent < 0 )
+		{
+			LOG->System( "Write failed for %s (%s): killing.", m_sName.c_str(), strerror(errno) );
+			DropOutput();
+			Kill();
+			return;
+		}
+
+		ConsumeOutput( iSent );
+
+		// the socket's full again; try the rest when it's writable.
+		if( unsigned(iSent) < iLeft )
+		{
+			SetBlocked( true );
+			return;
+		}
+	}
+
+	// all caught up, so we don't need to hear about writability now
+	SetBlocked( false );
+}
+
+// the most we'll ask the socket for at once
+const unsigned READ_SIZE = 4096;
+
+void User::KillOversized()
+{
+	LOG->System( "%s sent a packet over %u bytes: killing.", m_sName.c_str(), s_iMaxPacketSize );
+
+	m_iInStart = m_iInEnd = 0;
+	m_Scan.Reset();
+	Kill();
+}
+
+bool User::ReserveInput( unsigned iLen )
+{
+	// the handled packets aren't needed now; move the rest to the front
+	if( m_iInStart > 0 )
+	{
+		memmove( &m_InBuffer[0], &m_InBuffer[m_iInStart], m_iInEnd - m_iInStart );
+		m_iInEnd -= m_iInStart;
+		m_iInStart = 0;
 	}
 
-	return iSent;
+	// whatever's left is an unfinished packet. if it's already too long to
+	// be a real one (plus a binary packet's length), this client is broken
+	// (or up to no good).
+	const unsigned iMaxFrame = s_iMaxPacketSize + (m_Encoding == ENCODING_BINARY ? 5 : 0);
+
+	if( m_iInEnd > iMaxFrame )
+	{
+		KillOversized();
+		return false;
+	}
+
+	if( m_InBuffer.size() < m_iInEnd + iLen )
+		m_InBuffer.resize( m_iInEnd + iLen );
+
+	return true;
+}
+
+void User::SaveHandoff( UserHandoff &state ) const
+{
+	state.iSocket = GetFD();
+	state.sAddress = m_Address.GetString();
+	state.sName = m_sName;
+	state.sPrefs = m_sPrefs;
+	state.sMessage = m_sMessage;
+	state.cLevel = m_cLevel;
+	state.bLoggedIn = m_bLoggedIn;
+	state.bMuted = m_bMuted;
+	state.bAway = m_bAway;
+	state.bMod = m_bIsMod;
+	state.iLastActive = m_LastActive;
+	state.iLastIdleMinute = m_iLastIdleMinute;
+	state.iEncoding = m_Encoding;
+
+	// the output's been flushed (see Shard::Quiesce()), so the stream's
+	// history is everything the client's been sent
+	state.bCompressed = (m_pDeflater != NULL);
+
+	if( m_pDeflater )
+		state.sDeflateHistory = m_pDeflater->GetHistory();
+
+	// packets held back by flood control came in first, framed as they were
+	state.sInput.clear();
+
+	for( unsigned i = 0; i < m_Flood.vDelayed.size(); ++i )
+	{
+		const std::string &sPacket = m_Flood.vDelayed[i];
+
+		if( m_Encoding == ENCODING_BINARY )
+			PacketUtil::PutVarint( state.sInput, sPacket.size() );
+
+		state.sInput.append( sPacket );
+
+		if( m_Encoding == ENCODING_TEXT )
+			state.sInput.append( 1, '\n' );
+	}
+
+	state.sInput.append( &m_InBuffer[0] + m_iInStart, m_iInEnd - m_iInStart );
+
+	state.sOutput.clear();
+
+	for( unsigned i = 0; i < m_OutQueue.size(); ++i )
+		state.sOutput.append( m_OutQueue[i], (i == 0) ? m_iOutOffset : 0, std::string::npos );
+}
+
+void User::LoadHandoff( const UserHandoff &state )
+{
+	m_sName = state.sName;
+	m_sPrefs = state.sPrefs;
+	m_sMessage = state.sMessage;
+	m_cLevel = state.cLevel;
+	m_bLoggedIn = state.bLoggedIn;
+	m_bMuted = state.bMuted;
+	m_bAway = state.bAway;
+	m_bIsMod = state.bMod;
+	m_LastActive = state.iLastActive;
+	m_iLastIdleMinute = state.iLastIdleMinute;
+	m_Encoding = m_RequestedEncoding = PacketEncoding( state.iEncoding );
+
+	// a logged in user's login has been checked already
+	if( m_bLoggedIn )
+		m_LoginState = LOGIN_SUCCESS;
+
+	if( !state.sInput.empty() )
+		AppendInput( state.sInput.data(), state.sInput.length() );
+
+	// this is compressed already, if it's going to be
+	if( !state.sOutput.empty() )
+		Write( state.sOutput );
+
+	// ...and the rest carries on from the same deflate stream
+	if( state.bCompressed && !StartCompression(state.sDeflateHistory) )
+		Kill();
+}
+
+bool User::AppendInput( const char *pData, unsigned iLen )
+{
+	if( m_bKilled || !ReserveInput(iLen) )
+		return false;
+
+	memcpy( &m_InBuffer[m_iInEnd], pData, iLen );
+	m_iInEnd += iLen;
+	return true;
 }
 
-int User::Read( char *buffer, unsigned len )
+int User::ReadInput()
 {
-	if( !m_Socket.IsOpen() )
+	if( !m_Socket.IsOpen() || m_bKilled )
 		return -1;
 
-	int iRead = m_Socket.Read( buffer, len );
+	if( !ReserveInput(READ_SIZE) )
+		return -1;
+
+	int iRead = m_Socket.Read( &m_InBuffer[m_iInEnd], m_InBuffer.size() - m_iInEnd );
 
 	if( iRead < 0 )
 	{
-		LOG->System( "Read failed for %s (%s): killing.", m_sName.c_str(), strerror(errno) );
-		m_Socket.Close();
+		// errno is cleared on a clean hangup; don't make a fuss over it
+		if( errno != 0 )
+			LOG->System( "Read failed for %s (%s): killing.", m_sName.c_str(), strerror(errno) );
+
+		Kill();
 		return -1;
 	}
 
+	m_iInEnd += iRead;
 	return iRead;
 }
 
+bool User::GetFrame( const char *&pFrame, unsigned &iLen, const TextScan *&pScan )
+{
+	if( m_Encoding == ENCODING_BINARY )
+	{
+		unsigned iHeaderLen, iBodyLen;
+		const int iFound = ChatPacket::GetBinaryFrame( &m_InBuffer[m_iInStart],
+			m_iInEnd - m_iInStart, iHeaderLen, iBodyLen );
+
+		// a length we can't read, or one that's too long to be a real
+		// packet: this client is broken (or up to no good). Short of that,
+		// the rest of this packet is still on the way.
+		if( iFound < 0 || iBodyLen > s_iMaxPacketSize )
+		{
+			KillOversized();
+			return false;
+		}
+
+		if( iFound == 0 )
+			return false;
+
+		pFrame = &m_InBuffer[m_iInStart + iHeaderLen];
+		iLen = iBodyLen;
+
+		m_iInStart += iHeaderLen + iBodyLen;
+		pScan = NULL;
+		return true;
+	}
+
+	while( m_iInStart < m_iInEnd )
+	{
+		const char *pStart = &m_InBuffer[m_iInStart];
+		const int iNewline = m_Scan.Scan( pStart, m_iInEnd - m_iInStart );
+
+		// no newline yet: the rest of this packet is still on the way,
+		// unless what we have is already too long to be a real one
+		if( iNewline < 0 )
+		{
+			if( m_iInEnd - m_iInStart > s_iMaxPacketSize )
+				KillOversized();
+
+			return false;
+		}
+
+		pFrame = pStart;
+		iLen = iNewline;
+
+		// the scan found the fields, too; keep them for the parser
+		m_FrameScan = m_Scan;
+		pScan = &m_FrameScan;
+
+		m_Scan.Reset();
+		m_iInStart += iNewline + 1;
+
+		if( iLen > s_iMaxPacketSize )
+		{
+			KillOversized();
+			return false;
+		}
+
+		// ignore blank lines; there's nothing to handle in them
+		if( iLen != 0 )
+			return true;
+	}
+
+	return false;
+}
+
 /* 
  * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
  *
@@ -7,15 +7,33 @@
 
 /* This is susceptible to the Year 2038 Problem.
  * We'll hopefully have replaced it by then. */
+#include <atomic>
 #include <ctime>
+#include <deque>
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include "network/NetAddress.h"
 #include "network/Socket.h"
+#include "packet/ChatPacket.h"
+#include "packet/FloodControl.h"
+#include "packet/TextScan.h"
+#include "util/TimerWheel.h"
 
+class Deflater;
+class Poller;
+class Ring;
+struct RingSend;
+struct iovec;
 class Room;
+class Shard;
+struct UserHandoff;
 
 /* primitive synchronization state: users have a LoginState. We can use
  * this to (indirectly) communicate between the ChatServer and the database
- * worker. TODO: make this a better architecture.
+ * worker. It's atomic, so everything the worker sets on the user before
+ * it changes the state is visible once the Shard sees the change.
+ * TODO: make this a better architecture.
  */
 enum LoginState
 {
@@ -30,22 +48,117 @@ enum LoginState
 class User
 {
 public:
-	User( unsigned iSocket );
+	User( unsigned iSocket, const NetAddress &addr );
 	~User();
 
-	// force the user to quit, e.g. failed validation or kicked.
-	void Kill() { m_Socket.Close(); }
+	// force the user to quit, e.g. failed validation or kicked. The
+	// socket is kept around (shut down) until the ChatServer reaps us.
+	// From another Shard's thread, this asks our Shard to do it later.
+	void Kill();
 
 	// if this is true, reap the user when possible.
 	bool IsDead() const
 	{
-		return !m_Socket.IsOpen() && m_LoginState != LOGIN_CHECKING;
+		return (m_bKilled || !m_Socket.IsOpen()) && m_LoginState != LOGIN_CHECKING;
 	}
 
-	// one part convenience, one part error detection
-	int Read( char *buffer, unsigned len );
-	int Write( const std::string &str );
-	const char* GetIP() const { return m_Socket.GetIP(); }
+	/* reads what the socket has into our input buffer. Returns the number
+	 * of bytes read, 0 if there's nothing more, or -1 if the user's dead. */
+	int ReadInput();
+
+	/* adds data received some other way (i.e. by a Ring) to the input
+	 * buffer. Returns false if that made the user too long-winded to live. */
+	bool AppendInput( const char *pData, unsigned iLen );
+
+	/* points pFrame at the next complete packet in the input buffer, minus
+	 * its newline (or, in the binary encoding, its length), and returns
+	 * true. A text packet's delimiters are found along the way, and pScan
+	 * points at where they are (for PacketView::Parse); otherwise, it's
+	 * NULL. The data's only good until the next ReadInput(), and pScan
+	 * until the next GetFrame(). Returns false if no complete packet is
+	 * buffered. */
+	bool GetFrame( const char *&pFrame, unsigned &iLen, const TextScan *&pScan );
+
+	/* the encoding of everything we send and receive. It's set once the
+	 * login's accepted, to what the login asked for (see ChatPacket.h),
+	 * and it's shared state: the state lock covers it. */
+	PacketEncoding GetEncoding() const	{ return m_Encoding; }
+	void SetEncoding( PacketEncoding e );
+
+	PacketEncoding GetRequestedEncoding() const	{ return m_RequestedEncoding; }
+	void RequestEncoding( PacketEncoding e )	{ m_RequestedEncoding = e; }
+
+	/* whether the login asked for compressed output, and whether it's
+	 * being compressed. Once StartCompression() is called, everything
+	 * written to us goes through one deflate stream (see Deflater.h).
+	 * Returns false if zlib wouldn't start one. */
+	bool GetRequestedCompression() const	{ return m_bRequestedCompression; }
+	void RequestCompression( bool b )	{ m_bRequestedCompression = b; }
+
+	bool IsCompressed() const	{ return m_pDeflater != NULL; }
+	bool StartCompression( const std::string &sHistory = std::string() );
+
+	/* where the user connected from, as of accept() */
+	const NetAddress& GetAddress() const { return m_Address; }
+	const char* GetIP() const { return m_Address.GetString(); }
+	int GetFD() const { return m_Socket.GetFD(); }
+
+	/* queues str to be sent when our Shard's done with this update,
+	 * along with everything else written to us in the meantime.
+	 * If bLossy is set, the data may be dropped for a slow client.
+	 * From another Shard's thread, the data's handed to our Shard. */
+	int Write( std::string_view str, bool bLossy = false );
+
+	/* writes packet, in our encoding. bLossy as above. */
+	int Write( const ChatPacket &packet, bool bLossy = false );
+
+	/* sends as much queued output as the socket will take, gathering
+	 * up to a few dozen packets into each send */
+	void Flush();
+
+	/* returns the number of bytes waiting to be sent */
+	unsigned GetQueuedBytes() const	{ return m_iQueuedBytes; }
+
+	/* registers with the poller that watches our socket, or unregisters
+	 * if p is NULL. We arm EPOLLOUT ourselves while output is queued. */
+	void SetPoller( Poller *p );
+
+	/* for the uring backend: our socket's I/O goes through p instead.
+	 * This starts receiving; output is sent by SendQueued(). */
+	void SetRing( Ring *p );
+
+	/* sends what's been written to us: with a Ring, queues a send of our
+	 * oldest output unless one's already out (the Ring sends it with the
+	 * rest of the batch); otherwise, Flush()es. */
+	void SendQueued();
+
+	/* Ring completions: iResult is what the send/recv returned.
+	 * bMore is false once the (multishot) receive has ended. */
+	void SendFinished( int iResult );
+	void RecvFinished( bool bMore );
+
+	/* writes down everything a new process needs to carry on as us,
+	 * and loads it back (except our room, which the RoomList has to
+	 * find for us: see ChatServer::Restore). */
+	void SaveHandoff( UserHandoff &state ) const;
+	void LoadHandoff( const UserHandoff &state );
+
+	/* the Ring still has requests out that point at us or our output.
+	 * We can't be deleted until they've finished. */
+	bool HasRingRequests() const	{ return m_bSendPending || m_bRecvPending; }
+
+	/* tags for our Ring requests: they have to survive our deletion */
+	uint64_t GetRecvTag() const	{ return (m_iID << 2) | RING_TAG_RECV; }
+	uint64_t GetSendTag() const	{ return (m_iID << 2) | RING_TAG_SEND; }
+
+	enum { RING_TAG_RECV = 1, RING_TAG_SEND = 2 };
+
+	/* the Shard whose thread owns our socket and buffers */
+	Shard* GetShard() const		{ return m_pShard; }
+	void SetShard( Shard *p )	{ m_pShard = p; }
+
+	/* unique for the life of the process, unlike our address */
+	uint64_t GetID() const		{ return m_iID; }
 
 	/* get/set login state */
 	LoginState GetLoginState() const	{ return m_LoginState; }
@@ -65,7 +178,15 @@ public:
 	bool IsMod() const	{ return m_bIsMod; }
 	void SetMod( bool b )	{ m_bIsMod = b; }
 
-	Room* GetRoom() const	{ return m_pRoom; }
+	/* the ID and name of the Room we're in, or 0 and "" for none. Only
+	 * our Shard's thread moves us, and then only through
+	 * ChatServer::EnterRoom(), so our Shard's room lists keep up. */
+	uint64_t GetRoomID() const	{ return m_iRoomID; }
+	const std::string& GetRoomName() const	{ return m_sRoom; }
+	void SetRoom( const Room *p );
+
+	/* how we stand with the server's flood limits */
+	FloodState& GetFloodState()	{ return m_Flood; }
 
 	/* get name/away/room/prefs */
 	const std::string& GetName() const	{ return m_sName; }
@@ -92,25 +213,139 @@ public:
 	bool IsIdle() const { return GetIdleMinutes() >= s_iIdleMinutes; }
 	bool IsInert() const { return GetIdleMinutes() >= s_iKickMinutes; }
 
+	/* when our idle status next needs checking: when we go idle, or
+	 * the next idle minute (the kick's on a minute too). Activity in
+	 * the meantime only pushes that back, so it's fine to check early. */
+	uint64_t GetNextIdleCheck() const;
+
+	/* our place on our Shard's TimerWheel, due at GetNextIdleCheck() */
+	Timer* GetIdleTimer()	{ return &m_IdleTimer; }
+
 	static void SetIdleLimits( unsigned idle, unsigned kick )
 	{
 		s_iIdleMinutes = idle, s_iKickMinutes = kick;
 	}
 
+	/* clients sending packets longer than this are disconnected */
+	static void SetInputLimit( unsigned iMaxPacket )
+	{
+		s_iMaxPacketSize = iMaxPacket;
+	}
+
+	/* past iSoft queued bytes, lossy writes are dropped; past iHard,
+	 * the client's considered hopeless and we disconnect it. */
+	static void SetOutputLimits( unsigned iSoft, unsigned iHard )
+	{
+		s_iOutputSoftLimit = iSoft, s_iOutputHardLimit = iHard;
+	}
+
+	/* the zlib level new compressed streams use (1-9). 0 turns down
+	 * logins that ask for compression. */
+	static void SetCompressionLevel( int iLevel )	{ s_iCompressionLevel = iLevel; }
+	static int GetCompressionLevel()		{ return s_iCompressionLevel; }
+
+	/* everything this thread's Write()n to any user, in bytes. What it
+	 * goes up by while a packet's handled is what the packet cost us in
+	 * output (see PacketStats). */
+	static uint64_t GetBytesWritten()	{ return s_iBytesWritten; }
+
 private:
 	/* idle time limits, set by ChatServer */
 	static unsigned s_iIdleMinutes, s_iKickMinutes;
 
-	// We only let Room call SetRoom(), for consistency.
-	friend class Room;
+	/* input/output queue limits, set by ChatServer */
+	static unsigned s_iMaxPacketSize;
+	static unsigned s_iOutputSoftLimit, s_iOutputHardLimit;
+	static int s_iCompressionLevel;
+
+	static __thread uint64_t s_iBytesWritten;
+
+	/* drops a client that sent more than s_iMaxPacketSize in one packet */
+	void KillOversized();
+
+	/* compacts the input buffer and makes room for iLen more bytes.
+	 * Returns false (and kills us) if the packet's already too long. */
+	bool ReserveInput( unsigned iLen );
+
+	/* throws away queued output, except what a Ring send still needs */
+	void DropOutput();
+
+	/* queues everything the Deflater's been given since its last flush.
+	 * Returns false (and kills us) if it couldn't be compressed. */
+	bool FlushDeflater();
 
-	void SetRoom( Room* p )	{ m_pRoom = p; }
+	/* points up to iMax iovecs at our queued output, oldest first, and
+	 * returns how many it used */
+	unsigned GatherOutput( struct iovec *pIOV, unsigned iMax ) const;
+
+	/* makes room for iLen bytes of output and returns where they go, or
+	 * NULL (with what Write() should return in iResult) if they shouldn't
+	 * be written. Once they're there, CommitOutput() queues them. */
+	char* ReserveOutput( unsigned iLen, bool bLossy, int &iResult );
+	int CommitOutput( unsigned iLen );
+
+	/* removes iBytes of sent output from the front of the queue */
+	void ConsumeOutput( unsigned iBytes );
+
+	/* returns the epoll events we want for our current state */
+	uint32_t GetPollEvents() const;
+
+	/* sets whether we're waiting for the socket to take more output */
+	void SetBlocked( bool b );
+
+	/* queues a Ring receive, or kills us if the Ring won't take it */
+	void StartRecv();
 
 	/* Socket descriptor for this user's connection */
 	Socket m_Socket;
+	NetAddress m_Address;
+
+	/* the poller watching m_Socket, if any */
+	Poller *m_pPoller;
+
+	/* set while the socket's full and we're waiting on EPOLLOUT */
+	bool m_bBlocked;
 
-	/* Room this user is suscribed to */
-	Room *m_pRoom;
+	/* the Ring doing our I/O instead, if any, and what it's doing */
+	Ring *m_pRing;
+	bool m_bSendPending, m_bRecvPending;
+
+	/* the pending Ring send, which covers our first m_iSendCount strings */
+	RingSend *m_pRingSend;
+	unsigned m_iSendCount;
+
+	/* set once we're on our Shard's list of users with output to send */
+	bool m_bSendQueued;
+
+	Shard *m_pShard;
+	uint64_t m_iID;
+
+	static std::atomic<uint64_t> s_iNextID;
+
+	/* how we talk to the client (see ChatPacket.h), and how they've
+	 * asked to be talked to once they're in */
+	PacketEncoding m_Encoding, m_RequestedEncoding;
+	bool m_bRequestedCompression;
+
+	/* compresses our output once it's been started, if it has */
+	Deflater *m_pDeflater;
+
+	/* data read from the socket. Everything before m_iInStart has been
+	 * handled; m_Scan is how far we've looked for the next newline, and
+	 * what we found on the way. m_FrameScan is the last frame's. */
+	std::vector<char> m_InBuffer;
+	unsigned m_iInStart, m_iInEnd;
+	TextScan m_Scan, m_FrameScan;
+
+	/* data the socket hasn't taken yet, oldest first (compressed, if
+	 * we are). The front string has already been sent up to m_iOutOffset. */
+	std::deque<std::string> m_OutQueue;
+	unsigned m_iOutOffset, m_iQueuedBytes;
+
+	/* Room this user is suscribed to. The name's a copy, since the
+	 * Room can be removed before our Shard gets around to moving us. */
+	uint64_t m_iRoomID;
+	std::string m_sRoom;
 
 	/* away status and message, if applicable */
 	bool m_bAway;
@@ -119,12 +354,25 @@ private:
 	/* basic user details */
 	std::string m_sName, m_sPrefs;
 	char m_cLevel;
-	bool m_bLoggedIn, m_bMuted, m_bIsMod;
+	bool m_bLoggedIn, m_bIsMod;
+
+	/* only our Shard changes this, but handlers on other Shards' threads
+	 * look, e.g. to see if an expired mute needs lifting */
+	std::atomic<bool> m_bMuted;
+
+	/* set by Kill(): the connection is finished, whatever the socket says */
+	bool m_bKilled;
 
 	unsigned m_iLastIdleMinute;
-	time_t m_LastActive;
 
-	LoginState m_LoginState;
+	/* when we last sent a packet, in Clock::GetSeconds() */
+	uint64_t m_LastActive;
+
+	Timer m_IdleTimer;
+
+	FloodState m_Flood;
+
+	std::atomic<LoginState> m_LoginState;
 };
 
 #endif // USER_H
@@ -0,0 +1,74 @@
+#include <cctype>
+#include <strings.h>
+#include "model/UserIndex.h"
+#include "model/User.h"
+
+size_t UserIndex::NameHash::operator()( std::string_view sName ) const
+{
+	// FNV-1a, of the name in lower case
+	uint64_t iHash = 14695981039346656037ULL;
+
+	for( size_t i = 0; i < sName.size(); ++i )
+	{
+		iHash ^= (unsigned char)tolower( (unsigned char)sName[i] );
+		iHash *= 1099511628211ULL;
+	}
+
+	return iHash;
+}
+
+bool UserIndex::NameEqual::operator()( std::string_view a, std::string_view b ) const
+{
+	return a.size() == b.size() && !strncasecmp( a.data(), b.data(), a.size() );
+}
+
+void UserIndex::Add( User *user )
+{
+	m_Users.insert( UserMap::value_type(user->GetName(), user) );
+}
+
+void UserIndex::Remove( User *user )
+{
+	std::pair<UserMap::iterator,UserMap::iterator> range = m_Users.equal_range( user->GetName() );
+
+	for( UserMap::iterator it = range.first; it != range.second; ++it )
+	{
+		if( it->second == user )
+		{
+			m_Users.erase( it );
+			return;
+		}
+	}
+}
+
+User* UserIndex::Find( std::string_view sName ) const
+{
+	std::pair<UserMap::const_iterator,UserMap::const_iterator> range = m_Users.equal_range( sName );
+	User *pFound = NULL;
+
+	// IDs go up as users connect, so the lowest is the first to
+	for( UserMap::const_iterator it = range.first; it != range.second; ++it )
+		if( pFound == NULL || it->second->GetID() < pFound->GetID() )
+			pFound = it->second;
+
+	return pFound;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
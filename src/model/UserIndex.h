@@ -0,0 +1,64 @@
+/* UserIndex: the logged in users, by name, ignoring case (as strcasecmp
+ * does), so finding one by name doesn't mean looking at everyone. The keys
+ * point at the users' own names, which can't change while they're logged
+ * in, so looking a name up copies nothing. */
+
+#ifndef USER_INDEX_H
+#define USER_INDEX_H
+
+#include <string_view>
+#include <unordered_map>
+
+class User;
+
+class UserIndex
+{
+public:
+	/* adds a user who's just logged in */
+	void Add( User *user );
+
+	/* takes out a user who's logging out; does nothing if they're not in */
+	void Remove( User *user );
+
+	/* the logged in user with this name, or NULL. If more than one has
+	 * it, that's whichever connected first. */
+	User* Find( std::string_view sName ) const;
+
+	unsigned GetSize() const	{ return m_Users.size(); }
+
+private:
+	struct NameHash
+	{
+		size_t operator()( std::string_view sName ) const;
+	};
+
+	struct NameEqual
+	{
+		bool operator()( std::string_view a, std::string_view b ) const;
+	};
+
+	/* the same name can be logged in twice (from two places at once) */
+	typedef std::unordered_multimap<std::string_view, User*, NameHash, NameEqual> UserMap;
+	UserMap m_Users;
+};
+
+#endif // USER_INDEX_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
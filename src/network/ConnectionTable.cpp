@@ -0,0 +1,193 @@
+#include <algorithm>
+
+#include "network/ConnectionTable.h"
+#include "model/User.h"
+#include "util/Clock.h"
+#include "util/StringUtil.h"
+
+using namespace std;
+
+ConnectionTable::ConnectionTable()
+{
+	m_iMaxConnections = m_iPerMinute = m_iBurst = 0;
+}
+
+void ConnectionTable::SetLimits( unsigned iMaxConnections, unsigned iPerMinute, unsigned iBurst )
+{
+	m_Lock.Lock();
+	m_iMaxConnections = iMaxConnections;
+	m_iPerMinute = iPerMinute;
+	m_iBurst = max( iBurst, 1u );
+	m_Lock.Unlock();
+}
+
+void ConnectionTable::Forget( EntryMap::iterator it, uint64_t iNow )
+{
+	Entry &entry = it->second;
+
+	if( entry.iConnections != 0 || !entry.vUsers.empty() )
+		return;
+
+	// keep an address we're still holding back until it's earned its
+	// burst back, or it could reconnect and get a fresh one
+	if( m_iPerMinute != 0 && !entry.Bucket.IsFull(m_iPerMinute, m_iBurst, iNow) )
+		return;
+
+	m_Entries.erase( it );
+}
+
+bool ConnectionTable::Admit( const NetAddress &addr )
+{
+	const uint64_t iNow = Clock::GetMilliseconds();
+
+	m_Lock.Lock();
+
+	EntryMap::iterator it = m_Entries.find( addr );
+
+	// a new address starts with a full burst
+	if( it == m_Entries.end() )
+	{
+		Entry entry;
+		entry.Bucket.Fill( m_iBurst, iNow );
+
+		it = m_Entries.insert( make_pair(addr, entry) ).first;
+	}
+
+	Entry &entry = it->second;
+	bool bAdmit = true;
+
+	if( m_iMaxConnections != 0 && entry.iConnections >= m_iMaxConnections )
+		bAdmit = false;
+
+	if( bAdmit && m_iPerMinute != 0 && !entry.Bucket.Take(m_iPerMinute, m_iBurst, iNow) )
+		bAdmit = false;
+
+	if( bAdmit )
+		++entry.iConnections;
+
+	m_Lock.Unlock();
+
+	return bAdmit;
+}
+
+void ConnectionTable::Readmit( const NetAddress &addr )
+{
+	m_Lock.Lock();
+	++m_Entries[addr].iConnections;
+	m_Lock.Unlock();
+}
+
+void ConnectionTable::Release( const NetAddress &addr )
+{
+	const uint64_t iNow = Clock::GetMilliseconds();
+
+	m_Lock.Lock();
+
+	EntryMap::iterator it = m_Entries.find( addr );
+
+	if( it != m_Entries.end() && it->second.iConnections > 0 )
+	{
+		--it->second.iConnections;
+		Forget( it, iNow );
+	}
+
+	m_Lock.Unlock();
+}
+
+void ConnectionTable::AddUser( User *user )
+{
+	m_Lock.Lock();
+	m_Entries[user->GetAddress()].vUsers.push_back( user );
+	m_Lock.Unlock();
+}
+
+void ConnectionTable::RemoveUser( User *user )
+{
+	const uint64_t iNow = Clock::GetMilliseconds();
+
+	m_Lock.Lock();
+
+	EntryMap::iterator it = m_Entries.find( user->GetAddress() );
+
+	if( it != m_Entries.end() )
+	{
+		vector<User*> &vUsers = it->second.vUsers;
+		vector<User*>::iterator pos = find( vUsers.begin(), vUsers.end(), user );
+
+		if( pos != vUsers.end() )
+		{
+			vUsers.erase( pos );
+
+			if( it->second.iConnections > 0 )
+				--it->second.iConnections;
+		}
+
+		Forget( it, iNow );
+	}
+
+	m_Lock.Unlock();
+}
+
+User* ConnectionTable::FindUser( const NetAddress &addr, const string &sName,
+	const User *pExcept ) const
+{
+	User *ret = NULL;
+
+	m_Lock.Lock();
+
+	EntryMap::const_iterator it = m_Entries.find( addr );
+
+	if( it != m_Entries.end() )
+	{
+		const vector<User*> &vUsers = it->second.vUsers;
+
+		for( unsigned i = 0; i < vUsers.size(); ++i )
+		{
+			if( vUsers[i] == pExcept )
+				continue;
+
+			if( !StringUtil::CompareNoCase(vUsers[i]->GetName(), sName) )
+			{
+				ret = vUsers[i];
+				break;
+			}
+		}
+	}
+
+	m_Lock.Unlock();
+
+	return ret;
+}
+
+void ConnectionTable::Prune()
+{
+	const uint64_t iNow = Clock::GetMilliseconds();
+
+	m_Lock.Lock();
+
+	for( EntryMap::iterator it = m_Entries.begin(); it != m_Entries.end(); )
+	{
+		EntryMap::iterator cur = it++;
+		Forget( cur, iNow );
+	}
+
+	m_Lock.Unlock();
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
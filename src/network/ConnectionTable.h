@@ -0,0 +1,112 @@
+/* ConnectionTable: every open connection, grouped by the address it came
+ * from. The SocketListener asks it whether to take each new connection
+ * right after accept(), which is where we stop one address from flooding
+ * us with sockets (and the DatabaseWorker with logins). Users are attached
+ * once they're created, so the table also finds a user's other sessions
+ * without searching the whole server.
+ *
+ * It has its own lock: connections are admitted by whichever thread
+ * accepted them, without the server's state lock. */
+
+#ifndef CONNECTIONTABLE_H
+#define CONNECTIONTABLE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "network/NetAddress.h"
+#include "util/Thread.h"
+#include "util/TokenBucket.h"
+
+class User;
+
+class ConnectionTable
+{
+public:
+	ConnectionTable();
+
+	/* iMaxConnections is the most connections one address can have open
+	 * at once. Each address may open iBurst connections in a row (at
+	 * least one), then iPerMinute a minute after that. iMaxConnections or
+	 * iPerMinute of 0 turns that limit off. */
+	void SetLimits( unsigned iMaxConnections, unsigned iPerMinute, unsigned iBurst );
+
+	/* counts a new connection from addr. If that would put addr over a
+	 * limit, counts nothing and returns false: the caller should close
+	 * the connection right away. */
+	bool Admit( const NetAddress &addr );
+
+	/* counts a connection from addr that was admitted by the process we
+	 * took over from, without checking it against the limits */
+	void Readmit( const NetAddress &addr );
+
+	/* un-counts a connection from addr that was admitted, but never got
+	 * a User (e.g. the server stopped before its Shard got to it) */
+	void Release( const NetAddress &addr );
+
+	/* attaches a user to its admitted connection; RemoveUser() detaches
+	 * it and releases the connection */
+	void AddUser( User *user );
+	void RemoveUser( User *user );
+
+	/* returns another user connected from addr under the name sName (not
+	 * case-sensitive), or NULL. Takes as long as the number of users from
+	 * that address, which the connection limit keeps small. Names only
+	 * change under the state lock, so it must be held to call this. */
+	User* FindUser( const NetAddress &addr, const std::string &sName,
+		const User *pExcept ) const;
+
+	/* forgets addresses with no connections whose rate limit has reset */
+	void Prune();
+
+private:
+	struct Entry
+	{
+		Entry() : iConnections(0) { }
+
+		/* admitted connections, and the users made from them so far */
+		unsigned iConnections;
+		std::vector<User*> vUsers;
+
+		/* the accept rate limit, in Clock::GetMilliseconds() */
+		TokenBucket Bucket;
+	};
+
+	struct HashAddress
+	{
+		size_t operator()( const NetAddress &addr ) const { return addr.Hash(); }
+	};
+
+	typedef std::unordered_map<NetAddress,Entry,HashAddress> EntryMap;
+
+	/* drops entry if it's not keeping track of anything anymore */
+	void Forget( EntryMap::iterator it, uint64_t iNow );
+
+	EntryMap m_Entries;
+	mutable Mutex m_Lock;
+
+	unsigned m_iMaxConnections;
+	unsigned m_iPerMinute, m_iBurst;
+};
+
+#endif // CONNECTIONTABLE_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -20,6 +20,11 @@ DatabaseConnector::~DatabaseConnector()
 	m_pWorker = NULL;
 }
 
+void DatabaseConnector::SetConfig( const Config *cfg )
+{
+	m_pWorker->SetConfig( cfg );
+}
+
 void DatabaseConnector::Login( User *user, const string &passwd )
 {
 	m_pWorker->Login( user, passwd );
@@ -24,6 +24,10 @@ public:
 	void Login( User *user, const std::string &passwd );
 	void SavePrefs( const User *user );
 
+	/* starts using the database settings in cfg, from the next request
+	 * on. Requests already queued aren't lost. */
+	void SetConfig( const Config *cfg );
+
 	/* self-explanatory, I think */
 	void Ban( const std::string &username );
 	void Unban( const std::string &username );
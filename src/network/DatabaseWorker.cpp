@@ -1,5 +1,3 @@
-/* The spinlock is occasionally hanging on itself. I've disabled it for now.
- * If this causes any problems, it's still better than hanging the server... */
 #include <cstring>
 #include <cerrno>
 #include "network/DatabaseWorker.h"
@@ -38,6 +36,15 @@ struct Request
 };
 
 DatabaseWorker::DatabaseWorker( const Config *cfg )
+{
+	m_pNewConfig = NULL;
+	LoadConfig( cfg );
+
+	m_bRunning = true;
+	m_Thread.Start( &Start, this );
+}
+
+void DatabaseWorker::LoadConfig( const Config *cfg )
 {
 	const char* DATABASE_HOST 	= cfg->Get( "DatabaseHost" );
 	const char* LOGIN_PAGE 		= cfg->Get( "LoginPage" );
@@ -53,10 +60,15 @@ DatabaseWorker::DatabaseWorker( const Config *cfg )
 
 	m_iReadTimeout = cfg->GetInt( "DatabaseReadTimeout", true, 5000 );
 	m_iWriteTimeout = cfg->GetInt( "DatabaseWriteTimeout", true, 5000 );
+}
 
-	m_bRunning = true;
-	m_Thread.Start( &Start, this );
+void DatabaseWorker::SetConfig( const Config *cfg )
+{
+	Config *pCopy = new Config( *cfg );
 
+	m_QueueLock.Lock();
+	delete m_pNewConfig;
+	m_pNewConfig = pCopy;
 	m_QueueLock.Unlock();
 }
 
@@ -65,28 +77,34 @@ DatabaseWorker::~DatabaseWorker()
 	// stop the worker thread
 	Stop();
 
-	while( m_Requests.size() )
-		delete PopRequest();
+	Request *req;
+
+	while( (req = PopRequest()) != NULL )
+		delete req;
+
+	delete m_pNewConfig;
 }
 
 void DatabaseWorker::AddRequest( Request *req )
 {
-//	m_QueueLock.Lock();
+	m_QueueLock.Lock();
 	m_Requests.push( req );
-//	m_QueueLock.Unlock();
+	m_QueueLock.Unlock();
 }
 
 Request* DatabaseWorker::PopRequest()
 {
-	if( m_Requests.empty() )
-		return NULL;
+	Request *ret = NULL;
 
-//	m_QueueLock.Lock();
+	m_QueueLock.Lock();
 
-	Request *ret = m_Requests.front();
-	m_Requests.pop();
+	if( !m_Requests.empty() )
+	{
+		ret = m_Requests.front();
+		m_Requests.pop();
+	}
 
-//	m_QueueLock.Unlock();
+	m_QueueLock.Unlock();
 
 	return ret;
 }
@@ -153,15 +171,28 @@ void DatabaseWorker::HandleRequests()
 {
 	while( m_bRunning )
 	{
+		// new settings apply from here on; what's been sent already with
+		// the old ones is done by now.
+		m_QueueLock.Lock();
+		Config *pConfig = m_pNewConfig;
+		m_pNewConfig = NULL;
+		m_QueueLock.Unlock();
+
+		if( pConfig )
+		{
+			LoadConfig( pConfig );
+			delete pConfig;
+		}
+
+		Request *req = PopRequest();
+
 		// sleep until we have a request or stop running
-		if( m_Requests.empty() )
+		if( req == NULL )
 		{
 			usleep( SLEEP_MICROSECONDS );
 			continue;
 		}
 
-		Request *req = PopRequest();
-
 		switch( req->type )
 		{
 		case REQ_LOGIN:
@@ -343,8 +374,14 @@ const char* DatabaseWorker::SendPOST( const string &sForm, const string &params
 	}
 
 	// force blocking mode. we're in a thread, so we can do this safely.
-	int iRead = m_Socket.Read( m_sBuffer, HTTP_BUFFER_SIZE, false );
+	// leave room for the terminator, since we treat this as a string.
+	int iRead = m_Socket.Read( m_sBuffer, HTTP_BUFFER_SIZE-1, false );
 	m_Socket.Close();
+
+	// Read() reports a hangup with no response as an error now
+	if( iRead < 0 )
+		return NULL;
+
 	m_sBuffer[iRead] = '\0';
 
 	LOG->Debug( "Received response to POST." );
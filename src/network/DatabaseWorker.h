@@ -25,6 +25,10 @@ protected:
 	// kill the worker thread
 	void Stop();
 
+	/* picks up new settings from cfg (which needn't outlive this call),
+	 * starting with the next request handled */
+	void SetConfig( const Config *cfg );
+
 	bool IsConnected() const { return m_Socket.IsOpen(); }
 
 	/* makes a new Request* and pushes it onto the queue. */
@@ -36,6 +40,10 @@ protected:
 	void Unban( const std::string &username );
 
 private:
+	/* reads our settings out of cfg. Only called by the worker thread
+	 * once it's running. */
+	void LoadConfig( const Config *cfg );
+
 	// shortcuts for handling the connection
 	bool Connect();
 	void Disconnect();
@@ -71,8 +79,13 @@ private:
 	/* stores HTTP read data */
 	char m_sBuffer[HTTP_BUFFER_SIZE];
 
-	/* Only allow one system to access the queue at a time. */
-	Spinlock m_QueueLock;
+	/* Only allow one system to access the queue at a time. Every
+	 * reactor thread can add requests, so this is a real Mutex. */
+	Mutex m_QueueLock;
+
+	/* settings from SetConfig() that the worker hasn't loaded yet.
+	 * Guarded by m_QueueLock. */
+	Config *m_pNewConfig;
 
 	/* true while the thread is still running. */
 	bool m_bRunning;
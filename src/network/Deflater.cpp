@@ -0,0 +1,152 @@
+#include <cstring>
+#include "network/Deflater.h"
+#include "logger/Logger.h"
+
+using namespace std;
+
+/* the protocol's boilerplate, with the most common last: zlib finds
+ * nearer matches more cheaply. Changing this breaks every client that
+ * uses it, so don't. */
+static const string DICTIONARY =
+	"`_`_`0`0`0\n"
+	"404`_`RV Chat`0`0`0\n"
+	"601`_`Server build\n"
+	"600`_`theme|Classic|"
+	"\n2`\n1`RV Chat|____`0`0`0\n"
+	"0`_`done`0`0`0\n"
+	"0`RV Chat|A___`0`0`0\n"
+	"500`\n602`_`0`0`0\n"
+	"603`_`0`0`0\n3`";
+
+// how much compressed output we make room for at a time
+const unsigned OUTPUT_CHUNK = 4096;
+
+const string& Deflater::GetDictionary()
+{
+	return DICTIONARY;
+}
+
+Deflater::Deflater()
+{
+	memset( &m_Stream, 0, sizeof(m_Stream) );
+	m_bInitialized = m_bPending = false;
+}
+
+Deflater::~Deflater()
+{
+	if( m_bInitialized )
+		deflateEnd( &m_Stream );
+}
+
+bool Deflater::Init( int iLevel, const string &sHistory )
+{
+	// negative window bits: raw deflate, with no zlib header or checksum
+	if( deflateInit2(&m_Stream, iLevel, Z_DEFLATED, -WINDOW_BITS, MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK )
+	{
+		LOG->System( "deflateInit2 failed: %s", m_Stream.msg ? m_Stream.msg : "?" );
+		return false;
+	}
+
+	m_bInitialized = true;
+
+	const string &sDictionary = sHistory.empty() ? DICTIONARY : sHistory;
+
+	if( deflateSetDictionary(&m_Stream, (const Bytef*)sDictionary.data(), sDictionary.size()) != Z_OK )
+	{
+		LOG->System( "deflateSetDictionary failed" );
+		return false;
+	}
+
+	return true;
+}
+
+bool Deflater::Deflate( int iFlush )
+{
+	int iResult;
+
+	do
+	{
+		const unsigned iOld = m_sOutput.size();
+		m_sOutput.resize( iOld + OUTPUT_CHUNK );
+
+		m_Stream.next_out = (Bytef*)&m_sOutput[iOld];
+		m_Stream.avail_out = OUTPUT_CHUNK;
+
+		iResult = deflate( &m_Stream, iFlush );
+		m_sOutput.resize( iOld + OUTPUT_CHUNK - m_Stream.avail_out );
+
+		// Z_BUF_ERROR just means there was nothing to do
+		if( iResult != Z_OK && iResult != Z_BUF_ERROR )
+		{
+			LOG->System( "deflate failed (%d)", iResult );
+			return false;
+		}
+	}
+	while( m_Stream.avail_out == 0 );
+
+	return true;
+}
+
+bool Deflater::Write( const char *pData, unsigned iLen )
+{
+	if( !m_bInitialized )
+		return false;
+
+	m_Stream.next_in = (Bytef*)pData;
+	m_Stream.avail_in = iLen;
+	m_bPending = true;
+
+	return Deflate( Z_NO_FLUSH );
+}
+
+bool Deflater::Flush( string &sOut )
+{
+	if( !m_bInitialized )
+		return false;
+
+	m_Stream.next_in = NULL;
+	m_Stream.avail_in = 0;
+
+	if( !Deflate(Z_SYNC_FLUSH) )
+		return false;
+
+	sOut.append( m_sOutput );
+	m_sOutput.clear();
+	m_bPending = false;
+
+	return true;
+}
+
+string Deflater::GetHistory() const
+{
+	if( !m_bInitialized )
+		return string();
+
+	string ret( 1 << WINDOW_BITS, '\0' );
+	uInt iLen = ret.size();
+
+	// deflateGetDictionary doesn't change anything; zlib's just not const
+	if( deflateGetDictionary(const_cast<z_stream*>(&m_Stream), (Bytef*)&ret[0], &iLen) != Z_OK )
+		return string();
+
+	ret.resize( iLen );
+	return ret;
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,83 @@
+/* Deflater: a raw deflate stream (RFC 1951) for one connection's output.
+ * Everything written is compressed as part of one long stream, so later
+ * packets refer back to earlier ones; Flush() ends what's been written so
+ * far on a byte boundary (a sync flush), so the client can inflate every
+ * packet it's been sent without waiting for more.
+ *
+ * The stream starts out primed with GetDictionary(), a string of the
+ * protocol's most common tokens, so even the first few packets compress.
+ * Clients have to inflate with the same dictionary and a window of at
+ * least 2^WINDOW_BITS bytes. */
+
+#ifndef DEFLATER_H
+#define DEFLATER_H
+
+#include <string>
+#include <zlib.h>
+
+class Deflater
+{
+public:
+	/* 8K of history and a smaller hash table keep each stream to about
+	 * 64K of memory, instead of zlib's usual 256K. */
+	enum { WINDOW_BITS = 13, MEM_LEVEL = 6 };
+
+	Deflater();
+	~Deflater();
+
+	/* starts the stream at compression level iLevel (1-9). With sHistory,
+	 * the stream carries on from one whose history that was (from
+	 * GetHistory()) instead of starting over. Returns false on failure. */
+	bool Init( int iLevel, const std::string &sHistory = std::string() );
+
+	/* compresses iLen bytes of pData. Some of it may not come out until
+	 * the next Flush(). Returns false if zlib failed. */
+	bool Write( const char *pData, unsigned iLen );
+
+	/* true if something's been written since the last Flush() */
+	bool HasPending() const		{ return m_bPending; }
+
+	/* how much compressed output is waiting for the next Flush() */
+	unsigned GetPendingSize() const	{ return m_sOutput.size(); }
+
+	/* finishes everything written so far and moves the compressed data,
+	 * up to a byte boundary, onto the end of sOut */
+	bool Flush( std::string &sOut );
+
+	/* the window later data may refer to. Only meaningful right after a
+	 * Flush(), when nothing's pending. */
+	std::string GetHistory() const;
+
+	/* what every stream starts out primed with */
+	static const std::string& GetDictionary();
+
+private:
+	/* runs deflate() on whatever's in m_Stream's input */
+	bool Deflate( int iFlush );
+
+	z_stream m_Stream;
+	bool m_bInitialized, m_bPending;
+
+	/* compressed output that hasn't been Flush()ed yet */
+	std::string m_sOutput;
+};
+
+#endif // DEFLATER_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,120 @@
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "network/NetAddress.h"
+
+NetAddress::NetAddress()
+{
+	m_iFamily = 0;
+	memset( m_Bytes, 0, sizeof(m_Bytes) );
+	strcpy( m_sAddress, "<unknown>" );
+}
+
+void NetAddress::Set( const struct sockaddr *pAddr, socklen_t iLen )
+{
+	*this = NetAddress();
+
+	if( pAddr == NULL )
+		return;
+
+	if( pAddr->sa_family == AF_INET && iLen >= sizeof(sockaddr_in) )
+	{
+		const sockaddr_in *sin = (const sockaddr_in*)pAddr;
+		m_iFamily = AF_INET;
+		memcpy( m_Bytes, &sin->sin_addr, 4 );
+	}
+	else if( pAddr->sa_family == AF_INET6 && iLen >= sizeof(sockaddr_in6) )
+	{
+		const sockaddr_in6 *sin6 = (const sockaddr_in6*)pAddr;
+
+		// ::ffff:a.b.c.d is really just a.b.c.d
+		if( IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr) )
+		{
+			m_iFamily = AF_INET;
+			memcpy( m_Bytes, &sin6->sin6_addr.s6_addr[12], 4 );
+		}
+		else
+		{
+			m_iFamily = AF_INET6;
+			memcpy( m_Bytes, &sin6->sin6_addr, 16 );
+		}
+	}
+	else
+	{
+		return;
+	}
+
+	// inet_ntop is reentrant, unlike inet_ntoa and its static buffer
+	if( inet_ntop(m_iFamily, m_Bytes, m_sAddress, sizeof(m_sAddress)) == NULL )
+		*this = NetAddress();
+}
+
+bool NetAddress::SetString( const char *szAddress )
+{
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+
+	memset( &sin, 0, sizeof(sin) );
+	memset( &sin6, 0, sizeof(sin6) );
+
+	if( inet_pton(AF_INET, szAddress, &sin.sin_addr) == 1 )
+	{
+		sin.sin_family = AF_INET;
+		Set( (const sockaddr*)&sin, sizeof(sin) );
+	}
+	else if( inet_pton(AF_INET6, szAddress, &sin6.sin6_addr) == 1 )
+	{
+		sin6.sin6_family = AF_INET6;
+		Set( (const sockaddr*)&sin6, sizeof(sin6) );
+	}
+	else
+	{
+		*this = NetAddress();
+	}
+
+	return IsSet();
+}
+
+bool NetAddress::operator==( const NetAddress &other ) const
+{
+	return m_iFamily == other.m_iFamily &&
+		memcmp( m_Bytes, other.m_Bytes, sizeof(m_Bytes) ) == 0;
+}
+
+size_t NetAddress::Hash() const
+{
+	// FNV-1a: addresses are short, and this spreads them well enough
+	uint64_t iHash = 14695981039346656037ULL ^ m_iFamily;
+
+	for( unsigned i = 0; i < sizeof(m_Bytes); ++i )
+		iHash = (iHash ^ m_Bytes[i]) * 1099511628211ULL;
+
+	return (size_t)iHash;
+}
+
+bool NetAddress::operator<( const NetAddress &other ) const
+{
+	if( m_iFamily != other.m_iFamily )
+		return m_iFamily < other.m_iFamily;
+
+	return memcmp( m_Bytes, other.m_Bytes, sizeof(m_Bytes) ) < 0;
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,70 @@
+/* NetAddress: a peer's address, captured once when its connection is
+ * accepted. It keeps both the binary address, for comparing and indexing
+ * connections by IP, and the printable one, so logging it is free. */
+
+#ifndef NETADDRESS_H
+#define NETADDRESS_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <sys/socket.h>
+
+class NetAddress
+{
+public:
+	NetAddress();
+
+	/* fills this in from an AF_INET or AF_INET6 sockaddr. An IPv4 address
+	 * mapped into IPv6 counts as plain IPv4, so a client is the same
+	 * client whichever way it came in. Anything else leaves us unset. */
+	void Set( const struct sockaddr *pAddr, socklen_t iLen );
+
+	/* the same, from a string like GetString() returns. Returns false
+	 * (leaving us unset) if it's not an address. */
+	bool SetString( const char *szAddress );
+
+	bool IsSet() const		{ return m_iFamily != 0; }
+
+	/* AF_INET, AF_INET6, or 0 if unset */
+	int GetFamily() const		{ return m_iFamily; }
+
+	/* e.g. "10.0.0.1" or "2001:db8::1"; "<unknown>" if unset */
+	const char* GetString() const	{ return m_sAddress; }
+
+	/* compares the binary address only (never the port) */
+	bool operator==( const NetAddress &other ) const;
+	bool operator!=( const NetAddress &other ) const { return !(*this == other); }
+	bool operator<( const NetAddress &other ) const;
+
+	/* for keying hash tables by address */
+	size_t Hash() const;
+
+private:
+	uint16_t m_iFamily;
+
+	/* IPv4 uses the first 4 bytes; the rest stay zero */
+	uint8_t m_Bytes[16];
+
+	/* big enough for the longest IPv6 address (INET6_ADDRSTRLEN) */
+	char m_sAddress[46];
+};
+
+#endif // NETADDRESS_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
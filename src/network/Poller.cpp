@@ -0,0 +1,88 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>	// for close()
+
+#include "network/Poller.h"
+#include "logger/Logger.h"
+
+Poller::Poller()
+{
+	m_iPollFD = epoll_create1( EPOLL_CLOEXEC );
+
+	if( m_iPollFD < 0 )
+		LOG->System( "epoll_create1 failed: %s", strerror(errno) );
+}
+
+Poller::~Poller()
+{
+	if( m_iPollFD >= 0 )
+		close( m_iPollFD );
+
+	m_iPollFD = -1;
+}
+
+static bool Control( int iPollFD, int op, int fd, void *pData, uint32_t iEvents )
+{
+	struct epoll_event ev;
+	memset( &ev, 0, sizeof(ev) );
+
+	ev.events = iEvents;
+	ev.data.ptr = pData;
+
+	if( epoll_ctl(iPollFD, op, fd, &ev) == 0 )
+		return true;
+
+	LOG->Debug( "epoll_ctl( %d, %d, %u ) failed: %s", op, fd, iEvents, strerror(errno) );
+	return false;
+}
+
+bool Poller::Add( int fd, void *pData, uint32_t iEvents )
+{
+	return Control( m_iPollFD, EPOLL_CTL_ADD, fd, pData, iEvents );
+}
+
+bool Poller::Modify( int fd, void *pData, uint32_t iEvents )
+{
+	return Control( m_iPollFD, EPOLL_CTL_MOD, fd, pData, iEvents );
+}
+
+bool Poller::Remove( int fd )
+{
+	// the event argument is ignored, but old kernels want it non-NULL
+	return Control( m_iPollFD, EPOLL_CTL_DEL, fd, NULL, 0 );
+}
+
+int Poller::Wait( int iTimeoutMS )
+{
+	int iReady = epoll_wait( m_iPollFD, m_Events, MAX_POLL_EVENTS, iTimeoutMS );
+
+	if( iReady < 0 )
+	{
+		// a signal (e.g. SIGHUP) woke us up; that's fine.
+		if( errno != EINTR )
+			LOG->System( "epoll_wait failed: %s", strerror(errno) );
+
+		return 0;
+	}
+
+	return iReady;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,64 @@
+/* Poller: a thin wrapper around epoll. Sockets are registered along with a
+ * pointer that's handed back to us when that socket has something to say,
+ * so the server only ever touches sockets that actually need attention. */
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+// the most events we'll pull out of the kernel in one Wait()
+const unsigned MAX_POLL_EVENTS = 256;
+
+class Poller
+{
+public:
+	Poller();
+	~Poller();
+
+	bool IsOpen() const	{ return m_iPollFD >= 0; }
+
+	/* epoll descriptors can be polled, too (e.g. by a Ring) */
+	int GetFD() const	{ return m_iPollFD; }
+
+	/* registers, re-registers, and unregisters fd. pData is returned
+	 * with every event for fd; iEvents is a mask of EPOLLIN/EPOLLOUT. */
+	bool Add( int fd, void *pData, uint32_t iEvents = EPOLLIN );
+	bool Modify( int fd, void *pData, uint32_t iEvents );
+	bool Remove( int fd );
+
+	/* waits up to iTimeoutMS (-1 for forever) for activity, and returns
+	 * the number of events ready. A signal or an error returns 0. */
+	int Wait( int iTimeoutMS );
+
+	/* accessors for the results of the last Wait() */
+	void* GetData( int i ) const		{ return m_Events[i].data.ptr; }
+	uint32_t GetEvents( int i ) const	{ return m_Events[i].events; }
+
+private:
+	int m_iPollFD;
+
+	struct epoll_event m_Events[MAX_POLL_EVENTS];
+};
+
+#endif // POLLER_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
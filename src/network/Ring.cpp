@@ -0,0 +1,398 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <ctime>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "network/Ring.h"
+#include "logger/Logger.h"
+
+// the receive buffers all come from this group
+const uint16_t BUFFER_GROUP = 0;
+
+static int io_uring_setup( unsigned iEntries, struct io_uring_params *p )
+{
+	return syscall( __NR_io_uring_setup, iEntries, p );
+}
+
+static int io_uring_enter( int fd, unsigned iSubmit, unsigned iWaitFor, unsigned iFlags, void *pArg, size_t iArgSize )
+{
+	return syscall( __NR_io_uring_enter, fd, iSubmit, iWaitFor, iFlags, pArg, iArgSize );
+}
+
+static int io_uring_register( int fd, unsigned iOpcode, void *pArg, unsigned iArgs )
+{
+	return syscall( __NR_io_uring_register, fd, iOpcode, pArg, iArgs );
+}
+
+// the kernel reads and writes the ring indices from the other side
+static inline unsigned LoadAcquire( const unsigned *p )	{ return __atomic_load_n( p, __ATOMIC_ACQUIRE ); }
+static inline void StoreRelease( unsigned *p, unsigned v )	{ __atomic_store_n( p, v, __ATOMIC_RELEASE ); }
+
+Ring::Ring()
+{
+	m_iRingFD = -1;
+	m_pSQRing = m_pCQRing = NULL;
+	m_iSQRingSize = m_iCQRingSize = 0;
+	m_pSQHead = m_pSQTail = m_pCQHead = m_pCQTail = NULL;
+	m_iSQMask = m_iCQMask = m_iSQEntries = m_iToSubmit = 0;
+	m_pSQEs = NULL;
+	m_pCQEs = NULL;
+	m_pBufRing = NULL;
+	m_pBuffers = NULL;
+	m_iBuffers = m_iBufferSize = 0;
+	m_bMultishot = true;
+}
+
+Ring::~Ring()
+{
+	// closing the ring cancels whatever's still in flight
+	if( m_iRingFD >= 0 )
+		close( m_iRingFD );
+
+	if( m_pSQEs )
+		munmap( m_pSQEs, m_iSQEntries * sizeof(io_uring_sqe) );
+	if( m_pCQRing && m_pCQRing != m_pSQRing )
+		munmap( m_pCQRing, m_iCQRingSize );
+	if( m_pSQRing )
+		munmap( m_pSQRing, m_iSQRingSize );
+	if( m_pBufRing )
+		munmap( m_pBufRing, m_iBuffers * sizeof(io_uring_buf) );
+
+	free( m_pBuffers );
+}
+
+bool Ring::Init( unsigned iEntries, unsigned iBuffers, unsigned iBufferSize )
+{
+	struct io_uring_params params;
+	memset( &params, 0, sizeof(params) );
+
+	// multishot receives can complete many times per request, so give
+	// completions plenty of room (the kernel doesn't drop them, but an
+	// overflow is slow).
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = iEntries * 4;
+
+	m_iRingFD = io_uring_setup( iEntries, &params );
+
+	if( m_iRingFD < 0 )
+	{
+		LOG->System( "io_uring_setup failed: %s", strerror(errno) );
+		return false;
+	}
+
+	// we need the single mmap and timed waits (5.11+)
+	const unsigned iNeeded = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+	if( (params.features & iNeeded) != iNeeded )
+	{
+		LOG->System( "io_uring is missing features we need (has %#x)", params.features );
+		close( m_iRingFD );
+		m_iRingFD = -1;
+		return false;
+	}
+
+	m_iSQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_iCQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	// both rings share one mapping
+	if( m_iCQRingSize > m_iSQRingSize )
+		m_iSQRingSize = m_iCQRingSize;
+
+	m_iCQRingSize = m_iSQRingSize;
+
+	m_pSQRing = mmap( NULL, m_iSQRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, m_iRingFD, IORING_OFF_SQ_RING );
+
+	m_iSQEntries = params.sq_entries;
+	m_pSQEs = (io_uring_sqe*)mmap( NULL, m_iSQEntries * sizeof(io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iRingFD, IORING_OFF_SQES );
+
+	if( m_pSQRing == MAP_FAILED || m_pSQEs == MAP_FAILED )
+	{
+		LOG->System( "io_uring mmap failed: %s", strerror(errno) );
+
+		if( m_pSQRing == MAP_FAILED )
+			m_pSQRing = NULL;
+		if( m_pSQEs == MAP_FAILED )
+			m_pSQEs = NULL;
+
+		return false;
+	}
+
+	m_pCQRing = m_pSQRing;
+
+	char *pSQ = (char*)m_pSQRing;
+	m_pSQHead = (unsigned*)(pSQ + params.sq_off.head);
+	m_pSQTail = (unsigned*)(pSQ + params.sq_off.tail);
+	m_iSQMask = *(unsigned*)(pSQ + params.sq_off.ring_mask);
+
+	// we always fill entries in order, so the index array is fixed
+	unsigned *pArray = (unsigned*)(pSQ + params.sq_off.array);
+
+	for( unsigned i = 0; i < m_iSQEntries; ++i )
+		pArray[i] = i;
+
+	char *pCQ = (char*)m_pCQRing;
+	m_pCQHead = (unsigned*)(pCQ + params.cq_off.head);
+	m_pCQTail = (unsigned*)(pCQ + params.cq_off.tail);
+	m_iCQMask = *(unsigned*)(pCQ + params.cq_off.ring_mask);
+	m_pCQEs = (io_uring_cqe*)(pCQ + params.cq_off.cqes);
+
+	// set up the receive buffers and the ring that hands them out
+	m_iBuffers = iBuffers;
+	m_iBufferSize = iBufferSize;
+
+	void *pBufRing = mmap( NULL, m_iBuffers * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE, -1, 0 );
+
+	if( pBufRing == MAP_FAILED )
+	{
+		LOG->System( "Buffer ring mmap failed: %s", strerror(errno) );
+		return false;
+	}
+
+	// fault the ring in before the kernel pins it
+	m_pBufRing = (io_uring_buf*)pBufRing;
+	memset( m_pBufRing, 0, m_iBuffers * sizeof(io_uring_buf) );
+	m_pBuffers = (char*)malloc( m_iBuffers * m_iBufferSize );
+
+	if( m_pBuffers == NULL )
+	{
+		LOG->System( "Can't allocate %u io_uring receive buffers", m_iBuffers );
+		return false;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset( &reg, 0, sizeof(reg) );
+	reg.ring_addr = (uint64_t)(uintptr_t)m_pBufRing;
+	reg.ring_entries = m_iBuffers;
+	reg.bgid = BUFFER_GROUP;
+
+	// provided buffer rings are 5.19+
+	if( io_uring_register(m_iRingFD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 )
+	{
+		LOG->System( "Registering io_uring buffer ring failed: %s", strerror(errno) );
+		return false;
+	}
+
+	for( unsigned i = 0; i < m_iBuffers; ++i )
+		ReturnBuffer( i );
+
+	return true;
+}
+
+void Ring::ReturnBuffer( int iBufferID )
+{
+	// the tail overlays the first entry's reserved field. We don't use
+	// io_uring_buf_ring for this: in C++, its flexible array of entries
+	// comes out 8 bytes after where the kernel looks for them.
+	uint16_t *pTail = &m_pBufRing[0].resv;
+	uint16_t iTail = *pTail;
+
+	struct io_uring_buf *pBuf = &m_pBufRing[iTail & (m_iBuffers - 1)];
+	pBuf->addr = (uint64_t)(uintptr_t)GetBuffer( iBufferID );
+	pBuf->len = m_iBufferSize;
+	pBuf->bid = iBufferID;
+
+	__atomic_store_n( pTail, uint16_t(iTail + 1), __ATOMIC_RELEASE );
+}
+
+io_uring_sqe* Ring::GetSQE()
+{
+	unsigned iTail = *m_pSQTail;
+
+	// full: make the kernel take what we have so far
+	if( iTail - LoadAcquire(m_pSQHead) >= m_iSQEntries )
+	{
+		Enter( 0, 0 );
+
+		if( iTail - LoadAcquire(m_pSQHead) >= m_iSQEntries )
+			return NULL;
+	}
+
+	io_uring_sqe *sqe = &m_pSQEs[iTail & m_iSQMask];
+	memset( sqe, 0, sizeof(*sqe) );
+
+	StoreRelease( m_pSQTail, iTail + 1 );
+	++m_iToSubmit;
+
+	return sqe;
+}
+
+bool Ring::Poll( int fd, uint64_t iTag )
+{
+	io_uring_sqe *sqe = GetSQE();
+
+	if( sqe == NULL )
+	{
+		LOG->System( "io_uring submission queue is stuck; can't poll %d", fd );
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = iTag;
+
+	return true;
+}
+
+bool Ring::Cancel( uint64_t iTarget, uint64_t iTag )
+{
+	io_uring_sqe *sqe = GetSQE();
+
+	if( sqe == NULL )
+	{
+		LOG->System( "io_uring submission queue is stuck; can't cancel" );
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = iTarget;
+	sqe->user_data = iTag;
+
+	return true;
+}
+
+bool Ring::Recv( int fd, uint64_t iTag )
+{
+	io_uring_sqe *sqe = GetSQE();
+
+	if( sqe == NULL )
+	{
+		LOG->System( "io_uring submission queue is stuck; can't receive on %d", fd );
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->ioprio = m_bMultishot ? IORING_RECV_MULTISHOT : 0;
+	sqe->user_data = iTag;
+
+	return true;
+}
+
+bool Ring::SendMsg( int fd, const struct msghdr *msg, uint64_t iTag )
+{
+	io_uring_sqe *sqe = GetSQE();
+
+	if( sqe == NULL )
+	{
+		LOG->System( "io_uring submission queue is stuck; can't send on %d", fd );
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = iTag;
+
+	return true;
+}
+
+int Ring::Enter( unsigned iWaitFor, int iTimeoutMS )
+{
+	unsigned iFlags = 0;
+
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	memset( &arg, 0, sizeof(arg) );
+
+	if( iWaitFor > 0 )
+	{
+		iFlags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		arg.sigmask_sz = _NSIG / 8;
+
+		if( iTimeoutMS >= 0 )
+		{
+			ts.tv_sec = iTimeoutMS / 1000;
+			ts.tv_nsec = (iTimeoutMS % 1000) * 1000000L;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+
+	int ret = io_uring_enter( m_iRingFD, m_iToSubmit, iWaitFor, iFlags,
+		iFlags ? &arg : NULL, iFlags ? sizeof(arg) : 0 );
+
+	if( ret >= 0 )
+		m_iToSubmit -= ret;
+
+	return ret;
+}
+
+void Ring::Submit()
+{
+	if( m_iToSubmit > 0 )
+		Enter( 0, 0 );
+}
+
+int Ring::Wait( int iTimeoutMS )
+{
+	unsigned iReady = LoadAcquire( m_pCQTail ) - *m_pCQHead;
+
+	// don't wait if there's already something to do
+	if( iReady > 0 || iTimeoutMS == 0 )
+	{
+		if( m_iToSubmit > 0 )
+			Enter( 0, 0 );
+	}
+	else if( Enter(1, iTimeoutMS) < 0 )
+	{
+		// timeouts and signals are fine; the rest aren't
+		if( errno != ETIME && errno != EINTR && errno != EBUSY )
+			LOG->System( "io_uring_enter failed: %s", strerror(errno) );
+	}
+
+	return LoadAcquire( m_pCQTail ) - *m_pCQHead;
+}
+
+bool Ring::GetCompletion( RingCompletion &c )
+{
+	unsigned iHead = *m_pCQHead;
+
+	if( iHead == LoadAcquire(m_pCQTail) )
+		return false;
+
+	const io_uring_cqe *cqe = &m_pCQEs[iHead & m_iCQMask];
+
+	c.iTag = cqe->user_data;
+	c.iResult = cqe->res;
+	c.bMore = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	c.iBufferID = (cqe->flags & IORING_CQE_F_BUFFER) ? int(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+	StoreRelease( m_pCQHead, iHead + 1 );
+	return true;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,141 @@
+/* Ring: a thin wrapper around io_uring, for the "uring" IOBackend. Requests
+ * are queued up and handed to the kernel in one batch by the next Wait(), so
+ * a broadcast to thousands of users costs a few syscalls instead of one send
+ * each. Receives are multishot, into buffers from a ring we share with the
+ * kernel, so a quiet connection doesn't tie up a buffer.
+ *
+ * Every request carries a 64-bit tag, which comes back with its completion.
+ * We talk to the kernel directly; there's no liburing dependency. */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+struct msghdr;
+
+struct RingCompletion
+{
+	uint64_t iTag;
+
+	/* bytes transferred, or -errno */
+	int iResult;
+
+	/* set if the request is still active and will complete again */
+	bool bMore;
+
+	/* the receive buffer holding the data, or -1 if there isn't one */
+	int iBufferID;
+};
+
+class Ring
+{
+public:
+	Ring();
+	~Ring();
+
+	/* sets up a ring with room for iEntries requests at once, plus
+	 * iBuffers receive buffers of iBufferSize bytes (iBuffers must be a
+	 * power of two). Returns false if the kernel can't do it. */
+	bool Init( unsigned iEntries, unsigned iBuffers, unsigned iBufferSize );
+
+	bool IsOpen() const	{ return m_iRingFD >= 0; }
+
+	/* Each of these returns false if the request couldn't be queued:
+	 * the submission queue's full, and the kernel won't take any more
+	 * until we've handled some completions (it says EBUSY when they've
+	 * overflowed). Nothing will complete for a request that wasn't
+	 * queued, so the caller has to give up on it, or try again later. */
+
+	/* queues a multishot poll for input on fd */
+	bool Poll( int fd, uint64_t iTag );
+
+	/* queues a receive on fd into the buffer ring. It's multishot unless
+	 * the kernel's told us it can't do that (see DisableMultishot). */
+	bool Recv( int fd, uint64_t iTag );
+
+	/* queues a sendmsg. msg, its iovecs, and the data they point at
+	 * must all stay put until the send completes. */
+	bool SendMsg( int fd, const struct msghdr *msg, uint64_t iTag );
+
+	/* asks the kernel to cancel the request tagged iTarget. The request
+	 * still completes (with -ECANCELED, unless it beat us to it); the
+	 * cancellation itself completes as iTag. */
+	bool Cancel( uint64_t iTarget, uint64_t iTag );
+
+	/* old kernels reject multishot receives with EINVAL. Once they do,
+	 * every Recv() after that is single-shot. */
+	void DisableMultishot()	{ m_bMultishot = false; }
+	bool IsMultishot() const	{ return m_bMultishot; }
+
+	/* submits everything queued, then waits up to iTimeoutMS (-1 for
+	 * forever) for a completion. Returns the number ready; a signal or
+	 * an error returns 0. */
+	int Wait( int iTimeoutMS );
+
+	/* hands the kernel everything queued so far, without waiting */
+	void Submit();
+
+	/* pops the oldest completion into c. Returns false if there's none. */
+	bool GetCompletion( RingCompletion &c );
+
+	/* receive buffer access. A buffer from a completion must be given
+	 * back with ReturnBuffer() once its data is copied out. */
+	const char* GetBuffer( int iBufferID ) const	{ return m_pBuffers + iBufferID * m_iBufferSize; }
+	void ReturnBuffer( int iBufferID );
+
+private:
+	/* returns the next free submission entry, submitting if we're full */
+	io_uring_sqe* GetSQE();
+
+	/* hands the kernel everything queued, optionally waiting too */
+	int Enter( unsigned iWaitFor, int iTimeoutMS );
+
+	int m_iRingFD;
+
+	/* the mmap()ed rings, and their sizes for munmap() */
+	void *m_pSQRing, *m_pCQRing;
+	unsigned m_iSQRingSize, m_iCQRingSize;
+
+	/* submission ring */
+	unsigned *m_pSQHead, *m_pSQTail, m_iSQMask;
+	io_uring_sqe *m_pSQEs;
+	unsigned m_iSQEntries;
+	unsigned m_iToSubmit;
+
+	/* completion ring */
+	unsigned *m_pCQHead, *m_pCQTail, m_iCQMask;
+	io_uring_cqe *m_pCQEs;
+
+	/* provided receive buffers, and the ring that hands them to the
+	 * kernel. The ring's tail is the first entry's reserved field. */
+	io_uring_buf *m_pBufRing;
+	char *m_pBuffers;
+	unsigned m_iBuffers, m_iBufferSize;
+
+	bool m_bMultishot;
+};
+
+#endif // RING_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
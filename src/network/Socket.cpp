@@ -2,24 +2,13 @@
 #include <cstring>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <netdb.h>
+#include <unistd.h>	// for close()
 
 #include "Socket.h"
 #include "logger/Logger.h"
 
-const char* Socket::GetIP() const
-{
-	struct sockaddr_in sin;
-	socklen_t len = sizeof( sin );
-
-	// if the socket has been disconnected already by the OS, we
-	// aren't gonna get the IP (which sucks a bit).
-	if( getpeername( m_iSocket, (sockaddr *)&sin, &len) < 0 )
-		return "<nil>";
-
-	return inet_ntoa(sin.sin_addr);
-}
-
 bool Socket::OpenHost( const std::string &host, int port )
 {
 	const struct hostent *entry = gethostbyname( host.c_str() );
@@ -38,7 +27,7 @@ bool Socket::OpenHost( const std::string &host, int port )
 
 bool Socket::Open( const std::string &ip, int port )
 {
-	m_iSocket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	m_iSocket = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP );
 
 	if( m_iSocket < 0 )
 	{
@@ -71,6 +60,11 @@ void Socket::Close()
 	m_iSocket = -1;
 }
 
+void Socket::Shutdown()
+{
+	shutdown( m_iSocket, SHUT_RDWR );
+}
+
 bool Socket::SetReadTimeout( unsigned iMilliSec )
 {
 	LOG->Debug( "SetReadTimeout( %u )", iMilliSec );
@@ -102,7 +96,15 @@ int Socket::Read( char *buffer, unsigned len, bool bDontWait )
 	int flags = (bDontWait) ? MSG_DONTWAIT : 0;
 	int iRead = recv( m_iSocket, buffer, len, flags );
 
-	if( iRead <= 0 )
+	// the other end hung up. clear errno, so callers can tell the
+	// difference between this and an actual error.
+	if( iRead == 0 && len != 0 )
+	{
+		errno = 0;
+		return -1;
+	}
+
+	if( iRead < 0 )
 	{
 		// ignore and return as an error
 		if( errno == EAGAIN || errno == EWOULDBLOCK )
@@ -142,6 +144,31 @@ int Socket::Write( const std::string &str, bool bDontWait )
 	return Write( str.c_str(), str.length(), bDontWait );
 }
 
+int Socket::Write( const struct iovec *pIOV, unsigned iCount, bool bDontWait )
+{
+	struct msghdr msg;
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_iov = const_cast<struct iovec*>( pIOV );
+	msg.msg_iovlen = iCount;
+
+	const int flags = bDontWait ? MSG_DONTWAIT : 0;
+	int iSent = sendmsg( m_iSocket, &msg, flags );
+
+	if( iSent <= 0 )
+	{
+		// ignore and return
+		if( errno == EAGAIN || errno == EWOULDBLOCK )
+			return 0;
+
+		LOG->Debug( "Write( %u, %u buffers, %d ) failed: %i (%s)",
+			m_iSocket, iCount, int(bDontWait), errno, strerror(errno) );
+
+		return -1;
+	}
+
+	return iSent;
+}
+
 /* 
  * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
  *
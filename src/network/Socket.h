@@ -6,20 +6,24 @@
 
 #include <string>
 
+struct iovec;
+
 class Socket
 {
 public:
 	Socket() : m_iSocket(-1) { }
 	Socket( int socket ) : m_iSocket(socket) { }
 
-	const char* GetIP() const;
-
 	// name difference is needed: same arg types, can't overload
 	bool OpenHost( const std::string &host, int port );
 	bool Open( const std::string &ip, int port );
 	void Close();
 
+	/* stops all traffic, but keeps the descriptor until Close() */
+	void Shutdown();
+
 	bool IsOpen() const	{ return m_iSocket > 0; }
+	int GetFD() const	{ return m_iSocket; }
 
 	bool SetReadTimeout( unsigned iMilliSec );
 	bool SetWriteTimeout( unsigned iMilliSec );
@@ -28,6 +32,9 @@ public:
 	int Write( const char *buffer, unsigned len, bool bDontWait = true );
 	int Write( const std::string &str, bool bDontWait = true );
 
+	/* gathers iCount buffers into one send */
+	int Write( const struct iovec *pIOV, unsigned iCount, bool bDontWait = true );
+
 private:
 	int m_iSocket;
 };
@@ -5,22 +5,38 @@
 
 // networking types
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>	// for TCP_DEFER_ACCEPT
 #include <arpa/inet.h>
 
 #include <unistd.h>	// for close()
 #include <fcntl.h>	// for fcntl()
 
 #include "network/SocketListener.h"
+#include "network/ConnectionTable.h"
+#include "network/NetAddress.h"
 #include "logger/Logger.h"
+#include "util/Clock.h"
+
+// when we're out of file descriptors, say so at most this often (in ms)
+const uint64_t OUT_OF_FILES_LOG_MS = 10*1000;
 
 SocketListener::SocketListener()
 {
 	m_iServerSocket = -1;
+	m_pConnections = NULL;
+	m_iLastOutOfFiles = 0;
+
+	// held in reserve for when we run out (see ShedConnection)
+	m_iSpareFD = open( "/dev/null", O_RDONLY | O_CLOEXEC );
 }
 
 SocketListener::~SocketListener()
 {
 	Disconnect();
+
+	if( m_iSpareFD >= 0 )
+		close( m_iSpareFD );
 }
 
 void SocketListener::Disconnect()
@@ -32,17 +48,17 @@ void SocketListener::Disconnect()
 	m_iServerSocket = -1;
 }
 
-bool SocketListener::Connect( int iPort )
+bool SocketListener::Connect( int iPort, int iBacklog, bool bReusePort, int iDeferSecs )
 {
-	LOG->Debug( "SocketListener::Connect( %d )", iPort );
+	LOG->Debug( "SocketListener::Connect( %d, %d, %d, %d )", iPort, iBacklog, bReusePort, iDeferSecs );
 
 	// Let Listen() know what port we're running on.
 	m_iPort = iPort;
 
 	// Create the server socket.
-	if( ( m_iServerSocket = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) < 0 )
+	if( ( m_iServerSocket = socket( PF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP ) ) < 0 )
 	{
-		LOG->System( "Error creating ServerSocket: %s\n", strerror(errno) );
+		LOG->System( "Error creating ServerSocket: %s", strerror(errno) );
 		return false;
 	}
 
@@ -63,46 +79,139 @@ bool SocketListener::Connect( int iPort )
 	/* allow us to reuse this address even if the socket isn't immediately cleaned up. */
 	int iSetOpt = 1;
 	setsockopt( m_iServerSocket, SOL_SOCKET, SO_REUSEADDR, &iSetOpt, sizeof(int) );
+
+	/* let each reactor thread have its own socket on this port. */
+	if( bReusePort && setsockopt(m_iServerSocket, SOL_SOCKET, SO_REUSEPORT, &iSetOpt, sizeof(int)) < 0 )
+		LOG->System( "Error setting SO_REUSEPORT: %s", strerror(errno) );
+
+	/* don't wake us up for clients that haven't said anything yet. */
+	if( iDeferSecs > 0 && setsockopt(m_iServerSocket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &iDeferSecs, sizeof(int)) < 0 )
+		LOG->System( "Error setting TCP_DEFER_ACCEPT: %s", strerror(errno) );
 	
 	// Bind the ServerSocket
 	if( bind( m_iServerSocket, (sockaddr *)&m_SockAddr, sizeof( m_SockAddr ) ) < 0 )
 	{
-		LOG->System( "Error binding ServerSocket: %s\n", strerror(errno) );
+		LOG->System( "Error binding ServerSocket: %s", strerror(errno) );
+		Disconnect();
 		return false;
 	}
 	
 	// Set the ServerSocket to listen for a connection
-	if( listen( m_iServerSocket, 5 ) < 0 )
+	if( listen( m_iServerSocket, iBacklog ) < 0 )
 	{
-		LOG->System( "Error listening for users: %s\n", strerror(errno) );
+		LOG->System( "Error listening for users: %s", strerror(errno) );
+		Disconnect();
 		return false;
 	}
 
 	return true;
 }
 
-int SocketListener::GetConnection()
+int SocketListener::Adopt( int iSocket )
 {
-	struct sockaddr_in ClientData;
-	socklen_t len = sizeof( ClientData );
+	Disconnect();
 
-	int iClientSocket = accept( m_iServerSocket, (sockaddr*)&ClientData, &len );
+	struct sockaddr_in addr;
+	socklen_t len = sizeof( addr );
 
-	if( iClientSocket < 0 )
+	if( getsockname(iSocket, (sockaddr*)&addr, &len) < 0 || addr.sin_family != AF_INET )
 	{
-		// expected errors: ignore them and continue
-		if( errno == EAGAIN || errno == EWOULDBLOCK )
+		LOG->System( "Can't adopt listening socket %d: %s", iSocket, strerror(errno) );
+		close( iSocket );
+		return -1;
+	}
+
+	m_iServerSocket = iSocket;
+	m_iPort = ntohs( addr.sin_port );
+
+	// it should be already, but accept mustn't block either way, and
+	// the socket's only passed on to a new process on purpose
+	fcntl( m_iServerSocket, F_SETFL, O_NONBLOCK );
+	fcntl( m_iServerSocket, F_SETFD, FD_CLOEXEC );
+
+	return m_iPort;
+}
+
+int SocketListener::GetConnection( NetAddress &addr )
+{
+	while( true )
+	{
+		struct sockaddr_storage ClientData;
+		socklen_t len = sizeof( ClientData );
+
+		// the new socket comes back non-blocking, which saves a syscall or two
+		int iClientSocket = accept4( m_iServerSocket, (sockaddr*)&ClientData, &len,
+			SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+		if( iClientSocket < 0 )
+		{
+			// the backlog's empty
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				return -1;
+
+			// that one went away before we got to it; there may be more
+			if( errno == ECONNABORTED || errno == EINTR )
+				continue;
+
+			// we can't take anyone, but they'll sit in the backlog (and
+			// keep the socket readable) until we do something with them
+			if( errno == EMFILE || errno == ENFILE )
+			{
+				if( ShedConnection() )
+					continue;
+
+				return -1;
+			}
+
+			// unexpected: log a warning, and leave the rest for next time
+			// (ClientData isn't filled in on failure, so there's no IP to log)
+			LOG->System( "Error accepting on port %d: %s", m_iPort, strerror(errno) );
+
 			return -1;
+		}
 
-		// unexpected: log a warning, then continue
-		LOG->System( "Error accepting %s on port %d: %s\n", inet_ntoa(ClientData.sin_addr),
-			m_iPort, strerror(errno) );
+		// we have a valid socket! accept() already told us who it's from,
+		// so remember that instead of asking the kernel again later.
+		addr.Set( (sockaddr*)&ClientData, len );
 
-		return -1;
+		if( m_pConnections == NULL || m_pConnections->Admit(addr) )
+			return iClientSocket;
+
+		// this address has too many connections, or is opening them too
+		// fast. Drop it before it costs us a User (or a login request).
+		LOG->Debug( "Refused connection from %s: over its limit", addr.GetString() );
+		close( iClientSocket );
+	}
+}
+
+bool SocketListener::ShedConnection()
+{
+	const int iError = errno;
+	const uint64_t iNow = Clock::GetMilliseconds();
+
+	if( m_iLastOutOfFiles == 0 || iNow - m_iLastOutOfFiles >= OUT_OF_FILES_LOG_MS )
+	{
+		LOG->System( "Out of file descriptors (%s); dropping new connections on port %d.",
+			strerror(iError), m_iPort );
+		m_iLastOutOfFiles = iNow;
 	}
 
-	// we have a valid socket!
-	return iClientSocket;
+	// we gave the spare back last time, and still can't get it again
+	if( m_iSpareFD < 0 && (m_iSpareFD = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0 )
+		return false;
+
+	// give up the spare for long enough to take the connection, so its
+	// client is told we've hung up instead of being left waiting
+	close( m_iSpareFD );
+
+	int iClientSocket = accept4( m_iServerSocket, NULL, NULL, SOCK_CLOEXEC );
+
+	if( iClientSocket >= 0 )
+		close( iClientSocket );
+
+	m_iSpareFD = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+
+	return iClientSocket >= 0;
 }
 
 /* 
@@ -4,7 +4,11 @@
 #ifndef SOCKETLISTENER_H
 #define SOCKETLISTENER_H
 
+#include <stdint.h>
+
 class ChatServer;
+class ConnectionTable;
+class NetAddress;
 
 class SocketListener
 {
@@ -12,22 +16,53 @@ public:
 	SocketListener();
 	~SocketListener();
 
-	/* Attempt to start listening on iPort, passing clients to pServer. */
-	bool Connect( int iPort );
+	/* Attempt to start listening on iPort. The kernel holds up to iBacklog
+	 * connections for us. With bReusePort, several listeners can bind the
+	 * same port and the kernel spreads new connections between them. If
+	 * iDeferSecs > 0, we don't hear about a connection until its first data
+	 * arrives (or that many seconds pass): TCP_DEFER_ACCEPT. */
+	bool Connect( int iPort, int iBacklog = 5, bool bReusePort = false, int iDeferSecs = 0 );
 	void Disconnect();
 
+	/* takes over iSocket, a listening socket handed to us by the process
+	 * we're replacing. Returns the port it listens on, or -1 (closing
+	 * the socket) if it isn't one. */
+	int Adopt( int iSocket );
+
 	bool IsConnected() const { return m_iServerSocket > 0; }
+	int GetFD() const { return m_iServerSocket; }
 
-	/* Returns a socket fd, or -1 if none is available (no new connections). */
-	int GetConnection();
+	/* connections are admitted by (and counted in) pTable from now on */
+	void SetConnectionTable( ConnectionTable *pTable ) { m_pConnections = pTable; }
+
+	/* Returns a non-blocking socket fd, or -1 if none is available (no
+	 * new connections). Call it until it returns -1 to drain the backlog.
+	 * The peer's address is stored in addr. Connections the table won't
+	 * admit are closed here, and never returned. */
+	int GetConnection( NetAddress &addr );
 
 private:
+	/* when accept() fails for want of a file descriptor, the connection
+	 * stays in the backlog, and we'd hear about it forever. This takes it
+	 * and hangs up, with m_iSpareFD closed to make room. Returns false if
+	 * that didn't work either. */
+	bool ShedConnection();
+
+	/* a descriptor on /dev/null, kept for ShedConnection() */
+	int m_iSpareFD;
+
+	/* when we last logged running out, in Clock::GetMilliseconds() */
+	uint64_t m_iLastOutOfFiles;
+
 	/* Server socket IDs */
 	int m_iServerSocket;
 
 	/* port we're listening on */
 	int m_iPort;
 
+	/* decides which connections we take, if set */
+	ConnectionTable *m_pConnections;
+
 };
 
 #endif // SOCKETLISTENER_H
@@ -0,0 +1,49 @@
+#include "packet/CachedResponse.h"
+
+using namespace std;
+
+CachedResponse::CachedResponse()
+{
+	for( int i = 0; i < NUM_ENCODINGS; ++i )
+	{
+		m_iVersion[i] = 0;
+		m_bValid[i] = false;
+	}
+}
+
+const string* CachedResponse::Get( PacketEncoding encoding, uint64_t iVersion ) const
+{
+	if( !m_bValid[encoding] || m_iVersion[encoding] != iVersion )
+		return NULL;
+
+	return &m_sData[encoding];
+}
+
+const string& CachedResponse::Set( PacketEncoding encoding, uint64_t iVersion, string &sData )
+{
+	m_sData[encoding].swap( sData );
+	sData.clear();
+
+	m_iVersion[encoding] = iVersion;
+	m_bValid[encoding] = true;
+
+	return m_sData[encoding];
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,53 @@
+/* CachedResponse: a run of packets that's the same for whoever asks for
+ * it (a whole list, say), kept serialized in each encoding it's been asked
+ * for in, so it goes out as one write.
+ *
+ * It's tied to the version of whatever it was built from (e.g. the
+ * PresenceTable's); once that's moved on, Get() comes up empty and the
+ * response has to be built again. */
+
+#ifndef CACHED_RESPONSE_H
+#define CACHED_RESPONSE_H
+
+#include <string>
+#include <stdint.h>
+#include "packet/ChatPacket.h"
+
+class CachedResponse
+{
+public:
+	CachedResponse();
+
+	/* the response in this encoding, if it was built as of iVersion;
+	 * otherwise, NULL */
+	const std::string* Get( PacketEncoding encoding, uint64_t iVersion ) const;
+
+	/* keeps sData (leaving it empty) as the response in this encoding as
+	 * of iVersion, and returns the kept copy */
+	const std::string& Set( PacketEncoding encoding, uint64_t iVersion, std::string &sData );
+
+private:
+	std::string m_sData[NUM_ENCODINGS];
+	uint64_t m_iVersion[NUM_ENCODINGS];
+	bool m_bValid[NUM_ENCODINGS];
+};
+
+#endif // CACHED_RESPONSE_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -1,8 +1,9 @@
 #include "packet/ChatPacket.h"
+#include "packet/PacketView.h"
 #include "packet/PacketUtil.h"
-#include <cstdlib>
-#include <vector>
-#include <cstdio>
+#include "packet/MessageCodes.h"
+#include "util/Arena.h"
+#include <charconv>
 using namespace std;
 
 ChatPacket::ChatPacket() : iCode( INVALID_CODE )
@@ -43,45 +44,140 @@ ChatPacket::ChatPacket( uint16_t iCode, const std::string &sUsername_,
 	this->b = b;
 }
 
-ChatPacket::ChatPacket( const string &sData ) : iCode( INVALID_CODE )
+ChatPacket::ChatPacket( const PacketView &view ) :
+	sUsername( view.sUsername ), sMessage( view.sMessage )
 {
-	FromString( sData );
+	iCode = view.iCode;
+	r = view.r;
+	g = view.g;
+	b = view.b;
 }
 
-bool ChatPacket::FromString( const string &sData )
+string ChatPacket::ToString() const
 {
-	/* XXX: should we split this off into a util file? */
-	vector<string> vTokens;
+	return Encode( ENCODING_TEXT );
+}
 
-	split( sData, vTokens, '`' );
+string ChatPacket::ToBinary() const
+{
+	return Encode( ENCODING_BINARY );
+}
 
-	// not a well-formed packet
-	if( vTokens.size() != 6 )
-		return false;
+/* Creates a string out of packet data. The size is worked out first,
+ * so the string's allocated once and the packet's written right into it. */
+string ChatPacket::Encode( PacketEncoding encoding ) const
+{
+	string ret;
+	PacketView( *this ).AppendTo( ret, encoding );
+
+	return ret;
+}
+
+int ChatPacket::GetBinaryFrame( const char *pData, unsigned iLen,
+	unsigned &iHeaderLen, unsigned &iBodyLen )
+{
+	uint32_t iValue;
+	const int iRead = PacketUtil::GetVarint( pData, iLen, iValue );
+
+	iHeaderLen = iBodyLen = 0;
+
+	if( iRead <= 0 )
+		return iRead;
 
-	iCode = atoi( vTokens[0].c_str() );
-	sUsername = vTokens[1];
-	sMessage = vTokens[2];
-	r = atoi( vTokens[3].c_str() );
-	g = atoi( vTokens[4].c_str() );
-	b = atoi( vTokens[5].c_str() );
+	iHeaderLen = iRead;
+	iBodyLen = iValue;
 
-	return true;
+	return (iLen - iHeaderLen >= iBodyLen) ? 1 : 0;
 }
 
-/* Creates a string out of packet data. The data is placed in a
- * buffer and formatted, then copied to a string and returned. */
-string ChatPacket::ToString() const
+uint16_t ChatPacket::GetCode( string_view sData, PacketEncoding encoding )
 {
-	/* Create a buffer based off param sizes and a bit extra (for delims, numbers) */
-	unsigned iLen = sUsername.size() + sMessage.size() + 20;
+	uint32_t iValue;
 
-	char *sBuffer = new char[iLen];
-	snprintf( sBuffer, iLen, "%u`%s`%s`%u`%u`%u\n", iCode, sUsername.c_str(), sMessage.c_str(), r, g, b );
-	string ret( sBuffer );
-	delete sBuffer;
+	if( encoding == ENCODING_TEXT )
+	{
+		const char *pEnd = sData.data() + sData.size();
 
-	return ret;
+		if( from_chars(sData.data(), pEnd, iValue).ec != errc() || iValue >= INVALID_CODE )
+			return INVALID_CODE;
+
+		return iValue;
+	}
+
+	if( PacketUtil::GetVarint(sData.data(), sData.size(), iValue) <= 0 || iValue >= INVALID_CODE )
+		return INVALID_CODE;
+
+	return iValue;
+}
+
+EncodedPacket::EncodedPacket( const PacketView &packet, Arena *pArena )
+{
+	Measure( packet );
+
+	const unsigned iSize = iStart[NUM_ENCODINGS];
+
+	bOwned = (pArena == NULL);
+	pData = bOwned ? new char[iSize] : (char*)pArena->Alloc( iSize, 1 );
+
+	Encode( packet );
+}
+
+EncodedPacket::EncodedPacket( const PacketView &packet, char *pBuffer )
+{
+	Measure( packet );
+
+	bOwned = false;
+	pData = pBuffer;
+
+	Encode( packet );
+}
+
+EncodedPacket::~EncodedPacket()
+{
+	if( bOwned )
+		delete[] pData;
+}
+
+unsigned EncodedPacket::GetSize( const PacketView &packet )
+{
+	unsigned iSize = 0;
+
+	for( int i = 0; i < NUM_ENCODINGS; ++i )
+		iSize += packet.GetEncodedSize( PacketEncoding(i) );
+
+	return iSize;
+}
+
+void EncodedPacket::Measure( const PacketView &packet )
+{
+	iStart[0] = 0;
+
+	for( int i = 0; i < NUM_ENCODINGS; ++i )
+		iStart[i+1] = iStart[i] + packet.GetEncodedSize( PacketEncoding(i) );
+}
+
+void EncodedPacket::Encode( const PacketView &packet )
+{
+	for( int i = 0; i < NUM_ENCODINGS; ++i )
+		packet.EncodeTo( PacketEncoding(i), pData + iStart[i] );
+
+	bLossy = ChatPacket::IsLossy( packet.iCode );
+}
+
+bool ChatPacket::IsLossy( uint16_t iCode )
+{
+	// typing notifications and idle updates go stale almost
+	// immediately, and the next one will correct a missed one.
+	switch( iCode )
+	{
+	case START_TYPING:
+	case STOP_TYPING:
+	case RESET_TYPING:
+	case CLIENT_IDLE:
+		return true;
+	default:
+		return false;
+	}
 }
 
 /* 
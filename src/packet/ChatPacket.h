@@ -1,16 +1,55 @@
-/* ChatPacket: contains the separated pieces of data from a data packet. */
+/* ChatPacket: contains the separated pieces of data from a data packet.
+ *
+ * Packets go over the wire in one of two encodings. The text encoding,
+ * "code`user`message`r`g`b\n", is what every client speaks to begin with.
+ * A client can ask for the binary encoding by logging in (USER_JOIN) with
+ * BINARY_PROTOCOL set in r. If it does, its ACCESS_GRANTED comes back with
+ * the same bit set, and that's the last text it gets: everything after
+ * it, both ways, including anything the client sent after its login, is
+ * binary. A binary packet is
+ *
+ *	varint	length of the rest of the packet
+ *	varint	code
+ *	varint	username length, then the username
+ *	varint	message length, then the message
+ *	3 bytes	r, g, b
+ *
+ * with varints as in PacketUtil. Fields can hold anything but '`', '\n',
+ * '\r' and NUL: text clients get these packets too, and they'd take those
+ * for the end of a field or packet. A packet with one is malformed, and
+ * its sender is dropped.
+ *
+ * Independently, a client can set DEFLATE_PROTOCOL in r to have what it's
+ * sent compressed. If the server allows it, ACCESS_GRANTED comes back with
+ * that bit set too, and everything the server sends after it (in either
+ * encoding) is one raw deflate stream, as Deflater.h describes. What the
+ * client sends isn't compressed. */
 
 #ifndef CHAT_PACKET_H
 #define CHAT_PACKET_H
 
 #include <string>
+#include <string_view>
 #include <stdint.h>
 
+struct PacketView;
+
 const uint16_t INVALID_CODE = 0xFFFF;
 
 // defines a blank packet field
 const std::string BLANK = "_";
 
+enum PacketEncoding
+{
+	ENCODING_TEXT,
+	ENCODING_BINARY,
+	NUM_ENCODINGS
+};
+
+// flags a client sets in its login's r field for protocol options
+const uint8_t BINARY_PROTOCOL = 2;	/* ENCODING_BINARY, both ways */
+const uint8_t DEFLATE_PROTOCOL = 4;	/* a deflate stream, server to client */
+
 struct ChatPacket
 {
 public:
@@ -32,18 +71,36 @@ public:
 	ChatPacket( uint16_t iCode, const std::string &sUsername,
 		const std::string &sMessage, uint8_t r, uint8_t g, uint8_t b );
 
-	/* Shortcut constructor for ChatPacket() and FromString(str). */
-	ChatPacket( const std::string &sData );
-
-	/* Loads packet data from a string, returns true if well-formed */
-	bool FromString( const std::string &sData );
+	/* Copies the fields out of a parsed packet (see PacketView). */
+	ChatPacket( const PacketView &view );
 
 	/* Returns a network-formatted string from the packet */
 	std::string ToString() const;
 
+	/* Returns the binary encoding of the packet, length and all */
+	std::string ToBinary() const;
+
+	/* the above, in whichever encoding's given */
+	std::string Encode( PacketEncoding encoding ) const;
+
+	/* finds the first binary packet in the iLen bytes at pData. Returns 1
+	 * if it's all there, 0 if it isn't yet, or -1 if the length's garbage.
+	 * Once the length's in, iHeaderLen and iBodyLen are the sizes of it and
+	 * the rest of the packet; until then, they're 0. */
+	static int GetBinaryFrame( const char *pData, unsigned iLen,
+		unsigned &iHeaderLen, unsigned &iBodyLen );
+
+	/* reads just the code from an encoded packet (INVALID_CODE if it
+	 * can't), without the work of decoding the rest */
+	static uint16_t GetCode( std::string_view sData, PacketEncoding encoding );
+
 	/* if IsValid, contains valid packet data. */
 	bool IsValid() const	{ return iCode != INVALID_CODE; }
 
+	/* true if a slow client can miss this packet without harm */
+	bool IsLossy() const	{ return IsLossy( iCode ); }
+	static bool IsLossy( uint16_t iCode );
+
 public:
 	uint16_t iCode;
 	std::string sUsername;
@@ -52,6 +109,47 @@ public:
 
 };
 
+class Arena;
+
+/* a packet encoded once in every encoding, for sending to many users. The
+ * encodings sit end to end in one buffer: from the heap, from pArena if
+ * it's given (in which case, it's only good until the Arena's Reset()), or
+ * one the caller's made room for. */
+struct EncodedPacket
+{
+	EncodedPacket( const PacketView &packet, Arena *pArena = NULL );
+	/* encodes into pBuffer, which has to hold GetSize( packet ) bytes.
+	 * The buffer stays the caller's. */
+	EncodedPacket( const PacketView &packet, char *pBuffer );
+	~EncodedPacket();
+
+	/* how big the buffer for all of packet's encodings is */
+	static unsigned GetSize( const PacketView &packet );
+
+	std::string_view Get( PacketEncoding encoding ) const
+	{
+		return std::string_view( pData + iStart[encoding], iStart[encoding+1] - iStart[encoding] );
+	}
+
+	char *pData;
+	/* if pData's ours to delete */
+	bool bOwned;
+
+	/* where each encoding starts in pData, and where the last one ends */
+	unsigned iStart[NUM_ENCODINGS+1];
+
+	bool bLossy;
+
+private:
+	/* finds where each encoding starts, and encodes them into pData */
+	void Measure( const PacketView &packet );
+	void Encode( const PacketView &packet );
+
+	// the buffer may be ours
+	EncodedPacket( const EncodedPacket& );
+	EncodedPacket& operator=( const EncodedPacket& );
+};
+
 #endif // CHAT_PACKET_H
 
 /* 
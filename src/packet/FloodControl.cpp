@@ -0,0 +1,199 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "packet/FloodControl.h"
+#include "packet/MessageCodes.h"
+#include "logger/Logger.h"
+#include "util/Config.h"
+#include "util/StringUtil.h"
+
+using namespace std;
+
+/* the most packets we'll hold for one user; any more are dropped */
+const unsigned MAX_DELAYED_PACKETS = 32;
+
+/* strikes older than this are forgotten, in ms */
+const uint64_t STRIKE_WINDOW = 60*1000;
+
+/* the least time between two warnings to one user, in ms */
+const uint64_t WARNING_INTERVAL = 5*1000;
+
+/* config keys for each FloodClass, in order */
+static const char* const CLASS_KEYS[NUM_FLOOD_CLASSES] =
+{
+	"FloodChat", "FloodTyping", "FloodStatus", "FloodQuery"
+};
+
+FloodControl::FloodControl()
+{
+	memset( m_Limits, 0, sizeof(m_Limits) );
+	m_iStrikes = m_iMuteMinutes = 0;
+}
+
+void FloodControl::Load( const Config *cfg )
+{
+	for( unsigned i = 0; i < NUM_FLOOD_CLASSES; ++i )
+	{
+		Limit &limit = m_Limits[i];
+		limit.iPerMinute = limit.iBurst = 0;
+		limit.action = FLOOD_DROP;
+
+		// e.g. "60,10,warn": 60 a minute after a burst of 10, then warn
+		const char *szLimit = cfg->Get( CLASS_KEYS[i], true );
+
+		if( szLimit == NULL )
+			continue;
+
+		vector<string> vsFields;
+		StringUtil::Split( szLimit, vsFields, ',' );
+
+		if( vsFields.size() < 2 )
+		{
+			LOG->System( "Ignoring %s: expected \"rate,burst[,action]\"", CLASS_KEYS[i] );
+			continue;
+		}
+
+		limit.iPerMinute = max( atoi(vsFields[0].c_str()), 0 );
+		limit.iBurst = max( atoi(vsFields[1].c_str()), 1 );
+
+		const string sAction = vsFields.size() > 2 ? vsFields[2] : "drop";
+
+		if( sAction == "delay" )
+			limit.action = FLOOD_DELAY;
+		else if( sAction == "warn" )
+			limit.action = FLOOD_WARN;
+		else if( sAction != "drop" )
+			LOG->System( "Unknown %s action \"%s\"; dropping instead", CLASS_KEYS[i], sAction.c_str() );
+	}
+
+	m_iStrikes = max( cfg->GetInt("FloodStrikes", true, 0), 0 );
+	m_iMuteMinutes = max( cfg->GetInt("FloodMuteMinutes", true, 5), 1 );
+}
+
+FloodClass FloodControl::GetClass( int iCode )
+{
+	switch( iCode )
+	{
+	case ROOM_MESSAGE:
+	case ROOM_ACTION:
+	case USER_PM:
+	case MOD_CHAT:
+		return FLOOD_CHAT;
+	case START_TYPING:
+	case STOP_TYPING:
+	case RESET_TYPING:
+		return FLOOD_TYPING;
+	case CLIENT_IDLE:
+	case CLIENT_AWAY:
+	case CLIENT_BACK:
+	case JOIN_ROOM:
+	case CREATE_ROOM:
+		return FLOOD_STATUS;
+	case USER_LIST:
+	case ROOM_LIST:
+		return FLOOD_QUERY;
+	default:
+		return FLOOD_UNLIMITED;
+	}
+}
+
+void FloodControl::Start( FloodState &state, uint64_t iNow )
+{
+	if( state.bStarted )
+		return;
+
+	for( unsigned i = 0; i < NUM_FLOOD_CLASSES; ++i )
+		state.Buckets[i].Fill( m_Limits[i].iBurst, iNow );
+
+	state.iStrikesSince = iNow;
+	state.bStarted = true;
+}
+
+void FloodControl::AddStrike( FloodState &state, uint64_t iNow )
+{
+	if( iNow - state.iStrikesSince > STRIKE_WINDOW )
+	{
+		state.iStrikes = 0;
+		state.iStrikesSince = iNow;
+	}
+
+	++state.iStrikes;
+}
+
+FloodAction FloodControl::Check( FloodState &state, int iCode, uint64_t iNow )
+{
+	Start( state, iNow );
+
+	const FloodClass fc = GetClass( iCode );
+
+	// anything behind a delayed packet waits its turn, limited or not
+	if( !state.vDelayed.empty() )
+	{
+		if( state.vDelayed.size() < MAX_DELAYED_PACKETS )
+			return FLOOD_DELAY;
+
+		AddStrike( state, iNow );
+		return FLOOD_DROP;
+	}
+
+	if( fc == FLOOD_UNLIMITED )
+		return FLOOD_PASS;
+
+	const Limit &limit = m_Limits[fc];
+
+	if( limit.iPerMinute == 0 || state.Buckets[fc].Take(limit.iPerMinute, limit.iBurst, iNow) )
+		return FLOOD_PASS;
+
+	AddStrike( state, iNow );
+	return limit.action;
+}
+
+bool FloodControl::Retry( FloodState &state, int iCode, uint64_t iNow )
+{
+	const FloodClass fc = GetClass( iCode );
+
+	if( fc == FLOOD_UNLIMITED )
+		return true;
+
+	const Limit &limit = m_Limits[fc];
+
+	return limit.iPerMinute == 0 || state.Buckets[fc].Take( limit.iPerMinute, limit.iBurst, iNow );
+}
+
+bool FloodControl::IsStruckOut( FloodState &state, uint64_t iNow )
+{
+	if( m_iStrikes == 0 || state.iStrikes < m_iStrikes )
+		return false;
+
+	state.iStrikes = 0;
+	state.iStrikesSince = iNow;
+	return true;
+}
+
+bool FloodControl::ShouldWarn( FloodState &state, uint64_t iNow )
+{
+	if( state.iLastWarning != 0 && iNow - state.iLastWarning < WARNING_INTERVAL )
+		return false;
+
+	state.iLastWarning = iNow;
+	return true;
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,129 @@
+/* FloodControl: limits how fast each user can send each kind of packet,
+ * so one client can't make the server fan out more than its share. Every
+ * user has a token bucket per FloodClass; a packet over its class's limit
+ * is dropped, delayed until the bucket refills, or dropped with a warning
+ * to the user, as configured. Users who keep going over get muted.
+ *
+ * Packets that don't fall in a class (logins, mod commands, ...) are never
+ * limited. */
+
+#ifndef FLOOD_CONTROL_H
+#define FLOOD_CONTROL_H
+
+#include <deque>
+#include <string>
+#include <stdint.h>
+
+#include "util/TokenBucket.h"
+
+class Config;
+
+enum FloodClass
+{
+	FLOOD_CHAT,		/* room messages, actions, PMs, mod chat */
+	FLOOD_TYPING,		/* typing notifications */
+	FLOOD_STATUS,		/* idle/away/back, joining or making rooms */
+	FLOOD_QUERY,		/* asking for the user or room list */
+	NUM_FLOOD_CLASSES,
+	FLOOD_UNLIMITED = NUM_FLOOD_CLASSES
+};
+
+enum FloodAction
+{
+	FLOOD_PASS,		/* under the limit: handle the packet */
+	FLOOD_DROP,		/* over the limit: ignore the packet */
+	FLOOD_DELAY,		/* over the limit: handle it once there's room */
+	FLOOD_WARN		/* over the limit: ignore it, and tell the user */
+};
+
+/* one user's standing with the limits. Only its Shard's thread uses it. */
+struct FloodState
+{
+	FloodState() : bStarted(false), iStrikes(0), iStrikesSince(0), iLastWarning(0) { }
+
+	bool bStarted;
+	TokenBucket Buckets[NUM_FLOOD_CLASSES];
+
+	/* times over a limit since iStrikesSince (in ms) */
+	unsigned iStrikes;
+	uint64_t iStrikesSince;
+
+	uint64_t iLastWarning;
+
+	/* packets waiting on FLOOD_DELAY, oldest first */
+	std::deque<std::string> vDelayed;
+};
+
+class FloodControl
+{
+public:
+	FloodControl();
+
+	/* reads the limits from cfg; see config.txt */
+	void Load( const Config *cfg );
+
+	static FloodClass GetClass( int iCode );
+
+	/* decides what to do with a packet with iCode, as of iNow (in
+	 * Clock::GetMilliseconds()). FLOOD_PASS takes a token for it; any
+	 * other action is the class's over-limit action, and counts a strike.
+	 * Once a user has packets delayed, everything else they send waits
+	 * behind them (FLOOD_DELAY), so nothing's handled out of order; the
+	 * caller should add the packet to state.vDelayed. If that's full,
+	 * the packet's dropped instead. */
+	FloodAction Check( FloodState &state, int iCode, uint64_t iNow );
+
+	/* takes a token for the oldest delayed packet, with iCode, if there's
+	 * one to take. Returns false if it has to keep waiting. */
+	bool Retry( FloodState &state, int iCode, uint64_t iNow );
+
+	/* true if the user's been over a limit often enough to be muted for
+	 * it. If so, their strikes start over. */
+	bool IsStruckOut( FloodState &state, uint64_t iNow );
+
+	/* true if a FLOOD_WARN should be sent to the user now; warnings are
+	 * rate limited too, or they'd be a flood of their own */
+	bool ShouldWarn( FloodState &state, uint64_t iNow );
+
+	/* how long a struck out user stays muted */
+	unsigned GetMuteSeconds() const	{ return m_iMuteMinutes * 60; }
+
+private:
+	/* fills every bucket if this is the user's first packet */
+	void Start( FloodState &state, uint64_t iNow );
+
+	void AddStrike( FloodState &state, uint64_t iNow );
+
+	struct Limit
+	{
+		unsigned iPerMinute, iBurst;
+		FloodAction action;
+	};
+
+	/* iPerMinute == 0 means no limit */
+	Limit m_Limits[NUM_FLOOD_CLASSES];
+
+	/* this many strikes within a minute mutes a user; 0 never does */
+	unsigned m_iStrikes;
+	unsigned m_iMuteMinutes;
+};
+
+#endif // FLOOD_CONTROL_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
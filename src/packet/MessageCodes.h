@@ -1,70 +1,78 @@
 #ifndef MESSAGE_CODES_H
 #define MESSAGE_CODES_H
 
+/* every code, as X( name, value ). The enum's built from this, and so is
+ * PacketHandler's dispatch table, which won't compile unless it says what
+ * to do with each one. */
+#define MESSAGE_CODES( X ) \
+	/* user messages */ \
+	X( USER_LIST,	0 ) \
+	X( USER_JOIN,	1 ) \
+	X( USER_PART,	2 ) \
+	\
+	/* communication messages */ \
+	X( ROOM_MESSAGE,	3 ) \
+	X( ROOM_ACTION,	4 ) \
+	X( USER_PM,		5 ) \
+	\
+	/* moderator commands */ \
+	X( USER_KICK,	6 ) \
+	X( USER_DISABLE,	7 ) \
+	X( USER_BAN,	8 ) \
+	X( USER_UNBAN,	9 ) \
+	X( USER_MUTE,	10 ) \
+	X( USER_UNMUTE,	11 ) \
+	\
+	X( SERVER_DOWN,	12 ) \
+	X( IDLE_KICK,	13 ) \
+	X( IP_QUERY,	14 ) \
+	X( DEBUG_COMMAND,	15 ) \
+	\
+	/* timed mod commands */ \
+	X( USER_TIMEDBAN,	16 ) \
+	X( USER_TIMEDMUTE,	17 ) \
+	\
+	/* mod chat command */ \
+	X( MOD_CHAT,	18 ) \
+	\
+	/* login responses */ \
+	X( ACCESS_GRANTED,	100 ) \
+	X( ACCESS_DENIED,	101 ) \
+	X( LIMIT_REACHED,	102 ) \
+	\
+	/* ??? */ \
+	X( PM_BOX,		200 ) \
+	\
+	/* other mod commands */ \
+	X( FORCE_CLEAR,	300 ) \
+	X( FORCE_URL,	301 ) \
+	\
+	/* room commands */ \
+	X( JOIN_ROOM,	400 ) \
+	X( CREATE_ROOM,	402 ) \
+	X( DESTROY_ROOM,	403 ) \
+	X( ROOM_LIST,	404 ) \
+	X( FORCE_JOIN,	405 ) \
+	\
+	/* client messages */ \
+	X( CLIENT_IDLE,	500 ) \
+	X( CLIENT_AWAY,	501 ) \
+	X( CLIENT_BACK,	502 ) \
+	X( CLIENT_CONFIG,	600 ) \
+	\
+	/* global broadcast */ \
+	X( WALL_MESSAGE,	601 ) \
+	\
+	/* more client messages */ \
+	X( START_TYPING,	602 ) \
+	X( STOP_TYPING,	603 ) \
+	X( RESET_TYPING,	604 )
+
 enum MessageCode
 {
-	// user messages
-	USER_LIST	= 0,
-	USER_JOIN	= 1,
-	USER_PART	= 2,
-
-	// communication messages
-	ROOM_MESSAGE	= 3,
-	ROOM_ACTION	= 4,
-	USER_PM		= 5,
-
-	// moderator commands
-	USER_KICK	= 6,
-	USER_DISABLE	= 7,
-	USER_BAN	= 8,
-	USER_UNBAN	= 9,
-	USER_MUTE	= 10,
-	USER_UNMUTE	= 11,
-
-	SERVER_DOWN	= 12,
-	IDLE_KICK	= 13,
-	IP_QUERY	= 14,
-	DEBUG_COMMAND	= 15,
-
-	// timed mod commands
-	USER_TIMEDBAN	= 16,
-	USER_TIMEDMUTE	= 17,
-
-	// mod chat command
-	MOD_CHAT	= 18,
-
-	// login responses
-	ACCESS_GRANTED	= 100,
-	ACCESS_DENIED	= 101,
-	LIMIT_REACHED	= 102,
-
-	// ???
-	PM_BOX		= 200,
-
-	// other mod commands
-	FORCE_CLEAR	= 300,
-	FORCE_URL	= 301,
-
-	// room commands
-	JOIN_ROOM	= 400,
-	CREATE_ROOM	= 402,
-	DESTROY_ROOM	= 403,
-	ROOM_LIST	= 404,
-	FORCE_JOIN	= 405,
-
-	// client messages
-	CLIENT_IDLE	= 500,
-	CLIENT_AWAY	= 501,
-	CLIENT_BACK	= 502,
-	CLIENT_CONFIG	= 600,
-
-	// global broadcast
-	WALL_MESSAGE	= 601,
-
-	// more client messages
-	START_TYPING	= 602,
-	STOP_TYPING	= 603,
-	RESET_TYPING	= 604
+#define MESSAGE_CODE_ENUM( name, value )	name = value,
+	MESSAGE_CODES( MESSAGE_CODE_ENUM )
+#undef MESSAGE_CODE_ENUM
 };
 
 #endif // MESSAGE_CODES_H
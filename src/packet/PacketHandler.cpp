@@ -1,13 +1,132 @@
+#include <array>
 #include "packet/PacketHandler.h"
+#include "packet/PacketStats.h"
 #include "logger/Logger.h"
+#include "util/Clock.h"
+#include "Shard.h"
 
-HandlerMap* PacketHandler::GetMap()
+namespace
 {
-	static HandlerMap g_HandlerMap;
-	return &g_HandlerMap;
+	/* what to do with every code, and what its handler needs locked (see
+	 * Shard.h). Order doesn't matter, but each code in MessageCodes.h has
+	 * to be here exactly once; the checks below fail the build otherwise. */
+	constexpr HandlerEntry HANDLERS[] =
+	{
+		{ USER_LIST,		&ListUsers,		LOCK_LISTS },
+		{ USER_JOIN,		&Login,			LOCK_WRITE },
+		{ USER_PART,		&Logout,		LOCK_NONE },
+
+		{ ROOM_MESSAGE,		&HandleMessage,		LOCK_NONE },
+		{ ROOM_ACTION,		&Action,		LOCK_NONE },
+		{ USER_PM,		&HandlePM,		LOCK_READ },
+
+		{ USER_KICK,		&UserAction,		LOCK_WRITE },
+		{ USER_DISABLE,		&UserAction,		LOCK_WRITE },
+		{ USER_BAN,		&UserAction,		LOCK_WRITE },
+		{ USER_UNBAN,		&UserAction,		LOCK_WRITE },
+		{ USER_MUTE,		&UserAction,		LOCK_WRITE },
+		{ USER_UNMUTE,		&UserAction,		LOCK_WRITE },
+
+		{ SERVER_DOWN,		NULL },
+		{ IDLE_KICK,		NULL },
+		{ IP_QUERY,		&UserAction,		LOCK_READ },
+		{ DEBUG_COMMAND,	NULL },
+
+		// not implemented
+		{ USER_TIMEDBAN,	NULL },
+		{ USER_TIMEDMUTE,	NULL },
+
+		{ MOD_CHAT,		&ModChat,		LOCK_NONE },
+
+		{ ACCESS_GRANTED,	NULL },
+		{ ACCESS_DENIED,	NULL },
+		{ LIMIT_REACHED,	NULL },
+
+		{ PM_BOX,		NULL },
+
+		{ FORCE_CLEAR,		&ForceClear,		LOCK_NONE },
+		{ FORCE_URL,		NULL },
+
+		{ JOIN_ROOM,		&HandleJoin,		LOCK_READ },
+		{ CREATE_ROOM,		&HandleCreate,		LOCK_WRITE },
+		{ DESTROY_ROOM,		&HandleDestroy,		LOCK_WRITE },
+		{ ROOM_LIST,		&ListRooms,		LOCK_READ },
+		{ FORCE_JOIN,		&HandleForceJoin,	LOCK_READ },
+
+		{ CLIENT_IDLE,		NULL },
+		{ CLIENT_AWAY,		&Away,			LOCK_NONE },
+		{ CLIENT_BACK,		NULL },
+		{ CLIENT_CONFIG,	&HandleSetConfig,	LOCK_NONE },
+
+		{ WALL_MESSAGE,		NULL },
+
+		{ START_TYPING,		&HandleTyping,		LOCK_READ },
+		{ STOP_TYPING,		&HandleTyping,		LOCK_READ },
+		{ RESET_TYPING,		&HandleTyping,		LOCK_READ },
+	};
+
+#define MESSAGE_CODE_VALUE( name, value )	name,
+	constexpr MessageCode ALL_CODES[] = { MESSAGE_CODES( MESSAGE_CODE_VALUE ) };
+#undef MESSAGE_CODE_VALUE
+
+	constexpr unsigned NUM_HANDLERS = sizeof(HANDLERS) / sizeof(HANDLERS[0]);
+	constexpr unsigned NUM_CODES = sizeof(ALL_CODES) / sizeof(ALL_CODES[0]);
+
+	constexpr unsigned CountEntries( MessageCode iCode )
+	{
+		unsigned iCount = 0;
+		for( unsigned i = 0; i < NUM_HANDLERS; ++i )
+			if( HANDLERS[i].iCode == iCode )
+				++iCount;
+		return iCount;
+	}
+
+	constexpr bool HasDuplicates()
+	{
+		for( unsigned i = 0; i < NUM_HANDLERS; ++i )
+			if( CountEntries(HANDLERS[i].iCode) != 1 )
+				return true;
+		return false;
+	}
+
+	constexpr bool CoversAllCodes()
+	{
+		for( unsigned i = 0; i < NUM_CODES; ++i )
+			if( CountEntries(ALL_CODES[i]) == 0 )
+				return false;
+		return true;
+	}
+
+	static_assert( !HasDuplicates(), "a code is in HANDLERS more than once" );
+	static_assert( CoversAllCodes(), "a code from MessageCodes.h is missing from HANDLERS" );
+
+	constexpr unsigned MaxCode()
+	{
+		unsigned iMax = 0;
+		for( unsigned i = 0; i < NUM_CODES; ++i )
+			if( unsigned(ALL_CODES[i]) > iMax )
+				iMax = ALL_CODES[i];
+		return iMax;
+	}
+
+	/* HANDLERS spread out by code. The codes are clustered, but there are
+	 * few enough of them that a flat table's only ~5K, and a lookup's one
+	 * bounds check and one load. */
+	typedef std::array<HandlerEntry, MaxCode()+1> HandlerTable;
+
+	constexpr HandlerTable BuildTable()
+	{
+		HandlerTable table {};
+		for( unsigned i = 0; i < NUM_HANDLERS; ++i )
+			table[HANDLERS[i].iCode] = HANDLERS[i];
+		return table;
+	}
+
+	constexpr HandlerTable TABLE = BuildTable();
 }
 
-bool PacketHandler::Handle( ChatServer *server, User *user, const ChatPacket *packet )
+bool PacketHandler::Handle( ChatServer *server, User *user, const PacketView *packet,
+	unsigned iBytes )
 {
 	// if the user who sent this was away, send a notification
 	if( user->IsAway() )
@@ -18,18 +137,37 @@ bool PacketHandler::Handle( ChatServer *server, User *user, const ChatPacket *pa
 	user->PacketSent();
 
 	// try to find a handler for this packet's code
-	HandlerMap::iterator it = GetMap()->find( MessageCode(packet->iCode) );
+	const HandlerEntry *entry = packet->iCode < TABLE.size() ? &TABLE[packet->iCode] : NULL;
+	PacketStats *pStats = user->GetShard()->GetStats();
+
+	if( entry != NULL && entry->fn != NULL )
+	{
+		// whatever it writes, here or (for broadcasts) on other Shards,
+		// is counted towards this code
+		const uint64_t iWritten = User::GetBytesWritten();
+		const uint64_t iStart = Clock::ReadNanoseconds();
+		PacketStats::SetCurrentCode( packet->iCode );
+
+		server->Lock( entry->lock );
+		const bool bHandled = entry->fn( server, user, packet );
+		server->Unlock( entry->lock );
+
+		PacketStats::SetCurrentCode( PacketStats::NO_CODE );
+		pStats->AddHandled( packet->iCode, iBytes, User::GetBytesWritten() - iWritten,
+			Clock::ReadNanoseconds() - iStart, bHandled );
+
+		return bHandled;
+	}
 
-	if( it != GetMap()->end() )
-		return it->second( server, user, packet );
+	pStats->AddUnhandled( packet->iCode, iBytes );
 
 	/* no handler found, so warn about it. */
 	LOG->Debug( "Code %u requested, but no handler found!", packet->iCode );
 
 	LOG->Debug( "Unhandled packet data:" );
 	LOG->Debug( "\tCode: %d", packet->iCode );
-	LOG->Debug( "\tUsername: %s", packet->sUsername.c_str() );
-	LOG->Debug( "\tMessage: %s", packet->sMessage.c_str() );
+	LOG->Debug( "\tUsername: %.*s", int(packet->sUsername.size()), packet->sUsername.data() );
+	LOG->Debug( "\tMessage: %.*s", int(packet->sMessage.size()), packet->sMessage.data() );
 	LOG->Debug( "\tRGB: %d/%d/%d", packet->r, packet->g, packet->b );
 
 	return false;
@@ -37,8 +175,9 @@ bool PacketHandler::Handle( ChatServer *server, User *user, const ChatPacket *pa
 
 void PacketHandler::DebugDump()
 {
-	for( HandlerMap::iterator it = GetMap()->begin(); it != GetMap()->end(); ++it )
-		LOG->Debug( "%d handled at %p", it->first, it->second );
+	for( unsigned i = 0; i < NUM_HANDLERS; ++i )
+		if( HANDLERS[i].fn != NULL )
+			LOG->Debug( "%d handled at %p", HANDLERS[i].iCode, HANDLERS[i].fn );
 }
 
 /* 
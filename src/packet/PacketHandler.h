@@ -1,51 +1,71 @@
-/* PacketHandler: defines a base class that includes a static registration
- * for packet handlers. I like it because it's easier than doing manual
- * branching (and probably faster), plus it's easier to modify later. */
+/* PacketHandler: finds the function that handles a packet's code. Every
+ * code has a slot in a table built at compile time (see PacketHandler.cpp),
+ * so finding it is one array load, and a code with no entry - or two - is
+ * a build error instead of a packet nobody handles. */
 
 #ifndef PACKET_HANDLER_H
 #define PACKET_HANDLER_H
 
-#include <map>
 #include <stdint.h>
 
 // All handlers will need these headers, so we may as well include them
 #include "ChatServer.h"
 #include "model/User.h"
 #include "packet/ChatPacket.h"
+#include "packet/PacketView.h"
 #include "packet/MessageCodes.h"
 
-// function pointer for a packet handler, taking pointers
-// to ChatServer, a User, and a ChatPacket for handling
-typedef bool (*HandlerFn)(ChatServer*,User*,const ChatPacket*);
+// function pointer for a packet handler, taking pointers to ChatServer,
+// a User, and a PacketView for handling. The view's fields point into
+// the user's input, so a handler copies out whatever it keeps.
+typedef bool (*HandlerFn)(ChatServer*,User*,const PacketView*);
 
-// aliases, for convenience
-typedef std::pair<MessageCode,HandlerFn> HandlerEntry;
-typedef std::map<MessageCode,HandlerFn> HandlerMap;
+/* one code and the function that handles it: NULL for codes we only
+ * ever send. The function's called with lock held (see Shard.h). */
+struct HandlerEntry
+{
+	MessageCode iCode;
+	HandlerFn fn;
+	HandlerLock lock;
+};
 
 namespace PacketHandler
 {
-	/* gets the static map that holds handler entries */
-	HandlerMap* GetMap();
-
 	/* finds the handler for this packet and handles it. returns false
-	 * if no handler exists or if the packet could not be handled. */
-	bool Handle( ChatServer *server, User *user, const ChatPacket *packet );
+	 * if no handler exists or if the packet could not be handled. The
+	 * packet (iBytes long, as it came in) is counted in the stats of the
+	 * user's Shard. */
+	bool Handle( ChatServer *server, User *user, const PacketView *packet,
+		unsigned iBytes );
 
-	/* dumps the entire map in terms of code to function pointer */
+	/* dumps the entire table in terms of code to function pointer */
 	void DebugDump();
 }
 
-struct RegisterHandler
-{
-	RegisterHandler( MessageCode iCode, HandlerFn fn )
-	{
-		PacketHandler::GetMap()->insert( HandlerEntry(iCode,fn) );
-	}
-};
+/* the handlers, in handlers/ */
+bool ListUsers( ChatServer *server, User *user, const PacketView *packet );
+bool Login( ChatServer *server, User *user, const PacketView *packet );
+bool Logout( ChatServer *server, User *user, const PacketView *packet );
+bool HandleMessage( ChatServer *server, User *user, const PacketView *packet );
+bool Action( ChatServer *server, User *user, const PacketView *packet );
+bool HandlePM( ChatServer *server, User *user, const PacketView *packet );
+bool Away( ChatServer *server, User *user, const PacketView *packet );
+bool HandleSetConfig( ChatServer *server, User *user, const PacketView *packet );
+bool HandleTyping( ChatServer *server, User *user, const PacketView *packet );
+bool ListRooms( ChatServer *server, User *user, const PacketView *packet );
+
+/* room changes */
+bool HandleJoin( ChatServer *server, User *user, const PacketView *packet );
+bool HandleCreate( ChatServer *server, User *user, const PacketView *packet );
+bool HandleDestroy( ChatServer *server, User *user, const PacketView *packet );
+bool HandleForceJoin( ChatServer *server, User *user, const PacketView *packet );
+
+/* a moderation action that involves a moderator and a user */
+bool UserAction( ChatServer *server, User *user, const PacketView *packet );
 
-/* Use this to define a specific function to handle a chat code. */
-#define REGISTER_HANDLER( code, func ) \
-	static RegisterHandler g_Handler##code( code, &func )
+/* these are handled separately because they don't share code paths */
+bool ForceClear( ChatServer *server, User *user, const PacketView *packet );
+bool ModChat( ChatServer *server, User *user, const PacketView *packet );
 
 #endif // PACKET_HANDLER_H
 
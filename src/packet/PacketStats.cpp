@@ -0,0 +1,235 @@
+#include <array>
+#include "packet/PacketStats.h"
+#include "packet/MessageCodes.h"
+#include "logger/Logger.h"
+#include "util/StringUtil.h"
+
+using namespace std;
+
+__thread int PacketStats::s_iCurrentCode = PacketStats::NO_CODE;
+
+namespace
+{
+#define MESSAGE_CODE_VALUE( name, value )	name,
+	constexpr MessageCode ALL_CODES[] = { MESSAGE_CODES( MESSAGE_CODE_VALUE ) };
+#undef MESSAGE_CODE_VALUE
+
+#define MESSAGE_CODE_NAME( name, value )	#name,
+	const char* const CODE_NAMES[] = { MESSAGE_CODES( MESSAGE_CODE_NAME ) };
+#undef MESSAGE_CODE_NAME
+
+	constexpr unsigned NUM_CODES = sizeof(ALL_CODES) / sizeof(ALL_CODES[0]);
+	constexpr unsigned NUM_SLOTS = NUM_CODES + 1;
+	constexpr unsigned OTHER_SLOT = NUM_CODES;
+
+	constexpr unsigned MaxCode()
+	{
+		unsigned iMax = 0;
+		for( unsigned i = 0; i < NUM_CODES; ++i )
+			if( unsigned(ALL_CODES[i]) > iMax )
+				iMax = ALL_CODES[i];
+		return iMax;
+	}
+
+	/* each code's place in the stats, by code (see PacketHandler.cpp) */
+	typedef std::array<uint8_t, MaxCode()+1> SlotTable;
+
+	static_assert( NUM_SLOTS <= 256, "too many codes for a uint8_t slot" );
+
+	constexpr SlotTable BuildSlots()
+	{
+		SlotTable slots {};
+		for( unsigned i = 0; i < slots.size(); ++i )
+			slots[i] = OTHER_SLOT;
+		for( unsigned i = 0; i < NUM_CODES; ++i )
+			slots[ALL_CODES[i]] = i;
+		return slots;
+	}
+
+	constexpr SlotTable SLOTS = BuildSlots();
+
+	/* a count only ever written by one thread: no need for a locked add */
+	inline void Increase( atomic<uint64_t> &c, uint64_t iBy )
+	{
+		c.store( c.load(memory_order_relaxed) + iBy, memory_order_relaxed );
+	}
+
+	/* a time in nanoseconds, in whatever unit reads best */
+	string FormatNanos( uint64_t iNanos )
+	{
+		if( iNanos < 10000 )
+			return StringUtil::Format( "%lluns", (unsigned long long)iNanos );
+		if( iNanos < 10000000 )
+			return StringUtil::Format( "%.1fus", iNanos / 1e3 );
+		if( iNanos < 10000000000ULL )
+			return StringUtil::Format( "%.1fms", iNanos / 1e6 );
+
+		return StringUtil::Format( "%.1fs", iNanos / 1e9 );
+	}
+}
+
+PacketStats::PacketStats()
+{
+	// value-initialized, so every count starts at zero
+	m_pCodes = new CodeStats[NUM_SLOTS]();
+}
+
+PacketStats::~PacketStats()
+{
+	delete[] m_pCodes;
+}
+
+PacketStats::CodeStats& PacketStats::Get( uint16_t iCode ) const
+{
+	return m_pCodes[iCode < SLOTS.size() ? SLOTS[iCode] : OTHER_SLOT];
+}
+
+unsigned PacketStats::GetBucket( uint64_t iNanos )
+{
+	if( iNanos < SUB_BUCKETS )
+		return iNanos;
+
+	// which power of two, then which eighth of it
+	const unsigned iExp = 63 - __builtin_clzll( iNanos );
+	const unsigned iSub = (iNanos >> (iExp - SUB_BITS)) & (SUB_BUCKETS - 1);
+	const unsigned iBucket = (iExp - SUB_BITS + 1) * SUB_BUCKETS + iSub;
+
+	return iBucket < NUM_BUCKETS ? iBucket : NUM_BUCKETS - 1;
+}
+
+uint64_t PacketStats::GetBucketStart( unsigned iBucket )
+{
+	if( iBucket < SUB_BUCKETS )
+		return iBucket;
+
+	const unsigned iExp = iBucket / SUB_BUCKETS + SUB_BITS - 1;
+	const uint64_t iSub = iBucket % SUB_BUCKETS;
+
+	return (SUB_BUCKETS + iSub) << (iExp - SUB_BITS);
+}
+
+void PacketStats::AddHandled( uint16_t iCode, unsigned iBytesIn, uint64_t iBytesOut,
+	uint64_t iNanos, bool bHandled )
+{
+	CodeStats &stats = Get( iCode );
+
+	Increase( stats.iPackets, 1 );
+	Increase( stats.iBytesIn, iBytesIn );
+	Increase( stats.iBytesOut, iBytesOut );
+	Increase( stats.iLatency[GetBucket(iNanos)], 1 );
+
+	if( !bHandled )
+		Increase( stats.iRejected, 1 );
+}
+
+void PacketStats::AddUnhandled( uint16_t iCode, unsigned iBytesIn )
+{
+	CodeStats &stats = Get( iCode );
+
+	Increase( stats.iPackets, 1 );
+	Increase( stats.iUnhandled, 1 );
+	Increase( stats.iBytesIn, iBytesIn );
+}
+
+void PacketStats::AddBytesOut( uint16_t iCode, uint64_t iBytes )
+{
+	Increase( Get(iCode).iBytesOut, iBytes );
+}
+
+void PacketStats::Add( const PacketStats &other )
+{
+	for( unsigned i = 0; i < NUM_SLOTS; ++i )
+	{
+		CodeStats &to = m_pCodes[i];
+		const CodeStats &from = other.m_pCodes[i];
+
+		Increase( to.iPackets, from.iPackets.load(memory_order_relaxed) );
+		Increase( to.iRejected, from.iRejected.load(memory_order_relaxed) );
+		Increase( to.iUnhandled, from.iUnhandled.load(memory_order_relaxed) );
+		Increase( to.iBytesIn, from.iBytesIn.load(memory_order_relaxed) );
+		Increase( to.iBytesOut, from.iBytesOut.load(memory_order_relaxed) );
+
+		for( unsigned j = 0; j < NUM_BUCKETS; ++j )
+			Increase( to.iLatency[j], from.iLatency[j].load(memory_order_relaxed) );
+	}
+}
+
+void PacketStats::Dump() const
+{
+	LOG->System( "Packet stats (code: packets, rejected, unhandled, bytes in/out; handler time):" );
+
+	for( unsigned i = 0; i < NUM_SLOTS; ++i )
+	{
+		const CodeStats &stats = m_pCodes[i];
+		const uint64_t iPackets = stats.iPackets.load( memory_order_relaxed );
+
+		if( iPackets == 0 )
+			continue;
+
+		// the handler's time, in percentiles, then bucket by bucket
+		// (each bucket's named for the shortest time in it)
+		uint64_t iTimed = 0;
+		for( unsigned j = 0; j < NUM_BUCKETS; ++j )
+			iTimed += stats.iLatency[j].load( memory_order_relaxed );
+
+		const double PERCENTILES[] = { 0.5, 0.9, 0.99, 1.0 };
+		const char* const PERCENTILE_NAMES[] = { "p50", "p90", "p99", "max" };
+		const unsigned NUM_PERCENTILES = sizeof(PERCENTILES) / sizeof(PERCENTILES[0]);
+
+		string sTimes, sHistogram;
+		uint64_t iSeen = 0;
+		unsigned iNext = 0;
+
+		for( unsigned j = 0; j < NUM_BUCKETS && iTimed != 0; ++j )
+		{
+			const uint64_t iCount = stats.iLatency[j].load( memory_order_relaxed );
+
+			if( iCount == 0 )
+				continue;
+
+			iSeen += iCount;
+
+			// report the top of the bucket: the time's no more than that
+			const uint64_t iTop = (j + 1 < NUM_BUCKETS) ? GetBucketStart(j + 1) - 1 : GetBucketStart(j);
+
+			for( ; iNext < NUM_PERCENTILES && iSeen >= PERCENTILES[iNext] * iTimed; ++iNext )
+				sTimes += StringUtil::Format( " %s %s", PERCENTILE_NAMES[iNext], FormatNanos(iTop).c_str() );
+
+			sHistogram += StringUtil::Format( " %s:%llu", FormatNanos(GetBucketStart(j)).c_str(),
+				(unsigned long long)iCount );
+		}
+
+		const string sName = (i == OTHER_SLOT) ? string( "other codes" ) :
+			StringUtil::Format( "%u %s", ALL_CODES[i], CODE_NAMES[i] );
+
+		LOG->System( "  %s: %llu, %llu, %llu, %llu/%llu;%s", sName.c_str(),
+			(unsigned long long)iPackets,
+			(unsigned long long)stats.iRejected.load( memory_order_relaxed ),
+			(unsigned long long)stats.iUnhandled.load( memory_order_relaxed ),
+			(unsigned long long)stats.iBytesIn.load( memory_order_relaxed ),
+			(unsigned long long)stats.iBytesOut.load( memory_order_relaxed ),
+			sTimes.c_str() );
+
+		if( !sHistogram.empty() )
+			LOG->System( "    histogram:%s", sHistogram.c_str() );
+	}
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
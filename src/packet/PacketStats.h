@@ -0,0 +1,103 @@
+/* PacketStats: what each kind of packet costs us. For every code, it
+ * counts the packets that came in, their bytes, what their handlers wrote
+ * back, how many were rejected (handled, but refused) or unhandled (no
+ * handler at all), and how long the handlers took, in a log-linear
+ * histogram: eight buckets to every power of two nanoseconds, so any time
+ * is known to within 12.5%.
+ *
+ * Each Shard keeps its own, and only its thread writes to it, so counting
+ * takes no locks and no atomic read-modify-writes. The counters are atomic
+ * anyway so that another thread can Add() them up while they're running. */
+
+#ifndef PACKET_STATS_H
+#define PACKET_STATS_H
+
+#include <atomic>
+#include <stdint.h>
+
+class PacketStats
+{
+public:
+	/* not a code: "no packet's being handled" */
+	static const int NO_CODE = -1;
+
+	PacketStats();
+	~PacketStats();
+
+	/* counts a packet with iCode that went to its handler, which took
+	 * iNanos and wrote iBytesOut. bHandled is what the handler returned. */
+	void AddHandled( uint16_t iCode, unsigned iBytesIn, uint64_t iBytesOut,
+		uint64_t iNanos, bool bHandled );
+
+	/* counts a packet with iCode that had no handler */
+	void AddUnhandled( uint16_t iCode, unsigned iBytesIn );
+
+	/* counts bytes written to users on this thread for a packet handled
+	 * on another (e.g. a broadcast delivered by another Shard) */
+	void AddBytesOut( uint16_t iCode, uint64_t iBytes );
+
+	/* adds other's counts to ours. Safe while other's being written. */
+	void Add( const PacketStats &other );
+
+	/* writes every code's counts and latencies to the system log */
+	void Dump() const;
+
+	/* the code of the packet this thread's handling, if any, so output it
+	 * causes elsewhere can be counted towards it */
+	static int GetCurrentCode()		{ return s_iCurrentCode; }
+	static void SetCurrentCode( int iCode )	{ s_iCurrentCode = iCode; }
+
+private:
+	/* the histogram: SUB_BUCKETS buckets per power of two, up to 2^MAX_EXP
+	 * nanoseconds (17 seconds); anything longer goes in the last */
+	static const unsigned SUB_BITS = 3;
+	static const unsigned SUB_BUCKETS = 1 << SUB_BITS;
+	static const unsigned MAX_EXP = 34;
+	static const unsigned NUM_BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_BUCKETS;
+
+	static unsigned GetBucket( uint64_t iNanos );
+
+	/* the smallest time that lands in iBucket */
+	static uint64_t GetBucketStart( unsigned iBucket );
+
+	typedef std::atomic<uint64_t> Counter;
+
+	struct CodeStats
+	{
+		Counter iPackets, iRejected, iUnhandled;
+		Counter iBytesIn, iBytesOut;
+		Counter iLatency[NUM_BUCKETS];
+	};
+
+	CodeStats& Get( uint16_t iCode ) const;
+
+	/* one per code in MessageCodes.h, then one for codes that aren't */
+	CodeStats *m_pCodes;
+
+	static __thread int s_iCurrentCode;
+
+	// big, and no reason to copy them
+	PacketStats( const PacketStats& );
+	PacketStats& operator=( const PacketStats& );
+};
+
+#endif // PACKET_STATS_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -4,36 +4,62 @@
 
 using namespace std;
 
-void split( const string& in, vector<string>& add, const char delim )
+void PacketUtil::PutVarint( string &out, uint32_t i )
 {
-	size_t start = 0;
-	size_t next = 0;
-
-	while( 1 )
+	while( i >= 0x80 )
 	{
-		start = in.find_first_not_of( delim, next );
-		next = in.find_first_of( delim, start );
+		out.push_back( char((i & 0x7F) | 0x80) );
+		i >>= 7;
+	}
 
-		// no more tokens to split, so stop looping
-		if( start == string::npos && next == string::npos )
-			break;
+	out.push_back( char(i) );
+}
 
-		add.push_back( in.substr(start, (next-start)) );
+char* PacketUtil::PutVarint( char *p, uint32_t i )
+{
+	while( i >= 0x80 )
+	{
+		*p++ = char((i & 0x7F) | 0x80);
+		i >>= 7;
 	}
+
+	*p++ = char(i);
+	return p;
 }
 
-/* a packet is suffixed with "\n"; we can use that
- * as a criterion for determining multiple packets. */
-bool PacketUtil::NeedsSplit( const string& in )
+unsigned PacketUtil::VarintSize( uint32_t i )
 {
-	// if the first "\n" is not at the end, we have multiple packets.
-	return in.length() - 1 != in.find_first_of("\n");
+	unsigned iSize = 1;
+
+	for( ; i >= 0x80; i >>= 7 )
+		++iSize;
+
+	return iSize;
 }
 
-void PacketUtil::Split( const string& in, vector<string>& add )
+int PacketUtil::GetVarint( const char *p, unsigned iLen, uint32_t &i )
 {
-	// packets are delimited by a newline.
-	split( in, add, '\n' );
+	i = 0;
+
+	// five bytes hold 35 bits; anything longer is garbage
+	for( unsigned n = 0; n < 5; ++n )
+	{
+		if( n == iLen )
+			return 0;
+
+		const uint8_t c = p[n];
+
+		// the fifth byte only has four bits' worth of room left
+		if( n == 4 && (c & 0x70) )
+			return -1;
+
+		i |= uint32_t(c & 0x7F) << (7 * n);
+
+		if( (c & 0x80) == 0 )
+			return n + 1;
+	}
+
+	return -1;
 }
 
 /* 
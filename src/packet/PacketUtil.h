@@ -3,17 +3,23 @@
 
 #include <string>
 #include <vector>
-
-/* XXX: can we find a better place to declare this? */
-void split( const std::string& in, std::vector<std::string>& add, const char delim );
+#include <stdint.h>
 
 namespace PacketUtil
 {
-	/* returns true if there's more than one packet in the string. */
-	bool NeedsSplit( const std::string& in );
+	/* varints, for the binary protocol: seven bits a byte, least
+	 * significant first, with the high bit set on all but the last. */
+	void PutVarint( std::string &out, uint32_t i );
+
+	/* the same, into p, which has room for VarintSize(i) bytes. Returns
+	 * the end of what it wrote. */
+	char* PutVarint( char *p, uint32_t i );
+	unsigned VarintSize( uint32_t i );
 
-	/* splits a string into one string per packet. */
-	void Split( const std::string& in, std::vector<std::string>& add );
+	/* reads a varint from the iLen bytes at p into i. Returns the bytes
+	 * it took, 0 if p ends before it does, or -1 if it's too long to be
+	 * a uint32_t. */
+	int GetVarint( const char *p, unsigned iLen, uint32_t &i );
 }
 
 #endif // PACKET_UTIL_H
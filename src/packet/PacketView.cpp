@@ -0,0 +1,249 @@
+#include <charconv>
+#include <cstring>
+#include "packet/PacketView.h"
+#include "packet/PacketUtil.h"
+#include "packet/TextScan.h"
+
+using namespace std;
+
+// a text packet's fields: code, username, message, r, g, b
+const unsigned NUM_TEXT_FIELDS = 6;
+
+/* a text field ends at its first NUL, if it has one: it always has, and
+ * the clients couldn't take one anyway */
+static string_view TextField( string_view sField )
+{
+	const char *pNul = (const char*)memchr( sField.data(), '\0', sField.size() );
+	return pNul ? sField.substr( 0, pNul - sField.data() ) : sField;
+}
+
+static unsigned DecimalSize( unsigned i )
+{
+	unsigned iSize = 1;
+
+	for( ; i >= 10; i /= 10 )
+		++iSize;
+
+	return iSize;
+}
+
+static char* PutDecimal( char *p, unsigned i )
+{
+	return to_chars( p, p + DecimalSize(i), i ).ptr;
+}
+
+static char* PutField( char *p, string_view sField )
+{
+	memcpy( p, sField.data(), sField.size() );
+	return p + sField.size();
+}
+
+/* true if sField can go in a text packet as it is. A text client splits
+ * packets on '\n' (or '\r') and fields on '`', so a field holding one
+ * would be read as more fields, or as packets of its own. */
+static bool IsTextSafe( string_view sField )
+{
+	return sField.find_first_of( string_view("`\n\r\0", 4) ) == string_view::npos;
+}
+
+/* reads all of sField as a decimal number, no bigger than iMax */
+static bool ParseNumber( string_view sField, unsigned iMax, unsigned &iOut )
+{
+	const char *pEnd = sField.data() + sField.size();
+	const from_chars_result res = from_chars( sField.data(), pEnd, iOut );
+
+	return res.ec == errc() && res.ptr == pEnd && iOut <= iMax;
+}
+
+bool PacketView::Parse( string_view sData, PacketEncoding encoding, const TextScan *pScan )
+{
+	iCode = INVALID_CODE;
+
+	const bool bParsed = (encoding == ENCODING_BINARY) ?
+		ParseBinary( sData ) : ParseText( sData, pScan );
+
+	if( !bParsed )
+		iCode = INVALID_CODE;
+
+	return bParsed;
+}
+
+/* the size of a binary packet, not counting its length */
+static unsigned GetBodySize( const PacketView &packet )
+{
+	return PacketUtil::VarintSize( packet.iCode ) +
+		PacketUtil::VarintSize( packet.sUsername.size() ) + packet.sUsername.size() +
+		PacketUtil::VarintSize( packet.sMessage.size() ) + packet.sMessage.size() + 3;
+}
+
+unsigned PacketView::GetEncodedSize( PacketEncoding encoding ) const
+{
+	if( encoding == ENCODING_BINARY )
+	{
+		const unsigned iBody = GetBodySize( *this );
+		return PacketUtil::VarintSize( iBody ) + iBody;
+	}
+
+	// "code`user`message`r`g`b\n"
+	return DecimalSize( iCode ) + TextField( sUsername ).size() +
+		TextField( sMessage ).size() + DecimalSize( r ) + DecimalSize( g ) +
+		DecimalSize( b ) + NUM_TEXT_FIELDS;
+}
+
+char* PacketView::EncodeTo( PacketEncoding encoding, char *p ) const
+{
+	if( encoding == ENCODING_BINARY )
+	{
+		p = PacketUtil::PutVarint( p, GetBodySize(*this) );
+		p = PacketUtil::PutVarint( p, iCode );
+		p = PacketUtil::PutVarint( p, sUsername.size() );
+		p = PutField( p, sUsername );
+		p = PacketUtil::PutVarint( p, sMessage.size() );
+		p = PutField( p, sMessage );
+		*p++ = char(r);
+		*p++ = char(g);
+		*p++ = char(b);
+
+		return p;
+	}
+
+	p = PutDecimal( p, iCode );
+	*p++ = '`';
+	p = PutField( p, TextField(sUsername) );
+	*p++ = '`';
+	p = PutField( p, TextField(sMessage) );
+	*p++ = '`';
+	p = PutDecimal( p, r );
+	*p++ = '`';
+	p = PutDecimal( p, g );
+	*p++ = '`';
+	p = PutDecimal( p, b );
+	*p++ = '\n';
+
+	return p;
+}
+
+void PacketView::AppendTo( string &sOut, PacketEncoding encoding ) const
+{
+	const size_t iStart = sOut.size();
+
+	sOut.resize( iStart + GetEncodedSize(encoding) );
+	EncodeTo( encoding, &sOut[iStart] );
+}
+
+bool PacketView::ParseText( string_view sData, const TextScan *pScan )
+{
+	// find the backticks ourselves if whoever framed this didn't
+	TextScan scan;
+
+	if( pScan == NULL )
+	{
+		scan.Scan( sData.data(), sData.size() );
+		pScan = &scan;
+	}
+
+	// a client that ends its lines with "\r\n" still gets the '\r' here
+	if( !sData.empty() && sData.back() == '\r' )
+		sData.remove_suffix( 1 );
+
+	if( pScan->iTicks != NUM_TEXT_FIELDS-1 )
+		return false;
+
+	string_view sFields[NUM_TEXT_FIELDS];
+	unsigned iStart = 0;
+
+	for( unsigned i = 0; i < NUM_TEXT_FIELDS; ++i )
+	{
+		const unsigned iEnd = (i < pScan->iTicks) ? pScan->iTick[i] : sData.size();
+
+		// a blank field is sent as "_", never as nothing at all
+		if( iEnd <= iStart )
+			return false;
+
+		sFields[i] = sData.substr( iStart, iEnd - iStart );
+		iStart = iEnd + 1;
+	}
+
+	unsigned iValues[4];
+
+	if( !ParseNumber(sFields[0], INVALID_CODE-1, iValues[0]) ||
+		!ParseNumber(sFields[3], 255, iValues[1]) ||
+		!ParseNumber(sFields[4], 255, iValues[2]) ||
+		!ParseNumber(sFields[5], 255, iValues[3]) )
+		return false;
+
+	sUsername = sFields[1];
+	sMessage = sFields[2];
+	r = iValues[1];
+	g = iValues[2];
+	b = iValues[3];
+	iCode = iValues[0];
+
+	return true;
+}
+
+bool PacketView::ParseBinary( string_view sData )
+{
+	const char *p = sData.data();
+	const char *pEnd = p + sData.size();
+
+	uint32_t iValue;
+	int iRead;
+
+	if( (iRead = PacketUtil::GetVarint(p, pEnd - p, iValue)) <= 0 || iValue >= INVALID_CODE )
+		return false;
+
+	p += iRead;
+	const uint16_t iNewCode = iValue;
+
+	// the username, then the message
+	string_view *pFields[] = { &sUsername, &sMessage };
+
+	for( unsigned i = 0; i < 2; ++i )
+	{
+		if( (iRead = PacketUtil::GetVarint(p, pEnd - p, iValue)) <= 0 )
+			return false;
+
+		p += iRead;
+
+		if( iValue > unsigned(pEnd - p) )
+			return false;
+
+		*pFields[i] = string_view( p, iValue );
+		p += iValue;
+
+		// we'd be passing it on to text clients: it has to suit them too
+		if( !IsTextSafe(*pFields[i]) )
+			return false;
+	}
+
+	// exactly the colour's left
+	if( pEnd - p != 3 )
+		return false;
+
+	r = p[0];
+	g = p[1];
+	b = p[2];
+	iCode = iNewCode;
+
+	return true;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
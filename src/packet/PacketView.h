@@ -0,0 +1,88 @@
+/* PacketView: a packet parsed in place. Where ChatPacket owns copies of its
+ * fields, a PacketView only points into the buffer it was parsed from, so
+ * reading one costs no allocations at all. It's only good for as long as
+ * that buffer is, so anything that needs a field later (or needs it as a
+ * std::string) copies it out itself, e.g. with ChatPacket( view ).
+ *
+ * It works the other way, too: a view of some fields can be encoded
+ * straight into a buffer, with its exact size known up front, without
+ * building a ChatPacket (or any other string) first.
+ *
+ * A text packet needs exactly six fields, none of them empty, and the code
+ * and colours must be plain decimal numbers that fit, with nothing else in
+ * the field. Anything else isn't a packet. */
+
+#ifndef PACKET_VIEW_H
+#define PACKET_VIEW_H
+
+#include <string_view>
+#include <stdint.h>
+
+#include "packet/ChatPacket.h"
+
+struct TextScan;
+
+struct PacketView
+{
+	PacketView() : iCode( INVALID_CODE ), r( 0 ), g( 0 ), b( 0 ) { }
+
+	PacketView( uint16_t iCode_, std::string_view sUsername_, std::string_view sMessage_,
+		uint8_t r_ = 0, uint8_t g_ = 0, uint8_t b_ = 0 ) : iCode( iCode_ ),
+		sUsername( sUsername_ ), sMessage( sMessage_ ), r( r_ ), g( g_ ), b( b_ ) { }
+
+	/* views the fields of packet, which has to outlive this */
+	explicit PacketView( const ChatPacket &packet ) : iCode( packet.iCode ),
+		sUsername( packet.sUsername ), sMessage( packet.sMessage ),
+		r( packet.r ), g( packet.g ), b( packet.b ) { }
+
+	/* points this at the packet in sData, in the given encoding (a
+	 * binary one without its length; see ChatPacket::GetBinaryFrame).
+	 * A text packet's backticks are found again unless pScan says where
+	 * they are. Returns true if it's well-formed; if not, IsValid() is
+	 * false. */
+	bool Parse( std::string_view sData, PacketEncoding encoding,
+		const TextScan *pScan = NULL );
+
+	bool IsValid() const	{ return iCode != INVALID_CODE; }
+
+	/* the exact number of bytes EncodeTo() writes (for a binary packet,
+	 * that's with its length) */
+	unsigned GetEncodedSize( PacketEncoding encoding ) const;
+
+	/* writes the packet to pOut, which must have room for all of it.
+	 * Returns the end of what was written. */
+	char* EncodeTo( PacketEncoding encoding, char *pOut ) const;
+
+	/* adds the packet to the end of sOut */
+	void AppendTo( std::string &sOut, PacketEncoding encoding ) const;
+
+	uint16_t iCode;
+	std::string_view sUsername;
+	std::string_view sMessage;
+	uint8_t r, g, b;
+
+private:
+	bool ParseText( std::string_view sData, const TextScan *pScan );
+	bool ParseBinary( std::string_view sData );
+};
+
+#endif // PACKET_VIEW_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,158 @@
+#include "packet/TextScan.h"
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+typedef int (*ScanFn)( TextScan &scan, const char *p, unsigned iLen );
+
+/* records what a block at iOffset had: a bit set in iTicks for each
+ * backtick, and in iNewlines for each newline. Returns the offset of the
+ * first newline, or -1 if there wasn't one. */
+static int TakeMasks( TextScan &scan, unsigned iOffset, uint32_t iTicks, uint32_t iNewlines )
+{
+	int iFound = -1;
+
+	// the backticks past the newline belong to the next packet
+	if( iNewlines != 0 )
+	{
+		const unsigned iBit = __builtin_ctz( iNewlines );
+
+		iTicks &= (uint32_t(1) << iBit) - 1;
+		iFound = iOffset + iBit;
+		scan.iScanned = iFound;
+	}
+
+	for( ; iTicks != 0 && scan.iTicks < TextScan::MAX_TICKS; iTicks &= iTicks - 1 )
+		scan.iTick[scan.iTicks++] = iOffset + __builtin_ctz( iTicks );
+
+	return iFound;
+}
+
+/* a byte at a time: for what's left after the last full block, or for
+ * CPUs we've got nothing better for */
+static int ScanBytes( TextScan &scan, const char *p, unsigned iLen )
+{
+	for( unsigned i = scan.iScanned; i < iLen; ++i )
+	{
+		if( p[i] == '\n' )
+		{
+			scan.iScanned = i;
+			return i;
+		}
+
+		if( p[i] == '`' && scan.iTicks < TextScan::MAX_TICKS )
+			scan.iTick[scan.iTicks++] = i;
+	}
+
+	scan.iScanned = iLen;
+	return -1;
+}
+
+#if defined(__SSE2__)
+static int ScanSSE2( TextScan &scan, const char *p, unsigned iLen )
+{
+	const __m128i tick = _mm_set1_epi8( '`' );
+	const __m128i newline = _mm_set1_epi8( '\n' );
+
+	unsigned i = scan.iScanned;
+
+	for( ; i + 16 <= iLen; i += 16 )
+	{
+		const __m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+		const uint32_t iTicks = _mm_movemask_epi8( _mm_cmpeq_epi8(v, tick) );
+		const uint32_t iNewlines = _mm_movemask_epi8( _mm_cmpeq_epi8(v, newline) );
+
+		if( (iTicks | iNewlines) != 0 && TakeMasks(scan, i, iTicks, iNewlines) >= 0 )
+			return scan.iScanned;
+	}
+
+	scan.iScanned = i;
+	return ScanBytes( scan, p, iLen );
+}
+
+__attribute__((target("avx2")))
+static int ScanAVX2( TextScan &scan, const char *p, unsigned iLen )
+{
+	const __m256i tick = _mm256_set1_epi8( '`' );
+	const __m256i newline = _mm256_set1_epi8( '\n' );
+
+	unsigned i = scan.iScanned;
+
+	for( ; i + 32 <= iLen; i += 32 )
+	{
+		const __m256i v = _mm256_loadu_si256( (const __m256i*)(p + i) );
+		const uint32_t iTicks = _mm256_movemask_epi8( _mm256_cmpeq_epi8(v, tick) );
+		const uint32_t iNewlines = _mm256_movemask_epi8( _mm256_cmpeq_epi8(v, newline) );
+
+		if( (iTicks | iNewlines) != 0 && TakeMasks(scan, i, iTicks, iNewlines) >= 0 )
+			return scan.iScanned;
+	}
+
+	// one more 16-byte block might fit
+	scan.iScanned = i;
+	return ScanSSE2( scan, p, iLen );
+}
+#endif
+
+/* each Method this build and CPU can use; NULL for the rest */
+static ScanFn s_pMethods[TextScan::NUM_METHODS];
+
+static ScanFn PickScan()
+{
+	s_pMethods[TextScan::METHOD_BYTES] = &ScanBytes;
+
+#if defined(__SSE2__)
+	__builtin_cpu_init();
+
+	s_pMethods[TextScan::METHOD_SSE2] = &ScanSSE2;
+
+	if( __builtin_cpu_supports("avx2") )
+		s_pMethods[TextScan::METHOD_AVX2] = &ScanAVX2;
+#endif
+
+	// the fastest one we've got
+	int m = TextScan::NUM_METHODS - 1;
+
+	while( s_pMethods[m] == NULL )
+		--m;
+
+	return s_pMethods[m];
+}
+
+static const ScanFn s_pScan = PickScan();
+
+int TextScan::Scan( const char *pPacket, unsigned iLen )
+{
+	return s_pScan( *this, pPacket, iLen );
+}
+
+bool TextScan::HasMethod( Method m )
+{
+	return s_pMethods[m] != NULL;
+}
+
+int TextScan::ScanWith( Method m, const char *pPacket, unsigned iLen )
+{
+	return s_pMethods[m]( *this, pPacket, iLen );
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,67 @@
+/* TextScan: finds the delimiters in a text packet. Framing needs the
+ * newline that ends it, and parsing needs the backticks between its
+ * fields; Scan() finds both in one pass, so each byte a client sends is
+ * looked at once. It goes 16 bytes at a time with SSE2, or 32 with AVX2
+ * if the CPU has it (checked once, at startup).
+ *
+ * A packet can arrive in pieces, so a scan can be picked up where it left
+ * off once more of it's in. Offsets are from the start of the packet, so
+ * they stay good if the packet's moved in the meantime. */
+
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+struct TextScan
+{
+	/* a packet has five backticks; a sixth only tells us it's malformed */
+	static const unsigned MAX_TICKS = 6;
+
+	/* the ways we can look, slowest first. Scan() uses the best one this
+	 * build and CPU have; tests and benchmarks can ask for the others. */
+	enum Method { METHOD_BYTES, METHOD_SSE2, METHOD_AVX2, NUM_METHODS };
+
+	TextScan()	{ Reset(); }
+
+	/* forgets everything, for scanning a new packet */
+	void Reset()	{ iScanned = iTicks = 0; }
+
+	/* looks through the iLen bytes at pPacket, from where the last Scan()
+	 * stopped, for the newline ending the packet. Returns its offset, or
+	 * -1 if it isn't there yet. Either way, the backticks before it are
+	 * in iTick. */
+	int Scan( const char *pPacket, unsigned iLen );
+
+	/* true if Method m can be used here */
+	static bool HasMethod( Method m );
+
+	/* Scan(), with Method m, which has to be one we have */
+	int ScanWith( Method m, const char *pPacket, unsigned iLen );
+
+	/* how far we've looked */
+	unsigned iScanned;
+
+	/* the offsets of the first iTicks backticks */
+	unsigned iTicks;
+	unsigned iTick[MAX_TICKS];
+};
+
+#endif // TEXT_SCAN_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
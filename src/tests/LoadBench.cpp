@@ -0,0 +1,263 @@
+/* LoadBench: how many chat lines a running server can deliver a second.
+ * It logs in a number of clients (over loopback, one connection each),
+ * then has them all talk at once: room messages in the default room, which
+ * every client gets, and some PMs to a random client, if asked for. Start
+ * the server with the ReactorThreads you want to try, and then:
+ *
+ *	tests/LoadBench [clients] [lines each] [% of lines PMs] [port]
+ *
+ * which defaults to 32 clients, 300 lines each, no PMs, on port 7005. The
+ * server's flood limits, connection limits, and database have to let that
+ * many clients in and talking (e.g. FloodChat=0,1 MaxConnectionsPerIP=0
+ * ConnectRatePerIP=0). The client side needs a core or so to itself to
+ * keep up; otherwise, it's measuring itself. */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "util/Clock.h"
+
+using namespace std;
+
+/* the most deliveries we'll have outstanding, per client. Any more, and
+ * we'd only be measuring how much the socket buffers hold. */
+static const long WINDOW_PER_CLIENT = 32;
+
+/* how long to give logins and the run before giving up, in seconds */
+static const double LOGIN_TIMEOUT = 60, RUN_TIMEOUT = 120;
+
+struct Client
+{
+	int iSocket;
+	bool bLoggedIn;
+	long iSent, iReceived;
+
+	/* the start of a line we haven't seen the end of; only its code
+	 * matters, so only the first few bytes are kept */
+	string sPartial;
+};
+
+static double Now()
+{
+	return Clock::ReadMicroseconds() / 1e6;
+}
+
+/* counts what's in this chunk of a client's input */
+static void Scan( Client &c, const char *p, int iLen )
+{
+	for( int i = 0; i < iLen; ++i )
+	{
+		if( p[i] != '\n' )
+		{
+			if( c.sPartial.size() < 8 )
+				c.sPartial += p[i];
+			continue;
+		}
+
+		if( !c.sPartial.compare(0, 2, "3`") || !c.sPartial.compare(0, 2, "5`") )
+			++c.iReceived;
+		else if( !c.sPartial.compare(0, 4, "100`") )
+			c.bLoggedIn = true;
+
+		c.sPartial.clear();
+	}
+}
+
+/* reads everything the client's got; returns false if it's been cut off */
+static bool Drain( Client &c )
+{
+	char buf[65536];
+	int iRead;
+
+	while( (iRead = read(c.iSocket, buf, sizeof(buf))) > 0 )
+		Scan( c, buf, iRead );
+
+	return iRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int main( int argc, char **argv )
+{
+	const int iClients = argc > 1 ? atoi( argv[1] ) : 32;
+	const long iLines = argc > 2 ? atol( argv[2] ) : 300;
+	const int iPMPercent = argc > 3 ? atoi( argv[3] ) : 0;
+	const int iPort = argc > 4 ? atoi( argv[4] ) : 7005;
+
+	if( iClients < 2 || iLines < 1 || iPMPercent < 0 || iPMPercent > 100 )
+	{
+		fprintf( stderr, "usage: %s [clients] [lines each] [%% of lines PMs] [port]\n", argv[0] );
+		return 1;
+	}
+
+	vector<Client> vClients( iClients );
+	const int iPoll = epoll_create1( 0 );
+
+	sockaddr_in addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( iPort );
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	for( int i = 0; i < iClients; ++i )
+	{
+		Client &c = vClients[i];
+		c.iSocket = socket( AF_INET, SOCK_STREAM, 0 );
+		c.bLoggedIn = false;
+		c.iSent = c.iReceived = 0;
+
+		if( connect(c.iSocket, (sockaddr*)&addr, sizeof(addr)) != 0 )
+		{
+			fprintf( stderr, "couldn't connect to port %d: %s\n", iPort, strerror(errno) );
+			return 1;
+		}
+
+		const int iOne = 1;
+		setsockopt( c.iSocket, IPPROTO_TCP, TCP_NODELAY, &iOne, sizeof(iOne) );
+
+		char szLogin[64];
+		const int iLen = snprintf( szLogin, sizeof(szLogin), "1`load%03d`pw`0`0`0\n", i );
+		write( c.iSocket, szLogin, iLen );
+
+		fcntl( c.iSocket, F_SETFL, O_NONBLOCK );
+
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl( iPoll, EPOLL_CTL_ADD, c.iSocket, &ev );
+	}
+
+	vector<epoll_event> vEvents( 256 );
+	int iLoggedIn = 0;
+	double fStart = Now();
+
+	while( iLoggedIn < iClients && Now() - fStart < LOGIN_TIMEOUT )
+	{
+		const int iEvents = epoll_wait( iPoll, &vEvents[0], vEvents.size(), 100 );
+
+		for( int i = 0; i < iEvents; ++i )
+		{
+			Client &c = vClients[vEvents[i].data.u32];
+			const bool bWas = c.bLoggedIn;
+
+			if( !Drain(c) )
+			{
+				fprintf( stderr, "a client was cut off while logging in\n" );
+				return 1;
+			}
+
+			if( !bWas && c.bLoggedIn )
+				++iLoggedIn;
+		}
+	}
+
+	if( iLoggedIn < iClients )
+	{
+		fprintf( stderr, "only %d of %d clients got logged in\n", iLoggedIn, iClients );
+		return 1;
+	}
+
+	// let the join broadcasts settle, then start counting from nothing
+	usleep( 300*1000 );
+
+	for( int i = 0; i < iClients; ++i )
+	{
+		Drain( vClients[i] );
+		vClients[i].iReceived = 0;
+	}
+
+	// a room message reaches everyone (the sender too); a PM, one client
+	long iExpected = 0, iReceived = 0, iSent = 0;
+	const long iWindow = WINDOW_PER_CLIENT * iClients;
+	srand( 1 );
+
+	fStart = Now();
+
+	while( (iSent < iLines * iClients || iReceived < iExpected) && Now() - fStart < RUN_TIMEOUT )
+	{
+		for( int i = 0; i < iClients && iExpected - iReceived < iWindow; ++i )
+		{
+			Client &c = vClients[i];
+
+			if( c.iSent >= iLines )
+				continue;
+
+			char szLine[64];
+			int iLen;
+			int iDeliveries;
+
+			if( rand() % 100 < iPMPercent )
+			{
+				iLen = snprintf( szLine, sizeof(szLine), "5`load%03d`pm %ld`0`0`0\n", rand() % iClients, c.iSent );
+				iDeliveries = 1;
+			}
+			else
+			{
+				iLen = snprintf( szLine, sizeof(szLine), "3`_`line %ld`0`0`0\n", c.iSent );
+				iDeliveries = iClients;
+			}
+
+			if( write(c.iSocket, szLine, iLen) != iLen )
+				continue;
+
+			++c.iSent;
+			++iSent;
+			iExpected += iDeliveries;
+		}
+
+		const bool bFull = iExpected - iReceived >= iWindow || iSent == iLines * iClients;
+		const int iEvents = epoll_wait( iPoll, &vEvents[0], vEvents.size(), bFull ? 10 : 0 );
+
+		for( int i = 0; i < iEvents; ++i )
+		{
+			Client &c = vClients[vEvents[i].data.u32];
+			const long iBefore = c.iReceived;
+
+			if( !Drain(c) )
+			{
+				fprintf( stderr, "a client was cut off (is the server's output limit too low?)\n" );
+				return 1;
+			}
+
+			iReceived += c.iReceived - iBefore;
+		}
+	}
+
+	const double fElapsed = Now() - fStart;
+
+	printf( "%d clients, %ld lines (%d%% PMs): %ld/%ld delivered in %.2fs\n",
+		iClients, iSent, iPMPercent, iReceived, iExpected, fElapsed );
+	printf( "%.0f lines handled/s, %.0f deliveries/s\n",
+		iSent / fElapsed, iReceived / fElapsed );
+
+	return iReceived == iExpected ? 0 : 1;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,77 @@
+/* OldEncoding: how packets were encoded before PacketView::EncodeTo(),
+ * kept so the tests and benchmarks have something to hold it to. The text
+ * encoder's buffer is one byte bigger than it was: the old one cut the
+ * newline off a 5-digit code with three 3-digit colours, which was a bug,
+ * not something to stay compatible with. */
+
+#ifndef OLD_ENCODING_H
+#define OLD_ENCODING_H
+
+#include <cstdio>
+#include <string>
+#include "packet/ChatPacket.h"
+#include "packet/PacketUtil.h"
+
+namespace OldEncoding
+{
+	inline std::string ToString( const ChatPacket &packet )
+	{
+		const unsigned iLen = packet.sUsername.size() + packet.sMessage.size() + 21;
+
+		char *sBuffer = new char[iLen];
+		snprintf( sBuffer, iLen, "%u`%s`%s`%u`%u`%u\n", packet.iCode, packet.sUsername.c_str(),
+			packet.sMessage.c_str(), packet.r, packet.g, packet.b );
+		std::string ret( sBuffer );
+		delete[] sBuffer;
+
+		return ret;
+	}
+
+	inline std::string ToBinary( const ChatPacket &packet )
+	{
+		std::string sBody;
+		sBody.reserve( packet.sUsername.size() + packet.sMessage.size() + 16 );
+
+		PacketUtil::PutVarint( sBody, packet.iCode );
+		PacketUtil::PutVarint( sBody, packet.sUsername.size() );
+		sBody.append( packet.sUsername );
+		PacketUtil::PutVarint( sBody, packet.sMessage.size() );
+		sBody.append( packet.sMessage );
+		sBody.push_back( char(packet.r) );
+		sBody.push_back( char(packet.g) );
+		sBody.push_back( char(packet.b) );
+
+		std::string ret;
+		ret.reserve( sBody.size() + 5 );
+		PacketUtil::PutVarint( ret, sBody.size() );
+		ret.append( sBody );
+
+		return ret;
+	}
+
+	inline std::string Encode( const ChatPacket &packet, PacketEncoding encoding )
+	{
+		return (encoding == ENCODING_BINARY) ? ToBinary( packet ) : ToString( packet );
+	}
+}
+
+#endif // OLD_ENCODING_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
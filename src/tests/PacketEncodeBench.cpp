@@ -0,0 +1,126 @@
+/* PacketEncodeBench: how long encoding a packet takes, the old way
+ * (snprintf, or a string per binary body, then a copy) and the new:
+ * ChatPacket::Encode(), which makes one string of the right size, and
+ * PacketView::EncodeTo() straight into an output buffer, the way
+ * User::Write() does. Run it with no arguments; the results are in ns
+ * per packet, the best of several passes. */
+
+#include <cstdio>
+#include <string>
+#include "packet/ChatPacket.h"
+#include "packet/MessageCodes.h"
+#include "packet/PacketView.h"
+#include "tests/OldEncoding.h"
+#include "util/Clock.h"
+
+using namespace std;
+
+static const unsigned PASSES = 5;
+static const unsigned PACKETS = 200000;
+
+/* so the compiler can't skip the work */
+static volatile size_t s_iSink;
+
+enum Way { WAY_OLD, WAY_ENCODE, WAY_ENCODE_TO, NUM_WAYS };
+
+static double Time( Way way, const ChatPacket &packet, PacketEncoding encoding )
+{
+	// room for a chunk's worth of output, as a user's queue would have
+	string sOut( 64 * 1024, '\0' );
+	double fBest = 0;
+
+	for( unsigned i = 0; i < PASSES; ++i )
+	{
+		const uint64_t iStart = Clock::ReadNanoseconds();
+		size_t iTotal = 0;
+
+		for( unsigned n = 0; n < PACKETS; ++n )
+		{
+			switch( way )
+			{
+			case WAY_OLD:
+				iTotal += OldEncoding::Encode( packet, encoding ).size();
+				break;
+			case WAY_ENCODE:
+				iTotal += packet.Encode( encoding ).size();
+				break;
+			case WAY_ENCODE_TO:
+				{
+					// the view's made per packet, as User::Write() does
+					const PacketView view( packet );
+					const unsigned iSize = view.GetEncodedSize( encoding );
+
+					if( iTotal % sOut.size() + iSize > sOut.size() )
+						iTotal += sOut.size() - iTotal % sOut.size();
+
+					view.EncodeTo( encoding, &sOut[iTotal % sOut.size()] );
+					iTotal += iSize;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		const double fTime = double(Clock::ReadNanoseconds() - iStart) / PACKETS;
+		s_iSink = iTotal;
+
+		if( i == 0 || fTime < fBest )
+			fBest = fTime;
+	}
+
+	return fBest;
+}
+
+int main()
+{
+	const ChatPacket PACKETS_TIMED[] =
+	{
+		ChatPacket( ROOM_MESSAGE, "_", "anyone else think the new song list is kind of short", 255, 128, 0 ),
+		ChatPacket( USER_LIST, "someone", "RV Chat|____" ),
+		ChatPacket( START_TYPING, "_", "_" ),
+		ChatPacket( ROOM_MESSAGE, "_", string(390, 'x'), 12, 34, 56 ),
+	};
+
+	printf( "%-24s %26s   %26s\n", "", "text old/Encode/EncodeTo", "binary old/Encode/EncodeTo" );
+
+	for( unsigned i = 0; i < sizeof(PACKETS_TIMED) / sizeof(PACKETS_TIMED[0]); ++i )
+	{
+		const ChatPacket &packet = PACKETS_TIMED[i];
+		char szName[32];
+
+		snprintf( szName, sizeof(szName), "%u, %zu bytes", packet.iCode,
+			packet.Encode(ENCODING_TEXT).size() );
+		printf( "%-24s", szName );
+
+		for( int e = 0; e < NUM_ENCODINGS; ++e )
+		{
+			printf( "   %8.1f %8.1f %8.1f", Time(WAY_OLD, packet, PacketEncoding(e)),
+				Time(WAY_ENCODE, packet, PacketEncoding(e)),
+				Time(WAY_ENCODE_TO, packet, PacketEncoding(e)) );
+		}
+
+		printf( "\n" );
+	}
+
+	return 0;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,204 @@
+/* PacketViewTest: a binary client's packets are passed on to text clients
+ * in the same room, so whatever the binary parser accepts has to come out
+ * as exactly one text packet. And output is encoded straight into buffers
+ * sized by GetEncodedSize(), so EncodeTo() has to write exactly that much,
+ * and the same bytes the old encoder did. "make check" runs this. */
+
+#include <cstdio>
+#include <string>
+#include "packet/ChatPacket.h"
+#include "packet/MessageCodes.h"
+#include "packet/PacketView.h"
+#include "tests/OldEncoding.h"
+
+using namespace std;
+
+static unsigned s_iFailures = 0;
+
+#define CHECK( cond ) \
+	do { if( !(cond) ) { fprintf( stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond ); ++s_iFailures; } } while( 0 )
+
+/* parses packet the way a binary client would have sent it, as sFrame
+ * (which view points into) */
+static bool ParseAsBinary( const ChatPacket &packet, string &sFrame, PacketView &view )
+{
+	sFrame = packet.ToBinary();
+	unsigned iHeaderLen, iBodyLen;
+
+	if( ChatPacket::GetBinaryFrame(sFrame.data(), sFrame.size(), iHeaderLen, iBodyLen) != 1 )
+		return false;
+
+	return view.Parse( string_view(sFrame).substr(iHeaderLen, iBodyLen), ENCODING_BINARY );
+}
+
+static void TestForgedPacket()
+{
+	// a room message that a text client would read as a second packet,
+	// a wall message from the server
+	const ChatPacket forged( ROOM_MESSAGE, "_", "hi`0`0`0\n601`_`Server restarting`0`0`0" );
+	string sFrame;
+	PacketView view;
+
+	CHECK( !ParseAsBinary(forged, sFrame, view) );
+	CHECK( !view.IsValid() );
+}
+
+static void TestSeparators()
+{
+	const string sBad[] = { "`", "\n", "\r", string(1, '\0') };
+
+	for( unsigned i = 0; i < sizeof(sBad) / sizeof(sBad[0]); ++i )
+	{
+		string sFrame;
+		PacketView view;
+
+		CHECK( !ParseAsBinary(ChatPacket(ROOM_MESSAGE, "_", "a" + sBad[i] + "b"), sFrame, view) );
+		CHECK( !ParseAsBinary(ChatPacket(USER_PM, "a" + sBad[i] + "b", "hi"), sFrame, view) );
+		CHECK( !ParseAsBinary(ChatPacket(CLIENT_AWAY, "_", sBad[i]), sFrame, view) );
+	}
+}
+
+static void TestMixedRoom()
+{
+	// what the binary client sends...
+	const ChatPacket sent( ROOM_MESSAGE, "_", "hi there ~!@#$%^&*()", 1, 2, 3 );
+	string sFrame;
+	PacketView view;
+
+	CHECK( ParseAsBinary(sent, sFrame, view) );
+	CHECK( view.sMessage == sent.sMessage );
+
+	// ...is what a text client in the room gets, as one packet
+	const EncodedPacket encoded( view );
+	const string_view sText = encoded.Get( ENCODING_TEXT );
+
+	CHECK( sText == "3`_`hi there ~!@#$%^&*()`1`2`3\n" );
+	CHECK( sText.find('\n') == sText.size() - 1 );
+
+	PacketView echoed;
+	CHECK( echoed.Parse(sText.substr(0, sText.size() - 1), ENCODING_TEXT) );
+	CHECK( echoed.sMessage == sent.sMessage );
+}
+
+/* what's in a packet, for saying which one failed */
+static string Describe( const ChatPacket &packet )
+{
+	char szDesc[128];
+	snprintf( szDesc, sizeof(szDesc), "code %u, %zu+%zu bytes of fields, colour %u/%u/%u",
+		packet.iCode, packet.sUsername.size(), packet.sMessage.size(), packet.r, packet.g, packet.b );
+
+	return szDesc;
+}
+
+static void CheckEncoding( const ChatPacket &packet )
+{
+	static const char *ENCODING_NAMES[NUM_ENCODINGS] = { "text", "binary" };
+
+	// a guard band past the end, to catch EncodeTo() writing more than it said
+	const unsigned GUARD = 16;
+	const char GUARD_BYTE = '\xA5';
+
+	const PacketView view( packet );
+
+	for( int e = 0; e < NUM_ENCODINGS; ++e )
+	{
+		const unsigned iFailures = s_iFailures;
+		const PacketEncoding encoding = PacketEncoding( e );
+		const string sOld = OldEncoding::Encode( packet, encoding );
+		const unsigned iSize = view.GetEncodedSize( encoding );
+
+		string sBuffer( iSize + GUARD, GUARD_BYTE );
+		const char *pEnd = view.EncodeTo( encoding, &sBuffer[0] );
+
+		CHECK( unsigned(pEnd - sBuffer.data()) == iSize );
+		CHECK( sBuffer.compare(iSize, GUARD, string(GUARD, GUARD_BYTE)) == 0 );
+		CHECK( sBuffer.compare(0, iSize, sOld) == 0 );
+
+		string sAppended = "earlier output";
+		view.AppendTo( sAppended, encoding );
+		CHECK( sAppended == "earlier output" + sOld );
+
+		CHECK( packet.Encode(encoding) == sOld );
+
+		if( s_iFailures != iFailures )
+			fprintf( stderr, "    (%s, %s)\n", ENCODING_NAMES[e], Describe(packet).c_str() );
+	}
+}
+
+/* field and packet lengths take one more varint byte past each of these */
+static const unsigned VARINT_LIMITS[] = { 127, 16383, 2097151 };
+
+static void TestEncodeFields()
+{
+	CheckEncoding( ChatPacket(ROOM_MESSAGE, "", "") );
+	CheckEncoding( ChatPacket(ROOM_MESSAGE, "_", "") );
+	CheckEncoding( ChatPacket(ROOM_MESSAGE, "", "hi") );
+
+	// a text field stops at a NUL, as %s did; a binary one doesn't
+	CheckEncoding( ChatPacket(ROOM_MESSAGE, string("ab\0cd", 5), string("\0", 1)) );
+
+	for( unsigned i = 0; i < sizeof(VARINT_LIMITS) / sizeof(VARINT_LIMITS[0]); ++i )
+	{
+		// fields either side of the limit...
+		for( unsigned iLen = VARINT_LIMITS[i] - 1; iLen <= VARINT_LIMITS[i] + 2; ++iLen )
+		{
+			CheckEncoding( ChatPacket(ROOM_MESSAGE, "_", string(iLen, 'm')) );
+			CheckEncoding( ChatPacket(USER_PM, string(iLen, 'u'), "hi") );
+		}
+
+		// ...and whole packets: a 1-byte code and name leave 7-8 bytes
+		for( unsigned iLen = VARINT_LIMITS[i] - 12; iLen <= VARINT_LIMITS[i] - 4; ++iLen )
+			CheckEncoding( ChatPacket(ROOM_MESSAGE, "_", string(iLen, 'm'), 255, 255, 255) );
+	}
+}
+
+static void TestEncodeNumbers()
+{
+	// every width of decimal, and both sides of each varint byte
+	static const unsigned CODES[] = { 0, 1, 9, 10, 99, 100, 127, 128, 999, 1000,
+		9999, 10000, 16383, 16384, INVALID_CODE-1 };
+	static const unsigned COLOURS[] = { 0, 9, 10, 99, 100, 127, 128, 255 };
+
+	const unsigned NUM_CODES = sizeof(CODES) / sizeof(CODES[0]);
+	const unsigned NUM_COLOURS = sizeof(COLOURS) / sizeof(COLOURS[0]);
+
+	for( unsigned c = 0; c < NUM_CODES; ++c )
+		for( unsigned r = 0; r < NUM_COLOURS; ++r )
+			for( unsigned g = 0; g < NUM_COLOURS; ++g )
+				for( unsigned b = 0; b < NUM_COLOURS; ++b )
+					CheckEncoding( ChatPacket(CODES[c], "name", "a message",
+						COLOURS[r], COLOURS[g], COLOURS[b]) );
+}
+
+int main()
+{
+	TestForgedPacket();
+	TestSeparators();
+	TestMixedRoom();
+	TestEncodeFields();
+	TestEncodeNumbers();
+
+	if( s_iFailures )
+		fprintf( stderr, "%u check(s) failed\n", s_iFailures );
+
+	return s_iFailures ? 1 : 0;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
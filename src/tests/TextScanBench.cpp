@@ -0,0 +1,193 @@
+/* TextScanBench: how long framing and splitting a text packet takes, the
+ * old way (memchr for the newline, then for each backtick) and with each
+ * TextScan method this machine has. The packets are the ones a server
+ * logged to its chatlog.txt, laid end to end as they'd come in:
+ *
+ *	tests/TextScanBench [/var/log/rvserver/chatlog.txt]
+ *
+ * Results are in ns per packet, the best of several passes, for all the
+ * packets and then by size. */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "packet/TextScan.h"
+#include "util/Clock.h"
+
+using namespace std;
+
+static const unsigned PASSES = 7;
+
+/* packets of at least this many bytes, and less than the next */
+static const unsigned BUCKETS[] = { 0, 24, 48, 96, 192, 384 };
+static const unsigned NUM_BUCKETS = sizeof(BUCKETS) / sizeof(BUCKETS[0]);
+
+/* so the compiler can't skip the work */
+static volatile unsigned s_iSink;
+
+/* the old way: the newline first, then each field's end */
+static unsigned FrameMemchr( const char *p, const char *pEnd )
+{
+	unsigned iPackets = 0, iTicks = 0;
+
+	while( p < pEnd )
+	{
+		const char *pNewline = (const char*)memchr( p, '\n', pEnd - p );
+
+		for( unsigned i = 0; i < TextScan::MAX_TICKS; ++i )
+		{
+			const char *pTick = (const char*)memchr( p, '`', pNewline - p );
+
+			if( pTick == NULL )
+				break;
+
+			p = pTick + 1;
+			++iTicks;
+		}
+
+		p = pNewline + 1;
+		++iPackets;
+	}
+
+	s_iSink = iTicks;
+	return iPackets;
+}
+
+static unsigned FrameScan( TextScan::Method m, const char *p, const char *pEnd )
+{
+	unsigned iPackets = 0, iTicks = 0;
+	TextScan scan;
+
+	while( p < pEnd )
+	{
+		scan.Reset();
+		p += scan.ScanWith( m, p, pEnd - p ) + 1;
+		iTicks += scan.iTicks;
+		++iPackets;
+	}
+
+	s_iSink = iTicks;
+	return iPackets;
+}
+
+/* ns per packet in sData, best of PASSES; m < 0 for the memchr way */
+static double Time( int m, const string &sData )
+{
+	const char *p = sData.data(), *pEnd = p + sData.size();
+	double fBest = 0;
+
+	for( unsigned i = 0; i < PASSES; ++i )
+	{
+		const uint64_t iStart = Clock::ReadNanoseconds();
+		const unsigned iPackets = m < 0 ? FrameMemchr(p, pEnd) : FrameScan(TextScan::Method(m), p, pEnd);
+		const double fTime = double(Clock::ReadNanoseconds() - iStart) / iPackets;
+
+		if( i == 0 || fTime < fBest )
+			fBest = fTime;
+	}
+
+	return fBest;
+}
+
+int main( int argc, char **argv )
+{
+	const char *szPath = argc > 1 ? argv[1] : "chatlog.txt";
+	ifstream file( szPath );
+
+	if( !file )
+	{
+		fprintf( stderr, "can't open %s\n", szPath );
+		return 1;
+	}
+
+	// log lines are "[time] name@ip<tab>packet"
+	string sAll, sBucket[NUM_BUCKETS];
+	unsigned iCount[NUM_BUCKETS] = { 0 };
+	string sLine;
+
+	while( getline(file, sLine) )
+	{
+		const size_t iTab = sLine.find( '\t' );
+
+		if( iTab == string::npos )
+			continue;
+
+		const unsigned iLen = sLine.size() - iTab - 1;
+		unsigned b = NUM_BUCKETS - 1;
+
+		while( iLen < BUCKETS[b] )
+			--b;
+
+		sAll.append( sLine, iTab + 1, string::npos ).append( 1, '\n' );
+		sBucket[b].append( sLine, iTab + 1, string::npos ).append( 1, '\n' );
+		++iCount[b];
+	}
+
+	unsigned iTotal = 0;
+	for( unsigned b = 0; b < NUM_BUCKETS; ++b )
+		iTotal += iCount[b];
+
+	if( iTotal == 0 )
+	{
+		fprintf( stderr, "no packets in %s\n", szPath );
+		return 1;
+	}
+
+	static const char *NAMES[TextScan::NUM_METHODS] = { "bytes", "SSE2", "AVX2" };
+
+	printf( "%u packets, %.0f bytes on average\n\n", iTotal, double(sAll.size()) / iTotal - 1 );
+	printf( "%-12s %8s %8s", "packets", "count", "memchr" );
+
+	for( int m = 0; m < TextScan::NUM_METHODS; ++m )
+		if( TextScan::HasMethod(TextScan::Method(m)) )
+			printf( " %8s", NAMES[m] );
+
+	printf( "\n" );
+
+	for( int b = -1; b < int(NUM_BUCKETS); ++b )
+	{
+		const string &sData = b < 0 ? sAll : sBucket[b];
+
+		if( sData.empty() )
+			continue;
+
+		char szName[16];
+
+		if( b < 0 )
+			snprintf( szName, sizeof(szName), "all" );
+		else if( b + 1 < int(NUM_BUCKETS) )
+			snprintf( szName, sizeof(szName), "%u-%u B", BUCKETS[b], BUCKETS[b+1] - 1 );
+		else
+			snprintf( szName, sizeof(szName), "%u+ B", BUCKETS[b] );
+
+		printf( "%-12s %8u %8.1f", szName, b < 0 ? iTotal : iCount[b], Time(-1, sData) );
+
+		for( int m = 0; m < TextScan::NUM_METHODS; ++m )
+			if( TextScan::HasMethod(TextScan::Method(m)) )
+				printf( " %8.1f", Time(m, sData) );
+
+		printf( "\n" );
+	}
+
+	return 0;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,259 @@
+/* TextScanTest: Scan() picks its method by what the CPU has, so a bug in
+ * one of them would only show up on some machines. This runs every method
+ * we have here over the same inputs, whole and in pieces, and checks each
+ * against the obvious byte-at-a-time answer. "make check" runs this. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "packet/TextScan.h"
+
+using namespace std;
+
+static unsigned s_iFailures = 0;
+
+static const char *METHOD_NAMES[TextScan::NUM_METHODS] = { "bytes", "SSE2", "AVX2" };
+
+/* what any scan of all of sData should come up with */
+struct Expected
+{
+	int iFound;
+	TextScan scan;
+};
+
+static Expected Reference( const string &sData )
+{
+	Expected ret;
+	ret.iFound = -1;
+
+	for( unsigned i = 0; i < sData.size() && ret.iFound < 0; ++i )
+	{
+		if( sData[i] == '\n' )
+			ret.iFound = i;
+		else if( sData[i] == '`' && ret.scan.iTicks < TextScan::MAX_TICKS )
+			ret.scan.iTick[ret.scan.iTicks++] = i;
+	}
+
+	ret.scan.iScanned = ret.iFound < 0 ? sData.size() : ret.iFound;
+	return ret;
+}
+
+static string Printable( const string &sData )
+{
+	string ret;
+
+	for( unsigned i = 0; i < sData.size(); ++i )
+		ret += sData[i] == '\n' ? '|' : sData[i];
+
+	return ret;
+}
+
+static void Compare( TextScan::Method m, const string &sData, const char *szHow,
+	int iFound, const TextScan &scan, const Expected &want )
+{
+	bool bSame = iFound == want.iFound && scan.iScanned == want.scan.iScanned &&
+		scan.iTicks == want.scan.iTicks;
+
+	for( unsigned i = 0; bSame && i < scan.iTicks; ++i )
+		bSame = scan.iTick[i] == want.scan.iTick[i];
+
+	if( bSame )
+		return;
+
+	++s_iFailures;
+
+	// one's plenty to go on, and there'd be thousands
+	if( s_iFailures > 10 )
+		return;
+
+	fprintf( stderr, "%s, %s: \"%s\": found %d (want %d), scanned %u (want %u), %u ticks (want %u)\n",
+		METHOD_NAMES[m], szHow, Printable(sData).c_str(), iFound, want.iFound,
+		scan.iScanned, want.scan.iScanned, scan.iTicks, want.scan.iTicks );
+}
+
+/* copies sData to iAlign bytes into a buffer of its own: the vector
+ * loads are unaligned, and the bytes past the end shouldn't matter */
+static const char *Place( vector<char> &buf, const string &sData, unsigned iAlign )
+{
+	buf.assign( sData.size() + iAlign + 64, '\n' );
+	memcpy( &buf[iAlign], sData.data(), sData.size() );
+	return &buf[iAlign];
+}
+
+/* scans sData whole, then as it would arrive in two reads split at each
+ * point, moving it between them the way User compacts its input */
+static void CheckMethod( TextScan::Method m, const string &sData, const Expected &want )
+{
+	vector<char> buf;
+
+	for( unsigned iAlign = 0; iAlign < 32; iAlign += 7 )
+	{
+		TextScan scan;
+		const int iFound = scan.ScanWith( m, Place(buf, sData, iAlign), sData.size() );
+		Compare( m, sData, "whole", iFound, scan, want );
+	}
+
+	for( unsigned iCut = 0; iCut <= sData.size(); ++iCut )
+	{
+		TextScan scan;
+		int iFound = scan.ScanWith( m, Place(buf, sData, 3), iCut );
+
+		if( iFound < 0 )
+			iFound = scan.ScanWith( m, Place(buf, sData, 0), sData.size() );
+
+		char szHow[32];
+		snprintf( szHow, sizeof(szHow), "cut at %u", iCut );
+		Compare( m, sData, szHow, iFound, scan, want );
+	}
+}
+
+/* and in a handful of reads, a byte to a few blocks each */
+static void CheckPieces( TextScan::Method m, const string &sData, const Expected &want )
+{
+	vector<char> buf;
+	TextScan scan;
+	unsigned iLen = 0;
+	int iFound = -1;
+
+	while( iFound < 0 && iLen < sData.size() )
+	{
+		iLen = min<unsigned>( sData.size(), iLen + 1 + rand() % 80 );
+		iFound = scan.ScanWith( m, Place(buf, sData, rand() % 32), iLen );
+	}
+
+	if( iFound < 0 )
+		iFound = scan.ScanWith( m, Place(buf, sData, 0), sData.size() );
+
+	Compare( m, sData, "in pieces", iFound, scan, want );
+}
+
+static void Check( const string &sData )
+{
+	const Expected want = Reference( sData );
+
+	for( int m = 0; m < TextScan::NUM_METHODS; ++m )
+	{
+		if( !TextScan::HasMethod(TextScan::Method(m)) )
+			continue;
+
+		CheckMethod( TextScan::Method(m), sData, want );
+		CheckPieces( TextScan::Method(m), sData, want );
+	}
+}
+
+/* the 16- and 32-byte blocks start over at each of these */
+static const unsigned BOUNDARIES[] = { 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 95, 96 };
+static const unsigned NUM_BOUNDARIES = sizeof(BOUNDARIES) / sizeof(BOUNDARIES[0]);
+
+static void TestEdges()
+{
+	// a newline, or a backtick before one, anywhere
+	for( unsigned i = 0; i < 140; ++i )
+	{
+		string sData( 140, 'x' );
+		sData[i] = '\n';
+		Check( sData );
+
+		sData[i] = '`';
+		Check( sData );
+		Check( sData + "\n" );
+	}
+
+	for( unsigned i = 0; i < NUM_BOUNDARIES; ++i )
+	{
+		const unsigned b = BOUNDARIES[i];
+
+		// a backtick and the newline on either side of the boundary...
+		string sData( 128, 'x' );
+		sData[b-1] = '`';
+		sData[b] = '\n';
+		Check( sData );
+
+		// ...and backticks after the newline, in the same block and the next
+		sData = string( 128, 'x' );
+		sData[b-1] = '\n';
+		sData[b] = '`';
+		sData[b+1] = '`';
+		sData[b+20] = '`';
+		Check( sData );
+
+		// a packet's worth of fields, the last ending on the boundary
+		sData = string( 128, 'x' );
+		for( unsigned t = 0; t < 5; ++t )
+			sData[b - 1 - t*3] = '`';
+		sData[b] = '\n';
+		Check( sData );
+	}
+
+	// more backticks than we keep track of, in one block and over several
+	for( unsigned i = 1; i < 100; ++i )
+	{
+		Check( string(i, '`') );
+		Check( string(i, '`') + "\n" + string(i, '`') );
+	}
+
+	string sSpread;
+	for( unsigned i = 0; i < 20; ++i )
+		sSpread += "abcdefghijklmno`";
+	Check( sSpread );
+	Check( sSpread + "\n" );
+
+	// a packet's own fields, then the next packet's
+	Check( "3`_`hello there`0`0`0\n3`_`and again`0`0`0\n" );
+	Check( "" );
+	Check( "\n" );
+}
+
+static void TestRandom()
+{
+	// mostly text, with enough delimiters to land in every spot
+	static const char CHARS[] = "abcdefghijklmnop0123456789 ``````\n";
+
+	for( unsigned i = 0; i < 3000; ++i )
+	{
+		string sData( rand() % 300, 'x' );
+
+		for( unsigned j = 0; j < sData.size(); ++j )
+			sData[j] = CHARS[rand() % (sizeof(CHARS) - 1)];
+
+		Check( sData );
+	}
+}
+
+int main()
+{
+	srand( 1 );
+
+	for( int m = 0; m < TextScan::NUM_METHODS; ++m )
+		if( !TextScan::HasMethod(TextScan::Method(m)) )
+			printf( "no %s here; not testing it\n", METHOD_NAMES[m] );
+
+	TestEdges();
+	TestRandom();
+
+	if( s_iFailures )
+		fprintf( stderr, "%u check(s) failed\n", s_iFailures );
+
+	return s_iFailures ? 1 : 0;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
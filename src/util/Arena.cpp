@@ -0,0 +1,92 @@
+#include <cstdint>
+#include "util/Arena.h"
+
+Arena::Arena( size_t iBlockSize ) : m_iBlockSize( iBlockSize )
+{
+	m_iBlock = 0;
+	m_pNext = m_pEnd = NULL;
+	m_iUsed = 0;
+}
+
+Arena::~Arena()
+{
+	Reset();
+
+	for( unsigned i = 0; i < m_Blocks.size(); ++i )
+		delete[] m_Blocks[i];
+}
+
+Arena* Arena::GetTick()
+{
+	static thread_local Arena s_Tick;
+	return &s_Tick;
+}
+
+void* Arena::Alloc( size_t iSize, size_t iAlign )
+{
+	m_iUsed += iSize;
+
+	// too big for a block: it gets one of its own, and the block we
+	// were filling carries on afterwards
+	if( iSize > m_iBlockSize )
+	{
+		m_LargeBlocks.push_back( new char[iSize] );
+		return m_LargeBlocks.back();
+	}
+
+	char *p = (char*)( (uintptr_t(m_pNext) + iAlign - 1) & ~uintptr_t(iAlign - 1) );
+
+	if( m_pNext == NULL || p > m_pEnd || iSize > size_t(m_pEnd - p) )
+	{
+		// a fresh block's aligned for anything
+		NextBlock();
+		p = m_pNext;
+	}
+
+	m_pNext = p + iSize;
+	return p;
+}
+
+void Arena::NextBlock()
+{
+	// after a Reset(), we start over at block 0
+	if( m_pNext != NULL )
+		++m_iBlock;
+
+	if( m_iBlock == m_Blocks.size() )
+		m_Blocks.push_back( new char[m_iBlockSize] );
+
+	m_pNext = m_Blocks[m_iBlock];
+	m_pEnd = m_pNext + m_iBlockSize;
+}
+
+void Arena::Reset()
+{
+	for( unsigned i = 0; i < m_LargeBlocks.size(); ++i )
+		delete[] m_LargeBlocks[i];
+
+	m_LargeBlocks.clear();
+
+	m_iBlock = 0;
+	m_pNext = m_pEnd = NULL;
+	m_iUsed = 0;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,82 @@
+/* Arena: memory for things that only last until the end of an update.
+ * Alloc() just moves a pointer along, and nothing's freed by itself:
+ * Reset() takes it all back at once. The blocks stay around for the next
+ * update, so once an Arena's grown to what a busy update needs, it never
+ * calls malloc again.
+ *
+ * Every reactor thread has one, GetTick(), which its Shard resets at the
+ * end of each Update(). Anything that might outlive that - whatever's
+ * handed to another Shard, for one - has to come from the heap or a
+ * SharedArena instead. */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+class Arena
+{
+public:
+	Arena( size_t iBlockSize = DEFAULT_BLOCK_SIZE );
+	~Arena();
+
+	/* iSize bytes, aligned to iAlign (a power of two), good until the
+	 * next Reset() */
+	void* Alloc( size_t iSize, size_t iAlign = alignof(std::max_align_t) );
+
+	/* frees everything Alloc()ed. Blocks over the usual size (made for
+	 * one big allocation) go back to the heap; the rest are kept. */
+	void Reset();
+
+	/* how much has been Alloc()ed since the last Reset() */
+	size_t GetUsed() const	{ return m_iUsed; }
+
+	/* the calling thread's Arena */
+	static Arena* GetTick();
+
+	static const size_t DEFAULT_BLOCK_SIZE = 64*1024;
+
+private:
+	/* moves on to the next block, making one if need be */
+	void NextBlock();
+
+	const size_t m_iBlockSize;
+
+	/* the usual-sized blocks, and which one we're filling */
+	std::vector<char*> m_Blocks;
+	size_t m_iBlock;
+
+	/* blocks made for one allocation over the usual size */
+	std::vector<char*> m_LargeBlocks;
+
+	/* where the next allocation goes, and where the block ends */
+	char *m_pNext, *m_pEnd;
+
+	size_t m_iUsed;
+
+	// it owns its blocks
+	Arena( const Arena& );
+	Arena& operator=( const Arena& );
+};
+
+#endif // ARENA_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
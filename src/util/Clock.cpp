@@ -0,0 +1,111 @@
+#include "Clock.h"
+
+namespace
+{
+	struct ClockState
+	{
+		uint64_t iMilliseconds;
+		time_t iWallTime;
+
+		/* the wall time szTimestamp was formatted for */
+		time_t iStampTime;
+		char szTimestamp[16];
+
+		/* set once this thread calls Tick() */
+		bool bTicking;
+	};
+
+	/* each thread's cached time (zero-filled until it first reads it) */
+	__thread ClockState t_Clock;
+
+	void Read( ClockState &c )
+	{
+		struct timespec ts;
+
+		// the coarse clock is the tick-rate timestamp the kernel already
+		// has lying around: no hardware read, just a copy
+		clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+		c.iMilliseconds = uint64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+
+		clock_gettime( CLOCK_REALTIME, &ts );
+		c.iWallTime = ts.tv_sec;
+	}
+
+	ClockState& Get()
+	{
+		if( !t_Clock.bTicking )
+			Read( t_Clock );
+
+		return t_Clock;
+	}
+}
+
+void Clock::Tick()
+{
+	Read( t_Clock );
+	t_Clock.bTicking = true;
+}
+
+uint64_t Clock::GetSeconds()
+{
+	return Get().iMilliseconds / 1000;
+}
+
+uint64_t Clock::GetMilliseconds()
+{
+	return Get().iMilliseconds;
+}
+
+time_t Clock::GetWallTime()
+{
+	return Get().iWallTime;
+}
+
+const char* Clock::GetTimestamp()
+{
+	ClockState &c = Get();
+
+	// localtime_r and strftime are far from free; once a second is plenty
+	if( c.iStampTime != c.iWallTime || c.szTimestamp[0] == '\0' )
+	{
+		struct tm timeval;
+		localtime_r( &c.iWallTime, &timeval );
+		strftime( c.szTimestamp, sizeof(c.szTimestamp), "[%X] ", &timeval );
+		c.iStampTime = c.iWallTime;
+	}
+
+	return c.szTimestamp;
+}
+
+uint64_t Clock::ReadMicroseconds()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t Clock::ReadNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
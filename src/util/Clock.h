@@ -0,0 +1,60 @@
+/* Clock: the time, read once per update instead of on every call. Each
+ * reactor thread calls Tick() at the top of its update, and everything it
+ * does until the next Tick() sees the same time. A thread that never ticks
+ * (the DatabaseWorker, or anything before the Shards start) reads the
+ * clock on every call instead, so it's never stale.
+ *
+ * Seconds and milliseconds are monotonic: they never jump when somebody
+ * sets the system clock, so they're what elapsed times are measured in.
+ * The wall time is only for things that mean a time of day (timestamps,
+ * ban expiry dates). */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <ctime>
+#include <stdint.h>
+
+namespace Clock
+{
+	/* rereads the clocks for the calling thread (and marks it as one
+	 * that ticks, so it uses the cached values from now on) */
+	void Tick();
+
+	/* monotonic time as of the last Tick(), at coarse (~ms) precision */
+	uint64_t GetSeconds();
+	uint64_t GetMilliseconds();
+
+	/* wall clock time as of the last Tick() */
+	time_t GetWallTime();
+
+	/* the wall time as a log line prefix, e.g. "[11:22:33] ". It's only
+	 * reformatted when the second changes. */
+	const char* GetTimestamp();
+
+	/* reads a precise monotonic clock right now, for timing things that
+	 * take less than a tick */
+	uint64_t ReadMicroseconds();
+	uint64_t ReadNanoseconds();
+}
+
+#endif // CLOCK_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -17,6 +17,16 @@
 
 using namespace std;
 
+static string Trim( const string &s )
+{
+	const size_t iStart = s.find_first_not_of( " \t\r" );
+
+	if( iStart == string::npos )
+		return string();
+
+	return s.substr( iStart, s.find_last_not_of(" \t\r") - iStart + 1 );
+}
+
 bool Config::Load( const char *path )
 {
 	FILE *pFile = fopen( path, "r" );
@@ -38,7 +48,9 @@ bool Config::Load( const char *path )
 	char *data = new char[iFileSize];
 
 	// read the entire file into memory
-	if( fread(data, sizeof(char), iFileSize, pFile) < 0 )
+	const size_t iRead = fread( data, sizeof(char), iFileSize, pFile );
+
+	if( ferror(pFile) )
 	{
 		LOG->Stdout( "Failed to load \"%s\": %s", path, strerror(errno) );
 		fclose( pFile );
@@ -46,8 +58,9 @@ bool Config::Load( const char *path )
 		return false;
 	}
 
-	/* we have our data now, so we can clean up. */
-	string sData( data );
+	/* we have our data now, so we can clean up. (it's not terminated,
+	 * so go by what was read.) */
+	string sData( data, iRead );
 	delete[] data;
 	data = NULL;
 
@@ -63,15 +76,24 @@ bool Config::Load( const char *path )
 		// read each line and split the keys and values apart
 		for( unsigned i = 0; i < vsLines.size(); ++i )
 		{
-			unsigned iSignPos = vsLines[i].find_first_of('=');
+			const string sLine = Trim( vsLines[i] );
+
+			// comments may well have an '=' in them; skip them outright
+			if( sLine.empty() || sLine[0] == '#' || !sLine.compare(0, 2, "//") )
+				continue;
+
+			const size_t iSignPos = sLine.find_first_of('=');
 
 			// invalid line, ignore
 			if( iSignPos == string::npos )
 				continue;
 
 			// split key=value into key, value
-			const string sKey = vsLines[i].substr( 0, iSignPos );
-			const string sValue = vsLines[i].substr( iSignPos+1 );
+			const string sKey = Trim( sLine.substr(0, iSignPos) );
+			const string sValue = Trim( sLine.substr(iSignPos+1) );
+
+			if( sKey.empty() )
+				continue;
 
 			LOG->Stdout( "%s -> %s", sKey.c_str(), sValue.c_str() );
 
@@ -83,6 +105,34 @@ bool Config::Load( const char *path )
 	return true;
 }
 
+void Config::Diff( const Config &other, vector<string> &vKeys ) const
+{
+	KeyValMap::const_iterator a = m_Entries.begin(), b = other.m_Entries.begin();
+
+	// both maps are sorted, so walk them side by side
+	while( a != m_Entries.end() || b != other.m_Entries.end() )
+	{
+		if( b == other.m_Entries.end() || (a != m_Entries.end() && a->first < b->first) )
+		{
+			vKeys.push_back( a->first );
+			++a;
+		}
+		else if( a == m_Entries.end() || b->first < a->first )
+		{
+			vKeys.push_back( b->first );
+			++b;
+		}
+		else
+		{
+			if( a->second != b->second )
+				vKeys.push_back( a->first );
+
+			++a;
+			++b;
+		}
+	}
+}
+
 const char* Config::Get( const char *key, bool bOptional, const char *def ) const
 {
 	KeyValMap::const_iterator it = m_Entries.find( key );
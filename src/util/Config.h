@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 // convenience aliases
 typedef std::map<const std::string, const std::string> KeyValMap;
@@ -14,6 +15,14 @@ public:
 	/* loads keys/values from a file path. */
 	bool Load( const char *path );
 
+	/* fills vKeys with every key that's set differently in other,
+	 * including keys only one of us has */
+	void Diff( const Config &other, std::vector<std::string> &vKeys ) const;
+
+	/* trades entries with other. Anything returned by Get() on either
+	 * one is only good until the other is destroyed. */
+	void Swap( Config &other )	{ m_Entries.swap( other.m_Entries ); }
+
 	/* Returns this key's entry, NULL if none exists. If
 	 * bOptional is false, log an error and abort. */
 	const char* Get( const char *key, bool bOptional = false, const char *def = 0 ) const;
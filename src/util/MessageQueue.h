@@ -0,0 +1,112 @@
+/* MessageQueue: a lock-free, intrusive, multiple-producer/single-consumer
+ * queue. Any thread may Push(); only the owning thread may Pop(). Pushing
+ * is a single atomic exchange, so producers never wait on each other or on
+ * the consumer. (This is Dmitry Vyukov's MPSC node queue.)
+ *
+ * Queued types derive from QueueNode. The queue never allocates or frees
+ * anything; what's popped belongs to the caller. */
+
+#ifndef MESSAGE_QUEUE_H
+#define MESSAGE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+struct QueueNode
+{
+	QueueNode() : pNext(NULL) { }
+
+	std::atomic<QueueNode*> pNext;
+};
+
+class MessageQueue
+{
+public:
+	MessageQueue() : m_pHead(&m_Stub), m_pTail(&m_Stub) { }
+
+	/* safe to call from any thread */
+	void Push( QueueNode *pNode )
+	{
+		pNode->pNext.store( NULL, std::memory_order_relaxed );
+		QueueNode *pPrev = m_pHead.exchange( pNode );
+		pPrev->pNext.store( pNode, std::memory_order_release );
+	}
+
+	/* returns the oldest node, or NULL if there's nothing ready yet.
+	 * Only the consumer thread may call this. */
+	QueueNode* Pop()
+	{
+		QueueNode *pTail = m_pTail;
+		QueueNode *pNext = pTail->pNext.load( std::memory_order_acquire );
+
+		// skip over the stub; it's only there to keep the list non-empty
+		if( pTail == &m_Stub )
+		{
+			if( pNext == NULL )
+				return NULL;
+
+			m_pTail = pTail = pNext;
+			pNext = pNext->pNext.load( std::memory_order_acquire );
+		}
+
+		if( pNext != NULL )
+		{
+			m_pTail = pNext;
+			return pTail;
+		}
+
+		// a producer has swapped in a new head, but hasn't linked it yet.
+		// it's not ready; we'll get it next time around.
+		if( pTail != m_pHead.load() )
+			return NULL;
+
+		// pTail is the last node. put the stub behind it, so we can pop it.
+		Push( &m_Stub );
+		pNext = pTail->pNext.load( std::memory_order_acquire );
+
+		if( pNext != NULL )
+		{
+			m_pTail = pNext;
+			return pTail;
+		}
+
+		return NULL;
+	}
+
+	/* true if nothing has been pushed since the last Pop() ran dry. A push
+	 * in progress counts as non-empty. Only the consumer may call this. */
+	bool IsEmpty() const
+	{
+		return m_pTail->pNext.load() == NULL && m_pHead.load() == m_pTail;
+	}
+
+private:
+	// producers push here...
+	std::atomic<QueueNode*> m_pHead;
+
+	// ...and the consumer pops from here.
+	QueueNode *m_pTail;
+
+	QueueNode m_Stub;
+};
+
+#endif // MESSAGE_QUEUE_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,133 @@
+#include <cstdint>
+#include <new>
+#include "util/SharedArena.h"
+
+SharedArena::SharedArena( size_t iBlockSize ) : m_iBlockSize( iBlockSize )
+{
+	m_pBlock = NULL;
+	m_pNext = m_pEnd = NULL;
+}
+
+SharedArena::~SharedArena()
+{
+	if( m_pBlock )
+		FreeBlock( m_pBlock );
+
+	for( unsigned i = 0; i < m_Retired.size(); ++i )
+		FreeBlock( m_Retired[i] );
+}
+
+SharedArena::Block* SharedArena::NewBlock( size_t iSize )
+{
+	// new[] is aligned for anything, and so is what follows a Block
+	Block *pBlock = new( new char[sizeof(Block) + iSize] ) Block;
+	pBlock->iRefs.store( 0, std::memory_order_relaxed );
+	pBlock->iSize = iSize;
+	return pBlock;
+}
+
+void SharedArena::FreeBlock( Block *pBlock )
+{
+	pBlock->~Block();
+	delete[] (char*)pBlock;
+}
+
+void* SharedArena::Alloc( size_t iSize, unsigned iRefs, Block **ppBlock, size_t iAlign )
+{
+	// too big for a block: it gets one of its own, which is retired
+	// right away, and the block we were filling carries on afterwards
+	if( iSize > m_iBlockSize )
+	{
+		Block *pBlock = NewBlock( iSize );
+		pBlock->iRefs.store( iRefs, std::memory_order_relaxed );
+		m_Retired.push_back( pBlock );
+
+		*ppBlock = pBlock;
+		return GetData( pBlock );
+	}
+
+	char *p = (char*)( (uintptr_t(m_pNext) + iAlign - 1) & ~uintptr_t(iAlign - 1) );
+
+	if( m_pBlock == NULL || p > m_pEnd || iSize > size_t(m_pEnd - p) )
+	{
+		NextBlock();
+		p = m_pNext;
+	}
+
+	m_pNext = p + iSize;
+
+	// the other threads only ever take references away, and won't take
+	// these before we've handed them out.
+	m_pBlock->iRefs.fetch_add( iRefs, std::memory_order_relaxed );
+
+	*ppBlock = m_pBlock;
+	return p;
+}
+
+void SharedArena::NextBlock()
+{
+	// it's reused once everything in it is released, however long
+	// that takes; until then, we only ever look at its count.
+	if( m_pBlock != NULL )
+		m_Retired.push_back( m_pBlock );
+
+	m_pBlock = Sweep();
+
+	if( m_pBlock == NULL )
+		m_pBlock = NewBlock( m_iBlockSize );
+
+	m_pNext = GetData( m_pBlock );
+	m_pEnd = m_pNext + m_iBlockSize;
+}
+
+SharedArena::Block* SharedArena::Sweep()
+{
+	Block *pFree = NULL;
+	unsigned iKept = 0;
+
+	for( unsigned i = 0; i < m_Retired.size(); ++i )
+	{
+		Block *pBlock = m_Retired[i];
+
+		// (acquire: whatever the releasing thread did with the block
+		// is done before we write over it)
+		if( pBlock->iRefs.load(std::memory_order_acquire) == 0 )
+		{
+			if( pBlock->iSize != m_iBlockSize )
+			{
+				FreeBlock( pBlock );
+				continue;
+			}
+
+			if( pFree == NULL )
+			{
+				pFree = pBlock;
+				continue;
+			}
+		}
+
+		m_Retired[iKept++] = pBlock;
+	}
+
+	m_Retired.resize( iKept );
+	return pFree;
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
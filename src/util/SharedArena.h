@@ -0,0 +1,96 @@
+/* SharedArena: memory one thread hands out to others, who each let go of
+ * their share when they're done with it. As with an Arena, Alloc() just
+ * moves a pointer along a block; but each allocation says how many
+ * references it's handing out, and a block's reused once every reference
+ * to anything in it has been Release()d, on whatever thread. Only the
+ * thread that owns the SharedArena may Alloc() from it.
+ *
+ * Every Shard has one for its broadcasts: the packet and the messages to
+ * the other Shards go in one allocation, and come back once the last of
+ * those Shards has delivered it. Once it's grown to cover what the other
+ * Shards have yet to get through, it never calls malloc again. */
+
+#ifndef SHARED_ARENA_H
+#define SHARED_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "util/Arena.h"
+
+class SharedArena
+{
+public:
+	struct alignas(std::max_align_t) Block
+	{
+		/* what's still to be Release()d */
+		std::atomic<unsigned> iRefs;
+		size_t iSize;
+	};
+
+	SharedArena( size_t iBlockSize = Arena::DEFAULT_BLOCK_SIZE );
+	/* frees every block, released or not */
+	~SharedArena();
+
+	/* iSize bytes, aligned to iAlign (a power of two, no more than
+	 * alignof(std::max_align_t)), from the block put in *ppBlock. They're
+	 * good until that's been Release()d iRefs times. */
+	void* Alloc( size_t iSize, unsigned iRefs, Block **ppBlock,
+		size_t iAlign = alignof(std::max_align_t) );
+
+	/* lets go of one reference to pBlock. Any thread may call this. */
+	static void Release( Block *pBlock )
+	{
+		pBlock->iRefs.fetch_sub( 1, std::memory_order_release );
+	}
+
+private:
+	/* retires the block we were filling, and moves on to one that's
+	 * been released (or a new one) */
+	void NextBlock();
+
+	/* frees any blocks made for one big allocation that've been
+	 * released, and takes out the first usual-sized one (or NULL) */
+	Block* Sweep();
+
+	static Block* NewBlock( size_t iSize );
+	static void FreeBlock( Block *pBlock );
+	static char* GetData( Block *pBlock )	{ return (char*)(pBlock + 1); }
+
+	const size_t m_iBlockSize;
+
+	/* the block we're filling, where the next allocation goes, and
+	 * where the block ends */
+	Block *m_pBlock;
+	char *m_pNext, *m_pEnd;
+
+	/* blocks we've moved on from, oldest first, and blocks made for
+	 * one allocation over the usual size */
+	std::vector<Block*> m_Retired;
+
+	// it owns its blocks
+	SharedArena( const SharedArena& );
+	SharedArena& operator=( const SharedArena& );
+};
+
+#endif // SHARED_ARENA_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -79,6 +79,21 @@ void StringUtil::Split( const string &in, vector<char> &add, const char delim )
 		add.push_back( vsData[i][0] );
 }
 
+string StringUtil::Join( const vector<string> &in, const string &delim )
+{
+	string ret;
+
+	for( unsigned i = 0; i < in.size(); ++i )
+	{
+		if( i > 0 )
+			ret.append( delim );
+
+		ret.append( in[i] );
+	}
+
+	return ret;
+}
+
 /* Parses a string and returns the total elapsed seconds of the given tokens.
  * Supported tokens: w (week), d (day), h (hour), m (minute), s (second).
  * Usage is e.g. "1w 4d 8m" for the time spanned by 1 week, 4 days, 8 minutes.
@@ -119,7 +134,7 @@ time_t StringUtil::ParseTime( const std::string &sMessage )
 
 string print( unsigned val, const char *name )
 {
-	static char buffer[16];
+	char buffer[16];
 
 	snprintf( buffer, 16, "%d %s%c", val, name, val == 1 ? '\0' : 's' );
 	return string(buffer);
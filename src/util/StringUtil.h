@@ -27,6 +27,9 @@ namespace StringUtil
 	void Split( const std::string &in, std::vector<char> &add,
 		const char delim );
 
+	/* joins the strings in in, with delim between each */
+	std::string Join( const std::vector<std::string> &in, const std::string &delim );
+
 	/* parses a string describing a period of time. See .cpp for more info. */
 	time_t ParseTime( const std::string &sMessage );
 
@@ -101,6 +101,36 @@ bool Spinlock::TryLock()
 	return pthread_spin_trylock(&m_Lock) == 0;
 }
 
+RWLock::RWLock()
+{
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init( &attr );
+	pthread_rwlockattr_setkind_np( &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+
+	pthread_rwlock_init( &m_Lock, &attr );
+	pthread_rwlockattr_destroy( &attr );
+}
+
+RWLock::~RWLock()
+{
+	pthread_rwlock_destroy( &m_Lock );
+}
+
+int RWLock::LockRead()
+{
+	return pthread_rwlock_rdlock( &m_Lock );
+}
+
+int RWLock::LockWrite()
+{
+	return pthread_rwlock_wrlock( &m_Lock );
+}
+
+int RWLock::Unlock()
+{
+	return pthread_rwlock_unlock( &m_Lock );
+}
+
 /* 
  * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
  *
@@ -74,6 +74,23 @@ private:
 	pthread_spinlock_t m_Lock;
 };	
 
+/* A very simple C++ wrapper for pthread_rwlock_t. Writers are preferred,
+ * so a steady stream of readers can't starve them out. */
+class RWLock
+{
+public:
+	RWLock();
+	~RWLock();
+
+	/* see above comments in Mutex */
+	int LockRead();
+	int LockWrite();
+	int Unlock();
+
+private:
+	pthread_rwlock_t m_Lock;
+};
+
 #endif // THREAD_H
 
 /* 
@@ -0,0 +1,171 @@
+#include "TimerWheel.h"
+
+using namespace std;
+
+/* links pTimer in at the end of the slot headed by pHead */
+static void Link( Timer *pHead, Timer *pTimer )
+{
+	pTimer->pPrev = pHead->pPrev;
+	pTimer->pNext = pHead;
+	pHead->pPrev->pNext = pTimer;
+	pHead->pPrev = pTimer;
+}
+
+void Timer::Cancel()
+{
+	if( pNext == NULL )
+		return;
+
+	pPrev->pNext = pNext;
+	pNext->pPrev = pPrev;
+	pPrev = pNext = NULL;
+}
+
+TimerWheel::TimerWheel( uint64_t iNow ) : m_iNow(iNow)
+{
+	// every slot starts out as an empty circle
+	for( unsigned i = 0; i < LEVELS; ++i )
+	{
+		for( unsigned j = 0; j < SLOTS; ++j )
+			m_Slots[i][j].pPrev = m_Slots[i][j].pNext = &m_Slots[i][j];
+	}
+}
+
+TimerWheel::~TimerWheel()
+{
+	// let go of anything still scheduled, so its Timer doesn't try to
+	// unlink itself from us later. Clearing the sentinels after that
+	// keeps their own destructors from doing anything.
+	for( unsigned i = 0; i < LEVELS; ++i )
+	{
+		for( unsigned j = 0; j < SLOTS; ++j )
+		{
+			Timer *pHead = &m_Slots[i][j];
+
+			while( pHead->pNext != pHead )
+				pHead->pNext->Cancel();
+
+			pHead->pPrev = pHead->pNext = NULL;
+		}
+	}
+}
+
+void TimerWheel::Schedule( Timer *pTimer, uint64_t iExpires )
+{
+	pTimer->Cancel();
+	pTimer->iExpires = (iExpires > m_iNow) ? iExpires : m_iNow + 1;
+	Insert( pTimer );
+}
+
+void TimerWheel::Insert( Timer *pTimer )
+{
+	uint64_t iWhen = pTimer->iExpires;
+	uint64_t iDelta = iWhen - m_iNow;
+
+	unsigned iLevel = 0;
+
+	while( iLevel < LEVELS - 1 && iDelta >= (uint64_t(1) << (LEVEL_BITS * (iLevel+1))) )
+		++iLevel;
+
+	// past the end of the wheel: park it in the farthest slot we have,
+	// and it'll be put back in the right place when that cascades.
+	const uint64_t iRange = uint64_t(1) << (LEVEL_BITS * LEVELS);
+
+	if( iDelta >= iRange )
+		iWhen = m_iNow + iRange - 1;
+
+	const unsigned iSlot = (iWhen >> (LEVEL_BITS * iLevel)) & (SLOTS - 1);
+	Link( &m_Slots[iLevel][iSlot], pTimer );
+}
+
+void TimerWheel::Cascade( unsigned iLevel, unsigned iSlot )
+{
+	Timer *pHead = &m_Slots[iLevel][iSlot];
+
+	if( pHead->pNext == pHead )
+		return;
+
+	// detach the whole slot first: reinserting may put timers back in it
+	Timer *pTimer = pHead->pNext;
+	pHead->pPrev->pNext = NULL;
+	pHead->pPrev = pHead->pNext = pHead;
+
+	while( pTimer != NULL )
+	{
+		Timer *pNext = pTimer->pNext;
+		Insert( pTimer );
+		pTimer = pNext;
+	}
+}
+
+bool TimerWheel::IsEmpty() const
+{
+	for( unsigned i = 0; i < LEVELS; ++i )
+	{
+		for( unsigned j = 0; j < SLOTS; ++j )
+		{
+			if( m_Slots[i][j].pNext != &m_Slots[i][j] )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void TimerWheel::Advance( uint64_t iNow, vector<Timer*> &vDue )
+{
+	// after a long sleep with nothing to do, there's no need to walk
+	// every tick we missed
+	if( iNow > m_iNow + SLOTS && IsEmpty() )
+		m_iNow = iNow;
+
+	while( m_iNow < iNow )
+	{
+		++m_iNow;
+
+		// each time a level comes back around to slot 0, the next
+		// level's current slot is due to be spread out below it
+		for( unsigned iLevel = 1; iLevel < LEVELS; ++iLevel )
+		{
+			const unsigned iShift = LEVEL_BITS * iLevel;
+
+			if( (m_iNow & ((uint64_t(1) << iShift) - 1)) != 0 )
+				break;
+
+			Cascade( iLevel, (m_iNow >> iShift) & (SLOTS - 1) );
+		}
+
+		Timer *pHead = &m_Slots[0][m_iNow & (SLOTS - 1)];
+
+		while( pHead->pNext != pHead )
+		{
+			Timer *pTimer = pHead->pNext;
+			pTimer->Cancel();
+
+			// a timer parked at the end of the wheel might not be due
+			if( pTimer->iExpires > m_iNow )
+				Insert( pTimer );
+			else
+				vDue.push_back( pTimer );
+		}
+	}
+}
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
@@ -0,0 +1,100 @@
+/* TimerWheel: a hierarchical timing wheel, for deadlines measured in whole
+ * ticks (the server uses seconds). Scheduling and cancelling are O(1), and
+ * advancing the clock only touches the timers that come due, plus the rare
+ * cascade of a far-off slot down a level - never every timer there is.
+ *
+ * Timers are intrusive: the owner embeds a Timer, points pData back at
+ * itself, and gets the Timer back from Advance() once it's due. A Timer
+ * takes itself off the wheel when it's destroyed. Nothing here locks; the
+ * wheel and its timers belong to whoever advances it. */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+struct Timer
+{
+	Timer( void *pData_ = NULL ) : pData(pData_), iExpires(0), pPrev(NULL), pNext(NULL) { }
+	~Timer()	{ Cancel(); }
+
+	/* takes the timer off its wheel, if it's on one */
+	void Cancel();
+
+	bool IsScheduled() const	{ return pNext != NULL; }
+
+	/* whatever the owner wants to find again when this comes due */
+	void *pData;
+
+	/* the tick this is due on */
+	uint64_t iExpires;
+
+	/* the wheel slot we're in. Slots are circular lists around a
+	 * sentinel Timer, so unlinking doesn't need the wheel. */
+	Timer *pPrev, *pNext;
+
+private:
+	Timer( const Timer &rhs );
+	Timer& operator=( const Timer &rhs );
+};
+
+class TimerWheel
+{
+public:
+	/* iNow is the current tick; everything scheduled is after it */
+	TimerWheel( uint64_t iNow = 0 );
+	~TimerWheel();
+
+	/* (re)schedules pTimer for tick iExpires. A time that's already
+	 * passed comes due on the next tick. */
+	void Schedule( Timer *pTimer, uint64_t iExpires );
+
+	/* moves the clock up to iNow, appending every timer that came due
+	 * to vDue (they're off the wheel now). The clock never goes back. */
+	void Advance( uint64_t iNow, std::vector<Timer*> &vDue );
+
+	uint64_t GetNow() const	{ return m_iNow; }
+
+private:
+	enum { LEVEL_BITS = 6, SLOTS = 1 << LEVEL_BITS, LEVELS = 4 };
+
+	/* puts pTimer in the slot for its deadline */
+	void Insert( Timer *pTimer );
+
+	/* empties a slot on an upper level, reinserting its timers lower */
+	void Cascade( unsigned iLevel, unsigned iSlot );
+
+	/* true if nothing's scheduled at all */
+	bool IsEmpty() const;
+
+	/* every tick before or at this has been handled */
+	uint64_t m_iNow;
+
+	/* level 0 has a slot per tick for the next 64 ticks, level 1 a slot
+	 * per 64 ticks, and so on: 4 levels cover 2^24 ticks (194 days of
+	 * seconds). Anything farther out waits in the last level. */
+	Timer m_Slots[LEVELS][SLOTS];
+};
+
+#endif // TIMER_WHEEL_H
+
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
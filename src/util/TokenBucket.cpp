@@ -0,0 +1,57 @@
+#include <algorithm>
+#include "util/TokenBucket.h"
+
+void TokenBucket::Fill( unsigned iBurst, uint64_t iNow )
+{
+	iTokens = (uint64_t)iBurst * 1000;
+	iLastRefill = iNow;
+}
+
+void TokenBucket::Refill( unsigned iPerMinute, unsigned iBurst, uint64_t iNow )
+{
+	// iPerMinute tokens a minute is iPerMinute/60 thousandths a ms
+	const uint64_t iGained = (iNow - iLastRefill) * iPerMinute / 60;
+
+	// leave iLastRefill alone until there's something to add, so the
+	// fractions of a thousandth aren't lost between frequent calls
+	if( iGained == 0 )
+		return;
+
+	iTokens = std::min( iTokens + iGained, (uint64_t)iBurst * 1000 );
+	iLastRefill = iNow;
+}
+
+bool TokenBucket::Take( unsigned iPerMinute, unsigned iBurst, uint64_t iNow )
+{
+	Refill( iPerMinute, iBurst, iNow );
+
+	if( iTokens < 1000 )
+		return false;
+
+	iTokens -= 1000;
+	return true;
+}
+
+bool TokenBucket::IsFull( unsigned iPerMinute, unsigned iBurst, uint64_t iNow )
+{
+	Refill( iPerMinute, iBurst, iNow );
+	return iTokens >= (uint64_t)iBurst * 1000;
+}
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */
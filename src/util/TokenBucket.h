@@ -0,0 +1,52 @@
+/* TokenBucket: a rate limit. The bucket holds up to iBurst tokens and
+ * refills at iPerMinute tokens a minute; whatever's being limited takes a
+ * token to go ahead. Tokens are counted in thousandths, so a slow rate
+ * still refills a little at a time. Times are in milliseconds (e.g.
+ * Clock::GetMilliseconds()).
+ *
+ * The limits aren't stored here, since whole tables of buckets share them. */
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <stdint.h>
+
+struct TokenBucket
+{
+	TokenBucket() : iTokens(0), iLastRefill(0) { }
+
+	/* fills the bucket to the brim, as of iNow */
+	void Fill( unsigned iBurst, uint64_t iNow );
+
+	/* takes a token if there's one to take */
+	bool Take( unsigned iPerMinute, unsigned iBurst, uint64_t iNow );
+
+	/* true if the bucket's full as of iNow */
+	bool IsFull( unsigned iPerMinute, unsigned iBurst, uint64_t iNow );
+
+	/* adds whatever's dripped in since the last refill */
+	void Refill( unsigned iPerMinute, unsigned iBurst, uint64_t iNow );
+
+	uint64_t iTokens;
+	uint64_t iLastRefill;
+};
+
+#endif // TOKEN_BUCKET_H
+/* 
+ * Copyright (c) 2009-10 Mark Cannon ("Vyhd")
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  
+ * 02110-1301, USA.
+ */